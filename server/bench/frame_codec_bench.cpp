@@ -0,0 +1,68 @@
+#include <lib/codec/frame_encoder.h>
+#include <lib/server/frame_decoder.h>
+#include <lib/server/post_parser.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    constexpr std::size_t kSeries = 10000;
+    constexpr std::size_t kPointsPerSeries = 100;
+
+    // The same batch as a JSON body and as frames.
+    std::pair<std::string, std::string> MakePayloads() {
+        std::string json = R"({"metrics":[)";
+        FrameEncoder encoder;
+        std::vector<int64_t> timestamps(kPointsPerSeries);
+        std::vector<double> values(kPointsPerSeries);
+        for (std::size_t i = 0; i < kSeries; ++i) {
+            std::string host = "host=" + std::to_string(i);
+            if (i > 0) {
+                json += ',';
+            }
+            json += R"({"project_id":"bench_project","metric_type":"SPEED","tags":["region=eu",")" + host + R"("],"values":[)";
+            for (std::size_t j = 0; j < kPointsPerSeries; ++j) {
+                timestamps[j] = 1700000000000 + static_cast<int64_t>(j) * 15000;
+                values[j] = static_cast<double>(j) + 0.25;
+                if (j > 0) {
+                    json += ',';
+                }
+                json += R"({"value":)" + std::to_string(j) + ".25" + R"(,"timestamp":)" + std::to_string(timestamps[j]) + "}";
+            }
+            json += "]}";
+            auto id = encoder.series("bench_project", WIRE_SPEED, std::vector<std::string>{"region=eu", host});
+            encoder.points(id, timestamps, values);
+        }
+        json += "]}";
+        return {std::move(json), encoder.take()};
+    }
+
+    template <class F>
+    void Measure(const std::string& name, const std::string& body, F decode) {
+        constexpr int kIterations = 5;
+        std::size_t metrics = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kIterations; ++i) {
+            metrics += decode(body).metrics.size();
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / kIterations;
+        double points = static_cast<double>(kSeries * kPointsPerSeries);
+        std::cout << name << ": " << body.size() / 1024 << " KiB, "
+                  << elapsed * 1000 << " ms, "
+                  << points / elapsed / 1e6 << " M points/s"
+                  << " (" << metrics / kIterations << " metrics)\n";
+    }
+
+} // anonymous namespace
+
+int main() {
+    auto [json, frames] = MakePayloads();
+    std::cout << kSeries << " series x " << kPointsPerSeries << " points\n";
+    Measure("  json", json, [](const std::string& body) { return ParsePostRequest(body); });
+    Measure("  frames", frames, [](const std::string& body) { return DecodeFrames(body); });
+    return EXIT_SUCCESS;
+}
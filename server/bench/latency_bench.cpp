@@ -0,0 +1,85 @@
+#include <lib/server/runner.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    constexpr std::size_t kConnections = 64;
+    constexpr std::size_t kRequestsPerConnection = 2000;
+
+    // Every connection sends its requests one after another and records how
+    // long each took. /stats/admission does not touch the database, so the
+    // numbers show what the threading model itself costs.
+    std::vector<double> Load(unsigned short port) {
+        std::vector<std::vector<double>> latencies(kConnections);
+        std::vector<std::thread> clients;
+        for (std::size_t i = 0; i < kConnections; ++i) {
+            clients.emplace_back([port, &latencies = latencies[i]] {
+                net::io_context ioc;
+                tcp::socket socket(ioc);
+                socket.connect(tcp::endpoint{net::ip::make_address("127.0.0.1"), port});
+                beast::flat_buffer buffer;
+                http::request<http::string_body> request{http::verb::get, "/stats/admission", 11};
+                request.set(http::field::host, "127.0.0.1");
+                latencies.reserve(kRequestsPerConnection);
+                for (std::size_t j = 0; j < kRequestsPerConnection; ++j) {
+                    auto start = std::chrono::steady_clock::now();
+                    http::write(socket, request);
+                    http::response<http::string_body> response;
+                    http::read(socket, buffer, response);
+                    latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+
+        std::vector<double> all;
+        for (auto& part : latencies) {
+            all.insert(all.end(), part.begin(), part.end());
+        }
+        std::sort(all.begin(), all.end());
+        return all;
+    }
+
+    void Measure(const std::string& name, ServerOptions options) {
+        options.endpoint = tcp::endpoint{net::ip::make_address("127.0.0.1"), 0};
+        HttpServer server(std::move(options));
+        server.start();
+
+        auto start = std::chrono::steady_clock::now();
+        auto latencies = Load(server.port());
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        server.stop();
+        server.join();
+
+        auto percentile = [&](double p) {
+            return latencies[static_cast<std::size_t>(p * (latencies.size() - 1))];
+        };
+        std::cout << name << ": " << static_cast<std::size_t>(latencies.size() / elapsed) << " req/s, "
+                  << "p50 " << percentile(0.5) << " us, "
+                  << "p99 " << percentile(0.99) << " us, "
+                  << "p99.9 " << percentile(0.999) << " us\n";
+    }
+
+} // anonymous namespace
+
+int main() {
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+
+    ServerOptions shared;
+    shared.threads = cores;
+    Measure("shared io_context + worker pool", shared);
+
+    ServerOptions sharded;
+    sharded.sharded = true;
+    sharded.threads = cores;
+    sharded.workers_per_shard = 1;
+    Measure("sharded, one io_context per core", sharded);
+}
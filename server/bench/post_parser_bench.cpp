@@ -0,0 +1,107 @@
+#include <lib/server/post_parser.h>
+
+#include <boost/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+namespace {
+
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<std::size_t> allocated_bytes{0};
+
+} // anonymous namespace
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+    // The DOM based parser the server used before.
+    PostRequest ParseWithDom(const std::string& body) {
+        auto json = boost::json::parse(body);
+        PostRequest request;
+        for (auto& entry : json.at("metrics").as_array()) {
+            auto metric_json = entry.as_object();
+            request.metrics.emplace_back();
+            auto& metric = request.metrics.back();
+            metric.identifiers.project_id = metric_json.at("project_id").as_string().c_str();
+            metric.identifiers.metric_type = FromString(metric_json.at("metric_type").as_string().c_str());
+            for (auto& tag : metric_json.at("tags").as_array()) {
+                metric.identifiers.tags.emplace_back(tag.as_string().c_str());
+            }
+            for (auto& value : metric_json.at("values").as_array()) {
+                metric.values.push_back(MetricValue{
+                    .value = value.at("value").as_double(),
+                    .timestamp = value.at("timestamp").as_int64()
+                });
+            }
+        }
+        return request;
+    }
+
+    std::string MakePayload(std::size_t target_size) {
+        std::string body = R"({"metrics":[)";
+        for (std::size_t i = 0; body.size() < target_size; ++i) {
+            if (i > 0) {
+                body += ',';
+            }
+            body += R"({"project_id":"bench_project","metric_type":"SPEED","tags":["region=eu","host=)";
+            body += std::to_string(i);
+            body += R"("],"values":[)";
+            for (int j = 0; j < 10; ++j) {
+                if (j > 0) {
+                    body += ',';
+                }
+                body += R"({"value":)" + std::to_string(j) + ".25" + R"(,"timestamp":)" + std::to_string(1700000000000 + j * 1000) + "}";
+            }
+            body += "]}";
+        }
+        body += "]}";
+        return body;
+    }
+
+    template <class F>
+    void Measure(const std::string& name, const std::string& body, F parse) {
+        allocations = 0;
+        allocated_bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        PostRequest request = parse(body);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double megabytes = static_cast<double>(body.size()) / (1 << 20);
+        std::cout << name << ": " << elapsed * 1000 << " ms, "
+                  << megabytes / elapsed << " MB/s, "
+                  << allocations.load() << " allocations, "
+                  << static_cast<double>(allocated_bytes.load()) / static_cast<double>(body.size()) << "x payload bytes allocated"
+                  << " (" << request.metrics.size() << " metrics)\n";
+    }
+
+} // anonymous namespace
+
+int main() {
+    for (std::size_t size : {std::size_t(1) << 20, std::size_t(100) << 20}) {
+        std::string body = MakePayload(size);
+        std::cout << "payload " << body.size() / (1 << 20) << " MB\n";
+        Measure("  dom", body, ParseWithDom);
+        Measure("  sax", body, [](const std::string& b) { return ParsePostRequest(b); });
+    }
+    return EXIT_SUCCESS;
+}
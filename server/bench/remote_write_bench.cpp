@@ -0,0 +1,74 @@
+#include <lib/codec/remote_write_encoder.h>
+#include <lib/server/compression.h>
+#include <lib/server/post_parser.h>
+#include <lib/server/remote_write.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Prometheus sends up to 2000 samples per request by default; a sidecar
+    // translating them posts the same batch as JSON.
+    constexpr std::size_t kSeries = 500;
+    constexpr std::size_t kSamplesPerSeries = 4;
+    constexpr std::size_t kRequests = 200;
+
+    std::pair<std::string, std::string> MakePayloads() {
+        std::string json = R"({"metrics":[)";
+        RemoteWriteEncoder encoder;
+        std::vector<int64_t> timestamps(kSamplesPerSeries);
+        std::vector<double> values(kSamplesPerSeries);
+        for (std::size_t i = 0; i < kSeries; ++i) {
+            std::string instance = "node-" + std::to_string(i % 50) + ":9100";
+            std::string cpu = std::to_string(i % 10);
+            if (i > 0) {
+                json += ',';
+            }
+            json += R"({"project_id":"bench_project","metric_type":"DOT","tags":["metric=node_cpu_seconds_total","cpu=)" + cpu +
+                    R"(","instance=)" + instance + R"(","job=node","mode=idle"],"values":[)";
+            for (std::size_t j = 0; j < kSamplesPerSeries; ++j) {
+                timestamps[j] = 1700000000000 + static_cast<int64_t>(j) * 15000;
+                values[j] = 12345.0 + static_cast<double>(i * kSamplesPerSeries + j) * 0.25;
+                if (j > 0) {
+                    json += ',';
+                }
+                json += R"({"value":)" + std::to_string(values[j]) + R"(,"timestamp":)" + std::to_string(timestamps[j]) + "}";
+            }
+            json += "]}";
+            encoder.series({{"__name__", "node_cpu_seconds_total"}, {"cpu", cpu}, {"instance", instance}, {"job", "node"}, {"mode", "idle"}},
+                           timestamps, values);
+        }
+        json += "]}";
+        return {std::move(json), encoder.take()};
+    }
+
+    template <class F>
+    void Measure(const std::string& name, const std::string& body, F decode) {
+        std::size_t metrics = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < kRequests; ++i) {
+            metrics += decode(body).metrics.size();
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double samples = static_cast<double>(kRequests * kSeries * kSamplesPerSeries);
+        std::cout << name << ": " << body.size() / 1024 << " KiB, "
+                  << elapsed * 1e6 / kRequests << " us/request, "
+                  << samples / elapsed / 1e6 << " M samples/s"
+                  << " (" << metrics / kRequests << " metrics)\n";
+    }
+
+} // anonymous namespace
+
+int main() {
+    auto [json, remote_write] = MakePayloads();
+    std::cout << kSeries << " series x " << kSamplesPerSeries << " samples per request\n";
+    Measure("  json", json, [](const std::string& body) { return ParsePostRequest(body); });
+    Measure("  remote write", remote_write, [](const std::string& body) {
+        return DecodeWriteRequest(SnappyUncompress(body, 64 << 20), "bench_project");
+    });
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+#include <lib/server/response_writer.h>
+
+#include <boost/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+namespace {
+
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<std::size_t> allocated_bytes{0};
+
+} // anonymous namespace
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+    // The DOM based serializer the server used before.
+    std::string SerializeWithDom(const GetResponse& response) {
+        boost::json::object json;
+        json["metrics"] = boost::json::array();
+        boost::json::array& metrics = json["metrics"].as_array();
+        for (auto& value : response.values) {
+            metrics.push_back(boost::json::object{
+                {"value", value.value},
+                {"timestamp", value.timestamp}
+            });
+        }
+        return boost::json::serialize(json);
+    }
+
+    GetResponse MakeResponse(std::size_t points) {
+        GetResponse response;
+        response.values.reserve(points);
+        for (std::size_t i = 0; i < points; ++i) {
+            response.values.push_back(MetricValue{
+                .value = static_cast<double>(i) * 1.37 + 0.1,
+                .timestamp = 1700000000000 + static_cast<int64_t>(i) * 15000
+            });
+        }
+        return response;
+    }
+
+    template <class F>
+    void Measure(const std::string& name, const GetResponse& response, F serialize) {
+        constexpr int kIterations = 20;
+        std::size_t size = 0;
+        allocations = 0;
+        allocated_bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kIterations; ++i) {
+            // A fresh body every time, as the server does.
+            std::string body = serialize(response);
+            size = body.size();
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / kIterations;
+        std::cout << name << ": " << elapsed * 1000 << " ms, "
+                  << allocations.load() / kIterations << " allocations, "
+                  << allocated_bytes.load() / kIterations / 1024 << " KiB allocated"
+                  << " (" << size / 1024 << " KiB body)\n";
+    }
+
+} // anonymous namespace
+
+int main() {
+    GetResponse response = MakeResponse(100000);
+    std::cout << response.values.size() << " points\n";
+    Measure("  dom", response, SerializeWithDom);
+    Measure("  writer, shortest", response, [](const GetResponse& r) {
+        std::string body;
+        WriteGetResponse(r, body);
+        return body;
+    });
+    Measure("  writer, precision 3", response, [](const GetResponse& r) {
+        std::string body;
+        WriteGetResponse(r, body, NumberFormat{.precision = 3});
+        return body;
+    });
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#include <lib/server/router.h>
+
+#include <boost/container_hash/hash.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace http = boost::beast::http;
+
+namespace {
+
+    using Handler = void (*)(int&);
+
+    void Increment(int& counter) {
+        ++counter;
+    }
+
+    const std::vector<std::pair<std::string, http::verb>> kRoutes = {
+        {"/register", http::verb::post},
+        {"/post", http::verb::post},
+        {"/get", http::verb::get},
+        {"/topk", http::verb::get},
+        {"/query", http::verb::get},
+        {"/alerts/rules", http::verb::post},
+        {"/alerts/rules", http::verb::get},
+        {"/alerts/events", http::verb::get},
+    };
+
+    // The dispatch HttpSession used to do: build the table per request and
+    // look the target up by a copied std::string.
+    int PerRequestTable(const std::vector<std::pair<std::string, http::verb>>& requests) {
+        struct Handle {
+            std::string name;
+            http::verb method;
+
+            bool operator==(const Handle& other) const = default;
+        };
+        struct HandleHash {
+            std::size_t operator()(const Handle& h) const {
+                auto base = boost::hash_value(h.name);
+                boost::hash_combine(base, h.method);
+                return base;
+            }
+        };
+
+        int counter = 0;
+        for (const auto& [target, method] : requests) {
+            std::unordered_map<Handle, std::function<void(int&)>, HandleHash> handlers;
+            for (const auto& [name, verb] : kRoutes) {
+                handlers.emplace(Handle{name, verb}, &Increment);
+            }
+            auto it = handlers.find(Handle{std::string(target), method});
+            if (it != handlers.end()) {
+                it->second(counter);
+            }
+        }
+        return counter;
+    }
+
+    int PrebuiltRouter(const Router<Handler>& router, const std::vector<std::pair<std::string, http::verb>>& requests) {
+        int counter = 0;
+        for (const auto& [target, method] : requests) {
+            auto route = router.match(target, method);
+            if (route.handler) {
+                (*route.handler)(counter);
+            }
+        }
+        return counter;
+    }
+
+    template <class F>
+    void Measure(const std::string& name, std::size_t iterations, F f) {
+        auto start = std::chrono::steady_clock::now();
+        int result = f();
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": " << elapsed / static_cast<double>(iterations) << " ns/request"
+                  << " (matched " << result << ")\n";
+    }
+
+} // anonymous namespace
+
+int main() {
+    constexpr std::size_t kRequests = 1'000'000;
+
+    Router<Handler> router;
+    for (const auto& [name, verb] : kRoutes) {
+        router.add(name, verb, &Increment);
+    }
+    router.add("/alerts/rules/{id}", http::verb::delete_, &Increment);
+    router.build();
+
+    std::vector<std::pair<std::string, http::verb>> requests;
+    requests.reserve(kRequests);
+    for (std::size_t i = 0; i < kRequests; ++i) {
+        const auto& route = kRoutes[i % kRoutes.size()];
+        requests.emplace_back(route.first, route.second);
+    }
+
+    Measure("per-request unordered_map", kRequests, [&] { return PerRequestTable(requests); });
+    Measure("prebuilt router", kRequests, [&] { return PrebuiltRouter(router, requests); });
+
+    for (auto& request : requests) {
+        request = {"/alerts/rules/rule-" + std::to_string(request.first.size()), http::verb::delete_};
+    }
+    Measure("prebuilt router, path parameter", kRequests, [&] { return PrebuiltRouter(router, requests); });
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+#include <lib/server/post_parser.h>
+#include <lib/service/tracing.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+
+    constexpr std::size_t kRequests = 1'000'000;
+    // A typical /post batch; parsing it is a fraction of what the request
+    // costs with its database round trips.
+    constexpr std::size_t kPostMetrics = 100;
+
+    // The marks a /post request goes through in the session and the service.
+    void TraceRequest(RequestTrace& trace) {
+        trace.start("/post");
+        auto queued = trace.now();
+        trace.add(TRACE_QUEUE, queued, trace.now());
+        {
+            TraceScope scope(&trace);
+            TraceSpan handler(TRACE_HANDLER);
+            {
+                TraceSpan read(TRACE_READ);
+            }
+            {
+                TraceSpan parse(TRACE_PARSE);
+            }
+            {
+                TraceSpan store(TRACE_STORE);
+            }
+            {
+                TraceSpan commit(TRACE_COMMIT);
+            }
+        }
+        auto write_started = trace.now();
+        trace.add(TRACE_WRITE, write_started, trace.now());
+        trace.submit(200);
+    }
+
+    double MeasureTracing(bool enabled) {
+        Tracer::Instance().enable(enabled);
+        RequestTrace trace;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < kRequests; ++i) {
+            TraceRequest(trace);
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / kRequests;
+    }
+
+    double MeasurePost() {
+        std::string body = R"({"metrics":[)";
+        for (std::size_t i = 0; i < kPostMetrics; ++i) {
+            if (i > 0) {
+                body += ',';
+            }
+            body += R"({"project_id":"bench_project","metric_type":"DOT","tags":["host=)" + std::to_string(i) +
+                    R"("],"values":[{"value":1.5,"timestamp":1700000000000}]})";
+        }
+        body += "]}";
+        constexpr std::size_t kPosts = 10'000;
+        std::size_t metrics = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < kPosts; ++i) {
+            metrics += ParsePostRequest(body).metrics.size();
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        return metrics == kPosts * kPostMetrics ? elapsed / kPosts : 0.0;
+    }
+
+} // anonymous namespace
+
+int main() {
+    double disabled = MeasureTracing(false);
+    double enabled = MeasureTracing(true);
+    double post = MeasurePost();
+    std::cout << "tracing disabled: " << disabled << " ns/request\n"
+              << "tracing enabled: " << enabled << " ns/request\n"
+              << "parsing a " << kPostMetrics << " metric /post: " << post << " ns/request"
+              << " (tracing adds " << 100.0 * (enabled - disabled) / post << "%)\n";
+    return EXIT_SUCCESS;
+}
@@ -1,44 +1,58 @@
-#include <lib/server/server.h>
+#include <lib/server/runner.h>
+
+#include <boost/program_options.hpp>
+
 #include <iostream>
-#include <thread>
+#include <string>
+
+namespace po = boost::program_options;
 
 int main(int argc, char** argv) {
-    if (argc != 4) {
-        std::cerr <<
-            "Usage: http-server-async <address> <port> <threads>\n" <<
-            "Example:\n" <<
-            "    http-server-async 0.0.0.0 8080 4\n";
+    po::options_description description(
+        "Usage: http-server-async <address> <port> [threads] [options]\n"
+        "Example:\n"
+        "    http-server-async 0.0.0.0 8080 4\n"
+        "Options");
+    description.add_options()
+        ("help", "show this message")
+        ("address", po::value<std::string>()->required(), "address to listen on")
+        ("port", po::value<unsigned short>()->required(), "port to listen on")
+        ("threads", po::value<std::size_t>()->default_value(1), "io and worker threads; shards with --sharded, 0 for one per core")
+        ("sharded", po::bool_switch(), "run one io_context per core with its own SO_REUSEPORT acceptor")
+        ("workers-per-shard", po::value<std::size_t>()->default_value(4), "worker threads of every shard")
+        ("writers", po::value<std::size_t>()->default_value(0), "threads that store /post batches parsed by the workers, 0 to store on the workers")
+        ("statsd-port", po::value<unsigned short>(), "also accept StatsD lines over UDP on this port")
+        ("trace", po::bool_switch(), "record request stages for /traces/slowest");
+    po::positional_options_description positional;
+    positional.add("address", 1).add("port", 1).add("threads", 1);
+
+    po::variables_map options;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        if (options.count("help")) {
+            std::cout << description << "\n";
+            return EXIT_SUCCESS;
+        }
+        po::notify(options);
+    } catch (const po::error& e) {
+        std::cerr << e.what() << "\n" << description << "\n";
         return EXIT_FAILURE;
     }
-    auto const address = net::ip::make_address(argv[1]);
-    auto const port = static_cast<unsigned short>(std::atoi(argv[2]));
-    auto const threads = std::max<int>(1, std::atoi(argv[3]));
-
-    net::io_context ioc{threads};
-
-    net::thread_pool thread_pool(threads);
-
-    std::make_shared<HttpListener>(
-        ioc,
-        tcp::endpoint{address, port},
-        std::ref(thread_pool))->run();
-
-    std::vector<std::thread> v;
-    std::generate_n(
-        std::back_inserter(v),
-        threads - 1,
-        [&ioc]() {
-            return std::thread([&ioc] {
-                ioc.run();
-            });
-        });
-    ioc.run();
-
-    std::for_each(v.begin(), v.end(), [](std::thread& t) {
-        t.join();
-    });
-
-    thread_pool.join();
+
+    ServerOptions server_options;
+    server_options.endpoint = tcp::endpoint{net::ip::make_address(options["address"].as<std::string>()), options["port"].as<unsigned short>()};
+    server_options.threads = options["threads"].as<std::size_t>();
+    server_options.sharded = options["sharded"].as<bool>();
+    server_options.workers_per_shard = options["workers-per-shard"].as<std::size_t>();
+    server_options.writer_threads = options["writers"].as<std::size_t>();
+    server_options.tracing = options["trace"].as<bool>();
+    if (options.count("statsd-port")) {
+        server_options.statsd = udp::endpoint{server_options.endpoint.address(), options["statsd-port"].as<unsigned short>()};
+    }
+
+    HttpServer server(std::move(server_options));
+    server.start();
+    server.join();
 
     return EXIT_SUCCESS;
 }
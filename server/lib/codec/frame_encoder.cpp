@@ -0,0 +1,55 @@
+#include "frame_encoder.h"
+
+#include <stdexcept>
+
+FrameEncoder::FrameEncoder()
+    : body_(kFrameMagic)
+{
+}
+
+void FrameEncoder::points(uint32_t series, std::span<const int64_t> timestamps, std::span<const double> values) {
+    if (timestamps.size() != values.size()) {
+        throw std::invalid_argument("Timestamps and values differ in length");
+    }
+    if (series >= next_series_) {
+        throw std::invalid_argument("Unknown series");
+    }
+    begin_frame(POINTS_FRAME);
+    AppendVarint(body_, series);
+    AppendVarint(body_, timestamps.size());
+    int64_t previous = 0;
+    for (auto timestamp : timestamps) {
+        AppendVarint(body_, ZigZagEncode(TimestampDelta(previous, timestamp)));
+        previous = timestamp;
+    }
+    body_.append(reinterpret_cast<const char*>(values.data()), values.size_bytes());
+    end_frame();
+}
+
+std::string FrameEncoder::take() {
+    std::string body = std::move(body_);
+    body_ = kFrameMagic;
+    next_series_ = 0;
+    return body;
+}
+
+void FrameEncoder::begin_frame(EFrameType type) {
+    frame_start_ = body_.size();
+    AppendFixed32(body_, 0);
+    body_.push_back(static_cast<char>(type));
+}
+
+void FrameEncoder::end_frame() {
+    std::size_t length = body_.size() - frame_start_ - kFrameLengthSize;
+    if (length > kMaxFrameSize) {
+        body_.resize(frame_start_);
+        throw std::length_error("Frame exceeds kMaxFrameSize");
+    }
+    auto value = static_cast<uint32_t>(length);
+    std::memcpy(body_.data() + frame_start_, &value, sizeof(value));
+}
+
+void FrameEncoder::append_string(std::string_view str) {
+    AppendVarint(body_, str.size());
+    body_.append(str);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "frame_format.h"
+
+#include <cstdint>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Builds /post bodies in the binary ingest format for producers. Depends on
+// nothing but the standard library.
+//
+//     FrameEncoder encoder;
+//     auto cpu = encoder.series("web", WIRE_DOT, std::vector<std::string>{"host=1"});
+//     encoder.points(cpu, timestamps, values);
+//     std::string body = encoder.take();
+class FrameEncoder {
+public:
+    FrameEncoder();
+
+    // Declares a series and returns its id for points(). A series is
+    // declared once per body.
+    template <std::ranges::input_range Tags>
+    uint32_t series(std::string_view project_id, EWireMetricType metric_type, const Tags& tags) {
+        begin_frame(SERIES_FRAME);
+        AppendVarint(body_, next_series_);
+        body_.push_back(static_cast<char>(metric_type));
+        append_string(project_id);
+        AppendVarint(body_, static_cast<uint64_t>(std::ranges::distance(tags)));
+        for (const auto& tag : tags) {
+            append_string(tag);
+        }
+        end_frame();
+        return next_series_++;
+    }
+
+    // Appends one frame with the points of a series. Both spans have the
+    // same length.
+    void points(uint32_t series, std::span<const int64_t> timestamps, std::span<const double> values);
+
+    // Returns the body so far and starts a new one; series ids start over.
+    std::string take();
+
+    std::size_t size() const {
+        return body_.size();
+    }
+
+private:
+    void begin_frame(EFrameType type);
+    void end_frame();
+    void append_string(std::string_view str);
+
+    std::string body_;
+    std::size_t frame_start_ = 0;
+    uint32_t next_series_ = 0;
+};
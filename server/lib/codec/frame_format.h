@@ -0,0 +1,74 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Binary ingest format, served on /post with content type kFrameContentType.
+//
+// A body is kFrameMagic followed by frames. Every frame is a little-endian
+// uint32 payload length and the payload, whose first byte is its type:
+//
+//   SERIES  varint id, uint8 metric type, string project_id,
+//           varint tag count, string tags...
+//   POINTS  varint series id, varint count,
+//           zigzag varint first timestamp, zigzag varint deltas...,
+//           count little-endian IEEE 754 doubles
+//
+// Strings are a varint length and the bytes. Series ids are assigned
+// densely from 0 in the order SERIES frames appear and are only valid
+// within one body.
+inline constexpr std::string_view kFrameContentType = "application/x-monitoring-frames";
+inline constexpr std::string_view kFrameMagic = "MON1";
+inline constexpr std::size_t kFrameLengthSize = 4;
+inline constexpr std::size_t kMaxFrameSize = 16 << 20;
+
+enum EFrameType : uint8_t {
+    SERIES_FRAME = 1,
+    POINTS_FRAME = 2,
+};
+
+// Metric types on the wire, with the values of EMetricType. A point is
+// one double, so there is no HISTOGRAM (2).
+enum EWireMetricType : uint8_t {
+    WIRE_DOT = 0,
+    WIRE_SPEED = 1,
+    WIRE_COUNTER = 3,
+};
+
+static_assert(std::endian::native == std::endian::little, "The frame codec assumes a little-endian host");
+
+inline uint64_t ZigZagEncode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Deltas wrap around modulo 2^64 instead of overflowing, so any pair of
+// timestamps round-trips, however far apart.
+inline int64_t TimestampDelta(int64_t previous, int64_t timestamp) {
+    return static_cast<int64_t>(static_cast<uint64_t>(timestamp) - static_cast<uint64_t>(previous));
+}
+
+inline int64_t ApplyTimestampDelta(int64_t previous, int64_t delta) {
+    return static_cast<int64_t>(static_cast<uint64_t>(previous) + static_cast<uint64_t>(delta));
+}
+
+inline void AppendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline void AppendFixed32(std::string& out, uint32_t value) {
+    char bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    out.append(bytes, sizeof(bytes));
+}
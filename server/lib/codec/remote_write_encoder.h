@@ -0,0 +1,45 @@
+#pragma once
+
+#include "remote_write_format.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Builds remote write bodies, for tests, benchmarks and producers that do
+// not link Prometheus' own client. Depends on nothing but the standard
+// library.
+//
+//     RemoteWriteEncoder encoder;
+//     encoder.series({{"__name__", "cpu"}, {"host", "1"}}, timestamps, values);
+//     std::string body = encoder.take();
+class RemoteWriteEncoder {
+public:
+    using Label = std::pair<std::string_view, std::string_view>;
+
+    // Appends one TimeSeries. Both spans have the same length.
+    void series(std::span<const Label> labels, std::span<const int64_t> timestamps, std::span<const double> values);
+    void series(std::initializer_list<Label> labels, std::span<const int64_t> timestamps, std::span<const double> values) {
+        series(std::span<const Label>(labels.begin(), labels.size()), timestamps, values);
+    }
+
+    // Returns the snappy compressed WriteRequest so far and starts a new one.
+    std::string take();
+
+    // The uncompressed WriteRequest so far.
+    const std::string& message() const {
+        return message_;
+    }
+
+private:
+    std::string message_;
+    // Scratch space for the nested messages of a series.
+    std::string series_;
+    std::string nested_;
+};
+
+// Compresses input into one snappy block.
+std::string SnappyCompress(std::string_view input);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Prometheus remote write 1.0, served on /api/v1/write/{project}: the body
+// is a snappy block (Content-Encoding: snappy) holding a protobuf
+// WriteRequest. Only the fields below are read, others are skipped:
+//
+//   WriteRequest  repeated TimeSeries timeseries = 1
+//   TimeSeries    repeated Label labels = 1, repeated Sample samples = 2
+//   Label         string name = 1, string value = 2
+//   Sample        double value = 1, int64 timestamp = 2 (milliseconds)
+inline constexpr std::string_view kRemoteWriteContentType = "application/x-protobuf";
+inline constexpr std::string_view kRemoteWriteEncoding = "snappy";
+// Label that holds the metric name.
+inline constexpr std::string_view kMetricNameLabel = "__name__";
+// Prometheus marks a series that went stale with this NaN.
+inline constexpr uint64_t kStaleMarkerBits = 0x7ff0000000000002;
+
+enum EProtobufWireType : uint8_t {
+    WIRE_VARINT = 0,
+    WIRE_FIXED64 = 1,
+    WIRE_LENGTH_DELIMITED = 2,
+    WIRE_FIXED32 = 5,
+};
+
+inline constexpr uint32_t kWriteRequestTimeseries = 1;
+inline constexpr uint32_t kTimeSeriesLabels = 1;
+inline constexpr uint32_t kTimeSeriesSamples = 2;
+inline constexpr uint32_t kLabelName = 1;
+inline constexpr uint32_t kLabelValue = 2;
+inline constexpr uint32_t kSampleValue = 1;
+inline constexpr uint32_t kSampleTimestamp = 2;
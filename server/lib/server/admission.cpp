@@ -0,0 +1,109 @@
+#include "admission.h"
+
+#include <utility>
+
+AdmissionController::Ticket::Ticket(Ticket&& other) noexcept
+    : controller_(std::exchange(other.controller_, nullptr))
+    , route_(std::exchange(other.route_, nullptr))
+    , enqueued_(other.enqueued_)
+    , started_(other.started_)
+{
+}
+
+AdmissionController::Ticket& AdmissionController::Ticket::operator=(Ticket&& other) noexcept {
+    if (this != &other) {
+        release();
+        controller_ = std::exchange(other.controller_, nullptr);
+        route_ = std::exchange(other.route_, nullptr);
+        enqueued_ = other.enqueued_;
+        started_ = other.started_;
+    }
+    return *this;
+}
+
+AdmissionController::Ticket::~Ticket() {
+    release();
+}
+
+bool AdmissionController::Ticket::start() {
+    auto& controller = *controller_;
+    auto waited = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - enqueued_);
+    auto waited_us = static_cast<std::uint64_t>(waited.count());
+    controller.wait_time_sum_us_.fetch_add(waited_us, std::memory_order_relaxed);
+    auto max = controller.wait_time_max_us_.load(std::memory_order_relaxed);
+    while (waited_us > max && !controller.wait_time_max_us_.compare_exchange_weak(max, waited_us, std::memory_order_relaxed)) {
+    }
+
+    controller.queued_.fetch_sub(1, std::memory_order_relaxed);
+    controller.running_.fetch_add(1, std::memory_order_relaxed);
+    started_ = true;
+
+    if (waited > controller.limits_.max_queue_time) {
+        controller.shed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void AdmissionController::Ticket::release() {
+    if (!controller_) {
+        return;
+    }
+    (started_ ? controller_->running_ : controller_->queued_).fetch_sub(1, std::memory_order_relaxed);
+    if (route_) {
+        route_->fetch_sub(1, std::memory_order_relaxed);
+    }
+    controller_ = nullptr;
+    route_ = nullptr;
+}
+
+AdmissionController::AdmissionController(AdmissionLimits limits)
+    : limits_(std::move(limits))
+{
+    for (const auto& [pattern, limit] : limits_.routes) {
+        routes_.try_emplace(pattern, limit);
+    }
+}
+
+AdmissionController::Ticket AdmissionController::admit(std::string_view pattern) {
+    // Slots are taken first and given back on refusal, so concurrent
+    // admissions never overshoot a limit.
+    if (queued_.fetch_add(1, std::memory_order_relaxed) >= limits_.max_queue) {
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return {};
+    }
+
+    std::atomic<std::size_t>* route = nullptr;
+    if (auto it = routes_.find(pattern); it != routes_.end()) {
+        route = &it->second.in_flight;
+        if (route->fetch_add(1, std::memory_order_relaxed) >= it->second.limit) {
+            route->fetch_sub(1, std::memory_order_relaxed);
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return {};
+        }
+    }
+
+    admitted_.fetch_add(1, std::memory_order_relaxed);
+    Ticket ticket;
+    ticket.controller_ = this;
+    ticket.route_ = route;
+    ticket.enqueued_ = Clock::now();
+    return ticket;
+}
+
+AdmissionStats AdmissionController::stats() const {
+    AdmissionStats stats;
+    stats.queue_depth = queued_.load(std::memory_order_relaxed);
+    stats.running = running_.load(std::memory_order_relaxed);
+    stats.admitted = admitted_.load(std::memory_order_relaxed);
+    stats.rejected = rejected_.load(std::memory_order_relaxed);
+    stats.shed = shed_.load(std::memory_order_relaxed);
+    stats.wait_time_sum_us = wait_time_sum_us_.load(std::memory_order_relaxed);
+    stats.wait_time_max_us = wait_time_max_us_.load(std::memory_order_relaxed);
+    for (const auto& [pattern, route] : routes_) {
+        stats.in_flight.emplace(pattern, route.in_flight.load(std::memory_order_relaxed));
+    }
+    return stats;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+// Limits on work handed to the request thread pool.
+struct AdmissionLimits {
+    // Requests posted to the pool and not yet picked up by a worker.
+    std::size_t max_queue = 1024;
+    // A request that waited longer is answered with 503 instead of run:
+    // its client is likely to have given up already.
+    std::chrono::milliseconds max_queue_time{1000};
+    // Requests of a route queued or running at once; routes not listed
+    // are only bounded by max_queue.
+    std::map<std::string, std::size_t, std::less<>> routes = {
+        {"/post", 64},
+        {"/api/v1/write/{project}", 64},
+        {"/query", 16},
+        {"/topk", 16},
+    };
+    // Sent with every 503.
+    std::chrono::seconds retry_after{1};
+};
+
+struct AdmissionStats {
+    std::size_t queue_depth = 0;
+    std::size_t running = 0;
+    std::uint64_t admitted = 0;
+    // Refused because the queue or the route was full.
+    std::uint64_t rejected = 0;
+    // Dropped after waiting longer than max_queue_time.
+    std::uint64_t shed = 0;
+    // Wait of the requests that reached a worker, shed ones included.
+    std::uint64_t wait_time_sum_us = 0;
+    std::uint64_t wait_time_max_us = 0;
+    std::map<std::string, std::size_t, std::less<>> in_flight;
+};
+
+// Bounds the request queue of the thread pool, so that under overload
+// requests are refused at once rather than waiting until their clients
+// time out. All methods are thread-safe.
+class AdmissionController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Holds a queue slot from admit() until start(), then a running slot
+    // until it is destroyed.
+    class Ticket {
+    public:
+        Ticket() = default;
+        Ticket(Ticket&& other) noexcept;
+        Ticket& operator=(Ticket&& other) noexcept;
+        ~Ticket();
+
+        explicit operator bool() const {
+            return controller_ != nullptr;
+        }
+
+        // Called by the worker. False when the request waited too long and
+        // must be refused.
+        bool start();
+
+    private:
+        friend class AdmissionController;
+
+        void release();
+
+        AdmissionController* controller_ = nullptr;
+        std::atomic<std::size_t>* route_ = nullptr;
+        Clock::time_point enqueued_;
+        bool started_ = false;
+    };
+
+    explicit AdmissionController(AdmissionLimits limits = {});
+
+    // Empty ticket when the request must be refused.
+    Ticket admit(std::string_view pattern);
+
+    const AdmissionLimits& limits() const {
+        return limits_;
+    }
+
+    AdmissionStats stats() const;
+
+private:
+    struct RouteState {
+        std::size_t limit;
+        std::atomic<std::size_t> in_flight{0};
+
+        explicit RouteState(std::size_t limit)
+            : limit(limit)
+        {
+        }
+    };
+
+    AdmissionLimits limits_;
+    // Built once from limits_, so lookups need no lock.
+    std::map<std::string, RouteState, std::less<>> routes_;
+
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<std::size_t> running_{0};
+    std::atomic<std::uint64_t> admitted_{0};
+    std::atomic<std::uint64_t> rejected_{0};
+    std::atomic<std::uint64_t> shed_{0};
+    std::atomic<std::uint64_t> wait_time_sum_us_{0};
+    std::atomic<std::uint64_t> wait_time_max_us_{0};
+};
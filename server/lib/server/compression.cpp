@@ -0,0 +1,523 @@
+#include "compression.h"
+
+#include <zlib.h>
+#ifdef MONITORING_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    constexpr int kGzipWindowBits = 15 + 16;
+    constexpr int kCompressionLevel = 3;
+    // Output produced per codec call.
+    constexpr std::size_t kStepSize = 64 * 1024;
+    // A 3 byte copy tag yields at most 64 bytes, more than any other tag.
+    constexpr std::uint64_t kMaxSnappyRatio = 22;
+    constexpr std::size_t kRetainedSnappyCapacity = 4 << 20;
+
+    // Output of SnappyUncompress on this thread. Grows to the largest block
+    // seen, and is released by the next smaller block once it is over
+    // kRetainedSnappyCapacity.
+    std::string& SnappyBuffer() {
+        thread_local std::string buffer;
+        return buffer;
+    }
+
+    // Finished contexts of each kind the pool keeps; beyond that they are
+    // freed, so a burst of streams does not pin its memory.
+    constexpr std::size_t kMaxPooledContexts = 64;
+
+    enum ECodecKind {
+        GZIP_COMPRESS,
+        GZIP_DECOMPRESS,
+        ZSTD_COMPRESS,
+        ZSTD_DECOMPRESS,
+        CODEC_KINDS,
+    };
+
+    ECodecKind KindOf(EContentEncoding encoding, bool compress) {
+        switch (encoding) {
+            case EContentEncoding::GZIP:
+                return compress ? GZIP_COMPRESS : GZIP_DECOMPRESS;
+#ifdef MONITORING_WITH_ZSTD
+            case EContentEncoding::ZSTD:
+                return compress ? ZSTD_COMPRESS : ZSTD_DECOMPRESS;
+#endif
+            default:
+                throw std::invalid_argument("Unsupported content encoding: " + ToString(encoding));
+        }
+    }
+
+} // anonymous namespace
+
+// State of one stream of one kind, created on first use and reset for every
+// stream after.
+struct CodecContext {
+    explicit CodecContext(ECodecKind kind)
+        : kind(kind)
+    {
+        switch (kind) {
+            case GZIP_COMPRESS:
+                if (deflateInit2(&zlib, kCompressionLevel, Z_DEFLATED, kGzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    throw std::runtime_error("Failed to initialize gzip compression");
+                }
+                break;
+            case GZIP_DECOMPRESS:
+                if (inflateInit2(&zlib, kGzipWindowBits) != Z_OK) {
+                    throw std::runtime_error("Failed to initialize gzip decompression");
+                }
+                break;
+#ifdef MONITORING_WITH_ZSTD
+            case ZSTD_COMPRESS:
+                zstd_compress = ZSTD_createCCtx();
+                if (!zstd_compress) {
+                    throw std::runtime_error("Failed to initialize zstd compression");
+                }
+                ZSTD_CCtx_setParameter(zstd_compress, ZSTD_c_compressionLevel, kCompressionLevel);
+                break;
+            case ZSTD_DECOMPRESS:
+                zstd_decompress = ZSTD_createDCtx();
+                if (!zstd_decompress) {
+                    throw std::runtime_error("Failed to initialize zstd decompression");
+                }
+                break;
+#endif
+            default:
+                std::unreachable();
+        }
+        if (kind == GZIP_DECOMPRESS || kind == ZSTD_DECOMPRESS) {
+            buffer.reset(new char[kStepSize]);
+        }
+    }
+
+    CodecContext(const CodecContext&) = delete;
+    CodecContext& operator=(const CodecContext&) = delete;
+
+    ~CodecContext() {
+        if (kind == GZIP_COMPRESS) {
+            deflateEnd(&zlib);
+        } else if (kind == GZIP_DECOMPRESS) {
+            inflateEnd(&zlib);
+        }
+#ifdef MONITORING_WITH_ZSTD
+        ZSTD_freeCCtx(zstd_compress);
+        ZSTD_freeDCtx(zstd_decompress);
+#endif
+    }
+
+    // Drops what is left of the previous stream, keeping the parameters.
+    void reset() {
+        switch (kind) {
+            case GZIP_COMPRESS:
+                deflateReset(&zlib);
+                break;
+            case GZIP_DECOMPRESS:
+                inflateReset(&zlib);
+                break;
+#ifdef MONITORING_WITH_ZSTD
+            case ZSTD_COMPRESS:
+                ZSTD_CCtx_reset(zstd_compress, ZSTD_reset_session_only);
+                break;
+            case ZSTD_DECOMPRESS:
+                ZSTD_DCtx_reset(zstd_decompress, ZSTD_reset_session_only);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+
+    ECodecKind kind;
+    z_stream zlib{};
+#ifdef MONITORING_WITH_ZSTD
+    ZSTD_CCtx* zstd_compress = nullptr;
+    ZSTD_DCtx* zstd_decompress = nullptr;
+#endif
+    // Output of a decompressor.
+    std::unique_ptr<char[]> buffer;
+};
+
+namespace {
+
+    class CodecPool {
+    public:
+        static CodecPool& Instance() {
+            static CodecPool pool;
+            return pool;
+        }
+
+        CodecContextPtr take(ECodecKind kind) {
+            std::unique_ptr<CodecContext> context;
+            {
+                std::lock_guard lock(mutex_);
+                auto& free = free_[kind];
+                if (!free.empty()) {
+                    context = std::move(free.back());
+                    free.pop_back();
+                }
+            }
+            if (!context) {
+                return CodecContextPtr(new CodecContext(kind));
+            }
+            context->reset();
+            return CodecContextPtr(context.release());
+        }
+
+        void give(CodecContext* context) {
+            std::unique_ptr<CodecContext> owned(context);
+            std::lock_guard lock(mutex_);
+            auto& free = free_[context->kind];
+            if (free.size() < kMaxPooledContexts) {
+                free.push_back(std::move(owned));
+            }
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<std::unique_ptr<CodecContext>> free_[CODEC_KINDS];
+    };
+
+    bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs) {
+        return std::ranges::equal(lhs, rhs, [](char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+        });
+    }
+
+    std::string_view Trim(std::string_view str) {
+        while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+            str.remove_suffix(1);
+        }
+        return str;
+    }
+
+    constexpr bool kZstdSupported =
+#ifdef MONITORING_WITH_ZSTD
+        true;
+#else
+        false;
+#endif
+
+} // anonymous namespace
+
+std::string ToString(EContentEncoding encoding) {
+    switch (encoding) {
+        case EContentEncoding::IDENTITY:
+            return "identity";
+        case EContentEncoding::GZIP:
+            return "gzip";
+        case EContentEncoding::ZSTD:
+            return "zstd";
+        default:
+            std::unreachable();
+    }
+}
+
+EContentEncoding ContentEncodingFromString(std::string_view str) {
+    str = Trim(str);
+    if (str.empty() || EqualsIgnoreCase(str, "identity")) {
+        return EContentEncoding::IDENTITY;
+    }
+    if (EqualsIgnoreCase(str, "gzip") || EqualsIgnoreCase(str, "x-gzip")) {
+        return EContentEncoding::GZIP;
+    }
+    if (kZstdSupported && EqualsIgnoreCase(str, "zstd")) {
+        return EContentEncoding::ZSTD;
+    }
+    throw std::invalid_argument("Unsupported content encoding: " + std::string(str));
+}
+
+EContentEncoding NegotiateEncoding(std::string_view accept_encoding) {
+    double gzip = -1.0;
+    double zstd = -1.0;
+    double any = 0.0;
+    while (!accept_encoding.empty()) {
+        auto comma = accept_encoding.find(',');
+        auto item = accept_encoding.substr(0, comma);
+        accept_encoding.remove_prefix(comma == std::string_view::npos ? accept_encoding.size() : comma + 1);
+
+        auto semicolon = item.find(';');
+        auto coding = Trim(item.substr(0, semicolon));
+        double q = 1.0;
+        if (semicolon != std::string_view::npos) {
+            auto params = Trim(item.substr(semicolon + 1));
+            if (params.size() > 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=') {
+                std::from_chars(params.data() + 2, params.data() + params.size(), q);
+            }
+        }
+
+        if (EqualsIgnoreCase(coding, "gzip") || EqualsIgnoreCase(coding, "x-gzip")) {
+            gzip = q;
+        } else if (EqualsIgnoreCase(coding, "zstd")) {
+            zstd = q;
+        } else if (coding == "*") {
+            any = q;
+        }
+    }
+    // Codings not listed are acceptable only through "*".
+    if (gzip < 0) {
+        gzip = any;
+    }
+    if (zstd < 0 || !kZstdSupported) {
+        zstd = kZstdSupported ? any : 0.0;
+    }
+
+    if (zstd > 0 && zstd >= gzip) {
+        return EContentEncoding::ZSTD;
+    }
+    if (gzip > 0) {
+        return EContentEncoding::GZIP;
+    }
+    return EContentEncoding::IDENTITY;
+}
+
+void CodecContextRelease::operator()(CodecContext* context) const {
+    CodecPool::Instance().give(context);
+}
+
+Compressor::Compressor(EContentEncoding encoding)
+    : encoding_(encoding)
+    , context_(CodecPool::Instance().take(KindOf(encoding, true)))
+{
+}
+
+void Compressor::write(std::string_view input, std::string& out) {
+    run(input, false, out);
+}
+
+void Compressor::finish(std::string& out) {
+    run({}, true, out);
+}
+
+void Compressor::run(std::string_view input, bool end, std::string& out) {
+    if (encoding_ == EContentEncoding::GZIP) {
+        auto& stream = context_->zlib;
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        int status;
+        do {
+            std::size_t offset = out.size();
+            out.resize_and_overwrite(offset + kStepSize, [&](char* data, std::size_t size) {
+                stream.next_out = reinterpret_cast<Bytef*>(data + offset);
+                stream.avail_out = static_cast<uInt>(size - offset);
+                status = deflate(&stream, end ? Z_FINISH : Z_NO_FLUSH);
+                return size - stream.avail_out;
+            });
+            if (status == Z_STREAM_ERROR) {
+                throw std::runtime_error("gzip compression failed");
+            }
+        } while (end ? status != Z_STREAM_END : stream.avail_in > 0 || stream.avail_out == 0);
+        return;
+    }
+
+#ifdef MONITORING_WITH_ZSTD
+    auto* context = context_->zstd_compress;
+    ZSTD_inBuffer in{input.data(), input.size(), 0};
+    std::size_t remaining;
+    do {
+        std::size_t offset = out.size();
+        out.resize_and_overwrite(offset + kStepSize, [&](char* data, std::size_t size) {
+            ZSTD_outBuffer buffer{data + offset, size - offset, 0};
+            remaining = ZSTD_compressStream2(context, &buffer, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+            return offset + buffer.pos;
+        });
+        if (ZSTD_isError(remaining)) {
+            throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(remaining));
+        }
+    } while (end ? remaining != 0 : in.pos < in.size);
+#endif
+}
+
+void Compress(EContentEncoding encoding, std::string_view input, std::string& out) {
+    Compressor compressor(encoding);
+    compressor.write(input, out);
+    compressor.finish(out);
+}
+
+Decompressor::Decompressor(EContentEncoding encoding, std::uint64_t max_output)
+    : encoding_(encoding)
+    , context_(CodecPool::Instance().take(KindOf(encoding, false)))
+    , max_output_(max_output)
+{
+}
+
+std::string_view Decompressor::read(std::string_view& input) {
+    char* buffer = context_->buffer.get();
+    // A full buffer means the codec may hold more output even without input.
+    while (!input.empty() || output_full_) {
+        std::size_t consumed = 0;
+        std::size_t produced = 0;
+        if (encoding_ == EContentEncoding::GZIP) {
+            if (ended_) {
+                if (!input.empty()) {
+                    throw std::invalid_argument("Data after the end of the gzip stream");
+                }
+                output_full_ = false;
+                break;
+            }
+            auto& stream = context_->zlib;
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+            stream.avail_in = static_cast<uInt>(std::min<std::size_t>(input.size(), std::numeric_limits<uInt>::max()));
+            stream.next_out = reinterpret_cast<Bytef*>(buffer);
+            stream.avail_out = static_cast<uInt>(kStepSize);
+            uInt offered = stream.avail_in;
+            int status = inflate(&stream, Z_NO_FLUSH);
+            if (status == Z_STREAM_END) {
+                ended_ = true;
+            } else if (status != Z_OK && status != Z_BUF_ERROR) {
+                throw std::invalid_argument("Malformed gzip body");
+            }
+            consumed = offered - stream.avail_in;
+            produced = kStepSize - stream.avail_out;
+        } else {
+#ifdef MONITORING_WITH_ZSTD
+            ZSTD_inBuffer in{input.data(), input.size(), 0};
+            ZSTD_outBuffer out{buffer, kStepSize, 0};
+            std::size_t hint = ZSTD_decompressStream(context_->zstd_decompress, &out, &in);
+            if (ZSTD_isError(hint)) {
+                throw std::invalid_argument(std::string("Malformed zstd body: ") + ZSTD_getErrorName(hint));
+            }
+            // 0 once a frame is complete; another frame may follow.
+            ended_ = hint == 0;
+            consumed = in.pos;
+            produced = out.pos;
+#endif
+        }
+
+        input.remove_prefix(consumed);
+        output_full_ = produced == kStepSize;
+        produced_ += produced;
+        if (produced_ > max_output_) {
+            throw std::length_error("Decompressed body too large");
+        }
+        if (produced > 0) {
+            return {buffer, produced};
+        }
+        if (consumed == 0) {
+            break;
+        }
+    }
+    return {};
+}
+
+void Decompressor::finish() const {
+    if (!ended_) {
+        throw std::invalid_argument("Truncated compressed body");
+    }
+}
+
+std::string_view SnappyUncompress(std::string_view input, std::uint64_t max_output) {
+    auto* in = reinterpret_cast<const unsigned char*>(input.data());
+    auto* in_end = in + input.size();
+    auto truncated = [] {
+        throw std::invalid_argument("Truncated snappy block");
+    };
+    // Little endian, n bytes.
+    auto fixed = [&](std::size_t n) {
+        if (static_cast<std::size_t>(in_end - in) < n) {
+            truncated();
+        }
+        std::size_t value = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            value |= static_cast<std::size_t>(in[i]) << (8 * i);
+        }
+        in += n;
+        return value;
+    };
+
+    std::uint64_t length = 0;
+    for (int shift = 0;; shift += 7) {
+        if (in == in_end || shift > 63) {
+            throw std::invalid_argument("Malformed snappy length");
+        }
+        length |= static_cast<std::uint64_t>(*in & 0x7f) << shift;
+        if ((*in++ & 0x80) == 0) {
+            break;
+        }
+    }
+    if (length > max_output) {
+        throw std::length_error("Uncompressed body exceeds the limit");
+    }
+    // No tag expands to more than kMaxSnappyRatio times its size, so a
+    // length beyond that is a lie that would only make us allocate.
+    if (length > static_cast<std::uint64_t>(input.size()) * kMaxSnappyRatio) {
+        throw std::invalid_argument("Snappy length larger than the block can hold");
+    }
+
+    auto& out = SnappyBuffer();
+    if (out.capacity() > kRetainedSnappyCapacity && length <= kRetainedSnappyCapacity) {
+        std::string().swap(out);
+    }
+    out.resize(length);
+    char* begin = out.data();
+    char* op = begin;
+    char* end = begin + length;
+    while (in < in_end) {
+        unsigned char tag = *in++;
+        std::size_t size;
+        std::size_t offset = 0;
+        switch (tag & 3) {
+            case 0:
+                size = tag >> 2;
+                if (size >= 60) {
+                    size = fixed(size - 59);
+                }
+                ++size;
+                if (static_cast<std::size_t>(in_end - in) < size) {
+                    truncated();
+                }
+                if (static_cast<std::size_t>(end - op) < size) {
+                    throw std::invalid_argument("Snappy block longer than declared");
+                }
+                std::memcpy(op, in, size);
+                op += size;
+                in += size;
+                continue;
+            case 1:
+                size = 4 + ((tag >> 2) & 7);
+                offset = (static_cast<std::size_t>(tag >> 5) << 8) | fixed(1);
+                break;
+            case 2:
+                size = (tag >> 2) + 1;
+                offset = fixed(2);
+                break;
+            default:
+                size = (tag >> 2) + 1;
+                offset = fixed(4);
+                break;
+        }
+        if (offset == 0 || offset > static_cast<std::size_t>(op - begin)) {
+            throw std::invalid_argument("Snappy copy before the start of the block");
+        }
+        if (static_cast<std::size_t>(end - op) < size) {
+            throw std::invalid_argument("Snappy block longer than declared");
+        }
+        // A copy may overlap its own output to repeat a short pattern.
+        const char* from = op - offset;
+        if (offset >= size) {
+            std::memcpy(op, from, size);
+            op += size;
+        } else {
+            for (std::size_t i = 0; i < size; ++i) {
+                *op++ = from[i];
+            }
+        }
+    }
+    if (op != end) {
+        throw std::invalid_argument("Snappy block shorter than declared");
+    }
+    return out;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// zstd is optional: it is used only when the build finds libzstd and
+// defines MONITORING_WITH_ZSTD.
+enum EContentEncoding {
+    IDENTITY,
+    GZIP,
+    ZSTD,
+};
+
+std::string ToString(EContentEncoding encoding);
+// Parses a Content-Encoding value, empty meaning identity. Throws
+// std::invalid_argument for codings this build does not support.
+EContentEncoding ContentEncodingFromString(std::string_view str);
+
+// Picks the supported coding with the highest q-value in an
+// Accept-Encoding header, preferring zstd on ties. IDENTITY if none.
+EContentEncoding NegotiateEncoding(std::string_view accept_encoding);
+
+// Every Compressor and Decompressor owns the codec context of its stream,
+// so the stream may move between threads and suspend between calls, as
+// long as one thread uses it at a time. Contexts of finished streams are
+// pooled and reset for the next ones, so neither class allocates once as
+// many streams ran at once before.
+struct CodecContext;
+
+struct CodecContextRelease {
+    void operator()(CodecContext* context) const;
+};
+
+using CodecContextPtr = std::unique_ptr<CodecContext, CodecContextRelease>;
+
+class Compressor {
+public:
+    explicit Compressor(EContentEncoding encoding);
+
+    // Appends what the codec produced for input to out; part of it may be
+    // held back until later writes or finish().
+    void write(std::string_view input, std::string& out);
+    void finish(std::string& out);
+
+private:
+    void run(std::string_view input, bool end, std::string& out);
+
+    EContentEncoding encoding_;
+    CodecContextPtr context_;
+};
+
+// Compresses a whole body into out.
+void Compress(EContentEncoding encoding, std::string_view input, std::string& out);
+
+class Decompressor {
+public:
+    // Throws std::length_error once more than max_output bytes come out.
+    Decompressor(EContentEncoding encoding, std::uint64_t max_output);
+
+    // Decompresses from the front of input into a buffer of the stream and
+    // returns the bytes produced, valid until the next call. Returns an
+    // empty view once input is used up. Throws std::invalid_argument on
+    // malformed input.
+    std::string_view read(std::string_view& input);
+    // Throws std::invalid_argument unless the compressed stream is complete.
+    void finish() const;
+
+private:
+    EContentEncoding encoding_;
+    CodecContextPtr context_;
+    std::uint64_t max_output_;
+    std::uint64_t produced_ = 0;
+    bool output_full_ = false;
+    bool ended_ = false;
+};
+
+// Decompresses a snappy block (the raw format, not the framed stream one)
+// into a per-thread buffer and returns it, valid until the next call on the
+// thread. Throws std::length_error when the block claims more than
+// max_output bytes and std::invalid_argument on malformed input.
+std::string_view SnappyUncompress(std::string_view input, std::uint64_t max_output);
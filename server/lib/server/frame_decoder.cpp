@@ -0,0 +1,241 @@
+#include "frame_decoder.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+    // Bounds-checked cursor over a frame payload.
+    class PayloadReader {
+    public:
+        explicit PayloadReader(std::string_view data)
+            : data_(data)
+        {
+        }
+
+        bool empty() const {
+            return data_.empty();
+        }
+
+        std::size_t remaining() const {
+            return data_.size();
+        }
+
+        uint8_t byte() {
+            if (data_.empty()) {
+                throw std::invalid_argument("Truncated frame");
+            }
+            auto value = static_cast<uint8_t>(data_.front());
+            data_.remove_prefix(1);
+            return value;
+        }
+
+        uint64_t varint() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                uint8_t next = byte();
+                value |= static_cast<uint64_t>(next & 0x7F) << shift;
+                if (!(next & 0x80)) {
+                    return value;
+                }
+            }
+            throw std::invalid_argument("Malformed varint");
+        }
+
+        std::string_view bytes(std::size_t size) {
+            if (size > data_.size()) {
+                throw std::invalid_argument("Truncated frame");
+            }
+            auto value = data_.substr(0, size);
+            data_.remove_prefix(size);
+            return value;
+        }
+
+        std::string_view string() {
+            return bytes(varint());
+        }
+
+    private:
+        std::string_view data_;
+    };
+
+} // anonymous namespace
+
+FrameDecoder::FrameDecoder(std::pmr::memory_resource* memory)
+    : memory_(memory)
+    , request_(memory)
+    , series_(memory)
+    , series_metric_(memory)
+    , pending_(memory)
+{
+}
+
+std::optional<std::size_t> FrameDecoder::unit_size(std::string_view data) const {
+    if (data.size() < kFrameLengthSize) {
+        return std::nullopt;
+    }
+    if (!magic_seen_) {
+        return kFrameMagic.size();
+    }
+    uint32_t length;
+    std::memcpy(&length, data.data(), sizeof(length));
+    if (length > kMaxFrameSize) {
+        throw std::invalid_argument("Frame too large");
+    }
+    return kFrameLengthSize + length;
+}
+
+void FrameDecoder::write(std::string_view chunk, bool more) {
+    if (done_) {
+        throw std::invalid_argument("Unexpected data after the last frame");
+    }
+
+    // First complete a frame left over from the previous write.
+    while (!pending_.empty() && !chunk.empty()) {
+        auto size = unit_size(pending_);
+        std::size_t take = std::min(size.value_or(kFrameLengthSize) - pending_.size(), chunk.size());
+        pending_.append(chunk.substr(0, take));
+        chunk.remove_prefix(take);
+        size = unit_size(pending_);
+        if (size && pending_.size() == *size) {
+            consume(pending_);
+            pending_.clear();
+        }
+    }
+
+    for (auto size = unit_size(chunk); size && *size <= chunk.size(); size = unit_size(chunk)) {
+        consume(chunk.substr(0, *size));
+        chunk.remove_prefix(*size);
+    }
+    pending_.append(chunk);
+
+    if (!more) {
+        if (!magic_seen_ || !pending_.empty()) {
+            throw std::invalid_argument("Truncated frame");
+        }
+        done_ = true;
+    }
+}
+
+void FrameDecoder::consume(std::string_view unit) {
+    if (!magic_seen_) {
+        if (unit != kFrameMagic) {
+            throw std::invalid_argument("Not a frame stream");
+        }
+        magic_seen_ = true;
+        return;
+    }
+    auto payload = unit.substr(kFrameLengthSize);
+    if (payload.empty()) {
+        throw std::invalid_argument("Empty frame");
+    }
+    switch (static_cast<uint8_t>(payload.front())) {
+        case SERIES_FRAME:
+            return decode_series(payload.substr(1));
+        case POINTS_FRAME:
+            return decode_points(payload.substr(1));
+        default:
+            throw std::invalid_argument("Unknown frame type");
+    }
+}
+
+void FrameDecoder::decode_series(std::string_view payload) {
+    PayloadReader reader(payload);
+    if (reader.varint() != series_.size()) {
+        throw std::invalid_argument("Series ids must be assigned in order");
+    }
+    auto& ids = series_.emplace_back();
+    uint8_t metric_type = reader.byte();
+    if (metric_type != WIRE_DOT && metric_type != WIRE_SPEED && metric_type != WIRE_COUNTER) {
+        throw std::invalid_argument("Unknown metric type");
+    }
+    static_assert(WIRE_SPEED == static_cast<int>(EMetricType::SPEED) && WIRE_COUNTER == static_cast<int>(EMetricType::COUNTER));
+    ids.metric_type = static_cast<EMetricType>(metric_type);
+    ids.project_id = reader.string();
+    uint64_t tag_count = reader.varint();
+    // Every tag takes at least its length byte.
+    if (tag_count > reader.remaining()) {
+        throw std::invalid_argument("Truncated frame");
+    }
+    ids.tags.reserve(tag_count);
+    for (uint64_t i = 0; i < tag_count; ++i) {
+        // Frames carry no histograms, whose buckets this key marks.
+        if (TagKey(ids.tags.emplace_back(reader.string())) == kHistogramBoundKey) {
+            throw std::invalid_argument("Only HISTOGRAM tags may have the key 'le'");
+        }
+    }
+    if (!reader.empty()) {
+        throw std::invalid_argument("Trailing bytes in frame");
+    }
+    series_metric_.push_back(kNoMetric);
+}
+
+void FrameDecoder::decode_points(std::string_view payload) {
+    PayloadReader reader(payload);
+    uint64_t id = reader.varint();
+    if (id >= series_.size()) {
+        throw std::invalid_argument("Unknown series");
+    }
+    uint64_t count = reader.varint();
+    // A point takes at least one timestamp byte and a double.
+    if (count > reader.remaining() / (1 + sizeof(double))) {
+        throw std::invalid_argument("Truncated frame");
+    }
+
+    auto& metric_index = series_metric_[id];
+    if (metric_index == kNoMetric) {
+        metric_index = request_.metrics.size();
+        request_.metrics.emplace_back().identifiers = series_[id];
+    }
+    auto& values = request_.metrics[metric_index].values;
+    std::size_t first = values.size();
+    values.resize(first + count);
+
+    int64_t timestamp = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        timestamp = ApplyTimestampDelta(timestamp, ZigZagDecode(reader.varint()));
+        values[first + i].timestamp = timestamp;
+    }
+    auto raw = reader.bytes(count * sizeof(double));
+    for (uint64_t i = 0; i < count; ++i) {
+        std::memcpy(&values[first + i].value, raw.data() + i * sizeof(double), sizeof(double));
+    }
+    if (!reader.empty()) {
+        throw std::invalid_argument("Trailing bytes in frame");
+    }
+}
+
+bool FrameDecoder::done() const {
+    return done_;
+}
+
+PostRequest FrameDecoder::release() {
+    if (!done_) {
+        throw std::invalid_argument("Incomplete frame stream");
+    }
+    PostRequest request = std::move(request_);
+    request_ = PostRequest(memory_);
+    series_.clear();
+    series_metric_.clear();
+    magic_seen_ = false;
+    done_ = false;
+    return request;
+}
+
+std::size_t FrameDecoder::completed() const {
+    return request_.metrics.size();
+}
+
+PostRequest FrameDecoder::release_completed() {
+    PostRequest batch(memory_);
+    batch.metrics = std::move(request_.metrics);
+    request_.metrics.clear();
+    std::fill(series_metric_.begin(), series_metric_.end(), kNoMetric);
+    return batch;
+}
+
+PostRequest DecodeFrames(std::string_view body, std::pmr::memory_resource* memory) {
+    FrameDecoder decoder(memory);
+    decoder.write(body, false);
+    return decoder.release();
+}
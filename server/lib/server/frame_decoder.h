@@ -0,0 +1,49 @@
+#pragma once
+
+#include <lib/codec/frame_format.h>
+#include <lib/service/service.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+
+// Decodes the binary ingest format of frame_format.h into a PostRequest.
+// Frames that arrive whole are decoded straight from the input; only a
+// frame split between two writes is copied to be completed. The interface
+// is that of PostRequestParser, so /post feeds either one the same way.
+class FrameDecoder {
+public:
+    explicit FrameDecoder(std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+    // Throws std::invalid_argument on malformed input.
+    void write(std::string_view chunk, bool more);
+    bool done() const;
+    PostRequest release();
+
+    // Every decoded frame is complete, so all metrics so far are.
+    std::size_t completed() const;
+    PostRequest release_completed();
+
+private:
+    // Size of the magic or of the frame at the start of data, nullopt
+    // while its length prefix is incomplete.
+    std::optional<std::size_t> unit_size(std::string_view data) const;
+    void consume(std::string_view unit);
+    void decode_series(std::string_view payload);
+    void decode_points(std::string_view payload);
+
+    std::pmr::memory_resource* memory_;
+    PostRequest request_;
+    // Declared series by id, and the metric of request_ collecting their
+    // points, kNoMetric if there is none yet.
+    static constexpr std::size_t kNoMetric = SIZE_MAX;
+    std::pmr::vector<MetricIdentifiers> series_;
+    std::pmr::vector<std::size_t> series_metric_;
+    std::pmr::string pending_;
+    bool magic_seen_ = false;
+    bool done_ = false;
+};
+
+PostRequest DecodeFrames(std::string_view body, std::pmr::memory_resource* memory = std::pmr::get_default_resource());
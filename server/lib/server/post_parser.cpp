@@ -0,0 +1,431 @@
+#include "post_parser.h"
+
+#include <boost/json/basic_parser_impl.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+    constexpr unsigned Bit(int field) {
+        return 1u << field;
+    }
+
+    bool IsJsonSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+} // anonymous namespace
+
+PostRequestHandler::PostRequestHandler(std::pmr::memory_resource* memory)
+    : request(memory)
+    , key_(memory)
+    , metric_type_(memory)
+    , buckets_(memory)
+{
+}
+
+bool PostRequestHandler::in_metric() const {
+    return state_ == METRIC || state_ == TAGS || state_ == VALUES || state_ == VALUE || state_ == BUCKETS;
+}
+
+bool PostRequestHandler::Fail(boost::json::error_code& ec, const char* message) {
+    error = message;
+    ec = boost::json::error::syntax;
+    return false;
+}
+
+bool PostRequestHandler::Mark(EField field, boost::json::error_code& ec) {
+    unsigned& seen = state_ == ROOT ? root_seen_ : state_ == METRIC ? metric_seen_ : value_seen_;
+    if (seen & Bit(field)) {
+        return Fail(ec, "Duplicate key");
+    }
+    seen |= Bit(field);
+    field_ = field;
+    return true;
+}
+
+bool PostRequestHandler::ExpandHistogram(boost::json::error_code& ec) {
+    auto& metrics = request.metrics;
+    Metric histogram = std::move(metrics.back());
+    metrics.pop_back();
+    std::ranges::stable_sort(buckets_, {}, &BucketCount::bound);
+    for (std::size_t i = 0; i < buckets_.size(); ++i) {
+        const auto& count = buckets_[i];
+        if (i == 0 || count.bound != buckets_[i - 1].bound) {
+            auto& bucket = metrics.emplace_back();
+            bucket.identifiers = histogram.identifiers;
+            bucket.identifiers.tags.emplace_back(HistogramBoundTag(count.bound));
+        } else if (count.value == buckets_[i - 1].value) {
+            // Keys spelling one bound twice, like "0.1" and "0.10", are the
+            // same key of the sample.
+            return Fail(ec, "Duplicate bucket key");
+        }
+        metrics.back().values.push_back(MetricValue{
+            .value = count.count,
+            .timestamp = histogram.values[count.value].timestamp
+        });
+    }
+    buckets_.clear();
+    return true;
+}
+
+bool PostRequestHandler::on_document_begin(boost::json::error_code&) {
+    return true;
+}
+
+bool PostRequestHandler::on_document_end(boost::json::error_code& ec) {
+    if (state_ != FINISHED) {
+        return Fail(ec, "Expected an object with 'metrics'");
+    }
+    return true;
+}
+
+bool PostRequestHandler::on_object_begin(boost::json::error_code& ec) {
+    switch (state_) {
+        case DOCUMENT:
+            state_ = ROOT;
+            root_seen_ = 0;
+            return true;
+        case METRICS:
+            state_ = METRIC;
+            metric_seen_ = 0;
+            metric_has_values_ = false;
+            metric_has_buckets_ = false;
+            buckets_.clear();
+            request.metrics.emplace_back();
+            return true;
+        case VALUES:
+            state_ = VALUE;
+            value_seen_ = 0;
+            request.metrics.back().values.emplace_back();
+            return true;
+        case VALUE:
+            if (field_ != FIELD_BUCKETS) {
+                break;
+            }
+            state_ = BUCKETS;
+            return true;
+        default:
+            break;
+    }
+    return Fail(ec, "Unexpected object");
+}
+
+bool PostRequestHandler::on_object_end(std::size_t, boost::json::error_code& ec) {
+    field_ = NONE;
+    switch (state_) {
+        case ROOT:
+            if (!(root_seen_ & Bit(FIELD_METRICS))) {
+                return Fail(ec, "Missing 'metrics'");
+            }
+            state_ = FINISHED;
+            return true;
+        case METRIC: {
+            constexpr unsigned kRequired =
+                Bit(FIELD_PROJECT_ID) | Bit(FIELD_METRIC_TYPE) | Bit(FIELD_TAGS) | Bit(FIELD_VALUES);
+            if ((metric_seen_ & kRequired) != kRequired) {
+                return Fail(ec, "Metric requires 'project_id', 'metric_type', 'tags' and 'values'");
+            }
+            EMetricType metric_type;
+            try {
+                metric_type = FromString(metric_type_);
+            } catch (const std::invalid_argument&) {
+                return Fail(ec, "Unknown 'metric_type'");
+            }
+            request.metrics.back().identifiers.metric_type = metric_type;
+            metric_type_.clear();
+            state_ = METRICS;
+            // The key marks the bucket series a histogram is stored as.
+            for (const auto& tag : request.metrics.back().identifiers.tags) {
+                if (TagKey(tag) == kHistogramBoundKey) {
+                    return Fail(ec, metric_type == EMetricType::HISTOGRAM
+                        ? "HISTOGRAM tags must not have the key 'le'"
+                        : "Only HISTOGRAM tags may have the key 'le'");
+                }
+            }
+            if (metric_type != EMetricType::HISTOGRAM) {
+                if (metric_has_buckets_) {
+                    return Fail(ec, "Only HISTOGRAM values have 'buckets'");
+                }
+                return true;
+            }
+            if (metric_has_values_) {
+                return Fail(ec, "HISTOGRAM values require 'buckets' instead of 'value'");
+            }
+            return ExpandHistogram(ec);
+        }
+        case VALUE: {
+            bool has_value = value_seen_ & Bit(FIELD_VALUE);
+            bool has_buckets = value_seen_ & Bit(FIELD_BUCKETS);
+            if (!(value_seen_ & Bit(FIELD_TIMESTAMP)) || has_value == has_buckets) {
+                return Fail(ec, "Value requires 'timestamp' and either 'value' or 'buckets'");
+            }
+            metric_has_values_ |= has_value;
+            metric_has_buckets_ |= has_buckets;
+            state_ = VALUES;
+            return true;
+        }
+        case BUCKETS:
+            state_ = VALUE;
+            return true;
+        default:
+            return Fail(ec, "Unexpected end of object");
+    }
+}
+
+bool PostRequestHandler::on_array_begin(boost::json::error_code& ec) {
+    if (state_ == ROOT && field_ == FIELD_METRICS) {
+        state_ = METRICS;
+        return true;
+    }
+    if (state_ == METRIC && field_ == FIELD_TAGS) {
+        state_ = TAGS;
+        return true;
+    }
+    if (state_ == METRIC && field_ == FIELD_VALUES) {
+        state_ = VALUES;
+        return true;
+    }
+    return Fail(ec, "Unexpected array");
+}
+
+bool PostRequestHandler::on_array_end(std::size_t, boost::json::error_code& ec) {
+    field_ = NONE;
+    switch (state_) {
+        case METRICS:
+            state_ = ROOT;
+            return true;
+        case TAGS:
+        case VALUES:
+            state_ = METRIC;
+            return true;
+        default:
+            return Fail(ec, "Unexpected end of array");
+    }
+}
+
+bool PostRequestHandler::on_key_part(boost::json::string_view s, std::size_t, boost::json::error_code&) {
+    key_.append(s.data(), s.size());
+    return true;
+}
+
+bool PostRequestHandler::on_key(boost::json::string_view s, std::size_t, boost::json::error_code& ec) {
+    bool ok;
+    if (key_.empty()) {
+        ok = ResolveKey(std::string_view(s.data(), s.size()), ec);
+    } else {
+        key_.append(s.data(), s.size());
+        ok = ResolveKey(key_, ec);
+        key_.clear();
+    }
+    return ok;
+}
+
+bool PostRequestHandler::ResolveKey(std::string_view key, boost::json::error_code& ec) {
+    switch (state_) {
+        case ROOT:
+            if (key == "metrics") {
+                return Mark(FIELD_METRICS, ec);
+            }
+            break;
+        case METRIC:
+            if (key == "project_id") {
+                return Mark(FIELD_PROJECT_ID, ec);
+            }
+            if (key == "metric_type") {
+                return Mark(FIELD_METRIC_TYPE, ec);
+            }
+            if (key == "tags") {
+                return Mark(FIELD_TAGS, ec);
+            }
+            if (key == "values") {
+                return Mark(FIELD_VALUES, ec);
+            }
+            break;
+        case VALUE:
+            if (key == "value") {
+                return Mark(FIELD_VALUE, ec);
+            }
+            if (key == "timestamp") {
+                return Mark(FIELD_TIMESTAMP, ec);
+            }
+            if (key == "buckets") {
+                return Mark(FIELD_BUCKETS, ec);
+            }
+            break;
+        case BUCKETS: {
+            auto bound = ParseHistogramBound(key);
+            if (!bound) {
+                return Fail(ec, "Bucket bound must be a number or '+Inf'");
+            }
+            bound_ = *bound;
+            field_ = FIELD_BUCKET_COUNT;
+            return true;
+        }
+        default:
+            break;
+    }
+    return Fail(ec, "Unknown key");
+}
+
+std::pmr::string* PostRequestHandler::StringTarget() {
+    if (state_ == TAGS) {
+        return &request.metrics.back().identifiers.tags.back();
+    }
+    if (state_ == METRIC && field_ == FIELD_PROJECT_ID) {
+        return &request.metrics.back().identifiers.project_id;
+    }
+    if (state_ == METRIC && field_ == FIELD_METRIC_TYPE) {
+        return &metric_type_;
+    }
+    return nullptr;
+}
+
+bool PostRequestHandler::on_string_part(boost::json::string_view s, std::size_t n, boost::json::error_code& ec) {
+    // n includes s, so the first part of a string has n == s.size().
+    if (state_ == TAGS && n == s.size()) {
+        request.metrics.back().identifiers.tags.emplace_back();
+    }
+    auto* target = StringTarget();
+    if (!target) {
+        return Fail(ec, "Unexpected string");
+    }
+    target->append(s.data(), s.size());
+    return true;
+}
+
+bool PostRequestHandler::on_string(boost::json::string_view s, std::size_t n, boost::json::error_code& ec) {
+    if (!on_string_part(s, n, ec)) {
+        return false;
+    }
+    if (state_ != TAGS) {
+        field_ = NONE;
+    }
+    return true;
+}
+
+bool PostRequestHandler::on_number_part(boost::json::string_view, boost::json::error_code&) {
+    return true;
+}
+
+bool PostRequestHandler::OnNumber(double value, bool integral, int64_t integer, boost::json::error_code& ec) {
+    if (state_ == BUCKETS && field_ == FIELD_BUCKET_COUNT) {
+        if (!(value >= 0.0) || std::isinf(value)) {
+            return Fail(ec, "Bucket count must be a non-negative number");
+        }
+        if (value > 0.0) {
+            buckets_.push_back(BucketCount{bound_, value, request.metrics.back().values.size() - 1});
+        }
+        field_ = NONE;
+        return true;
+    }
+    if (state_ != VALUE) {
+        return Fail(ec, "Unexpected number");
+    }
+    auto& metric_value = request.metrics.back().values.back();
+    if (field_ == FIELD_VALUE) {
+        metric_value.value = value;
+    } else if (field_ == FIELD_TIMESTAMP) {
+        if (!integral) {
+            return Fail(ec, "'timestamp' must be an integer");
+        }
+        metric_value.timestamp = integer;
+    } else {
+        return Fail(ec, "Unexpected number");
+    }
+    field_ = NONE;
+    return true;
+}
+
+bool PostRequestHandler::on_int64(int64_t i, boost::json::string_view, boost::json::error_code& ec) {
+    return OnNumber(static_cast<double>(i), true, i, ec);
+}
+
+bool PostRequestHandler::on_uint64(uint64_t u, boost::json::string_view, boost::json::error_code& ec) {
+    bool fits = u <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+    return OnNumber(static_cast<double>(u), fits, static_cast<int64_t>(u), ec);
+}
+
+bool PostRequestHandler::on_double(double d, boost::json::string_view, boost::json::error_code& ec) {
+    return OnNumber(d, false, 0, ec);
+}
+
+bool PostRequestHandler::on_bool(bool, boost::json::error_code& ec) {
+    return Fail(ec, "Unexpected boolean");
+}
+
+bool PostRequestHandler::on_null(boost::json::error_code& ec) {
+    return Fail(ec, "Unexpected null");
+}
+
+bool PostRequestHandler::on_comment_part(boost::json::string_view, boost::json::error_code&) {
+    return true;
+}
+
+bool PostRequestHandler::on_comment(boost::json::string_view, boost::json::error_code&) {
+    return true;
+}
+
+PostRequestParser::PostRequestParser(std::pmr::memory_resource* memory)
+    : memory_(memory)
+    , parser_(boost::json::parse_options{}, memory)
+{
+}
+
+void PostRequestParser::write(std::string_view chunk, bool more) {
+    boost::json::error_code ec;
+    std::size_t consumed = parser_.write_some(more, chunk.data(), chunk.size(), ec);
+    if (ec) {
+        const auto& error = parser_.handler().error;
+        throw std::invalid_argument(error.empty() ? ec.message() : error);
+    }
+    for (std::size_t i = consumed; i < chunk.size(); ++i) {
+        if (!IsJsonSpace(chunk[i])) {
+            throw std::invalid_argument("Unexpected data after the document");
+        }
+    }
+}
+
+bool PostRequestParser::done() const {
+    return parser_.done();
+}
+
+PostRequest PostRequestParser::release() {
+    if (!parser_.done()) {
+        throw std::invalid_argument("Incomplete document");
+    }
+    PostRequest request = std::move(parser_.handler().request);
+    parser_.handler() = PostRequestHandler(memory_);
+    parser_.reset();
+    return request;
+}
+
+std::size_t PostRequestParser::completed() const {
+    const auto& handler = parser_.handler();
+    return handler.request.metrics.size() - (handler.in_metric() ? 1 : 0);
+}
+
+PostRequest PostRequestParser::release_completed() {
+    auto& metrics = parser_.handler().request.metrics;
+    PostRequest batch(memory_);
+    if (!parser_.handler().in_metric()) {
+        batch.metrics = std::move(metrics);
+        metrics.clear();
+        return batch;
+    }
+    Metric current = std::move(metrics.back());
+    metrics.pop_back();
+    batch.metrics = std::move(metrics);
+    metrics.clear();
+    metrics.push_back(std::move(current));
+    return batch;
+}
+
+PostRequest ParsePostRequest(std::string_view body, std::pmr::memory_resource* memory) {
+    PostRequestParser parser(memory);
+    parser.write(body, false);
+    return parser.release();
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <lib/service/service.h>
+
+#include <boost/json/basic_parser.hpp>
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Builds a PostRequest straight from SAX events of boost::json::basic_parser,
+// without an intermediate DOM. Strings are appended into their final
+// string in place, numbers are stored as they are parsed. Everything the
+// request owns is allocated from the memory resource given on construction.
+//
+// The accepted document is strictly
+//   {"metrics": [{"project_id": str, "metric_type": str, "tags": [str...],
+//                 "values": [{"value": num, "timestamp": int}...]}...]}
+// except that the values of a HISTOGRAM metric carry the sample counts per
+// upper bound instead of a value, {"buckets": {"0.5": int, "+Inf": int},
+// "timestamp": int}; such a metric is handed out as one metric per bound,
+// see HistogramBoundTag. Unknown keys, wrong types and missing fields are
+// errors.
+class PostRequestHandler {
+public:
+    static constexpr std::size_t max_object_size = std::size_t(-1);
+    static constexpr std::size_t max_array_size = std::size_t(-1);
+    static constexpr std::size_t max_key_size = 64;
+    static constexpr std::size_t max_string_size = std::size_t(-1);
+
+    explicit PostRequestHandler(std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+    PostRequest request;
+    // Set together with the error code when the document violates the schema.
+    std::string error;
+
+    // Whether the last metric of request is still being parsed.
+    bool in_metric() const;
+
+    bool on_document_begin(boost::json::error_code& ec);
+    bool on_document_end(boost::json::error_code& ec);
+    bool on_object_begin(boost::json::error_code& ec);
+    bool on_object_end(std::size_t n, boost::json::error_code& ec);
+    bool on_array_begin(boost::json::error_code& ec);
+    bool on_array_end(std::size_t n, boost::json::error_code& ec);
+    bool on_key_part(boost::json::string_view s, std::size_t n, boost::json::error_code& ec);
+    bool on_key(boost::json::string_view s, std::size_t n, boost::json::error_code& ec);
+    bool on_string_part(boost::json::string_view s, std::size_t n, boost::json::error_code& ec);
+    bool on_string(boost::json::string_view s, std::size_t n, boost::json::error_code& ec);
+    bool on_number_part(boost::json::string_view s, boost::json::error_code& ec);
+    bool on_int64(int64_t i, boost::json::string_view s, boost::json::error_code& ec);
+    bool on_uint64(uint64_t u, boost::json::string_view s, boost::json::error_code& ec);
+    bool on_double(double d, boost::json::string_view s, boost::json::error_code& ec);
+    bool on_bool(bool b, boost::json::error_code& ec);
+    bool on_null(boost::json::error_code& ec);
+    bool on_comment_part(boost::json::string_view s, boost::json::error_code& ec);
+    bool on_comment(boost::json::string_view s, boost::json::error_code& ec);
+
+private:
+    enum EState {
+        DOCUMENT,
+        ROOT,
+        METRICS,
+        METRIC,
+        TAGS,
+        VALUES,
+        VALUE,
+        BUCKETS,
+        FINISHED,
+    };
+
+    enum EField {
+        NONE,
+        FIELD_METRICS,
+        FIELD_PROJECT_ID,
+        FIELD_METRIC_TYPE,
+        FIELD_TAGS,
+        FIELD_VALUES,
+        FIELD_VALUE,
+        FIELD_TIMESTAMP,
+        FIELD_BUCKETS,
+        FIELD_BUCKET_COUNT,
+    };
+
+    // A bucket count of the current metric, values[value] is its sample.
+    struct BucketCount {
+        double bound;
+        double count;
+        std::size_t value;
+    };
+
+    bool Fail(boost::json::error_code& ec, const char* message);
+    bool ResolveKey(std::string_view key, boost::json::error_code& ec);
+    bool OnNumber(double value, bool integral, int64_t integer, boost::json::error_code& ec);
+    std::pmr::string* StringTarget();
+    bool Mark(EField field, boost::json::error_code& ec);
+    // Replaces the current metric with one metric per bucket bound.
+    bool ExpandHistogram(boost::json::error_code& ec);
+
+    EState state_ = DOCUMENT;
+    EField field_ = NONE;
+    // Fields seen in the current root, metric and value objects.
+    unsigned root_seen_ = 0;
+    unsigned metric_seen_ = 0;
+    unsigned value_seen_ = 0;
+    std::pmr::string key_;
+    std::pmr::string metric_type_;
+    // Whether the values of the current metric had 'value', 'buckets'.
+    bool metric_has_values_ = false;
+    bool metric_has_buckets_ = false;
+    double bound_ = 0.0;
+    std::pmr::vector<BucketCount> buckets_;
+};
+
+// Incremental front-end over basic_parser: the body can be fed in chunks
+// as it arrives from the socket.
+class PostRequestParser {
+public:
+    explicit PostRequestParser(std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+    // Throws std::invalid_argument on malformed input.
+    void write(std::string_view chunk, bool more);
+    bool done() const;
+    PostRequest release();
+
+    // Metrics parsed completely so far. release_completed() hands them out
+    // before the document ends, so a long body can be stored in batches.
+    std::size_t completed() const;
+    PostRequest release_completed();
+
+private:
+    std::pmr::memory_resource* memory_;
+    boost::json::basic_parser<PostRequestHandler> parser_;
+};
+
+PostRequest ParsePostRequest(std::string_view body, std::pmr::memory_resource* memory = std::pmr::get_default_resource());
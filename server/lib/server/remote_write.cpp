@@ -0,0 +1,178 @@
+#include "remote_write.h"
+
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+    // Bounds-checked cursor over a protobuf message.
+    class ProtoReader {
+    public:
+        explicit ProtoReader(std::string_view data)
+            : data_(data)
+        {
+        }
+
+        bool empty() const {
+            return data_.empty();
+        }
+
+        uint64_t varint() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (data_.empty()) {
+                    throw std::invalid_argument("Truncated message");
+                }
+                auto next = static_cast<uint8_t>(data_.front());
+                data_.remove_prefix(1);
+                value |= static_cast<uint64_t>(next & 0x7F) << shift;
+                if (!(next & 0x80)) {
+                    return value;
+                }
+            }
+            throw std::invalid_argument("Malformed varint");
+        }
+
+        // Field number and wire type of the next field.
+        std::pair<uint64_t, uint8_t> key() {
+            auto key = varint();
+            return {key >> 3, static_cast<uint8_t>(key & 7)};
+        }
+
+        std::string_view bytes(std::size_t size) {
+            if (size > data_.size()) {
+                throw std::invalid_argument("Truncated message");
+            }
+            auto value = data_.substr(0, size);
+            data_.remove_prefix(size);
+            return value;
+        }
+
+        std::string_view message() {
+            return bytes(varint());
+        }
+
+        uint64_t fixed64() {
+            uint64_t value;
+            std::memcpy(&value, bytes(sizeof(value)).data(), sizeof(value));
+            return value;
+        }
+
+        void skip(uint8_t type) {
+            switch (type) {
+                case WIRE_VARINT:
+                    varint();
+                    return;
+                case WIRE_FIXED64:
+                    bytes(8);
+                    return;
+                case WIRE_LENGTH_DELIMITED:
+                    message();
+                    return;
+                case WIRE_FIXED32:
+                    bytes(4);
+                    return;
+                default:
+                    throw std::invalid_argument("Unsupported wire type");
+            }
+        }
+
+    private:
+        std::string_view data_;
+    };
+
+    void DecodeLabel(std::string_view label, Tags& tags) {
+        std::string_view name;
+        std::string_view value;
+        ProtoReader reader(label);
+        while (!reader.empty()) {
+            auto [field, type] = reader.key();
+            if (field == kLabelName && type == WIRE_LENGTH_DELIMITED) {
+                name = reader.message();
+            } else if (field == kLabelValue && type == WIRE_LENGTH_DELIMITED) {
+                value = reader.message();
+            } else {
+                reader.skip(type);
+            }
+        }
+        if (name.empty()) {
+            throw std::invalid_argument("Label without a name");
+        }
+        // '|' separates the tags of a series in the tags column.
+        if (name.find('|') != std::string_view::npos || value.find('|') != std::string_view::npos) {
+            throw std::invalid_argument("Label containing '|'");
+        }
+
+        // The name goes first, so that a series has the same tags whatever
+        // the order of its labels.
+        bool is_name = name == kMetricNameLabel;
+        auto& tag = is_name ? *tags.emplace(tags.begin()) : tags.emplace_back();
+        if (is_name) {
+            name = "metric";
+        }
+        tag.reserve(name.size() + 1 + value.size());
+        tag.append(name).append(1, '=').append(value);
+    }
+
+    // False for a stale marker.
+    bool DecodeSample(std::string_view sample, MetricValue& value) {
+        uint64_t bits = 0;
+        int64_t timestamp = 0;
+        ProtoReader reader(sample);
+        while (!reader.empty()) {
+            auto [field, type] = reader.key();
+            if (field == kSampleValue && type == WIRE_FIXED64) {
+                bits = reader.fixed64();
+            } else if (field == kSampleTimestamp && type == WIRE_VARINT) {
+                timestamp = static_cast<int64_t>(reader.varint());
+            } else {
+                reader.skip(type);
+            }
+        }
+        value.value = std::bit_cast<double>(bits);
+        value.timestamp = timestamp;
+        return bits != kStaleMarkerBits;
+    }
+
+    void DecodeTimeSeries(std::string_view series, std::string_view project_id, PostRequest& request) {
+        auto& metric = request.metrics.emplace_back();
+        metric.identifiers.project_id = project_id;
+        metric.identifiers.metric_type = EMetricType::DOT;
+        ProtoReader reader(series);
+        while (!reader.empty()) {
+            auto [field, type] = reader.key();
+            if (field == kTimeSeriesLabels && type == WIRE_LENGTH_DELIMITED) {
+                DecodeLabel(reader.message(), metric.identifiers.tags);
+            } else if (field == kTimeSeriesSamples && type == WIRE_LENGTH_DELIMITED) {
+                MetricValue value;
+                if (DecodeSample(reader.message(), value)) {
+                    metric.values.push_back(value);
+                }
+            } else {
+                reader.skip(type);
+            }
+        }
+        if (metric.values.empty()) {
+            request.metrics.pop_back();
+        }
+    }
+
+} // anonymous namespace
+
+PostRequest DecodeWriteRequest(std::string_view message, std::string_view project_id, std::pmr::memory_resource* memory) {
+    if (project_id.empty()) {
+        throw std::invalid_argument("Empty project id");
+    }
+    PostRequest request(memory);
+    ProtoReader reader(message);
+    while (!reader.empty()) {
+        auto [field, type] = reader.key();
+        if (field == kWriteRequestTimeseries && type == WIRE_LENGTH_DELIMITED) {
+            DecodeTimeSeries(reader.message(), project_id, request);
+        } else {
+            reader.skip(type);
+        }
+    }
+    return request;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <lib/codec/remote_write_format.h>
+#include <lib/service/service.h>
+
+#include <memory_resource>
+#include <string_view>
+
+// Decodes an uncompressed remote write WriteRequest into metrics of
+// project_id, one per TimeSeries. The metric name becomes the tag
+// metric=<name> and every other label name=value, in the order they come.
+// Series are stored as DOT; stale markers are dropped, and so are series
+// left without samples. Reads straight from message: only the tags and
+// values end up copied. Throws std::invalid_argument on malformed input,
+// labels containing '|' included.
+PostRequest DecodeWriteRequest(std::string_view message, std::string_view project_id,
+                               std::pmr::memory_resource* memory = std::pmr::get_default_resource());
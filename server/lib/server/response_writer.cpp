@@ -0,0 +1,92 @@
+#include "response_writer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+    constexpr std::string_view kValueKey = "{\"value\":";
+    constexpr std::string_view kTimestampKey = ",\"timestamp\":";
+    constexpr std::string_view kNull = "null";
+
+    // "-2.2250738585072014e-308"
+    constexpr std::size_t kMaxShortestDoubleSize = 24;
+    // "-9223372036854775808"
+    constexpr std::size_t kMaxInt64Size = 20;
+
+    char* Append(char* out, std::string_view str) {
+        std::memcpy(out, str.data(), str.size());
+        return out + str.size();
+    }
+
+    // Upper bound of a double printed in the given format over all values.
+    std::size_t MaxDoubleSize(std::span<const MetricValue> values, const NumberFormat& format) {
+        if (!format.precision) {
+            return kMaxShortestDoubleSize;
+        }
+        double max_magnitude = 0.0;
+        for (const auto& value : values) {
+            if (std::isfinite(value.value)) {
+                max_magnitude = std::max(max_magnitude, std::abs(value.value));
+            }
+        }
+        // One spare digit covers rounding in log10 and in the last place.
+        std::size_t integer_digits = max_magnitude < 1.0 ? 1 : static_cast<std::size_t>(std::log10(max_magnitude)) + 2;
+        return std::max(kNull.size(), 1 + integer_digits + 1 + static_cast<std::size_t>(*format.precision));
+    }
+
+    char* WriteDouble(char* first, char* last, double value, const NumberFormat& format) {
+        if (!std::isfinite(value)) {
+            return Append(first, kNull);
+        }
+        auto result = format.precision
+            ? std::to_chars(first, last, value, std::chars_format::fixed, *format.precision)
+            : std::to_chars(first, last, value);
+        return result.ptr;
+    }
+
+    // Writes the points into out with extra bytes reserved around them.
+    void WritePoints(std::span<const MetricValue> values, std::string& out, const NumberFormat& format,
+                     std::string_view prefix, std::string_view suffix) {
+        if (format.precision && (*format.precision < 0 || *format.precision > NumberFormat::kMaxPrecision)) {
+            throw std::invalid_argument("'precision' must be between 0 and 17");
+        }
+
+        std::size_t point_size = 1 + kValueKey.size() + MaxDoubleSize(values, format)
+            + kTimestampKey.size() + kMaxInt64Size + 1;
+        std::size_t offset = out.size();
+        std::size_t bound = prefix.size() + values.size() * point_size + suffix.size();
+
+        out.resize_and_overwrite(offset + bound, [&](char* data, std::size_t size) {
+            char* it = Append(data + offset, prefix);
+            char* end = data + size;
+            bool first = true;
+            for (const auto& value : values) {
+                if (!first) {
+                    *it++ = ',';
+                }
+                first = false;
+                it = Append(it, kValueKey);
+                it = WriteDouble(it, end, value.value, format);
+                it = Append(it, kTimestampKey);
+                it = std::to_chars(it, end, value.timestamp).ptr;
+                *it++ = '}';
+            }
+            it = Append(it, suffix);
+            return static_cast<std::size_t>(it - data);
+        });
+    }
+
+} // anonymous namespace
+
+void WriteGetResponse(const GetResponse& response, std::string& out, const NumberFormat& format) {
+    WritePoints(response.values, out, format, kGetResponseHead, kGetResponseTail);
+}
+
+void WriteMetricValues(std::span<const MetricValue> values, std::string& out, const NumberFormat& format) {
+    WritePoints(values, out, format, {}, {});
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <lib/service/service.h>
+
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+// How doubles are printed in responses.
+struct NumberFormat {
+    static constexpr int kMaxPrecision = 17;
+
+    // Digits after the decimal point. Empty means the shortest form that
+    // parses back to the same double.
+    std::optional<int> precision;
+};
+
+// Appends {"metrics":[{"value":...,"timestamp":...},...]} to out.
+//
+// The output is formatted with std::to_chars straight into out: its size is
+// bounded up front, so the whole response costs at most one allocation and
+// no intermediate DOM. Non-finite values are written as null.
+// Throws std::invalid_argument when the precision is out of range.
+void WriteGetResponse(const GetResponse& response, std::string& out, const NumberFormat& format = {});
+
+// Pieces of the same document for responses that are sent in chunks:
+// the head, comma separated point objects and the tail.
+inline constexpr std::string_view kGetResponseHead = "{\"metrics\":[";
+inline constexpr std::string_view kGetResponseTail = "]}";
+void WriteMetricValues(std::span<const MetricValue> values, std::string& out, const NumberFormat& format = {});
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <boost/beast/http/status.hpp>
+#include <boost/beast/http/verb.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+inline constexpr std::size_t kMaxRouteParams = 4;
+
+// Path parameters of a matched route, views into the request target.
+class RouteParams {
+public:
+    std::string_view get(std::string_view name) const {
+        for (std::size_t i = 0; i < size_; ++i) {
+            if (params_[i].first == name) {
+                return params_[i].second;
+            }
+        }
+        return {};
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool push(std::string_view name, std::string_view value) {
+        if (size_ == params_.size()) {
+            return false;
+        }
+        params_[size_++] = {name, value};
+        return true;
+    }
+
+    void clear() {
+        size_ = 0;
+    }
+
+private:
+    std::array<std::pair<std::string_view, std::string_view>, kMaxRouteParams> params_;
+    std::size_t size_ = 0;
+};
+
+template <class Handler>
+struct RouteMatch {
+    const Handler* handler = nullptr;
+    // Pattern of the matched path, empty when nothing matched.
+    std::string_view pattern;
+    // ok, not_found or method_not_allowed
+    boost::beast::http::status status = boost::beast::http::status::not_found;
+    RouteParams params;
+};
+
+// Route table that is filled once at startup and then only read.
+//
+// Paths without parameters are resolved through a perfect hash: build()
+// searches for a seed under which every static path lands in its own slot,
+// so a lookup is one hash of the target and one comparison. Paths with
+// "{name}" segments are matched segment by segment afterwards. match()
+// works on views into the target and never allocates.
+template <class Handler>
+class Router {
+public:
+    void add(std::string_view pattern, boost::beast::http::verb method, Handler handler) {
+        if (built_) {
+            throw std::logic_error("Router is already built");
+        }
+        auto& path = find_or_add_path(pattern);
+        path.methods.emplace_back(method, std::move(handler));
+    }
+
+    void build() {
+        std::vector<std::size_t> static_paths;
+        for (std::size_t i = 0; i < paths_.size(); ++i) {
+            if (!paths_[i].dynamic) {
+                static_paths.push_back(i);
+            }
+        }
+
+        std::size_t table_size = std::bit_ceil(std::max<std::size_t>(1, static_paths.size() * 2));
+        while (true) {
+            for (uint64_t seed = 1; seed < kMaxSeedAttempts; ++seed) {
+                if (try_seed(seed, table_size, static_paths)) {
+                    built_ = true;
+                    return;
+                }
+            }
+            table_size *= 2;
+        }
+    }
+
+    RouteMatch<Handler> match(std::string_view target, boost::beast::http::verb method) const {
+        RouteMatch<Handler> result;
+        if (auto query = target.find('?'); query != std::string_view::npos) {
+            target = target.substr(0, query);
+        }
+
+        if (!slots_.empty()) {
+            auto slot = slots_[hash(target, seed_) & (slots_.size() - 1)];
+            if (slot != kEmptySlot && paths_[slot].pattern == target) {
+                select_method(paths_[slot], method, result);
+                return result;
+            }
+        }
+
+        for (const auto& path : paths_) {
+            if (path.dynamic && match_segments(path, target, result.params)) {
+                select_method(path, method, result);
+                if (result.handler) {
+                    return result;
+                }
+            }
+            result.params.clear();
+        }
+        return result;
+    }
+
+private:
+    static constexpr uint32_t kEmptySlot = UINT32_MAX;
+    static constexpr uint64_t kMaxSeedAttempts = 1 << 16;
+
+    struct Path {
+        std::string pattern;
+        bool dynamic = false;
+        std::vector<std::pair<boost::beast::http::verb, Handler>> methods;
+    };
+
+    static uint64_t hash(std::string_view str, uint64_t seed) {
+        // FNV-1a mixed with the seed.
+        uint64_t h = 14695981039346656037ull ^ (seed * 0x9E3779B97F4A7C15ull);
+        for (unsigned char c : str) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        return h ^ (h >> 29);
+    }
+
+    static std::string_view next_segment(std::string_view& path) {
+        if (!path.empty() && path.front() == '/') {
+            path.remove_prefix(1);
+        }
+        auto end = path.find('/');
+        auto segment = path.substr(0, end);
+        path.remove_prefix(end == std::string_view::npos ? path.size() : end);
+        return segment;
+    }
+
+    static bool match_segments(const Path& path, std::string_view target, RouteParams& params) {
+        std::string_view pattern = path.pattern;
+        while (!pattern.empty() || !target.empty()) {
+            if (pattern.empty() || target.empty()) {
+                return false;
+            }
+            auto expected = next_segment(pattern);
+            auto actual = next_segment(target);
+            if (expected.size() > 2 && expected.front() == '{' && expected.back() == '}') {
+                if (actual.empty() || !params.push(expected.substr(1, expected.size() - 2), actual)) {
+                    return false;
+                }
+            } else if (expected != actual) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void select_method(const Path& path, boost::beast::http::verb method, RouteMatch<Handler>& result) {
+        result.pattern = path.pattern;
+        for (const auto& [verb, handler] : path.methods) {
+            if (verb == method) {
+                result.handler = &handler;
+                result.status = boost::beast::http::status::ok;
+                return;
+            }
+        }
+        result.status = boost::beast::http::status::method_not_allowed;
+    }
+
+    Path& find_or_add_path(std::string_view pattern) {
+        for (auto& path : paths_) {
+            if (path.pattern == pattern) {
+                return path;
+            }
+        }
+        auto& path = paths_.emplace_back();
+        path.pattern = pattern;
+        path.dynamic = pattern.find('{') != std::string_view::npos;
+        return path;
+    }
+
+    bool try_seed(uint64_t seed, std::size_t table_size, const std::vector<std::size_t>& static_paths) {
+        std::vector<uint32_t> slots(table_size, kEmptySlot);
+        for (auto index : static_paths) {
+            auto& slot = slots[hash(paths_[index].pattern, seed) & (table_size - 1)];
+            if (slot != kEmptySlot) {
+                return false;
+            }
+            slot = static_cast<uint32_t>(index);
+        }
+        seed_ = seed;
+        slots_ = std::move(slots);
+        return true;
+    }
+
+    std::vector<Path> paths_;
+    std::vector<uint32_t> slots_;
+    uint64_t seed_ = 0;
+    bool built_ = false;
+};
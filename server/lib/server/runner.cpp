@@ -0,0 +1,139 @@
+#include "runner.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+
+HttpServer::Shard::Shard(std::size_t io_threads, std::size_t worker_threads)
+    : workers(static_cast<int>(worker_threads))
+    , workers_guard(workers.get_executor())
+    , ioc(static_cast<int>(io_threads))
+{
+}
+
+HttpServer::HttpServer(ServerOptions options)
+    : options_(std::move(options))
+{
+    if (options_.writer_threads > 0) {
+        ingest_ = std::make_shared<IngestPipeline>(options_.writer_threads);
+    }
+
+    if (!options_.sharded) {
+        auto threads = std::max<std::size_t>(1, options_.threads);
+        auto& shard = *shards_.emplace_back(std::make_unique<Shard>(threads, threads));
+        shard.listener = std::make_shared<HttpListener>(
+            shard.ioc, options_.endpoint, shard.workers.get_executor(),
+            options_.body_limits, options_.admission, false, ingest_);
+    } else {
+        auto shards = options_.threads > 0 ? options_.threads : std::max(1u, std::thread::hardware_concurrency());
+        auto endpoint = options_.endpoint;
+        for (std::size_t i = 0; i < shards; ++i) {
+            auto& shard = *shards_.emplace_back(std::make_unique<Shard>(1, std::max<std::size_t>(1, options_.workers_per_shard)));
+            shard.listener = std::make_shared<HttpListener>(
+                shard.ioc, endpoint, shard.workers.get_executor(),
+                options_.body_limits, options_.admission, true, ingest_);
+            // Every shard must bind the port the first one got.
+            endpoint.port(shard.listener->port());
+        }
+    }
+
+    if (options_.tracing) {
+        Tracer::Instance().enable(true);
+    }
+
+    if (options_.statsd) {
+        auto& shard = *shards_.front();
+        statsd_ = std::make_shared<StatsdListener>(shard.ioc, *options_.statsd, shard.workers.get_executor());
+    }
+
+    auto& first = *shards_.front();
+    alert_sweeper_ = std::make_shared<AlertSweeper>(first.ioc, first.workers.get_executor());
+    bucket_keys_ = std::make_unique<BucketKeyMigrator>();
+}
+
+HttpServer::~HttpServer() {
+    stop();
+    join();
+}
+
+void HttpServer::start() {
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+        auto& shard = *shards_[i];
+        shard.listener->run();
+        if (i == 0) {
+            alert_sweeper_->run();
+            if (statsd_) {
+                statsd_->run();
+            }
+        }
+
+        std::size_t io_threads = options_.sharded ? 1 : std::max<std::size_t>(1, options_.threads);
+        std::size_t worker_threads = options_.sharded ? std::max<std::size_t>(1, options_.workers_per_shard) : io_threads;
+        auto run = [this, i, cores](net::io_context& context) {
+            return [this, i, cores, &context] {
+                if (options_.sharded) {
+                    PinThreadToCore(i % cores);
+                }
+                context.run();
+            };
+        };
+        for (std::size_t j = 0; j < io_threads; ++j) {
+            threads_.emplace_back(run(shard.ioc));
+        }
+        for (std::size_t j = 0; j < worker_threads; ++j) {
+            threads_.emplace_back(run(shard.workers));
+        }
+    }
+}
+
+unsigned short HttpServer::port() const {
+    return shards_.front()->listener->port();
+}
+
+unsigned short HttpServer::statsd_port() const {
+    return statsd_ ? statsd_->port() : 0;
+}
+
+void HttpServer::stop() {
+    alert_sweeper_->stop();
+    if (statsd_) {
+        statsd_->stop();
+    }
+    for (auto& shard : shards_) {
+        shard->listener->stop();
+        shard->ioc.stop();
+        shard->workers_guard.reset();
+        shard->workers.stop();
+    }
+}
+
+void HttpServer::join() {
+    for (auto& thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads_.clear();
+    if (statsd_) {
+        statsd_->drain();
+    }
+    if (ingest_) {
+        ingest_->stop();
+    }
+    bucket_keys_->stop();
+}
+
+void PinThreadToCore(std::size_t core) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+}
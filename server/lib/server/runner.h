@@ -0,0 +1,80 @@
+#pragma once
+
+#include <lib/server/server.h>
+#include <lib/service/bucket_keys.h>
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+struct ServerOptions {
+    tcp::endpoint endpoint;
+    // Shared mode: threads of the io_context and as many workers.
+    // Sharded mode: number of shards, one per core when 0.
+    std::size_t threads = 1;
+    // One io_context per core, each with its own SO_REUSEPORT acceptor and
+    // workers, all pinned to that core, so a request never leaves the core
+    // that accepted its connection.
+    bool sharded = false;
+    std::size_t workers_per_shard = 4;
+    // Threads that store /post and remote write batches, each through a
+    // database connection of its own, fed by the workers that parse them.
+    // Shared by all shards; 0 stores batches on the workers.
+    std::size_t writer_threads = 0;
+    BodyLimits body_limits;
+    // Applies to every shard on its own.
+    AdmissionLimits admission;
+    // UDP endpoint for StatsD lines. Served by the first shard only, so
+    // every series is aggregated in one place.
+    std::optional<udp::endpoint> statsd;
+    // Records the stages of every request for /traces/slowest.
+    bool tracing = false;
+};
+
+// Owns the io_contexts, listeners and threads of the server.
+class HttpServer {
+public:
+    explicit HttpServer(ServerOptions options);
+    ~HttpServer();
+
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    // Starts the threads and returns.
+    void start();
+    // Port the listeners are bound to, useful when the endpoint asked for 0.
+    unsigned short port() const;
+    // 0 without a StatsD listener.
+    unsigned short statsd_port() const;
+    void stop();
+    // Also stores what the StatsD listener and the ingest queues still hold,
+    // and interrupts a bucket key migration.
+    void join();
+
+private:
+    struct Shard {
+        // Runs the handlers; the guard keeps it running while idle.
+        net::io_context workers;
+        net::executor_work_guard<net::io_context::executor_type> workers_guard;
+        // Declared after workers so that sessions go first on destruction.
+        net::io_context ioc;
+        std::shared_ptr<HttpListener> listener;
+
+        Shard(std::size_t io_threads, std::size_t worker_threads);
+    };
+
+    ServerOptions options_;
+    // Declared before the shards, whose sessions hold it.
+    std::shared_ptr<IngestPipeline> ingest_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::shared_ptr<StatsdListener> statsd_;
+    std::shared_ptr<AlertSweeper> alert_sweeper_;
+    // Adds the bucket key to tables made before it, as they are used.
+    std::unique_ptr<BucketKeyMigrator> bucket_keys_;
+    std::vector<std::thread> threads_;
+};
+
+// Restricts the calling thread to one CPU core. No-op where unsupported.
+void PinThreadToCore(std::size_t core);
@@ -1,23 +1,61 @@
 #pragma once
 
-#include <boost/container_hash/hash.hpp>
+#include <lib/service/ingest.h>
 #include <lib/service/service.h>
+#include <lib/service/subscriptions.h>
+#include <lib/service/tracing.h>
+#include <lib/server/admission.h>
+#include <lib/server/compression.h>
+#include <lib/server/frame_decoder.h>
+#include <lib/server/post_parser.h>
+#include <lib/server/remote_write.h>
+#include <lib/server/response_writer.h>
+#include <lib/server/router.h>
+#include <lib/server/server_metrics.h>
+#include <lib/server/statsd.h>
 
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/beast/websocket.hpp>
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
 #include <boost/asio/dispatch.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/any_io_executor.hpp>
 #include <boost/asio/thread_pool.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/config.hpp>
 #include <boost/json.hpp>
 
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
 namespace beast = boost::beast;
 namespace http = beast::http;
+namespace websocket = beast::websocket;
 namespace net = boost::asio;
 using tcp = boost::asio::ip::tcp;
+using udp = boost::asio::ip::udp;
 
 namespace {
 
@@ -28,159 +66,1065 @@ namespace {
         };
     }
 
-    inline PostRequest ParsePostRequest(const std::string& body) {
-        auto json = boost::json::parse(body);
-        PostRequest request;
-        for (auto& entry : json.at("metrics").as_array()) {
-            auto metric_json = entry.as_object();
-            request.metrics.emplace_back();
-            auto& metric = request.metrics.back();
-            metric.identifiers.project_id = metric_json.at("project_id").as_string().c_str();
-            metric.identifiers.metric_type = FromString(metric_json.at("metric_type").as_string().c_str());
-            for (auto& tag : metric_json.at("tags").as_array()) {
-                metric.identifiers.tags.push_back(tag.as_string().c_str());
-            }
-            for (auto& value : metric_json.at("values").as_array()) {
-                metric.values.push_back(MetricValue{
-                    .value = value.at("value").as_double(),
-                    .timestamp = value.at("timestamp").as_int64()
-                });
-            }
+    inline GetRequest ParseGetRequest(const boost::json::value& json, std::pmr::memory_resource* memory = std::pmr::get_default_resource()) {
+        GetRequest request(memory);
+        request.identifiers.project_id = json.at("project_id").as_string().c_str();
+        request.identifiers.metric_type = FromString(json.at("metric_type").as_string().c_str());
+        for (auto& tag : json.at("tags").as_array()) {
+            request.identifiers.tags.emplace_back(tag.as_string().c_str());
         }
+        request.interval_seconds = json.at("interval_seconds").as_int64();
+        ValidateIntervalSeconds(request.interval_seconds);
         return request;
     }
 
     inline GetRequest ParseGetRequest(const std::string& body) {
+        return ParseGetRequest(boost::json::parse(body));
+    }
+
+    inline bool IsGroupedGetRequest(const boost::json::value& json) {
+        return json.is_object() && json.as_object().contains("group_by");
+    }
+
+    inline GroupedGetRequest ParseGroupedGetRequest(const boost::json::value& json) {
+        GroupedGetRequest request;
+        request.project_id = json.at("project_id").as_string().c_str();
+        request.metric_type = FromString(json.at("metric_type").as_string().c_str());
+        for (auto& tag : json.at("tags").as_array()) {
+            request.tags.emplace_back(tag.as_string().c_str());
+        }
+        for (auto& key : json.at("group_by").as_array()) {
+            request.group_by.push_back(key.as_string().c_str());
+        }
+        request.aggregation = EAggregation::SUM;
+        if (auto* aggregation = json.as_object().if_contains("aggregation")) {
+            request.aggregation = AggregationFromString(aggregation->as_string().c_str());
+        }
+        request.interval_seconds = json.at("interval_seconds").as_int64();
+        ValidateIntervalSeconds(request.interval_seconds);
+        return request;
+    }
+
+    inline TopKRequest ParseTopKRequest(const std::string& body) {
         auto json = boost::json::parse(body);
-        GetRequest request;
-        request.identifiers.project_id = json.at("project_id").as_string().c_str();
-        request.identifiers.metric_type = FromString(json.at("metric_type").as_string().c_str());
+        TopKRequest request;
+        request.project_id = json.at("project_id").as_string().c_str();
+        request.metric_type = FromString(json.at("metric_type").as_string().c_str());
         for (auto& tag : json.at("tags").as_array()) {
-            request.identifiers.tags.push_back(tag.as_string().c_str());
+            request.tags.emplace_back(tag.as_string().c_str());
         }
+        request.aggregation = AggregationFromString(json.at("aggregation").as_string().c_str());
         request.interval_seconds = json.at("interval_seconds").as_int64();
+        ValidateIntervalSeconds(request.interval_seconds);
+        request.k = boost::json::value_to<std::size_t>(json.at("k"));
+        return request;
+    }
+
+    inline QueryRequest ParseQueryRequest(const std::string& body) {
+        auto json = boost::json::parse(body);
+        return QueryRequest{
+            .query = json.at("query").as_string().c_str(),
+            .interval_seconds = json.at("interval_seconds").as_int64()
+        };
+    }
+
+    inline AlertRule ParseAlertRule(const std::string& body) {
+        auto json = boost::json::parse(body);
+        AlertRule rule;
+        rule.id = json.at("id").as_string().c_str();
+        rule.project_id = json.at("project_id").as_string().c_str();
+        for (auto& tag : json.at("tags").as_array()) {
+            rule.tags.emplace_back(tag.as_string().c_str());
+        }
+        rule.condition = AlertConditionFromString(json.at("condition").as_string().c_str());
+        if (rule.condition == EAlertCondition::ABSENT) {
+            rule.absent_seconds = json.at("absent_seconds").as_int64();
+        } else {
+            rule.threshold = json.at("threshold").to_number<double>();
+        }
+        return rule;
+    }
+
+    struct SubscribeRequest {
+        std::string project_id;
+        Tags tags;
+        std::optional<EDropPolicy> drop_policy;
+    };
+
+    inline SubscribeRequest ParseSubscribeRequest(const std::string& body) {
+        auto json = boost::json::parse(body);
+        SubscribeRequest request;
+        request.project_id = json.at("project_id").as_string().c_str();
+        if (auto* tags = json.as_object().if_contains("tags")) {
+            for (auto& tag : tags->as_array()) {
+                request.tags.emplace_back(tag.as_string().c_str());
+            }
+        }
+        if (auto* policy = json.as_object().if_contains("drop_policy")) {
+            request.drop_policy = DropPolicyFromString(policy->as_string().c_str());
+        }
         return request;
     }
 
-    inline std::string GetResponseToJson(const GetResponse& response) {
+    inline boost::json::array TagsToJson(const Tags& tags) {
+        boost::json::array json;
+        for (auto& tag : tags) {
+            json.emplace_back(boost::json::string_view(tag.data(), tag.size()));
+        }
+        return json;
+    }
+
+    inline NumberFormat ParseNumberFormat(const boost::json::value& json) {
+        NumberFormat format;
+        if (auto* precision = json.as_object().if_contains("precision")) {
+            format.precision = boost::json::value_to<int>(*precision);
+        }
+        return format;
+    }
+
+    inline std::string GroupedGetResponseToJson(const GroupedGetResponse& response) {
         boost::json::object json;
-        json["metrics"] = boost::json::array();
-        boost::json::array& metrics = json["metrics"].as_array();
-        for (auto& value : response.values) {
-            metrics.push_back(boost::json::object{
-                {"value", value.value},
-                {"timestamp", value.timestamp}
+        json["groups"] = boost::json::array();
+        boost::json::array& groups = json["groups"].as_array();
+        for (auto& group : response.groups) {
+            boost::json::array metrics;
+            for (auto& value : group.values) {
+                metrics.push_back(boost::json::object{
+                    {"value", value.value},
+                    {"timestamp", value.timestamp}
+                });
+            }
+            groups.push_back(boost::json::object{
+                {"group", TagsToJson(group.group)},
+                {"metrics", std::move(metrics)}
             });
         }
         return boost::json::serialize(json);
     }
 
+    inline std::string TopKResponseToJson(const TopKResponse& response) {
+        boost::json::object json;
+        json["series"] = boost::json::array();
+        boost::json::array& series = json["series"].as_array();
+        for (auto& ranked : response.series) {
+            series.push_back(boost::json::object{
+                {"tags", TagsToJson(ranked.tags)},
+                {"value", ranked.value}
+            });
+        }
+        return boost::json::serialize(json);
+    }
+
+    inline std::string QueryResponseToJson(const QueryResponse& response) {
+        boost::json::object json;
+        json["series"] = boost::json::array();
+        boost::json::array& series = json["series"].as_array();
+        for (auto& item : response.series) {
+            boost::json::array metrics;
+            for (auto& value : item.values) {
+                metrics.push_back(boost::json::object{
+                    {"value", value.value},
+                    {"timestamp", value.timestamp}
+                });
+            }
+            series.push_back(boost::json::object{
+                {"tags", TagsToJson(item.tags)},
+                {"metrics", std::move(metrics)}
+            });
+        }
+        return boost::json::serialize(json);
+    }
+
+    inline std::string AlertRulesToJson(const std::vector<AlertRule>& rules) {
+        boost::json::object json;
+        json["rules"] = boost::json::array();
+        boost::json::array& items = json["rules"].as_array();
+        for (auto& rule : rules) {
+            boost::json::object item{
+                {"id", rule.id},
+                {"project_id", rule.project_id},
+                {"tags", TagsToJson(rule.tags)},
+                {"condition", ToString(rule.condition)}
+            };
+            if (rule.condition == EAlertCondition::ABSENT) {
+                item["absent_seconds"] = rule.absent_seconds;
+            } else {
+                item["threshold"] = rule.threshold;
+            }
+            items.push_back(std::move(item));
+        }
+        return boost::json::serialize(json);
+    }
+
+    inline std::string AlertEventsToJson(const std::vector<AlertEvent>& events) {
+        boost::json::object json;
+        json["events"] = boost::json::array();
+        boost::json::array& items = json["events"].as_array();
+        for (auto& event : events) {
+            items.push_back(boost::json::object{
+                {"rule_id", event.rule_id},
+                {"project_id", event.project_id},
+                {"tags", TagsToJson(event.tags)},
+                {"state", event.firing ? "firing" : "resolved"},
+                {"value", event.value},
+                {"timestamp", event.timestamp}
+            });
+        }
+        return boost::json::serialize(json);
+    }
+
+    inline std::string AdmissionStatsToJson(const AdmissionStats& stats) {
+        boost::json::object in_flight;
+        for (auto& [pattern, count] : stats.in_flight) {
+            in_flight[pattern] = count;
+        }
+        return boost::json::serialize(boost::json::object{
+            {"queue_depth", stats.queue_depth},
+            {"running", stats.running},
+            {"admitted", stats.admitted},
+            {"rejected", stats.rejected},
+            {"shed", stats.shed},
+            {"wait_time_sum_us", stats.wait_time_sum_us},
+            {"wait_time_max_us", stats.wait_time_max_us},
+            {"in_flight", std::move(in_flight)}
+        });
+    }
+
+    // Value of a query string parameter of target, undecoded.
+    inline std::optional<std::string_view> QueryParameter(std::string_view target, std::string_view name) {
+        auto query = target.find('?');
+        if (query == std::string_view::npos) {
+            return std::nullopt;
+        }
+        target.remove_prefix(query + 1);
+        while (!target.empty()) {
+            auto end = target.find('&');
+            auto parameter = target.substr(0, end);
+            target.remove_prefix(end == std::string_view::npos ? target.size() : end + 1);
+            auto equals = parameter.find('=');
+            if (parameter.substr(0, equals) == name) {
+                return equals == std::string_view::npos ? std::string_view() : parameter.substr(equals + 1);
+            }
+        }
+        return std::nullopt;
+    }
+
+    inline std::int64_t TraceStartMicroseconds(const TraceRecord& trace) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(trace.started_at.time_since_epoch()).count();
+    }
+
+    inline std::string TracesToJson(const std::vector<TraceRecord>& traces) {
+        boost::json::array result;
+        for (const auto& trace : traces) {
+            boost::json::object stages;
+            for (int stage = 0; stage < TRACE_STAGES; ++stage) {
+                stages[ToString(static_cast<ETraceStage>(stage))] = trace.totals[stage].count();
+            }
+            boost::json::array spans;
+            for (const auto& span : trace.spans) {
+                spans.push_back(boost::json::object{
+                    {"stage", ToString(span.stage)},
+                    {"begin_us", span.begin.count()},
+                    {"duration_us", span.duration.count()}
+                });
+            }
+            result.push_back(boost::json::object{
+                {"route", trace.route},
+                {"status", trace.status},
+                {"started_at_us", TraceStartMicroseconds(trace)},
+                {"duration_us", trace.duration.count()},
+                {"stages", std::move(stages)},
+                {"spans", std::move(spans)}
+            });
+        }
+        return boost::json::serialize(boost::json::object{{"traces", std::move(result)}});
+    }
+
+    // Trace Event Format, for chrome://tracing and Perfetto: every request
+    // is a thread of its own, with its stages nested in it.
+    inline std::string TracesToChromeTrace(const std::vector<TraceRecord>& traces) {
+        boost::json::array events;
+        for (std::size_t i = 0; i < traces.size(); ++i) {
+            const auto& trace = traces[i];
+            auto start = TraceStartMicroseconds(trace);
+            events.push_back(boost::json::object{
+                {"name", trace.route.empty() ? std::string_view("none") : std::string_view(trace.route)},
+                {"cat", "request"},
+                {"ph", "X"},
+                {"ts", start},
+                {"dur", trace.duration.count()},
+                {"pid", 1},
+                {"tid", i},
+                {"args", boost::json::object{{"status", trace.status}}}
+            });
+            for (const auto& span : trace.spans) {
+                events.push_back(boost::json::object{
+                    {"name", ToString(span.stage)},
+                    {"cat", "stage"},
+                    {"ph", "X"},
+                    {"ts", start + span.begin.count()},
+                    {"dur", span.duration.count()},
+                    {"pid", 1},
+                    {"tid", i}
+                });
+            }
+        }
+        return boost::json::serialize(boost::json::object{
+            {"traceEvents", std::move(events)},
+            {"displayTimeUnit", "ms"}
+        });
+    }
+
 } // anonymous namespace
 
+// Sends a response with chunked transfer encoding, for bodies that are
+// produced while they are sent. begin() and write() only encode the
+// response, compressing chunks with the encoding the client accepted, and
+// may run on a worker; flush() sends what they encoded and runs in the
+// coroutine of the session, so no thread waits for the client meanwhile.
+// Every write runs under kWriteTimeout and the whole response under
+// kResponseTimeout, so a client that reads a trickle cannot hold the
+// connection for good either.
+// flush() and finish() throw beast::system_error when the peer is gone or
+// too slow.
+class ChunkedResponseWriter {
+public:
+    static constexpr std::chrono::seconds kWriteTimeout{30};
+    static constexpr std::chrono::seconds kResponseTimeout{300};
+
+    ChunkedResponseWriter(beast::tcp_stream& stream, unsigned version, bool keep_alive, EContentEncoding encoding, RequestTrace& trace)
+        : stream_(stream)
+        , encoding_(encoding)
+        , trace_(trace)
+    {
+        header_.version(version);
+        header_.keep_alive(keep_alive);
+    }
+
+    ChunkedResponseWriter(const ChunkedResponseWriter&) = delete;
+    ChunkedResponseWriter& operator=(const ChunkedResponseWriter&) = delete;
+
+    bool started() const {
+        return started_;
+    }
+
+    bool finished() const {
+        return finished_;
+    }
+
+    unsigned status() const {
+        return header_.result_int();
+    }
+
+    // Body bytes sent so far, after compression.
+    std::uint64_t bytes_written() const {
+        return bytes_written_;
+    }
+
+    void begin(http::status status, std::string_view content_type) {
+        started_ = true;
+        deadline_ = std::chrono::steady_clock::now() + kResponseTimeout;
+        header_.result(status);
+        header_.set(http::field::content_type, beast::string_view(content_type.data(), content_type.size()));
+        header_.chunked(true);
+        if (encoding_ != EContentEncoding::IDENTITY) {
+            compressor_.emplace(encoding_);
+            header_.set(http::field::content_encoding, ToString(encoding_));
+            header_.set(http::field::vary, "Accept-Encoding");
+        }
+    }
+
+    // Adds data to the chunk the next flush() sends.
+    void write(std::string_view data) {
+        if (compressor_) {
+            compressor_->write(data, pending_);
+        } else {
+            pending_ += data;
+        }
+    }
+
+    net::awaitable<void> flush() {
+        auto started = trace_.now();
+        beast::error_code ec;
+        if (!serializer_) {
+            serializer_.emplace(header_);
+            arm();
+            co_await http::async_write_header(stream_, *serializer_, net::redirect_error(net::use_awaitable, ec));
+            check(ec);
+        }
+        // An empty chunk would end the body.
+        if (!pending_.empty()) {
+            arm();
+            co_await net::async_write(stream_, http::make_chunk(net::buffer(pending_)), net::redirect_error(net::use_awaitable, ec));
+            check(ec);
+            bytes_written_ += pending_.size();
+            pending_.clear();
+        }
+        trace_.add(TRACE_WRITE, started, trace_.now());
+    }
+
+    // Returns once the whole body is sent.
+    net::awaitable<void> finish() {
+        if (compressor_) {
+            compressor_->finish(pending_);
+        }
+        co_await flush();
+        auto started = trace_.now();
+        beast::error_code ec;
+        arm();
+        co_await net::async_write(stream_, http::make_chunk_last(), net::redirect_error(net::use_awaitable, ec));
+        check(ec);
+        trace_.add(TRACE_WRITE, started, trace_.now());
+        finished_ = true;
+    }
+
+private:
+    void arm() {
+        auto left = deadline_ - std::chrono::steady_clock::now();
+        if (left <= left.zero()) {
+            throw beast::system_error(beast::error::timeout);
+        }
+        stream_.expires_after(std::min<std::chrono::steady_clock::duration>(left, kWriteTimeout));
+    }
+
+    static void check(beast::error_code ec) {
+        if (ec) {
+            throw beast::system_error(ec);
+        }
+    }
+
+    beast::tcp_stream& stream_;
+    EContentEncoding encoding_;
+    RequestTrace& trace_;
+    std::optional<Compressor> compressor_;
+    // Encoded since the last flush().
+    std::string pending_;
+    http::response<http::empty_body> header_;
+    std::optional<http::response_serializer<http::empty_body>> serializer_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::uint64_t bytes_written_ = 0;
+    bool started_ = false;
+    bool finished_ = false;
+};
+
+// Reads a request body piece by piece as it arrives, for handlers that
+// consume it incrementally instead of waiting for all of it. Reads are
+// asynchronous and run in the coroutine of the session, each under
+// kReadTimeout, so a client that stops sending its body is dropped like one
+// that stops sending its header, and no thread waits for it meanwhile.
+// Throws beast::system_error, http::error::body_limit included.
+class RequestBodyReader {
+public:
+    static constexpr std::size_t kPieceSize = 64 * 1024;
+    static constexpr std::chrono::seconds kReadTimeout{30};
+
+    RequestBodyReader(beast::tcp_stream& stream, beast::flat_buffer& buffer,
+                      http::request_parser<http::empty_body>&& header, std::uint64_t body_limit, RequestTrace& trace)
+        : stream_(stream)
+        , buffer_(buffer)
+        , parser_(std::move(header))
+        , piece_(new char[kPieceSize])
+        , body_limit_(body_limit)
+        , trace_(trace)
+    {
+        parser_.body_limit(body_limit);
+    }
+
+    const http::request<http::buffer_body>& header() const {
+        return parser_.get();
+    }
+
+    std::uint64_t body_limit() const {
+        return body_limit_;
+    }
+
+    bool done() const {
+        return parser_.is_done();
+    }
+
+    std::uint64_t bytes_read() const {
+        return bytes_read_;
+    }
+
+    // Next piece of the body, empty once the body is complete. The piece
+    // stays valid until the next read.
+    net::awaitable<std::string_view> read() {
+        auto started = trace_.now();
+        while (!parser_.is_done()) {
+            auto& body = parser_.get().body();
+            body.data = piece_.get();
+            body.size = kPieceSize;
+            stream_.expires_after(kReadTimeout);
+            beast::error_code ec;
+            co_await http::async_read_some(stream_, buffer_, parser_, net::redirect_error(net::use_awaitable, ec));
+            if (ec == http::error::need_buffer) {
+                ec = {};
+            }
+            if (ec) {
+                throw beast::system_error(ec);
+            }
+            std::size_t size = kPieceSize - parser_.get().body().size;
+            if (size > 0) {
+                bytes_read_ += size;
+                trace_.add(TRACE_READ, started, trace_.now());
+                co_return std::string_view(piece_.get(), size);
+            }
+        }
+        trace_.add(TRACE_READ, started, trace_.now());
+        co_return std::string_view();
+    }
+
+private:
+    beast::tcp_stream& stream_;
+    beast::flat_buffer& buffer_;
+    http::request_parser<http::buffer_body> parser_;
+    std::unique_ptr<char[]> piece_;
+    std::uint64_t body_limit_;
+    RequestTrace& trace_;
+    std::uint64_t bytes_read_ = 0;
+};
+
+// Largest request body accepted by route pattern, in bytes. A body over
+// the limit is refused with 413 as soon as its Content-Length or the bytes
+// read so far show it.
+struct BodyLimits {
+    std::uint64_t default_limit = std::uint64_t(1) << 20;
+    std::map<std::string, std::uint64_t, std::less<>> routes = {
+        {"/post", std::uint64_t(1) << 30},
+        {"/api/v1/write/{project}", std::uint64_t(16) << 20},
+    };
+
+    std::uint64_t get(std::string_view pattern) const {
+        auto it = routes.find(pattern);
+        return it == routes.end() ? default_limit : it->second;
+    }
+};
+
+// Everything a route handler gets besides the request and the response.
+struct RequestContext {
+    const RouteParams& params;
+    // Arena of the current request, released once the response is written.
+    std::pmr::memory_resource* memory;
+    // Takes over the response once begin() is called. Its flush() and
+    // finish() run in the session, so only streaming handlers may use it.
+    ChunkedResponseWriter& chunked;
+    const AdmissionController& admission;
+    // Writer threads for /post batches, nullptr to store them on the worker.
+    IngestPipeline* ingest;
+    // Where streaming handlers, which run in the session, send their work.
+    net::any_io_executor workers;
+    RequestTrace& trace;
+};
+
+// Runs function on the workers for the trace of the request and resumes
+// the calling coroutine afterwards, rethrowing what function threw.
+template <class Function>
+net::awaitable<void> OnWorkers(const RequestContext& context, Function function) {
+    co_await net::co_spawn(
+        context.workers,
+        [&]() -> net::awaitable<void> {
+            TraceScope scope(&context.trace);
+            function();
+            co_return;
+        },
+        net::use_awaitable
+    );
+}
+
+// Stores the batches of one request, either on the workers through their
+// connection or on the writer threads of an IngestPipeline. Lives in the
+// session: up to kMaxBatchesInFlight batches wait in the queue while the
+// next ones are parsed, all of them on the same writer so that they are
+// stored in order, and the session waits for them on a timer the writer
+// threads cancel, without holding a thread. The batches are handed to the
+// writer as they are, so they stay here until they are stored and must not
+// be freed by anything but the session.
+class PostBatchWriter {
+public:
+    static constexpr std::size_t kMaxBatchesInFlight = 4;
+
+    PostBatchWriter(const RequestContext& context, net::any_io_executor session)
+        : context_(context)
+        , session_(std::move(session))
+        , shard_(context.ingest ? context.ingest->shard() : 0)
+        , wake_(std::make_shared<net::steady_timer>(session_, net::steady_timer::time_point::max()))
+    {
+    }
+
+    PostBatchWriter(const PostBatchWriter&) = delete;
+    PostBatchWriter& operator=(const PostBatchWriter&) = delete;
+
+    // Throws the error of the first batch that was not stored, once the
+    // rest are.
+    net::awaitable<void> write(PostRequest request) {
+        if (!context_.ingest) {
+            // Calls may go to different workers, so the service, which is
+            // bound to its thread, is not kept between them.
+            co_await OnWorkers(context_, [&] {
+                MonitoringService service;
+                service.DoPost(request);
+            });
+            co_return;
+        }
+        auto& batch = pending_.emplace_back(std::move(request), std::make_shared<Completion>());
+        context_.ingest->push(shard_, batch.request, [session = session_, wake = wake_, completion = batch.completion](std::exception_ptr error) {
+            net::post(session, [wake, completion, error] {
+                completion->error = error;
+                completion->done = true;
+                wake->cancel();
+            });
+        });
+        if (pending_.size() > kMaxBatchesInFlight) {
+            co_await wait_oldest();
+        }
+    }
+
+    // Waits until every batch is stored, throws the error of the first
+    // that was not.
+    net::awaitable<void> finish() {
+        while (!pending_.empty()) {
+            co_await wait_oldest();
+        }
+    }
+
+    // Waits until the writer is done with every batch, whatever came of
+    // them. For requests that already failed.
+    net::awaitable<void> abandon() {
+        while (!pending_.empty()) {
+            co_await wait(pending_.front());
+            pending_.pop_front();
+        }
+    }
+
+private:
+    // Set in the session, as are the batches.
+    struct Completion {
+        std::exception_ptr error;
+        bool done = false;
+    };
+
+    struct Pending {
+        PostRequest request;
+        std::shared_ptr<Completion> completion;
+    };
+
+    net::awaitable<void> wait(const Pending& batch) {
+        while (!batch.completion->done) {
+            beast::error_code ec;
+            wake_->expires_at(net::steady_timer::time_point::max());
+            co_await wake_->async_wait(net::redirect_error(net::use_awaitable, ec));
+        }
+    }
+
+    net::awaitable<void> wait_oldest() {
+        auto stored = context_.trace.now();
+        co_await wait(pending_.front());
+        context_.trace.add(TRACE_STORE, stored, context_.trace.now());
+        auto error = pending_.front().completion->error;
+        pending_.pop_front();
+        if (error) {
+            co_await abandon();
+            std::rethrow_exception(error);
+        }
+    }
+
+    const RequestContext& context_;
+    net::any_io_executor session_;
+    std::size_t shard_;
+    std::shared_ptr<net::steady_timer> wake_;
+    std::deque<Pending> pending_;
+};
+
 class HttpSession : public std::enable_shared_from_this<HttpSession> {
 public:
-    HttpSession(tcp::socket&& socket, std::reference_wrapper<net::thread_pool> thread_pool)
+    HttpSession(tcp::socket&& socket, net::any_io_executor workers,
+                std::shared_ptr<const BodyLimits> limits, std::shared_ptr<AdmissionController> admission,
+                std::shared_ptr<IngestPipeline> ingest = nullptr)
         : stream_(std::move(socket)),
-          thread_pool_(thread_pool)
+          workers_(std::move(workers)),
+          limits_(std::move(limits)),
+          admission_(std::move(admission)),
+          ingest_(std::move(ingest))
     {
     }
 
     void start() {
-        req_ = {};
-        stream_.expires_after(std::chrono::seconds(30));
-        http::async_read(
-            stream_, buffer_, req_,
-            beast::bind_front_handler(&HttpSession::on_read, shared_from_this())
+        net::co_spawn(
+            stream_.get_executor(),
+            [self = shared_from_this()] { return self->run(); },
+            net::detached
         );
     }
 
-    void on_read(beast::error_code ec, std::size_t bytes_transferred) {
-        boost::ignore_unused(bytes_transferred);
-        
-        if (ec == http::error::end_of_stream) {
-            return do_close();
+    // Serves the requests of the connection one after another. Handlers run
+    // on the workers, because the service reaches the database through
+    // blocking libpqxx calls; the session waits for them without holding a
+    // thread of the io_context.
+    net::awaitable<void> run() {
+        try {
+            for (;;) {
+                req_ = {};
+                arena_.release();
+                header_parser_.emplace();
+                stream_.expires_after(std::chrono::seconds(30));
+
+                beast::error_code ec;
+                co_await http::async_read_header(stream_, buffer_, *header_parser_, net::redirect_error(net::use_awaitable, ec));
+                if (ec == http::error::end_of_stream) {
+                    break;
+                }
+                if (ec) {
+                    std::cerr << "Error: " << ec.message() << "\n";
+                    co_return;
+                }
+
+                if (!co_await serve()) {
+                    break;
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            co_return;
         }
+        do_close();
+    }
 
-        if (ec) {
-            std::cerr << "Error: " << ec.message() << "\n";
-            return;
+    struct Route;
+
+    // Records every answered request in ServerMetrics, from its header to
+    // the end of its response, and its stages in the Tracer when tracing is
+    // enabled. False when the connection must be closed.
+    net::awaitable<bool> serve() {
+        auto started = std::chrono::steady_clock::now();
+        const auto& header = header_parser_->get();
+        auto route = routes().match(std::string_view(header.target().data(), header.target().size()), header.method());
+        trace_.start(route.pattern);
+        status_ = 0;
+        response_bytes_ = 0;
+        request_bytes_ = header_parser_->content_length().value_or(0);
+
+        bool keep_alive = co_await handle(route);
+        if (status_ != 0) {
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+            ServerMetrics::Instance().record(route.pattern, status_, request_bytes_, response_bytes_, latency);
+            trace_.submit(status_);
         }
+        co_return keep_alive;
+    }
 
-        net::post(
-            thread_pool_.get(),
-            beast::bind_front_handler(&HttpSession::process_request, shared_from_this())
-        );
+    // The route is known once the header is in, so its body limit applies
+    // before the body is read and streaming routes never buffer it.
+    // Requests enter the thread pool only through the admission controller.
+    net::awaitable<bool> handle(const RouteMatch<Route>& route) {
+        const auto& header = header_parser_->get();
+        body_limit_ = limits_->get(route.pattern);
+        auto accept_encoding = header[http::field::accept_encoding];
+        response_encoding_ = NegotiateEncoding(std::string_view(accept_encoding.data(), accept_encoding.size()));
+        if (auto length = header_parser_->content_length(); length && *length > body_limit_) {
+            co_return co_await send(TooLarge());
+        }
+
+        bool streaming = route.handler && route.handler->streaming;
+        if (!streaming) {
+            body_parser_.emplace(std::move(*header_parser_));
+            body_parser_->body_limit(body_limit_);
+            beast::error_code ec;
+            auto read_started = trace_.now();
+            co_await http::async_read(stream_, buffer_, *body_parser_, net::redirect_error(net::use_awaitable, ec));
+            trace_.add(TRACE_READ, read_started, trace_.now());
+            if (ec == http::error::body_limit) {
+                co_return co_await send(TooLarge());
+            }
+            if (ec) {
+                if (ec != http::error::end_of_stream) {
+                    std::cerr << "Error: " << ec.message() << "\n";
+                }
+                co_return false;
+            }
+            req_ = body_parser_->release();
+        }
+
+        // A subscription holds the connection for good, so it takes no
+        // worker and does not count against admission.
+        if (route.handler && route.handler->websocket) {
+            co_return co_await subscribe();
+        }
+
+        auto ticket = admission_->admit(route.pattern);
+        if (!ticket) {
+            co_return co_await send(Overloaded(admission_->limits()));
+        }
+
+        Reply reply;
+        if (streaming) {
+            // Runs in the session, which reads the body and hands the work
+            // on it to the workers piece by piece.
+            if (!ticket.start()) {
+                reply.response = Overloaded(admission_->limits());
+            } else {
+                auto started = trace_.now();
+                reply = co_await process_streaming_request();
+                trace_.add(TRACE_HANDLER, started, trace_.now());
+            }
+            ticket = {};
+        } else {
+            auto queued = trace_.now();
+            co_await net::co_spawn(
+                workers_,
+                [&]() -> net::awaitable<void> {
+                    trace_.add(TRACE_QUEUE, queued, trace_.now());
+                    if (!ticket.start()) {
+                        reply.response = Overloaded(admission_->limits());
+                    } else {
+                        TraceScope scope(&trace_);
+                        TraceSpan span(TRACE_HANDLER);
+                        reply = process_request();
+                    }
+                    ticket = {};
+                    co_return;
+                },
+                net::use_awaitable
+            );
+        }
+
+        if (!reply.response) {
+            co_return reply.keep_alive;
+        }
+        co_return co_await send(std::move(*reply.response));
     }
 
-    void process_request() {
-        struct Handle {
-            std::string name;
-            boost::beast::http::verb method;
+    // Upgrades the connection to a WebSocket and pushes the buckets written
+    // by /post for the series the client subscribed to. Every text message
+    // of the client adds a subscription, up to
+    // SubscriptionHub::kMaxFiltersPerSubscriber,
+    //     {"project_id": "web", "tags": ["env=prod"], "drop_policy": "drop_oldest"}
+    // and is answered with {"message": ...}. Updates wait in a queue of
+    // kMaxQueuedUpdates; drop_policy picks what a full queue does.
+    net::awaitable<bool> subscribe() {
+        if (!websocket::is_upgrade(req_)) {
+            http::response<http::string_body> res{http::status::upgrade_required, req_.version()};
+            res.set(http::field::upgrade, "websocket");
+            res.set(http::field::content_type, "application/json");
+            res.keep_alive(req_.keep_alive());
+            res.body() = "{\"message\": \"WebSocket upgrade required\"}";
+            co_return co_await send(std::move(res));
+        }
+
+        stream_.expires_never();
+        auto ws = std::make_shared<websocket::stream<beast::tcp_stream&>>(stream_);
+        ws->set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+        ws->text(true);
+        co_await ws->async_accept(req_, net::use_awaitable);
 
-            Handle() = default;
-            Handle(const std::string& name, boost::beast::http::verb method)
-                : name(name),
-                  method(method)
-            {
+        // The reader and the writer share the strand of the connection, and
+        // a push from a worker wakes the writer through it.
+        auto executor = co_await net::this_coro::executor;
+        auto wake = std::make_shared<net::steady_timer>(executor, net::steady_timer::time_point::max());
+        auto done = std::make_shared<bool>(false);
+        auto subscriber = std::make_shared<Subscriber>(kMaxQueuedUpdates, EDropPolicy::DROP_OLDEST, [executor, wake] {
+            net::post(executor, [wake] { wake->cancel(); });
+        });
+        net::co_spawn(executor, PushUpdates(shared_from_this(), ws, subscriber, wake, done), net::detached);
+
+        beast::flat_buffer buffer;
+        for (;;) {
+            beast::error_code ec;
+            co_await ws->async_read(buffer, net::redirect_error(net::use_awaitable, ec));
+            if (ec) {
+                break;
             }
+            auto reply = AddSubscription(beast::buffers_to_string(buffer.data()), subscriber);
+            buffer.consume(buffer.size());
+            subscriber->push(std::make_shared<const std::string>(std::move(reply)));
+        }
 
-            Handle(http::request<http::string_body>& req)
-                : name(req.target()),
-                  method(req.method())
-            {
+        SubscriptionHub::Instance().Unsubscribe(*subscriber);
+        *done = true;
+        wake->cancel();
+        co_return false;
+    }
+
+    static std::string AddSubscription(const std::string& body, const std::shared_ptr<Subscriber>& subscriber) {
+        try {
+            auto request = ParseSubscribeRequest(body);
+            if (request.drop_policy) {
+                subscriber->set_policy(*request.drop_policy);
             }
+            SubscriptionHub::Instance().Subscribe(subscriber, request.project_id, std::move(request.tags));
+            return "{\"message\": \"Subscribed\"}";
+        } catch (const std::exception& e) {
+            return boost::json::serialize(boost::json::object{{"message", e.what()}});
+        }
+    }
 
-            bool operator==(const Handle& other) const = default;
-        };
-        std::unordered_map<
-            Handle,
-            std::function<void(http::request<http::string_body>&, http::response<http::string_body>&)>,
-            decltype(
-                [](const Handle& h) {
-                    auto base = boost::hash_value(h.name);
-                    boost::hash_combine(base, h.method);
-                    return base;
+    // Writes the queued updates of a subscriber until the reader is done,
+    // the write fails or the subscriber was disconnected for falling behind.
+    // self keeps stream_, which ws wraps, alive once the reader is gone.
+    static net::awaitable<void> PushUpdates([[maybe_unused]] std::shared_ptr<HttpSession> self,
+                                            std::shared_ptr<websocket::stream<beast::tcp_stream&>> ws,
+                                            std::shared_ptr<Subscriber> subscriber,
+                                            std::shared_ptr<net::steady_timer> wake,
+                                            std::shared_ptr<bool> done) {
+        beast::error_code ec;
+        while (!*done) {
+            while (auto message = subscriber->pop()) {
+                co_await ws->async_write(net::buffer(*message), net::redirect_error(net::use_awaitable, ec));
+                if (ec) {
+                    co_return;
                 }
-            )
-        > handlers = {
-            {{"/register", http::verb::post}, &HttpSession::RegisterProject},
-            {{"/post", http::verb::post}, &HttpSession::DoPost},
-            {{"/get", http::verb::get}, &HttpSession::DoGet},
-        };
+            }
+            if (subscriber->disconnected()) {
+                co_await ws->async_close(websocket::close_code::try_again_later, net::redirect_error(net::use_awaitable, ec));
+                co_return;
+            }
+            wake->expires_at(net::steady_timer::time_point::max());
+            co_await wake->async_wait(net::redirect_error(net::use_awaitable, ec));
+        }
+    }
+
+    using Handler = void (*)(http::request<http::string_body>&, http::response<http::string_body>&, const RequestContext&);
+    // Consumes the body while it arrives. Runs in the session, so anything
+    // that blocks goes to context.workers.
+    using StreamingHandler = net::awaitable<void> (*)(RequestBodyReader&, http::response<http::string_body>&, const RequestContext&);
 
+    // Exactly one of the handlers is set, or websocket for routes that
+    // upgrade the connection.
+    struct Route {
+        Handler handler = nullptr;
+        StreamingHandler streaming = nullptr;
+        bool websocket = false;
+    };
+
+    static const Router<Route>& routes() {
+        static const Router<Route> router = [] {
+            Router<Route> router;
+            router.add("/register", http::verb::post, {.handler = &HttpSession::RegisterProject});
+            router.add("/post", http::verb::post, {.streaming = &HttpSession::DoPost});
+            router.add("/api/v1/write/{project}", http::verb::post, {.streaming = &HttpSession::DoRemoteWrite});
+            router.add("/get", http::verb::get, {.streaming = &HttpSession::DoGet});
+            router.add("/topk", http::verb::get, {.handler = &HttpSession::DoTopK});
+            router.add("/query", http::verb::get, {.handler = &HttpSession::DoQuery});
+            router.add("/alerts/rules", http::verb::post, {.handler = &HttpSession::AddAlertRule});
+            router.add("/alerts/rules", http::verb::get, {.handler = &HttpSession::ListAlertRules});
+            router.add("/alerts/rules", http::verb::delete_, {.handler = &HttpSession::RemoveAlertRule});
+            router.add("/alerts/rules/{id}", http::verb::delete_, {.handler = &HttpSession::RemoveAlertRule});
+            router.add("/alerts/events", http::verb::get, {.handler = &HttpSession::DrainAlertEvents});
+            router.add("/stats/admission", http::verb::get, {.handler = &HttpSession::GetAdmissionStats});
+            router.add("/metrics", http::verb::get, {.handler = &HttpSession::GetMetrics});
+            router.add("/traces/slowest", http::verb::get, {.handler = &HttpSession::GetSlowestTraces});
+            router.add("/subscribe", http::verb::get, {.websocket = true});
+            router.build();
+            return router;
+        }();
+        return router;
+    }
+
+    // What a handler left to do: a response to write, or none when it
+    // already streamed one.
+    struct Reply {
+        std::optional<http::response<http::string_body>> response;
+        bool keep_alive = true;
+    };
+
+    net::awaitable<Reply> process_streaming_request() {
         http::response<http::string_body> res;
+        RequestBodyReader body(stream_, buffer_, std::move(*header_parser_), body_limit_, trace_);
+        const auto& header = body.header();
+        res.version(header.version());
+        res.keep_alive(header.keep_alive());
+        ChunkedResponseWriter chunked(stream_, header.version(), header.keep_alive(), response_encoding_, trace_);
 
-        auto it = handlers.find(Handle(req_));
-        if (it == handlers.end()) {
+        auto route = routes().match(std::string_view(header.target().data(), header.target().size()), header.method());
+        co_await (*route.handler->streaming)(body, res, RequestContext{route.params, &arena_, chunked, *admission_, ingest_.get(), workers_, trace_});
+
+        request_bytes_ = std::max(request_bytes_, body.bytes_read());
+        // The rest of an unread body would be taken for the next request.
+        if (!body.done()) {
+            res.keep_alive(false);
+        }
+        if (chunked.started()) {
+            status_ = chunked.status();
+            response_bytes_ = chunked.bytes_written();
+            co_return Reply{.response = std::nullopt, .keep_alive = chunked.finished() && res.keep_alive()};
+        }
+        co_return Reply{.response = std::move(res)};
+    }
+
+    Reply process_request() {
+        http::response<http::string_body> res;
+        res.version(req_.version());
+        res.keep_alive(req_.keep_alive());
+        ChunkedResponseWriter chunked(stream_, req_.version(), req_.keep_alive(), response_encoding_, trace_);
+
+        auto route = routes().match(std::string_view(req_.target().data(), req_.target().size()), req_.method());
+        if (route.handler) {
+            (*route.handler->handler)(req_, res, RequestContext{route.params, &arena_, chunked, *admission_, ingest_.get(), workers_, trace_});
+        } else if (route.status == http::status::method_not_allowed) {
+            res.result(http::status::method_not_allowed);
+            res.set(http::field::content_type, "application/json");
+            res.body() = "{\"message\": \"Method not allowed\"}";
+        } else {
             res.result(http::status::not_found);
             res.set(http::field::content_type, "application/json");
             res.body() = "{\"message\": \"Not found handler\"}";
-        } else {
-            it->second(req_, res);
         }
 
-        auto sp = std::make_shared<http::response<http::string_body>>(std::move(res));
-        res_ = sp;
-
-        http::async_write(
-            stream_,
-            *sp,
-            beast::bind_front_handler(&HttpSession::on_write, shared_from_this(), sp->need_eof())
-        );
+        if (chunked.started()) {
+            status_ = chunked.status();
+            response_bytes_ = chunked.bytes_written();
+            // A response broken off midway cannot be followed by another one.
+            return {.response = std::nullopt, .keep_alive = chunked.finished() && req_.keep_alive()};
+        }
+        return {.response = std::move(res)};
     }
 
-    void on_write(bool close, beast::error_code ec, std::size_t bytes_transferred) {
-        boost::ignore_unused(bytes_transferred);
+    // Bodies too small to gain from compression are sent as they are.
+    // False when the connection must be closed.
+    net::awaitable<bool> send(http::response<http::string_body> res) {
+        auto write_started = trace_.now();
+        if (response_encoding_ != EContentEncoding::IDENTITY && res.body().size() >= kCompressionThreshold) {
+            std::string compressed;
+            Compress(response_encoding_, res.body(), compressed);
+            res.body() = std::move(compressed);
+            res.set(http::field::content_encoding, ToString(response_encoding_));
+            res.set(http::field::vary, "Accept-Encoding");
+        }
+        // Without a Content-Length the body would end only with the connection.
+        res.prepare_payload();
 
+        bool keep_alive = !res.need_eof();
+        status_ = res.result_int();
+        response_bytes_ = res.body().size();
+        beast::error_code ec;
+        co_await http::async_write(stream_, res, net::redirect_error(net::use_awaitable, ec));
+        trace_.add(TRACE_WRITE, write_started, trace_.now());
         if (ec) {
             std::cerr << "Error: " << ec.message() << "\n";
+            co_return false;
         }
+        co_return keep_alive;
+    }
 
-        if (close) {
-            return do_close();
-        }
+    // The unread body cannot be skipped reliably, so the connection is
+    // closed after the response.
+    static http::response<http::string_body> TooLarge() {
+        http::response<http::string_body> res;
+        res.result(http::status::payload_too_large);
+        res.set(http::field::content_type, "application/json");
+        res.body() = "{\"message\": \"Request body too large\"}";
+        res.keep_alive(false);
+        return res;
+    }
 
-        start();
+    // Also closes the connection, which sheds its further requests too.
+    static http::response<http::string_body> Overloaded(const AdmissionLimits& limits) {
+        http::response<http::string_body> res;
+        res.result(http::status::service_unavailable);
+        res.set(http::field::content_type, "application/json");
+        res.set(http::field::retry_after, std::to_string(limits.retry_after.count()));
+        res.body() = "{\"message\": \"Server overloaded\"}";
+        res.keep_alive(false);
+        return res;
     }
 
     void do_close()
@@ -192,7 +1136,7 @@ public:
         }
     }
 
-    static void RegisterProject(http::request<http::string_body>& request, http::response<http::string_body>& response) {
+    static void RegisterProject(http::request<http::string_body>& request, http::response<http::string_body>& response, const RequestContext&) {
         MonitoringService service;
         try {
             RegisterProjectRequest req = ParseRegisterProjectRequest(request.body());
@@ -207,14 +1151,225 @@ public:
         }
     }
 
-    static void DoPost(http::request<http::string_body>& request, http::response<http::string_body>& response) {
-        MonitoringService service;
+    // Metrics are stored in sub-batches while the rest of the body is still
+    // being read. A malformed document leaves the batches before the error
+    // stored. Compressed bodies are decompressed as they arrive, and the
+    // route's body limit also bounds their decompressed size.
+    static net::awaitable<void> DoPost(RequestBodyReader& body, http::response<http::string_body>& response, const RequestContext& context) {
+        EContentEncoding encoding;
+        try {
+            auto content_encoding = body.header()[http::field::content_encoding];
+            encoding = ContentEncodingFromString(std::string_view(content_encoding.data(), content_encoding.size()));
+        } catch (const std::exception& e) {
+            response.result(http::status::unsupported_media_type);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+            co_return;
+        }
         try {
-            PostRequest req = ParsePostRequest(request.body());
-            service.DoPost(req);
+            // Batches come from a pool over the heap, not from the request
+            // arena, so the memory of stored batches goes back to the pool and
+            // the heap and /post holds the batches in flight, not the body.
+            std::pmr::unsynchronized_pool_resource memory(std::pmr::new_delete_resource());
+            PostBatchWriter writer(context, co_await net::this_coro::executor);
+            auto content_type = body.header()[http::field::content_type];
+            if (std::string_view(content_type.data(), content_type.size()).starts_with(kFrameContentType)) {
+                FrameDecoder decoder(&memory);
+                co_await IngestBody(body, encoding, decoder, writer, context);
+            } else {
+                PostRequestParser parser(&memory);
+                co_await IngestBody(body, encoding, parser, writer, context);
+            }
             response.result(http::status::ok);
             response.set(http::field::content_type, "application/json");
             response.body() = "{\"message\": \"Metrics posted successfully\"}";
+        } catch (const beast::system_error& e) {
+            response.result(e.code() == http::error::body_limit ? http::status::payload_too_large : http::status::bad_request);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"" + e.code().message() + "\"}";
+        } catch (const std::length_error& e) {
+            response.result(http::status::payload_too_large);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+        } catch (const std::exception& e) {
+            response.result(http::status::bad_request);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+        }
+    }
+
+    // Decoder is PostRequestParser or FrameDecoder. The session reads the
+    // body, every piece is decompressed and parsed on the workers, and the
+    // batches completed by then, once they have enough metrics or enough
+    // of the body went into them, go to the writer before the next piece is
+    // read. Whatever happens, the writer is done with every batch when this
+    // returns.
+    template <class Decoder>
+    static net::awaitable<void> IngestBody(RequestBodyReader& body, EContentEncoding encoding, Decoder& decoder,
+                                           PostBatchWriter& writer, const RequestContext& context) {
+        std::exception_ptr error;
+        try {
+            co_await ParseBatches(body, encoding, decoder, writer, context);
+            co_await writer.finish();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (error) {
+            co_await writer.abandon();
+            std::rethrow_exception(error);
+        }
+    }
+
+    template <class Decoder>
+    static net::awaitable<void> ParseBatches(RequestBodyReader& body, EContentEncoding encoding, Decoder& decoder,
+                                             PostBatchWriter& writer, const RequestContext& context) {
+        std::size_t batch_bytes = 0;
+        std::vector<PostRequest> batches;
+        auto consume = [&](std::string_view piece) {
+            {
+                TraceSpan span(TRACE_PARSE);
+                decoder.write(piece, true);
+            }
+            batch_bytes += piece.size();
+            if (decoder.completed() >= kPostBatchMetrics || (decoder.completed() > 0 && batch_bytes >= kPostBatchBytes)) {
+                batches.push_back(decoder.release_completed());
+                batch_bytes = 0;
+            }
+        };
+
+        std::optional<Decompressor> decompressor;
+        if (encoding != EContentEncoding::IDENTITY) {
+            decompressor.emplace(encoding, body.body_limit());
+        }
+        for (auto piece = co_await body.read(); !piece.empty(); piece = co_await body.read()) {
+            co_await OnWorkers(context, [&] {
+                if (!decompressor) {
+                    consume(piece);
+                    return;
+                }
+                for (auto plain = decompressor->read(piece); !plain.empty(); plain = decompressor->read(piece)) {
+                    consume(plain);
+                }
+            });
+            for (auto& batch : batches) {
+                co_await writer.write(std::move(batch));
+            }
+            batches.clear();
+        }
+        co_await OnWorkers(context, [&] {
+            if (decompressor) {
+                decompressor->finish();
+            }
+            TraceSpan span(TRACE_PARSE);
+            decoder.write({}, false);
+        });
+        co_await writer.write(decoder.release());
+    }
+
+    // Prometheus remote write. The whole body is one snappy block, so it is
+    // read in full and decoded in one go on the workers.
+    static net::awaitable<void> DoRemoteWrite(RequestBodyReader& body, http::response<http::string_body>& response, const RequestContext& context) {
+        response.set(http::field::content_type, "application/json");
+        auto content_encoding = body.header()[http::field::content_encoding];
+        std::string_view encoding(content_encoding.data(), content_encoding.size());
+        if (!encoding.empty() && encoding != kRemoteWriteEncoding) {
+            response.result(http::status::unsupported_media_type);
+            response.body() = "{\"message\": \"Unsupported content encoding\"}";
+            co_return;
+        }
+        try {
+            std::pmr::string message(context.memory);
+            for (auto piece = co_await body.read(); !piece.empty(); piece = co_await body.read()) {
+                message += piece;
+            }
+            std::optional<PostRequest> write_request;
+            co_await OnWorkers(context, [&] {
+                TraceSpan span(TRACE_PARSE);
+                std::string_view plain = message;
+                if (!encoding.empty()) {
+                    plain = SnappyUncompress(plain, kMaxRemoteWriteMessage);
+                }
+                write_request = DecodeWriteRequest(plain, context.params.get("project"), context.memory);
+            });
+            PostBatchWriter writer(context, co_await net::this_coro::executor);
+            co_await writer.write(std::move(*write_request));
+            co_await writer.finish();
+            response.result(http::status::ok);
+            response.body() = "{\"message\": \"Metrics posted successfully\"}";
+        } catch (const beast::system_error& e) {
+            response.result(e.code() == http::error::body_limit ? http::status::payload_too_large : http::status::bad_request);
+            response.body() = "{\"message\": \"" + e.code().message() + "\"}";
+        } catch (const std::length_error& e) {
+            response.result(http::status::payload_too_large);
+            response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+        } catch (const std::exception& e) {
+            response.result(http::status::bad_request);
+            response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+        }
+    }
+
+    // Runs in the session, so that long windows can be sent while they
+    // are read, see StreamGet.
+    static net::awaitable<void> DoGet(RequestBodyReader& body, http::response<http::string_body>& response, const RequestContext& context) {
+        std::pmr::string text(context.memory);
+        try {
+            for (auto piece = co_await body.read(); !piece.empty(); piece = co_await body.read()) {
+                text += piece;
+            }
+        } catch (const beast::system_error& e) {
+            response.result(e.code() == http::error::body_limit ? http::status::payload_too_large : http::status::bad_request);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"" + e.code().message() + "\"}";
+            co_return;
+        }
+
+        std::optional<GetRequest> streamed;
+        NumberFormat format;
+        co_await OnWorkers(context, [&] {
+            MonitoringService service;
+            try {
+                // The DOM of a typical /get body fits on the stack.
+                unsigned char json_buffer[kJsonBufferSize];
+                boost::json::monotonic_resource json_memory(json_buffer, sizeof(json_buffer));
+                auto json = boost::json::parse(text, &json_memory);
+                if (IsGroupedGetRequest(json)) {
+                    return DoGroupedGet(service, ParseGroupedGetRequest(json), response);
+                }
+                GetRequest req = ParseGetRequest(json, context.memory);
+                format = ParseNumberFormat(json);
+                if (req.interval_seconds * 1000 / kBucketMilliseconds > kStreamingMinBuckets) {
+                    streamed.emplace(std::move(req));
+                    return;
+                }
+                auto serviceResponse = service.DoGet(req);
+                if (serviceResponse) {
+                    response.result(http::status::ok);
+                    response.set(http::field::content_type, "application/json");
+                    WriteGetResponse(serviceResponse.value(), response.body(), format);
+                } else {
+                    response.result(http::status::not_found);
+                    response.set(http::field::content_type, "application/json");
+                    response.body() = "{\"message\": \"Metrics not found\"}";
+                }
+            } catch (const std::exception& e) {
+                response.result(http::status::bad_request);
+                response.set(http::field::content_type, "application/json");
+                response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+            }
+        });
+        if (streamed) {
+            co_await StreamGet(*streamed, format, response, context);
+        }
+    }
+
+    static void DoTopK(http::request<http::string_body>& request, http::response<http::string_body>& response, const RequestContext&) {
+        MonitoringService service;
+        try {
+            TopKRequest req = ParseTopKRequest(request.body());
+            auto serviceResponse = service.DoTopK(req);
+            response.result(http::status::ok);
+            response.set(http::field::content_type, "application/json");
+            response.body() = TopKResponseToJson(serviceResponse);
         } catch (const std::exception& e) {
             response.result(http::status::bad_request);
             response.set(http::field::content_type, "application/json");
@@ -222,19 +1377,54 @@ public:
         }
     }
 
-    static void DoGet(http::request<http::string_body>& request, http::response<http::string_body>& response) {
+    static void DoQuery(http::request<http::string_body>& request, http::response<http::string_body>& response, const RequestContext&) {
         MonitoringService service;
         try {
-            GetRequest req = ParseGetRequest(request.body());
-            auto serviceResponse = service.DoGet(req);
-            if (serviceResponse) {
+            QueryRequest req = ParseQueryRequest(request.body());
+            auto serviceResponse = service.DoQuery(req);
+            response.result(http::status::ok);
+            response.set(http::field::content_type, "application/json");
+            response.body() = QueryResponseToJson(serviceResponse);
+        } catch (const std::exception& e) {
+            response.result(http::status::bad_request);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+        }
+    }
+
+    static void AddAlertRule(http::request<http::string_body>& request, http::response<http::string_body>& response, const RequestContext&) {
+        try {
+            AlertEngine::Instance().AddRule(ParseAlertRule(request.body()));
+            response.result(http::status::ok);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"Alert rule saved\"}";
+        } catch (const std::exception& e) {
+            response.result(http::status::bad_request);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+        }
+    }
+
+    static void ListAlertRules(http::request<http::string_body>&, http::response<http::string_body>& response, const RequestContext&) {
+        response.result(http::status::ok);
+        response.set(http::field::content_type, "application/json");
+        response.body() = AlertRulesToJson(AlertEngine::Instance().Rules());
+    }
+
+    static void RemoveAlertRule(http::request<http::string_body>& request, http::response<http::string_body>& response, const RequestContext& context) {
+        try {
+            std::string id(context.params.get("id"));
+            if (id.empty()) {
+                id = boost::json::parse(request.body()).at("id").as_string().c_str();
+            }
+            if (AlertEngine::Instance().RemoveRule(id)) {
                 response.result(http::status::ok);
                 response.set(http::field::content_type, "application/json");
-                response.body() = GetResponseToJson(serviceResponse.value());
+                response.body() = "{\"message\": \"Alert rule removed\"}";
             } else {
                 response.result(http::status::not_found);
                 response.set(http::field::content_type, "application/json");
-                response.body() = "{\"message\": \"Metrics not found\"}";
+                response.body() = "{\"message\": \"Alert rule not found\"}";
             }
         } catch (const std::exception& e) {
             response.result(http::status::bad_request);
@@ -243,30 +1433,191 @@ public:
         }
     }
 
+    static void DrainAlertEvents(http::request<http::string_body>&, http::response<http::string_body>& response, const RequestContext&) {
+        constexpr std::size_t kMaxEventsPerResponse = 1000;
+        response.result(http::status::ok);
+        response.set(http::field::content_type, "application/json");
+        response.body() = AlertEventsToJson(AlertEngine::Instance().DrainEvents(kMaxEventsPerResponse));
+    }
+
+    static void GetAdmissionStats(http::request<http::string_body>&, http::response<http::string_body>& response, const RequestContext& context) {
+        response.result(http::status::ok);
+        response.set(http::field::content_type, "application/json");
+        response.body() = AdmissionStatsToJson(context.admission.stats());
+    }
+
+    static void GetMetrics(http::request<http::string_body>&, http::response<http::string_body>& response, const RequestContext&) {
+        response.result(http::status::ok);
+        response.set(http::field::content_type, "text/plain; version=0.0.4");
+        response.body() = ServerMetrics::Instance().scrape();
+    }
+
+    // GET /traces/slowest?n=20&format=chrome: the n slowest requests the
+    // Tracer holds with their stages, as JSON or as Chrome trace events.
+    static void GetSlowestTraces(http::request<http::string_body>& request, http::response<http::string_body>& response, const RequestContext&) {
+        constexpr std::size_t kDefaultTraces = 20;
+        constexpr std::size_t kMaxTraces = 1000;
+        response.set(http::field::content_type, "application/json");
+        std::string_view target(request.target().data(), request.target().size());
+        std::size_t n = kDefaultTraces;
+        if (auto value = QueryParameter(target, "n")) {
+            auto [end, ec] = std::from_chars(value->data(), value->data() + value->size(), n);
+            if (ec != std::errc() || end != value->data() + value->size()) {
+                response.result(http::status::bad_request);
+                response.body() = "{\"message\": \"Invalid n\"}";
+                return;
+            }
+        }
+        auto format = QueryParameter(target, "format").value_or("json");
+        if (format != "json" && format != "chrome") {
+            response.result(http::status::bad_request);
+            response.body() = "{\"message\": \"Unknown format\"}";
+            return;
+        }
+
+        auto traces = Tracer::Instance().slowest(std::min(n, kMaxTraces));
+        response.result(http::status::ok);
+        response.body() = format == "chrome" ? TracesToChromeTrace(traces) : TracesToJson(traces);
+    }
+
+    // Large windows are sent while they are read from the database, so
+    // neither the rows nor the body are ever held in full. The workers read
+    // a page of kStreamingChunkSize buckets and encode it, then the session
+    // sends it before the next page is read: a slow client holds neither a
+    // worker nor a transaction, only its own connection, and that for
+    // ChunkedResponseWriter::kResponseTimeout at most.
+    static net::awaitable<void> StreamGet(const GetRequest& request, const NumberFormat& format,
+                                          http::response<http::string_body>& response, const RequestContext& context) {
+        auto& chunked = context.chunked;
+        std::string buffer;
+        std::optional<int64_t> after;
+        for (;;) {
+            std::size_t read = 0;
+            co_await OnWorkers(context, [&] {
+                try {
+                    MonitoringService service;
+                    auto values = service.GetPage(request, after, kStreamingChunkSize);
+                    read = values.size();
+                    if (values.empty()) {
+                        return;
+                    }
+                    after = values.back().timestamp;
+                    buffer.assign(chunked.started() ? std::string_view(",") : kGetResponseHead);
+                    WriteMetricValues(values, buffer, format);
+                    if (!chunked.started()) {
+                        chunked.begin(http::status::ok, "application/json");
+                    }
+                    chunked.write(buffer);
+                } catch (const std::exception& e) {
+                    // A response begun can only be broken off.
+                    if (chunked.started()) {
+                        throw;
+                    }
+                    response.result(http::status::bad_request);
+                    response.set(http::field::content_type, "application/json");
+                    response.body() = "{\"message\": \"" + std::string(e.what()) + "\"}";
+                }
+            });
+            if (!chunked.started()) {
+                if (response.body().empty()) {
+                    response.result(http::status::not_found);
+                    response.set(http::field::content_type, "application/json");
+                    response.body() = "{\"message\": \"Metrics not found\"}";
+                }
+                co_return;
+            }
+            if (read < kStreamingChunkSize) {
+                break;
+            }
+            co_await chunked.flush();
+        }
+        chunked.write(kGetResponseTail);
+        co_await chunked.finish();
+    }
+
+    static void DoGroupedGet(MonitoringService& service, const GroupedGetRequest& request, http::response<http::string_body>& response) {
+        auto serviceResponse = service.DoGroupedGet(request);
+        if (serviceResponse) {
+            response.result(http::status::ok);
+            response.set(http::field::content_type, "application/json");
+            response.body() = GroupedGetResponseToJson(serviceResponse.value());
+        } else {
+            response.result(http::status::not_found);
+            response.set(http::field::content_type, "application/json");
+            response.body() = "{\"message\": \"Metrics not found\"}";
+        }
+    }
+
 private:
+    static constexpr std::size_t kArenaSize = 64 * 1024;
+    static constexpr std::size_t kJsonBufferSize = 4 * 1024;
+    // Metrics stored per transaction while a /post body is read.
+    static constexpr std::size_t kPostBatchMetrics = 1024;
+    static constexpr std::size_t kPostBatchBytes = 1 << 20;
+    // Uncompressed remote write request; Prometheus sends a few MiB at most.
+    static constexpr std::uint64_t kMaxRemoteWriteMessage = 64 << 20;
+    // /get responses longer than this many buckets are streamed.
+    static constexpr int64_t kStreamingMinBuckets = 4096;
+    static constexpr std::size_t kStreamingChunkSize = 1024;
+    static constexpr std::size_t kCompressionThreshold = 1024;
+    // Updates a WebSocket subscriber may fall behind by.
+    static constexpr std::size_t kMaxQueuedUpdates = 1024;
+
     beast::tcp_stream stream_;
     beast::flat_buffer buffer_;
     http::request<http::string_body> req_;
-    std::shared_ptr<void> res_;
-    std::reference_wrapper<net::thread_pool> thread_pool_;
+    std::optional<http::request_parser<http::empty_body>> header_parser_;
+    std::optional<http::request_parser<http::string_body>> body_parser_;
+    std::uint64_t body_limit_ = 0;
+    EContentEncoding response_encoding_ = EContentEncoding::IDENTITY;
+    // Of the current request, for ServerMetrics; status 0 until answered.
+    unsigned status_ = 0;
+    std::uint64_t request_bytes_ = 0;
+    std::uint64_t response_bytes_ = 0;
+    RequestTrace trace_;
+    // Executor of the threads that run handlers.
+    net::any_io_executor workers_;
+    std::shared_ptr<const BodyLimits> limits_;
+    std::shared_ptr<AdmissionController> admission_;
+    std::shared_ptr<IngestPipeline> ingest_;
+    // Per-request allocations start in this buffer and spill to the heap
+    // only for large requests; run() rewinds it for the next request.
+    std::unique_ptr<std::byte[]> arena_buffer_{new std::byte[kArenaSize]};
+    std::pmr::monotonic_buffer_resource arena_{arena_buffer_.get(), kArenaSize};
 };
 
 class HttpListener : public std::enable_shared_from_this<HttpListener>
 {
     net::io_context& ioc_;
     tcp::acceptor acceptor_;
-    std::reference_wrapper<net::thread_pool> thread_pool_;
+    net::any_io_executor workers_;
+    std::shared_ptr<const BodyLimits> limits_;
+    std::shared_ptr<AdmissionController> admission_;
+    std::shared_ptr<IngestPipeline> ingest_;
 
 public:
+    // With reuse_port several listeners, one per io_context, can bind the
+    // same endpoint and the kernel spreads connections between them.
+    // Without ingest, /post batches are stored by the workers themselves.
     HttpListener(
         net::io_context& ioc,
         tcp::endpoint endpoint,
-        std::reference_wrapper<net::thread_pool> thread_pool
+        net::any_io_executor workers,
+        BodyLimits limits = {},
+        AdmissionLimits admission = {},
+        bool reuse_port = false,
+        std::shared_ptr<IngestPipeline> ingest = nullptr
     )
         : ioc_(ioc)
         , acceptor_(ioc)
-        , thread_pool_(thread_pool)
+        , workers_(std::move(workers))
+        , limits_(std::make_shared<const BodyLimits>(std::move(limits)))
+        , admission_(std::make_shared<AdmissionController>(std::move(admission)))
+        , ingest_(std::move(ingest))
     {
+        boost::ignore_unused(HttpSession::routes());
+        ServerMetrics::Instance().add_admission(admission_);
+
         beast::error_code ec;
 
         boost::ignore_unused(acceptor_.open(endpoint.protocol(), ec));
@@ -281,6 +1632,15 @@ public:
             return;
         }
 
+        if (reuse_port) {
+            using reuse_port_option = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+            boost::ignore_unused(acceptor_.set_option(reuse_port_option(true), ec));
+            if(ec) {
+                std::cerr << "set_option: " << ec.message() << "\n";
+                return;
+            }
+        }
+
         boost::ignore_unused(acceptor_.bind(endpoint, ec));
         if(ec) {
             std::cerr << "bind: " << ec.message() << "\n";
@@ -301,6 +1661,13 @@ public:
         do_accept();
     }
 
+    // The bound port, 0 if binding failed.
+    unsigned short port() const {
+        beast::error_code ec;
+        auto endpoint = acceptor_.local_endpoint(ec);
+        return ec ? 0 : endpoint.port();
+    }
+
     void stop() {
         beast::error_code ec;
         boost::ignore_unused(acceptor_.close(ec));
@@ -321,14 +1688,218 @@ private:
 
     void on_accept(beast::error_code ec, tcp::socket socket)
     {
+        // stop() closed the acceptor.
+        if(ec == net::error::operation_aborted || !acceptor_.is_open()) {
+            return;
+        }
+
         if(ec) {
             std::cerr << "accept: " << ec.message() << "\n";
         } else {
             std::make_shared<HttpSession>(
                 std::move(socket),
-                thread_pool_)->start();
+                workers_,
+                limits_,
+                admission_,
+                ingest_)->start();
         }
 
         do_accept();
     }
 };
+
+// Receives StatsD datagrams, one or more newline separated lines each, and
+// stores the aggregated buckets once they are complete. Receiving and
+// aggregation run on one strand; stores go to the workers, one
+// transaction per project, so a few writes cover any sample rate.
+class StatsdListener : public std::enable_shared_from_this<StatsdListener>
+{
+public:
+    static constexpr std::size_t kMaxDatagramSize = 64 * 1024;
+    static constexpr std::chrono::milliseconds kFlushInterval{1000};
+    // Samples of a bucket may still arrive this long after it ended.
+    static constexpr int64_t kGraceMilliseconds = 2000;
+
+    StatsdListener(net::io_context& ioc, udp::endpoint endpoint, net::any_io_executor workers)
+        : strand_(net::make_strand(ioc))
+        , socket_(strand_)
+        , timer_(strand_)
+        , workers_(std::move(workers))
+        , datagram_(new char[kMaxDatagramSize])
+    {
+        beast::error_code ec;
+        boost::ignore_unused(socket_.open(endpoint.protocol(), ec));
+        if(ec) {
+            std::cerr << "statsd open: " << ec.message() << "\n";
+            return;
+        }
+        boost::ignore_unused(socket_.bind(endpoint, ec));
+        if(ec) {
+            std::cerr << "statsd bind: " << ec.message() << "\n";
+            boost::ignore_unused(socket_.close(ec));
+            return;
+        }
+    }
+
+    void run() {
+        if (!socket_.is_open()) {
+            return;
+        }
+        do_receive();
+        do_wait();
+    }
+
+    // The bound port, 0 if binding failed.
+    unsigned short port() const {
+        beast::error_code ec;
+        auto endpoint = socket_.local_endpoint(ec);
+        return ec ? 0 : endpoint.port();
+    }
+
+    void stop() {
+        net::post(strand_, [self = shared_from_this()] {
+            beast::error_code ec;
+            boost::ignore_unused(self->socket_.close(ec));
+            self->timer_.cancel();
+        });
+    }
+
+    // Stores everything still aggregated on the calling thread. Only once
+    // the io_context has stopped.
+    void drain() {
+        Store(aggregator_.flush(NowMilliseconds(), kGraceMilliseconds, true));
+    }
+
+private:
+    void do_receive() {
+        socket_.async_receive_from(
+            net::buffer(datagram_.get(), kMaxDatagramSize), sender_,
+            beast::bind_front_handler(&StatsdListener::on_receive, shared_from_this()));
+    }
+
+    void on_receive(beast::error_code ec, std::size_t bytes_transferred) {
+        if (ec == net::error::operation_aborted || !socket_.is_open()) {
+            return;
+        }
+        if (!ec) {
+            int64_t now = NowMilliseconds();
+            std::string_view lines(datagram_.get(), bytes_transferred);
+            StatsdSample sample;
+            while (!lines.empty()) {
+                auto end = lines.find('\n');
+                auto line = lines.substr(0, end);
+                lines.remove_prefix(end == std::string_view::npos ? lines.size() : end + 1);
+                if (ParseStatsdLine(line, sample)) {
+                    aggregator_.add(sample, now);
+                }
+            }
+        }
+        do_receive();
+    }
+
+    void do_wait() {
+        timer_.expires_after(kFlushInterval);
+        timer_.async_wait(beast::bind_front_handler(&StatsdListener::on_wait, shared_from_this()));
+    }
+
+    void on_wait(beast::error_code ec) {
+        if (ec) {
+            return;
+        }
+        auto requests = aggregator_.flush(NowMilliseconds(), kGraceMilliseconds);
+        if (!requests.empty()) {
+            net::post(workers_, [requests = std::move(requests)] {
+                Store(requests);
+            });
+        }
+        do_wait();
+    }
+
+    static void Store(const std::vector<PostRequest>& requests) {
+        if (requests.empty()) {
+            return;
+        }
+        try {
+            MonitoringService service;
+            for (const auto& request : requests) {
+                // An unknown project must not cost the others their buckets.
+                try {
+                    service.DoPost(request);
+                } catch (const std::exception& e) {
+                    std::cerr << "statsd store: " << e.what() << "\n";
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "statsd store: " << e.what() << "\n";
+        }
+    }
+
+    static int64_t NowMilliseconds() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    net::strand<net::io_context::executor_type> strand_;
+    udp::socket socket_;
+    net::steady_timer timer_;
+    net::any_io_executor workers_;
+    StatsdAggregator aggregator_;
+    std::unique_ptr<char[]> datagram_;
+    udp::endpoint sender_;
+};
+
+// Sweeps the alert engine once per interval on the workers, which fires
+// ABSENT rules and expires silent series off the ingest path. The next
+// sweep is only scheduled once the previous one finished.
+class AlertSweeper : public std::enable_shared_from_this<AlertSweeper>
+{
+public:
+    static constexpr std::chrono::milliseconds kSweepInterval{1000};
+
+    AlertSweeper(net::io_context& ioc, net::any_io_executor workers)
+        : strand_(net::make_strand(ioc))
+        , timer_(strand_)
+        , workers_(std::move(workers))
+    {
+    }
+
+    void run() {
+        net::post(strand_, [self = shared_from_this()] {
+            self->do_wait();
+        });
+    }
+
+    void stop() {
+        net::post(strand_, [self = shared_from_this()] {
+            self->stopped_ = true;
+            self->timer_.cancel();
+        });
+    }
+
+private:
+    void do_wait() {
+        if (stopped_) {
+            return;
+        }
+        timer_.expires_after(kSweepInterval);
+        timer_.async_wait(beast::bind_front_handler(&AlertSweeper::on_wait, shared_from_this()));
+    }
+
+    void on_wait(beast::error_code ec) {
+        if (ec) {
+            return;
+        }
+        net::post(workers_, [self = shared_from_this()] {
+            AlertEngine::Instance().Sweep(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+            net::post(self->strand_, [self] {
+                self->do_wait();
+            });
+        });
+    }
+
+    net::strand<net::io_context::executor_type> strand_;
+    net::steady_timer timer_;
+    net::any_io_executor workers_;
+    bool stopped_ = false;
+};
@@ -0,0 +1,223 @@
+#include "server_metrics.h"
+
+#include <lib/service/service.h>
+
+#include <algorithm>
+#include <format>
+#include <iterator>
+#include <map>
+
+namespace {
+
+    // Upper bounds of the exported latency buckets, in seconds.
+    constexpr std::array<double, 16> kLatencyBounds = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+        0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0,
+    };
+
+    struct MergedRoute {
+        std::uint64_t request_bytes = 0;
+        std::uint64_t response_bytes = 0;
+        std::map<unsigned, std::uint64_t> codes;
+        std::uint64_t other_codes = 0;
+        std::vector<std::uint64_t> latency = std::vector<std::uint64_t>(LatencyHistogram::kBuckets);
+        std::uint64_t latency_sum_us = 0;
+    };
+
+    void AppendHeader(std::string& out, std::string_view name, std::string_view type, std::string_view help) {
+        std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+    }
+
+} // anonymous namespace
+
+std::uint64_t LatencyHistogram::merge_into(std::vector<std::uint64_t>& counts) const {
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+        counts[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+    return sum_.load(std::memory_order_relaxed);
+}
+
+ServerMetrics& ServerMetrics::Instance() {
+    static ServerMetrics metrics;
+    return metrics;
+}
+
+ServerMetrics::ThreadMetrics& ServerMetrics::local() {
+    thread_local ThreadMetrics* metrics = nullptr;
+    if (!metrics) {
+        std::lock_guard lock(mutex_);
+        metrics = threads_.emplace_back(std::make_unique<ThreadMetrics>()).get();
+    }
+    return *metrics;
+}
+
+std::size_t ServerMetrics::slot(ThreadMetrics& metrics, std::string_view route) {
+    if (auto it = metrics.slots.find(route); it != metrics.slots.end()) {
+        return it->second;
+    }
+    std::size_t slot;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = std::ranges::find(routes_, route);
+        slot = static_cast<std::size_t>(it - routes_.begin());
+        if (it == routes_.end()) {
+            if (routes_.size() < kMaxRoutes) {
+                routes_.emplace_back(route);
+            } else {
+                slot = kMaxRoutes - 1;
+            }
+        }
+    }
+    metrics.slots.emplace(route, slot);
+    return slot;
+}
+
+void ServerMetrics::record(std::string_view route, unsigned status, std::uint64_t request_bytes,
+                           std::uint64_t response_bytes, std::chrono::microseconds latency) {
+    auto& metrics = local();
+    auto index = slot(metrics, route);
+    auto* stats = metrics.routes[index].load(std::memory_order_relaxed);
+    if (!stats) {
+        metrics.owned[index] = std::make_unique<RouteStats>();
+        stats = metrics.owned[index].get();
+        metrics.routes[index].store(stats, std::memory_order_release);
+    }
+
+    // Only this thread writes, so plain loads and stores do.
+    auto add = [](std::atomic<std::uint64_t>& counter, std::uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    };
+    add(stats->request_bytes, request_bytes);
+    add(stats->response_bytes, response_bytes);
+    std::size_t code = 0;
+    while (code < kMaxCodes) {
+        auto claimed = stats->codes[code].load(std::memory_order_relaxed);
+        if (claimed == status) {
+            break;
+        }
+        if (claimed == 0) {
+            stats->codes[code].store(status, std::memory_order_release);
+            break;
+        }
+        ++code;
+    }
+    add(code < kMaxCodes ? stats->code_counts[code] : stats->other_codes, 1);
+    stats->latency.record(static_cast<std::uint64_t>(std::max<std::int64_t>(0, latency.count())));
+}
+
+void ServerMetrics::add_admission(std::weak_ptr<const AdmissionController> admission) {
+    std::lock_guard lock(mutex_);
+    std::erase_if(admission_, [](const auto& controller) {
+        return controller.expired();
+    });
+    admission_.push_back(std::move(admission));
+}
+
+std::string ServerMetrics::scrape() const {
+    std::vector<std::string> routes;
+    std::vector<MergedRoute> merged;
+    AdmissionStats admission;
+    {
+        std::lock_guard lock(mutex_);
+        routes = routes_;
+        merged.resize(routes.size());
+        for (const auto& thread : threads_) {
+            for (std::size_t i = 0; i < routes.size(); ++i) {
+                const auto* stats = thread->routes[i].load(std::memory_order_acquire);
+                if (!stats) {
+                    continue;
+                }
+                auto& route = merged[i];
+                route.request_bytes += stats->request_bytes.load(std::memory_order_relaxed);
+                route.response_bytes += stats->response_bytes.load(std::memory_order_relaxed);
+                for (std::size_t code = 0; code < kMaxCodes; ++code) {
+                    auto status = stats->codes[code].load(std::memory_order_acquire);
+                    if (status != 0) {
+                        route.codes[status] += stats->code_counts[code].load(std::memory_order_relaxed);
+                    }
+                }
+                route.other_codes += stats->other_codes.load(std::memory_order_relaxed);
+                route.latency_sum_us += stats->latency.merge_into(route.latency);
+            }
+        }
+        for (const auto& weak : admission_) {
+            if (auto controller = weak.lock()) {
+                auto stats = controller->stats();
+                admission.queue_depth += stats.queue_depth;
+                admission.running += stats.running;
+                admission.admitted += stats.admitted;
+                admission.rejected += stats.rejected;
+                admission.shed += stats.shed;
+            }
+        }
+    }
+
+    std::string out;
+    auto label = [&](std::size_t i) -> std::string_view {
+        return routes[i].empty() ? "none" : std::string_view(routes[i]);
+    };
+
+    AppendHeader(out, "monitoring_http_requests_total", "counter", "Requests answered, by route pattern and status code.");
+    for (std::size_t i = 0; i < merged.size(); ++i) {
+        for (const auto& [code, count] : merged[i].codes) {
+            std::format_to(std::back_inserter(out), "monitoring_http_requests_total{{route=\"{}\",code=\"{}\"}} {}\n", label(i), code, count);
+        }
+        if (merged[i].other_codes > 0) {
+            std::format_to(std::back_inserter(out), "monitoring_http_requests_total{{route=\"{}\",code=\"other\"}} {}\n", label(i), merged[i].other_codes);
+        }
+    }
+    AppendHeader(out, "monitoring_http_request_bytes_total", "counter", "Request body bytes, as sent by the client.");
+    for (std::size_t i = 0; i < merged.size(); ++i) {
+        std::format_to(std::back_inserter(out), "monitoring_http_request_bytes_total{{route=\"{}\"}} {}\n", label(i), merged[i].request_bytes);
+    }
+    AppendHeader(out, "monitoring_http_response_bytes_total", "counter", "Response body bytes, after compression.");
+    for (std::size_t i = 0; i < merged.size(); ++i) {
+        std::format_to(std::back_inserter(out), "monitoring_http_response_bytes_total{{route=\"{}\"}} {}\n", label(i), merged[i].response_bytes);
+    }
+
+    AppendHeader(out, "monitoring_http_request_duration_seconds", "histogram",
+                 "Time from the request header to the end of the response.");
+    for (std::size_t i = 0; i < merged.size(); ++i) {
+        const auto& latency = merged[i].latency;
+        std::uint64_t cumulative = 0;
+        std::size_t bucket = 0;
+        for (double bound : kLatencyBounds) {
+            auto bound_us = static_cast<std::uint64_t>(bound * 1e6);
+            // A bucket counts once all of it is within the bound.
+            for (; bucket < latency.size() && LatencyHistogram::BucketUpperBound(bucket) <= bound_us; ++bucket) {
+                cumulative += latency[bucket];
+            }
+            std::format_to(std::back_inserter(out), "monitoring_http_request_duration_seconds_bucket{{route=\"{}\",le=\"{}\"}} {}\n",
+                           label(i), bound, cumulative);
+        }
+        for (; bucket < latency.size(); ++bucket) {
+            cumulative += latency[bucket];
+        }
+        std::format_to(std::back_inserter(out), "monitoring_http_request_duration_seconds_bucket{{route=\"{}\",le=\"+Inf\"}} {}\n", label(i), cumulative);
+        std::format_to(std::back_inserter(out), "monitoring_http_request_duration_seconds_sum{{route=\"{}\"}} {}\n",
+                       label(i), static_cast<double>(merged[i].latency_sum_us) / 1e6);
+        std::format_to(std::back_inserter(out), "monitoring_http_request_duration_seconds_count{{route=\"{}\"}} {}\n", label(i), cumulative);
+    }
+
+    AppendHeader(out, "monitoring_queue_depth", "gauge", "Requests waiting for a worker.");
+    std::format_to(std::back_inserter(out), "monitoring_queue_depth {}\n", admission.queue_depth);
+    AppendHeader(out, "monitoring_queue_running", "gauge", "Requests running on a worker.");
+    std::format_to(std::back_inserter(out), "monitoring_queue_running {}\n", admission.running);
+    AppendHeader(out, "monitoring_queue_admitted_total", "counter", "Requests let into the queue.");
+    std::format_to(std::back_inserter(out), "monitoring_queue_admitted_total {}\n", admission.admitted);
+    AppendHeader(out, "monitoring_queue_rejected_total", "counter", "Requests refused because the queue or the route was full.");
+    std::format_to(std::back_inserter(out), "monitoring_queue_rejected_total {}\n", admission.rejected);
+    AppendHeader(out, "monitoring_queue_shed_total", "counter", "Requests dropped after waiting too long.");
+    std::format_to(std::back_inserter(out), "monitoring_queue_shed_total {}\n", admission.shed);
+
+    auto database = MonitoringService::Stats();
+    AppendHeader(out, "monitoring_db_connections_open", "gauge", "Database connections held by worker threads.");
+    std::format_to(std::back_inserter(out), "monitoring_db_connections_open {}\n", database.connections_open);
+    AppendHeader(out, "monitoring_db_connections_in_use", "gauge", "Database connections serving a request.");
+    std::format_to(std::back_inserter(out), "monitoring_db_connections_in_use {}\n", database.in_use);
+    AppendHeader(out, "monitoring_db_connections_opened_total", "counter", "Database connections opened, reconnects included.");
+    std::format_to(std::back_inserter(out), "monitoring_db_connections_opened_total {}\n", database.connections_opened);
+    AppendHeader(out, "monitoring_db_connection_uses_total", "counter", "Requests that used a database connection.");
+    std::format_to(std::back_inserter(out), "monitoring_db_connection_uses_total {}\n", database.uses);
+    return out;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <lib/server/admission.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Log-linear histogram in the manner of HdrHistogram: values below
+// 2^kSubBucketBits are counted exactly, larger ones in 2^(kSubBucketBits-1)
+// buckets per power of two, so a bucket is at most 1/8 of its values wide.
+// Meant to have one writer: record() is lock-free and never contends, any
+// thread may read it meanwhile.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr int kMaxValueBits = 32;
+    // Larger values are counted as this one; in microseconds, over an hour.
+    static constexpr std::uint64_t kMaxValue = (std::uint64_t(1) << kMaxValueBits) - 1;
+
+    static constexpr std::size_t kBuckets =
+        (kMaxValueBits - kSubBucketBits) * (std::size_t(1) << (kSubBucketBits - 1)) + (std::size_t(1) << kSubBucketBits);
+
+    static constexpr std::size_t BucketIndex(std::uint64_t value) {
+        value = value < kMaxValue ? value : kMaxValue;
+        int width = std::bit_width(value);
+        if (width <= kSubBucketBits) {
+            return static_cast<std::size_t>(value);
+        }
+        int shift = width - kSubBucketBits;
+        return static_cast<std::size_t>(shift) * (std::size_t(1) << (kSubBucketBits - 1)) + static_cast<std::size_t>(value >> shift);
+    }
+
+    // Largest value counted in a bucket.
+    static constexpr std::uint64_t BucketUpperBound(std::size_t index) {
+        constexpr std::size_t kHalf = std::size_t(1) << (kSubBucketBits - 1);
+        if (index < 2 * kHalf) {
+            return index;
+        }
+        std::size_t shift = index / kHalf - 1;
+        std::uint64_t sub_bucket = index % kHalf + kHalf;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    void record(std::uint64_t value) {
+        // Plain load and store: only the owner writes.
+        auto& count = counts_[BucketIndex(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Adds the counts to counts, which has kBuckets entries, and returns the sum.
+    std::uint64_t merge_into(std::vector<std::uint64_t>& counts) const;
+
+private:
+    std::array<std::atomic<std::uint64_t>, kBuckets> counts_{};
+    std::atomic<std::uint64_t> sum_{0};
+};
+
+static_assert(LatencyHistogram::BucketIndex(LatencyHistogram::kMaxValue) + 1 == LatencyHistogram::kBuckets);
+
+// Self-metrics of the server: per-route requests by status code, body
+// bytes and latency, recorded by the io threads into per-thread blocks
+// without locks and merged when /metrics is scraped, plus the admission
+// queues and database connections. Thread blocks outlive their threads, so
+// counters never go back.
+class ServerMetrics {
+public:
+    // Routes beyond that share the last slot.
+    static constexpr std::size_t kMaxRoutes = 32;
+    // Distinct status codes per route and thread; others count as "other".
+    static constexpr std::size_t kMaxCodes = 8;
+
+    static ServerMetrics& Instance();
+
+    // route is the pattern of the matched route, empty when none matched.
+    void record(std::string_view route, unsigned status, std::uint64_t request_bytes,
+                std::uint64_t response_bytes, std::chrono::microseconds latency);
+
+    // Admission of every listener is summed up on scrape.
+    void add_admission(std::weak_ptr<const AdmissionController> admission);
+
+    // Prometheus text exposition format, version 0.0.4.
+    std::string scrape() const;
+
+private:
+    // Only Instance() exists: every thread caches a pointer to its block.
+    ServerMetrics() = default;
+
+    struct RouteStats {
+        std::atomic<std::uint64_t> request_bytes{0};
+        std::atomic<std::uint64_t> response_bytes{0};
+        // A slot is claimed once by the owner, code first.
+        std::array<std::atomic<unsigned>, kMaxCodes> codes{};
+        std::array<std::atomic<std::uint64_t>, kMaxCodes> code_counts{};
+        std::atomic<std::uint64_t> other_codes{0};
+        LatencyHistogram latency;
+    };
+
+    struct TransparentHash : std::hash<std::string_view> {
+        using is_transparent = void;
+    };
+
+    struct ThreadMetrics {
+        // Created by the owner on first use of the route.
+        std::array<std::atomic<RouteStats*>, kMaxRoutes> routes{};
+        std::array<std::unique_ptr<RouteStats>, kMaxRoutes> owned;
+        // Route pattern -> slot, so a known route is found without locks.
+        std::unordered_map<std::string, std::size_t, TransparentHash, std::equal_to<>> slots;
+    };
+
+    ThreadMetrics& local();
+    std::size_t slot(ThreadMetrics& metrics, std::string_view route);
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadMetrics>> threads_;
+    std::vector<std::string> routes_;
+    std::vector<std::weak_ptr<const AdmissionController>> admission_;
+};
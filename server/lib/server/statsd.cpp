@@ -0,0 +1,175 @@
+#include "statsd.h"
+
+#include <algorithm>
+#include <charconv>
+#include <map>
+
+namespace {
+
+    bool ParseDouble(std::string_view str, double& value) {
+        if (!str.empty() && str.front() == '+') {
+            str.remove_prefix(1);
+        }
+        auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+        return ec == std::errc() && end == str.data() + str.size() && !str.empty();
+    }
+
+    // Splits off the part of str before separator, or all of it.
+    std::string_view NextToken(std::string_view& str, char separator) {
+        auto position = str.find(separator);
+        auto token = str.substr(0, position);
+        str.remove_prefix(position == std::string_view::npos ? str.size() : position + 1);
+        return token;
+    }
+
+} // anonymous namespace
+
+bool ParseStatsdLine(std::string_view line, StatsdSample& sample) {
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    auto name = line.substr(0, colon);
+    auto dot = name.find('.');
+    if (dot == std::string_view::npos || dot == 0 || dot + 1 == name.size()) {
+        return false;
+    }
+    sample = StatsdSample{};
+    sample.project_id = name.substr(0, dot);
+    sample.metric = name.substr(dot + 1);
+
+    auto rest = line.substr(colon + 1);
+    auto value = NextToken(rest, '|');
+    auto type = NextToken(rest, '|');
+    if (type == "c") {
+        sample.type = STATSD_COUNTER;
+    } else if (type == "g") {
+        sample.type = STATSD_GAUGE;
+        sample.delta = !value.empty() && (value.front() == '+' || value.front() == '-');
+    } else if (type == "ms" || type == "h") {
+        sample.type = STATSD_TIMER;
+    } else {
+        return false;
+    }
+    if (!ParseDouble(value, sample.value)) {
+        return false;
+    }
+
+    while (!rest.empty()) {
+        auto field = NextToken(rest, '|');
+        if (field.starts_with('@')) {
+            if (!ParseDouble(field.substr(1), sample.sample_rate) || sample.sample_rate <= 0.0 || sample.sample_rate > 1.0) {
+                return false;
+            }
+        } else if (field.starts_with('#')) {
+            sample.tags = field.substr(1);
+        }
+        // Other extensions are skipped.
+    }
+    return true;
+}
+
+StatsdAggregator::SeriesState* StatsdAggregator::find(const StatsdSample& sample) {
+    key_.clear();
+    key_ += sample.project_id;
+    key_ += '\n';
+    key_ += sample.metric;
+    key_ += '\n';
+    key_ += sample.tags;
+    key_ += '\n';
+    key_ += static_cast<char>('0' + sample.type);
+    if (auto it = series_.find(std::string_view(key_)); it != series_.end()) {
+        return &it->second;
+    }
+    if (series_.size() >= max_series_) {
+        return nullptr;
+    }
+
+    SeriesState state;
+    state.type = sample.type;
+    state.identifiers.project_id = sample.project_id;
+    state.identifiers.metric_type = sample.type == STATSD_COUNTER ? EMetricType::SPEED : EMetricType::DOT;
+    state.identifiers.tags.emplace_back("metric=" + std::string(sample.metric));
+    auto tags = sample.tags;
+    while (!tags.empty()) {
+        auto tag = NextToken(tags, ',');
+        if (tag.empty()) {
+            continue;
+        }
+        auto& stored = state.identifiers.tags.emplace_back(tag);
+        if (auto colon = stored.find(':'); colon != std::pmr::string::npos) {
+            stored[colon] = '=';
+        }
+    }
+    return &series_.emplace(key_, std::move(state)).first->second;
+}
+
+bool StatsdAggregator::add(const StatsdSample& sample, int64_t timestamp_ms) {
+    auto* found = find(sample);
+    int64_t start = BucketOf(timestamp_ms);
+    if (!found || (start < found->flushed_until && sample.type != STATSD_COUNTER)) {
+        ++dropped_;
+        return false;
+    }
+    auto& series = *found;
+    // Samples arrive in time order, so the bucket is nearly always the last.
+    auto it = std::find_if(series.buckets.rbegin(), series.buckets.rend(), [&](const Bucket& bucket) {
+        return bucket.start == start;
+    });
+    Bucket* bucket;
+    if (it != series.buckets.rend()) {
+        bucket = &*it;
+    } else {
+        bucket = &series.buckets.emplace_back(Bucket{.start = start});
+    }
+
+    switch (sample.type) {
+        case STATSD_COUNTER:
+            bucket->value += sample.value / sample.sample_rate;
+            break;
+        case STATSD_GAUGE:
+            series.gauge = sample.delta ? series.gauge + sample.value : sample.value;
+            bucket->value = series.gauge;
+            break;
+        case STATSD_TIMER:
+            bucket->value += sample.value;
+            break;
+    }
+    ++bucket->count;
+    series.last_seen_ms = std::max(series.last_seen_ms, timestamp_ms);
+    return true;
+}
+
+std::vector<PostRequest> StatsdAggregator::flush(int64_t now_ms, int64_t grace_ms, bool everything) {
+    std::map<std::string_view, PostRequest> requests;
+    for (auto& [key, series] : series_) {
+        auto ready = std::stable_partition(series.buckets.begin(), series.buckets.end(), [&](const Bucket& bucket) {
+            return !everything && bucket.start + kBucketMilliseconds + grace_ms > now_ms;
+        });
+        if (ready == series.buckets.end()) {
+            continue;
+        }
+
+        Metric metric(series.identifiers, {});
+        for (auto it = ready; it != series.buckets.end(); ++it) {
+            double value = series.type == STATSD_TIMER ? it->value / static_cast<double>(it->count) : it->value;
+            metric.values.push_back(MetricValue{.value = value, .timestamp = it->start});
+            series.flushed_until = std::max(series.flushed_until, it->start + kBucketMilliseconds);
+        }
+        series.buckets.erase(ready, series.buckets.end());
+        requests[series.identifiers.project_id].metrics.push_back(std::move(metric));
+    }
+    std::erase_if(series_, [&](const auto& item) {
+        return item.second.buckets.empty() && item.second.last_seen_ms + kIdleMilliseconds <= now_ms;
+    });
+
+    std::vector<PostRequest> result;
+    result.reserve(requests.size());
+    for (auto& [project_id, request] : requests) {
+        result.push_back(std::move(request));
+    }
+    return result;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <lib/service/service.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// StatsD line protocol: <project>.<metric>:<value>|<type>[|@<rate>][|#<tags>]
+// with tags as comma separated key:value pairs (the DogStatsD extension).
+// The part of the name before the first dot is the project, the rest is
+// stored as the tag metric=<rest>, and every key:value tag as key=value.
+enum EStatsdType {
+    STATSD_COUNTER,
+    STATSD_GAUGE,
+    STATSD_TIMER,
+};
+
+// Views into the parsed line.
+struct StatsdSample {
+    std::string_view project_id;
+    std::string_view metric;
+    double value = 0.0;
+    EStatsdType type = STATSD_COUNTER;
+    double sample_rate = 1.0;
+    // Gauge given as +N or -N, added to the current value.
+    bool delta = false;
+    std::string_view tags;
+};
+
+// Does not allocate. False for malformed lines and unsupported types.
+bool ParseStatsdLine(std::string_view line, StatsdSample& sample);
+
+// Pre-aggregates samples into the buckets of the service, one value per
+// series and bucket: counters are summed and scaled by their sample rate
+// (stored as SPEED), gauges keep their last value and timers their mean
+// (both stored as DOT). Adding a sample to a known series does not
+// allocate; series idle for kIdleMilliseconds are forgotten on flush.
+// At most max_series series are tracked, samples of further ones are
+// dropped, as are gauge and timer samples for a bucket that was already
+// flushed, which the database would add to the stored value. Late counter
+// samples are kept: counters add up in the database anyway.
+// Not thread-safe.
+class StatsdAggregator {
+public:
+    static constexpr int64_t kIdleMilliseconds = 5 * 60 * 1000;
+    static constexpr std::size_t kMaxSeries = 100000;
+
+    explicit StatsdAggregator(std::size_t max_series = kMaxSeries)
+        : max_series_(max_series)
+    {
+    }
+
+    // False when the sample was dropped.
+    bool add(const StatsdSample& sample, int64_t timestamp_ms);
+
+    // Takes the buckets that ended at least grace_ms before now_ms, or all
+    // of them with everything set, grouped by project.
+    std::vector<PostRequest> flush(int64_t now_ms, int64_t grace_ms, bool everything = false);
+
+    std::size_t series() const {
+        return series_.size();
+    }
+
+    std::uint64_t dropped() const {
+        return dropped_;
+    }
+
+private:
+    struct Bucket {
+        int64_t start = 0;
+        double value = 0.0;
+        std::size_t count = 0;
+    };
+
+    struct SeriesState {
+        MetricIdentifiers identifiers;
+        EStatsdType type;
+        std::vector<Bucket> buckets;
+        // Gauges carry their value over from bucket to bucket.
+        double gauge = 0.0;
+        int64_t last_seen_ms = 0;
+        // Buckets starting before this were flushed.
+        int64_t flushed_until = 0;
+    };
+
+    struct KeyHash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view key) const {
+            return std::hash<std::string_view>{}(key);
+        }
+    };
+
+    // nullptr when the series is new and there are max_series_ already.
+    SeriesState* find(const StatsdSample& sample);
+
+    std::size_t max_series_;
+    std::uint64_t dropped_ = 0;
+    // project, metric, tags and type joined; reused across samples.
+    std::string key_;
+    std::unordered_map<std::string, SeriesState, KeyHash, std::equal_to<>> series_;
+};
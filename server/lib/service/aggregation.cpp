@@ -0,0 +1,255 @@
+#include "aggregation.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+std::string ToString(EAggregation aggregation) {
+    switch (aggregation) {
+        case EAggregation::SUM:
+            return "sum";
+        case EAggregation::AVG:
+            return "avg";
+        case EAggregation::MINIMUM:
+            return "min";
+        case EAggregation::MAXIMUM:
+            return "max";
+        case EAggregation::COUNT:
+            return "count";
+        default:
+            std::unreachable();
+    }
+}
+
+void ValidateIntervalSeconds(int64_t interval_seconds) {
+    if (interval_seconds <= 0 || interval_seconds > kMaxIntervalSeconds) {
+        throw std::invalid_argument("interval_seconds must be between 1 and " + std::to_string(kMaxIntervalSeconds));
+    }
+}
+
+EAggregation AggregationFromString(const std::string& str) {
+    if (str == "sum") {
+        return EAggregation::SUM;
+    }
+    if (str == "avg") {
+        return EAggregation::AVG;
+    }
+    if (str == "min") {
+        return EAggregation::MINIMUM;
+    }
+    if (str == "max") {
+        return EAggregation::MAXIMUM;
+    }
+    if (str == "count") {
+        return EAggregation::COUNT;
+    }
+    throw std::invalid_argument("Unknown aggregation: " + str);
+}
+
+void PartialAggregate::Add(double value) {
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    ++count;
+}
+
+void PartialAggregate::Merge(const PartialAggregate& other) {
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    count += other.count;
+}
+
+double PartialAggregate::Finalize(EAggregation aggregation) const {
+    switch (aggregation) {
+        case EAggregation::SUM:
+            return sum;
+        case EAggregation::AVG:
+            return count == 0 ? 0.0 : sum / static_cast<double>(count);
+        case EAggregation::MINIMUM:
+            return min;
+        case EAggregation::MAXIMUM:
+            return max;
+        case EAggregation::COUNT:
+            return static_cast<double>(count);
+        default:
+            std::unreachable();
+    }
+}
+
+Tags ParseTags(std::string_view stored) {
+    Tags tags;
+    if (stored.empty()) {
+        return tags;
+    }
+    if (stored.front() == '|') {
+        stored.remove_prefix(1);
+    }
+    while (true) {
+        auto pos = stored.find('|');
+        tags.emplace_back(stored.substr(0, pos));
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        stored.remove_prefix(pos + 1);
+    }
+    return tags;
+}
+
+std::string_view TagKey(std::string_view tag) {
+    auto pos = tag.find('=');
+    if (pos == std::string_view::npos) {
+        return {};
+    }
+    return tag.substr(0, pos);
+}
+
+std::string HistogramBoundTag(double bound) {
+    std::string tag(kHistogramBoundKey);
+    tag += '=';
+    if (std::isinf(bound) && bound > 0) {
+        tag += "+Inf";
+        return tag;
+    }
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), bound);
+    tag.append(buffer, end);
+    return tag;
+}
+
+std::optional<double> ParseHistogramBound(std::string_view bound) {
+    if (bound == "+Inf" || bound == "Inf") {
+        return std::numeric_limits<double>::infinity();
+    }
+    double value = 0.0;
+    auto [end, ec] = std::from_chars(bound.data(), bound.data() + bound.size(), value);
+    if (ec != std::errc() || end != bound.data() + bound.size() || !std::isfinite(value)) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+double HistogramQuantile(double q, std::span<const HistogramBucket> buckets) {
+    double total = 0.0;
+    for (const auto& bucket : buckets) {
+        total += bucket.count;
+    }
+    if (!(total > 0.0)) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    double rank = std::clamp(q, 0.0, 1.0) * total;
+    double below = 0.0;
+    double lower = 0.0;
+    for (std::size_t i = 0; i < buckets.size(); ++i) {
+        const auto& bucket = buckets[i];
+        lower = i == 0 ? std::min(0.0, bucket.bound) : buckets[i - 1].bound;
+        if (bucket.count > 0.0 && below + bucket.count >= rank) {
+            if (std::isinf(bucket.bound)) {
+                return lower;
+            }
+            return lower + (bucket.bound - lower) * (rank - below) / bucket.count;
+        }
+        below += bucket.count;
+    }
+    // Rounding left the rank past the last bucket.
+    return std::isinf(buckets.back().bound) ? lower : buckets.back().bound;
+}
+
+bool MatchesFilter(const Tags& series_tags, const Tags& filter) {
+    return std::all_of(filter.begin(), filter.end(), [&series_tags](const auto& tag) {
+        return std::find(series_tags.begin(), series_tags.end(), tag) != series_tags.end();
+    });
+}
+
+Tags GroupKey(const Tags& series_tags, const std::vector<std::string>& group_by) {
+    Tags key;
+    key.reserve(group_by.size());
+    for (const auto& name : group_by) {
+        auto it = std::find_if(series_tags.begin(), series_tags.end(), [&name](const auto& tag) {
+            return TagKey(tag) == name;
+        });
+        if (it != series_tags.end()) {
+            key.push_back(*it);
+        } else {
+            key.emplace_back(name).push_back('=');
+        }
+    }
+    return key;
+}
+
+namespace {
+
+    constexpr std::size_t kMinSeriesPerWorker = 64;
+
+    void AggregateRange(
+        std::vector<Series>::const_iterator begin,
+        std::vector<Series>::const_iterator end,
+        const std::vector<std::string>& group_by,
+        GroupAggregates& result
+    ) {
+        for (auto it = begin; it != end; ++it) {
+            auto& buckets = result[GroupKey(it->tags, group_by)];
+            for (std::size_t i = 0; i < it->timestamps.size(); ++i) {
+                buckets[BucketOf(it->timestamps[i])].Add(it->values[i]);
+            }
+        }
+    }
+
+    void MergeInto(GroupAggregates& target, GroupAggregates&& source) {
+        for (auto& [key, buckets] : source) {
+            auto [it, inserted] = target.try_emplace(key, std::move(buckets));
+            if (inserted) {
+                continue;
+            }
+            for (const auto& [bucket, partial] : buckets) {
+                it->second[bucket].Merge(partial);
+            }
+        }
+    }
+
+} // anonymous namespace
+
+std::size_t DefaultAggregationWorkers(std::size_t series_count) {
+    std::size_t cores = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    return std::clamp<std::size_t>(series_count / kMinSeriesPerWorker, 1, cores);
+}
+
+GroupAggregates AggregateGroups(
+    const std::vector<Series>& series,
+    const std::vector<std::string>& group_by,
+    std::size_t workers
+) {
+    workers = std::clamp<std::size_t>(workers, 1, std::max<std::size_t>(1, series.size()));
+
+    std::vector<GroupAggregates> partials(workers);
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+
+    std::size_t chunk = series.size() / workers;
+    std::size_t extra = series.size() % workers;
+    auto begin = series.begin();
+    for (std::size_t i = 0; i < workers; ++i) {
+        auto end = begin + static_cast<std::ptrdiff_t>(chunk + (i < extra ? 1 : 0));
+        if (i + 1 == workers) {
+            AggregateRange(begin, end, group_by, partials[i]);
+        } else {
+            threads.emplace_back(AggregateRange, begin, end, std::cref(group_by), std::ref(partials[i]));
+        }
+        begin = end;
+    }
+
+    std::for_each(threads.begin(), threads.end(), [](std::thread& t) {
+        t.join();
+    });
+
+    GroupAggregates result = std::move(partials.front());
+    for (std::size_t i = 1; i < partials.size(); ++i) {
+        MergeInto(result, std::move(partials[i]));
+    }
+    return result;
+}
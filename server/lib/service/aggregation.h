@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Request-side structures use polymorphic allocators, so a request can be
+// parsed and served out of a per-request arena; default-constructed
+// containers fall back to the global heap.
+using Tags = std::pmr::vector<std::pmr::string>;
+
+// bucket timestamp -> value
+using BucketValues = std::pmr::map<int64_t, double>;
+
+inline constexpr int64_t kBucketMilliseconds = 15000;
+
+// Longest window a request may cover. Keeps interval_seconds * 1000 and the
+// number of buckets in a window far from overflowing.
+inline constexpr int64_t kMaxIntervalSeconds = 366 * 24 * 3600;
+
+// Throws std::invalid_argument unless 0 < interval_seconds <= kMaxIntervalSeconds.
+void ValidateIntervalSeconds(int64_t interval_seconds);
+
+inline int64_t BucketOf(int64_t timestamp_ms) {
+    return (timestamp_ms / kBucketMilliseconds) * kBucketMilliseconds;
+}
+
+enum EAggregation {
+    SUM,
+    AVG,
+    MINIMUM,
+    MAXIMUM,
+    COUNT,
+};
+
+std::string ToString(EAggregation aggregation);
+EAggregation AggregationFromString(const std::string& str);
+
+// One series in column layout: timestamps[i] belongs to values[i].
+struct Series {
+    Tags tags;
+    std::vector<int64_t> timestamps;
+    std::vector<double> values;
+};
+
+// Mergeable state of every supported aggregation, so workers can
+// aggregate disjoint sets of series and combine the results afterwards.
+struct PartialAggregate {
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    int64_t count = 0;
+
+    void Add(double value);
+    void Merge(const PartialAggregate& other);
+    double Finalize(EAggregation aggregation) const;
+};
+
+// bucket timestamp -> partial aggregate
+using BucketAggregates = std::map<int64_t, PartialAggregate>;
+// group key -> buckets
+using GroupAggregates = std::map<Tags, BucketAggregates>;
+
+// Splits the '|'-joined tag string stored in the database ("|a|b") back into tags.
+Tags ParseTags(std::string_view stored);
+
+// "key=value" tags are addressed by their key; plain tags have no key.
+std::string_view TagKey(std::string_view tag);
+
+// A HISTOGRAM metric is stored as one series per bucket: its tags plus
+// le=<upper bound>, valued with the number of samples that fell into the
+// bucket (not below the bound, so buckets are independent and sum across
+// time and series). Empty buckets are not stored.
+inline constexpr std::string_view kHistogramBoundKey = "le";
+
+// "le=0.25"; an infinite bound is written "le=+Inf".
+std::string HistogramBoundTag(double bound);
+// Parses a bound as written by HistogramBoundTag, or "Inf"/"+Inf".
+std::optional<double> ParseHistogramBound(std::string_view bound);
+
+struct HistogramBucket {
+    double bound;
+    double count;
+};
+
+// Estimates the q-quantile of the buckets, sorted by bound, by linear
+// interpolation inside the bucket the quantile falls into. The first
+// bucket starts at 0 (or at its bound if that is not positive), a
+// quantile in the +Inf bucket is the highest finite bound. NaN without
+// samples.
+double HistogramQuantile(double q, std::span<const HistogramBucket> buckets);
+
+// True if every tag of the filter is present in the series tags.
+bool MatchesFilter(const Tags& series_tags, const Tags& filter);
+
+// Picks the "key=value" tags named by group_by, in group_by order.
+// A series without some key gets "key=" in its place.
+Tags GroupKey(const Tags& series_tags, const std::vector<std::string>& group_by);
+
+// Aggregates the series into groups in parallel: every worker folds a
+// contiguous range of series into its own GroupAggregates, and the partial
+// results are merged once all workers are done.
+GroupAggregates AggregateGroups(
+    const std::vector<Series>& series,
+    const std::vector<std::string>& group_by,
+    std::size_t workers
+);
+
+std::size_t DefaultAggregationWorkers(std::size_t series_count);
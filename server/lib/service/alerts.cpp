@@ -0,0 +1,205 @@
+#include "alerts.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+    constexpr std::size_t kMaxPendingEvents = 10000;
+
+    std::string JoinTags(const Tags& tags) {
+        std::string joined;
+        for (const auto& tag : tags) {
+            joined += '|';
+            joined += tag;
+        }
+        return joined;
+    }
+
+} // anonymous namespace
+
+std::string ToString(EAlertCondition condition) {
+    switch (condition) {
+        case EAlertCondition::ABOVE:
+            return "above";
+        case EAlertCondition::BELOW:
+            return "below";
+        case EAlertCondition::RATE_OF_CHANGE:
+            return "rate_of_change";
+        case EAlertCondition::ABSENT:
+            return "absent";
+        default:
+            std::unreachable();
+    }
+}
+
+EAlertCondition AlertConditionFromString(const std::string& str) {
+    if (str == "above") {
+        return EAlertCondition::ABOVE;
+    }
+    if (str == "below") {
+        return EAlertCondition::BELOW;
+    }
+    if (str == "rate_of_change") {
+        return EAlertCondition::RATE_OF_CHANGE;
+    }
+    if (str == "absent") {
+        return EAlertCondition::ABSENT;
+    }
+    throw std::invalid_argument("Unknown alert condition: " + str);
+}
+
+AlertEngine& AlertEngine::Instance() {
+    static AlertEngine engine;
+    return engine;
+}
+
+void AlertEngine::AddRule(AlertRule rule) {
+    std::lock_guard lock(mutex_);
+    std::string id = rule.id;
+    rules_.insert_or_assign(std::move(id), RuleState{.rule = std::move(rule), .series = {}});
+}
+
+bool AlertEngine::RemoveRule(const std::string& id) {
+    std::lock_guard lock(mutex_);
+    return rules_.erase(id) > 0;
+}
+
+std::vector<AlertRule> AlertEngine::Rules() const {
+    std::lock_guard lock(mutex_);
+    std::vector<AlertRule> rules;
+    rules.reserve(rules_.size());
+    for (const auto& [id, state] : rules_) {
+        rules.push_back(state.rule);
+    }
+    return rules;
+}
+
+void AlertEngine::OnBuckets(
+    std::string_view project_id,
+    const Tags& tags,
+    const BucketValues& buckets,
+    int64_t now_ms
+) {
+    std::lock_guard lock(mutex_);
+    if (rules_.empty()) {
+        return;
+    }
+
+    std::string key;
+    for (auto& [id, rule_state] : rules_) {
+        const auto& rule = rule_state.rule;
+        if (rule.project_id != project_id || !MatchesFilter(tags, rule.tags)) {
+            continue;
+        }
+        if (key.empty()) {
+            key = JoinTags(tags);
+        }
+
+        auto [it, inserted] = rule_state.series.try_emplace(key);
+        SeriesState& state = it->second;
+        if (inserted) {
+            state.project_id = project_id;
+            state.tags = tags;
+        }
+        state.last_seen_ms = now_ms;
+
+        for (const auto& [bucket, value] : buckets) {
+            if (bucket < state.bucket) {
+                // Late data for an already evaluated bucket.
+                continue;
+            }
+            if (bucket != state.bucket) {
+                if (state.bucket >= 0) {
+                    state.previous_bucket = state.bucket;
+                    state.previous_value = state.bucket_value;
+                    state.has_previous = true;
+                }
+                state.bucket = bucket;
+            }
+            state.bucket_value = value;
+            Evaluate(rule_state, state, now_ms);
+        }
+    }
+}
+
+void AlertEngine::Sweep(int64_t now_ms) {
+    std::lock_guard lock(mutex_);
+    for (auto& [id, rule_state] : rules_) {
+        const auto& rule = rule_state.rule;
+        bool absence = rule.condition == EAlertCondition::ABSENT;
+        int64_t ttl_ms = kSeriesTtlMilliseconds + (absence ? rule.absent_seconds * 1000 : 0);
+        for (auto it = rule_state.series.begin(); it != rule_state.series.end();) {
+            auto& state = it->second;
+            if (absence) {
+                Evaluate(rule_state, state, now_ms);
+            }
+            if (now_ms - state.last_seen_ms > ttl_ms) {
+                it = rule_state.series.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+std::vector<AlertEvent> AlertEngine::DrainEvents(std::size_t max_events) {
+    std::lock_guard lock(mutex_);
+    std::size_t count = std::min(max_events, events_.size());
+    std::vector<AlertEvent> events(
+        std::make_move_iterator(events_.begin()),
+        std::make_move_iterator(events_.begin() + static_cast<std::ptrdiff_t>(count)));
+    events_.erase(events_.begin(), events_.begin() + static_cast<std::ptrdiff_t>(count));
+    return events;
+}
+
+void AlertEngine::Evaluate(RuleState& rule_state, SeriesState& state, int64_t now_ms) {
+    const auto& rule = rule_state.rule;
+    switch (rule.condition) {
+        case EAlertCondition::ABOVE:
+            Transition(rule, state, state.bucket_value > rule.threshold, state.bucket_value, state.bucket);
+            break;
+        case EAlertCondition::BELOW:
+            Transition(rule, state, state.bucket_value < rule.threshold, state.bucket_value, state.bucket);
+            break;
+        case EAlertCondition::RATE_OF_CHANGE: {
+            if (!state.has_previous) {
+                break;
+            }
+            // Buckets may be missing in between, so the change is spread over
+            // the real distance between them.
+            double seconds = static_cast<double>(state.bucket - state.previous_bucket) / 1000.0;
+            double per_second = (state.bucket_value - state.previous_value) / seconds;
+            Transition(rule, state, std::abs(per_second) > rule.threshold, per_second, state.bucket);
+            break;
+        }
+        case EAlertCondition::ABSENT: {
+            int64_t silent_ms = now_ms - state.last_seen_ms;
+            Transition(rule, state, silent_ms > rule.absent_seconds * 1000, static_cast<double>(silent_ms) / 1000.0, now_ms);
+            break;
+        }
+        default:
+            std::unreachable();
+    }
+}
+
+void AlertEngine::Transition(const AlertRule& rule, SeriesState& state, bool firing, double value, int64_t timestamp) {
+    if (state.firing == firing) {
+        return;
+    }
+    state.firing = firing;
+    if (events_.size() >= kMaxPendingEvents) {
+        events_.pop_front();
+    }
+    events_.push_back(AlertEvent{
+        .rule_id = rule.id,
+        .project_id = state.project_id,
+        .tags = state.tags,
+        .firing = firing,
+        .value = value,
+        .timestamp = timestamp
+    });
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "aggregation.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum EAlertCondition {
+    ABOVE,
+    BELOW,
+    RATE_OF_CHANGE,
+    ABSENT,
+};
+
+std::string ToString(EAlertCondition condition);
+EAlertCondition AlertConditionFromString(const std::string& str);
+
+struct AlertRule {
+    std::string id;
+    std::string project_id;
+    // Series must carry all of these tags.
+    Tags tags;
+    EAlertCondition condition;
+    // ABOVE/BELOW: bucket value, RATE_OF_CHANGE: absolute change per second.
+    double threshold = 0.0;
+    // ABSENT: how long a series may stay silent.
+    int64_t absent_seconds = 0;
+};
+
+struct AlertEvent {
+    std::string rule_id;
+    std::string project_id;
+    Tags tags;
+    bool firing;
+    double value;
+    int64_t timestamp;
+};
+
+// Evaluates alert rules incrementally on the ingest path. Every matching
+// series keeps a small state per rule, so a written bucket costs O(rules)
+// and nobody has to poll /get to find out whether a threshold was crossed.
+class AlertEngine {
+public:
+    // Series state not updated for this long past the window of its rule is
+    // dropped by Sweep, so series that stop reporting do not pile up.
+    static constexpr int64_t kSeriesTtlMilliseconds = 60 * 60 * 1000;
+
+    static AlertEngine& Instance();
+
+    void AddRule(AlertRule rule);
+    bool RemoveRule(const std::string& id);
+    std::vector<AlertRule> Rules() const;
+
+    // Called once the buckets of a series have been committed, with the
+    // values they were stored with; a bucket seen again replaces its value.
+    void OnBuckets(std::string_view project_id, const Tags& tags, const BucketValues& buckets, int64_t now_ms);
+    // Fires ABSENT rules for series that have been silent for too long and
+    // drops expired series state. Scans every series of every rule, so it
+    // runs on a timer, not per write.
+    void Sweep(int64_t now_ms);
+
+    std::vector<AlertEvent> DrainEvents(std::size_t max_events);
+
+private:
+    struct SeriesState {
+        std::string project_id;
+        Tags tags;
+        int64_t bucket = -1;
+        double bucket_value = 0.0;
+        int64_t previous_bucket = -1;
+        double previous_value = 0.0;
+        bool has_previous = false;
+        int64_t last_seen_ms = 0;
+        bool firing = false;
+    };
+
+    struct RuleState {
+        AlertRule rule;
+        // '|'-joined tags -> state
+        std::unordered_map<std::string, SeriesState> series;
+    };
+
+    void Evaluate(RuleState& rule, SeriesState& state, int64_t now_ms);
+    void Transition(const AlertRule& rule, SeriesState& state, bool firing, double value, int64_t timestamp);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, RuleState> rules_;
+    std::deque<AlertEvent> events_;
+};
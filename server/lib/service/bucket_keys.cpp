@@ -0,0 +1,102 @@
+#include "bucket_keys.h"
+#include "service.h"
+
+#include <format>
+#include <iostream>
+
+BucketKeys& BucketKeys::Instance() {
+    static BucketKeys keys;
+    return keys;
+}
+
+std::string BucketKeys::IndexName(std::string_view project_id) {
+    return std::string(project_id) + "_bucket_key";
+}
+
+std::optional<BucketLayout> BucketKeys::Inspect(std::string_view project_id, pqxx::work& tx) {
+    auto table = tx.quote(tx.quote_name(project_id));
+    auto row = tx.exec(std::format(R"(
+        SELECT
+            to_regclass({0}) IS NOT NULL,
+            to_regclass({1}) IS NOT NULL,
+            EXISTS (
+                SELECT 1 FROM pg_attribute
+                WHERE attrelid = to_regclass({0}) AND attname = 'sample_ms' AND NOT attisdropped
+            );
+    )", table, tx.quote(tx.quote_name(IndexName(project_id)))))[0];
+    if (!row[0].as<bool>()) {
+        return std::nullopt;
+    }
+    return BucketLayout{.keyed = row[1].as<bool>(), .sampled = row[2].as<bool>()};
+}
+
+BucketLayout BucketKeys::Layout(std::string_view project_id, pqxx::work& tx) {
+    if (KnownCurrent(project_id)) {
+        return BucketLayout{.keyed = true, .sampled = true};
+    }
+    auto layout = Inspect(project_id, tx);
+    if (!layout) {
+        return {};
+    }
+
+    std::lock_guard lock(mutex_);
+    if (layout->current()) {
+        current_.emplace(project_id);
+    } else if (queued_.emplace(project_id).second) {
+        queue_.emplace_back(project_id);
+        queued_changed_.notify_one();
+    }
+    return *layout;
+}
+
+bool BucketKeys::KnownCurrent(std::string_view project_id) const {
+    std::lock_guard lock(mutex_);
+    return current_.contains(project_id);
+}
+
+void BucketKeys::MarkCurrent(std::string_view project_id) {
+    std::lock_guard lock(mutex_);
+    current_.emplace(project_id);
+}
+
+std::optional<std::string> BucketKeys::TakeQueued(std::stop_token stop) {
+    std::unique_lock lock(mutex_);
+    if (!queued_changed_.wait(lock, stop, [this] { return !queue_.empty(); })) {
+        return std::nullopt;
+    }
+    auto project_id = std::move(queue_.front());
+    queue_.pop_front();
+    return project_id;
+}
+
+void BucketKeys::Release(const std::string& project_id) {
+    std::lock_guard lock(mutex_);
+    queued_.erase(project_id);
+}
+
+BucketKeyMigrator::BucketKeyMigrator()
+    : thread_([this](std::stop_token stop) { run(stop); })
+{
+}
+
+void BucketKeyMigrator::stop() {
+    thread_.request_stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void BucketKeyMigrator::run(std::stop_token stop) {
+    auto& keys = BucketKeys::Instance();
+    while (auto project_id = keys.TakeQueued(stop)) {
+        try {
+            MonitoringService service;
+            if (service.MigrateBucketKey(*project_id, stop)) {
+                keys.MarkCurrent(*project_id);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: migrating the bucket layout of " << *project_id << ": " << e.what() << "\n";
+        }
+        keys.Release(*project_id);
+    }
+}
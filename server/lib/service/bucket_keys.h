@@ -0,0 +1,92 @@
+#pragma once
+
+#include <pqxx/pqxx>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+
+// What a project table has of the layout DoPost writes.
+struct BucketLayout {
+    // The unique (tags, time) key: every bucket is one row.
+    bool keyed = false;
+    // The sample_ms column, the time of the sample a counter bucket holds.
+    bool sampled = false;
+
+    bool current() const {
+        return keyed && sampled;
+    }
+};
+
+// Which project tables have the current BucketLayout. Tables made before
+// the key may hold several rows of a bucket: until they get it, writes
+// append to them and reads merge the rows of a bucket. The first statement
+// about such a table queues it for a BucketKeyMigrator, and a table once
+// current stays known as current.
+class BucketKeys {
+public:
+    static BucketKeys& Instance();
+
+    // Name of the key of a project table, unquoted.
+    static std::string IndexName(std::string_view project_id);
+    // Asks the database, within tx. nullopt when the table does not exist.
+    static std::optional<BucketLayout> Inspect(std::string_view project_id, pqxx::work& tx);
+
+    // Asks the database until the table is current, and queues it for
+    // migration while it is not. A missing table is left to the statement
+    // that needs it to fail.
+    BucketLayout Layout(std::string_view project_id, pqxx::work& tx);
+    // Current as last seen, without asking.
+    bool KnownCurrent(std::string_view project_id) const;
+    void MarkCurrent(std::string_view project_id);
+
+    // Migrator side. Waits for a queued table, nullopt once stop is
+    // requested.
+    std::optional<std::string> TakeQueued(std::stop_token stop);
+    // Done with a taken table, which is queued again by the next statement
+    // about it if it is still not current.
+    void Release(const std::string& project_id);
+
+private:
+    BucketKeys() = default;
+
+    struct Hash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view value) const {
+            return std::hash<std::string_view>{}(value);
+        }
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable_any queued_changed_;
+    std::unordered_set<std::string, Hash, std::equal_to<>> current_;
+    // Queued or being migrated.
+    std::unordered_set<std::string, Hash, std::equal_to<>> queued_;
+    std::deque<std::string> queue_;
+};
+
+// Thread bringing the tables BucketKeys queues to the current layout, one at a
+// time through MonitoringService::MigrateBucketKey. A table that fails or
+// is interrupted is tried again once a statement queues it again.
+class BucketKeyMigrator {
+public:
+    BucketKeyMigrator();
+
+    BucketKeyMigrator(const BucketKeyMigrator&) = delete;
+    BucketKeyMigrator& operator=(const BucketKeyMigrator&) = delete;
+
+    // Interrupts a migration between two of its transactions and joins the
+    // thread.
+    void stop();
+
+private:
+    void run(std::stop_token stop);
+
+    std::jthread thread_;
+};
@@ -0,0 +1,170 @@
+#include "ingest.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+MpscQueue::MpscQueue()
+    : head_(&stub_)
+    , tail_(&stub_)
+{
+}
+
+void MpscQueue::push(MpscNode* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    auto* previous = head_.exchange(node, std::memory_order_acq_rel);
+    // Until this store the node is not reachable from the tail.
+    previous->next.store(node, std::memory_order_release);
+}
+
+MpscNode* MpscQueue::pop() {
+    auto* tail = tail_;
+    auto* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+        if (!next) {
+            return nullptr;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+        tail_ = next;
+        return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+        // A producer swapped the head but has not linked its node yet.
+        return nullptr;
+    }
+    // tail is the last node: the stub goes behind it so it can be taken.
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+bool MpscQueue::empty() const {
+    return tail_ == &stub_ && !stub_.next.load(std::memory_order_acquire);
+}
+
+IngestPipeline::IngestPipeline(std::size_t writers, StoreFunction store, std::size_t max_batch_metrics)
+    : store_(std::move(store))
+    , max_batch_metrics_(max_batch_metrics)
+{
+    if (!store_) {
+        store_ = [](std::span<const PostRequest* const> requests) {
+            MonitoringService service;
+            service.DoPost(requests);
+        };
+    }
+    for (std::size_t i = 0; i < std::max<std::size_t>(1, writers); ++i) {
+        writers_.push_back(std::make_unique<Writer>());
+    }
+    for (auto& writer : writers_) {
+        writer->thread = std::thread([this, &writer = *writer] { run(writer); });
+    }
+}
+
+IngestPipeline::~IngestPipeline() {
+    stop();
+}
+
+std::size_t IngestPipeline::shard() {
+    return next_shard_.fetch_add(1, std::memory_order_relaxed) % writers_.size();
+}
+
+void IngestPipeline::push(std::size_t shard, const PostRequest& request, Completion done) {
+    auto batch = std::make_unique<Batch>();
+    batch->request = &request;
+    for (const auto& metric : request.metrics) {
+        batch->metrics += metric.values.size();
+    }
+    batch->done = std::move(done);
+
+    auto& writer = *writers_[shard % writers_.size()];
+    writer.queue.push(batch.release());
+    // Pairs with the writer that marks itself sleeping and then checks the
+    // queue once more: one of the two sees the other.
+    writer.pushed.fetch_add(1, std::memory_order_seq_cst);
+    if (writer.sleeping.load(std::memory_order_seq_cst)) {
+        writer.pushed.notify_one();
+    }
+}
+
+void IngestPipeline::stop() {
+    if (stopping_.exchange(true)) {
+        return;
+    }
+    for (auto& writer : writers_) {
+        writer->pushed.fetch_add(1, std::memory_order_seq_cst);
+        writer->pushed.notify_one();
+    }
+    for (auto& writer : writers_) {
+        if (writer->thread.joinable()) {
+            writer->thread.join();
+        }
+    }
+}
+
+void IngestPipeline::run(Writer& writer) {
+    std::vector<std::unique_ptr<Batch>> batches;
+    for (;;) {
+        std::size_t metrics = 0;
+        while (metrics < max_batch_metrics_) {
+            auto* node = writer.queue.pop();
+            if (!node) {
+                break;
+            }
+            auto& batch = batches.emplace_back(static_cast<Batch*>(node));
+            metrics += batch->metrics;
+        }
+        if (!batches.empty()) {
+            store(batches);
+            batches.clear();
+            continue;
+        }
+
+        auto seen = writer.pushed.load(std::memory_order_seq_cst);
+        writer.sleeping.store(true, std::memory_order_seq_cst);
+        if (writer.queue.empty()) {
+            if (stopping_.load(std::memory_order_seq_cst)) {
+                writer.sleeping.store(false, std::memory_order_relaxed);
+                return;
+            }
+            writer.pushed.wait(seen, std::memory_order_seq_cst);
+        }
+        writer.sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+void IngestPipeline::store(std::vector<std::unique_ptr<Batch>>& batches) {
+    std::vector<const PostRequest*> requests;
+    requests.reserve(batches.size());
+    for (const auto& batch : batches) {
+        requests.push_back(batch->request);
+    }
+    std::exception_ptr error;
+    try {
+        store_(requests);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (!error || batches.size() == 1) {
+        for (auto& batch : batches) {
+            batch->done(error);
+        }
+        return;
+    }
+    for (auto& batch : batches) {
+        error = nullptr;
+        try {
+            store_(std::span(&batch->request, 1));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        batch->done(error);
+    }
+}
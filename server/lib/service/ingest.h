@@ -0,0 +1,107 @@
+#pragma once
+
+#include "service.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+// Link of the elements of an MpscQueue.
+struct MpscNode {
+    std::atomic<MpscNode*> next{nullptr};
+};
+
+// Unbounded intrusive queue of many producers and one consumer (Vyukov's):
+// push() is a single exchange and never waits, pop() does not either but
+// may miss a node whose push is halfway done until it is called again.
+class MpscQueue {
+public:
+    MpscQueue();
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Any thread. The queue does not own node.
+    void push(MpscNode* node);
+    // Consumer only. nullptr when there is nothing to take.
+    MpscNode* pop();
+    // Consumer only.
+    bool empty() const;
+
+private:
+    std::atomic<MpscNode*> head_;
+    // Consumer side.
+    MpscNode* tail_;
+    MpscNode stub_;
+};
+
+// Second stage of /post: the workers parse bodies and queue the batches,
+// dedicated writer threads store them, each through a database connection
+// of its own, so parsing keeps the cores busy while the writers keep the
+// database busy. A writer takes whatever its queue holds, up to
+// max_batch_metrics metrics, and stores it in one transaction.
+class IngestPipeline {
+public:
+    // Stores the batches in one transaction, or throws.
+    using StoreFunction = std::function<void(std::span<const PostRequest* const>)>;
+    // Called on the writer thread once a batch is committed, with the error
+    // if it could not be.
+    using Completion = std::function<void(std::exception_ptr)>;
+
+    static constexpr std::size_t kMaxBatchMetrics = 8192;
+
+    // A queue and a thread per writer; store defaults to a MonitoringService
+    // of the writer thread.
+    explicit IngestPipeline(std::size_t writers, StoreFunction store = {}, std::size_t max_batch_metrics = kMaxBatchMetrics);
+    ~IngestPipeline();
+
+    IngestPipeline(const IngestPipeline&) = delete;
+    IngestPipeline& operator=(const IngestPipeline&) = delete;
+
+    // Queue for the batches of a request, taken in turns. Batches sent to
+    // one queue are stored in order.
+    std::size_t shard();
+
+    // Queues request without copying it, so it must stay alive and
+    // unchanged until done is called. A transaction that fails is retried
+    // batch by batch, so one bad batch fails alone.
+    void push(std::size_t shard, const PostRequest& request, Completion done);
+
+    std::size_t writers() const {
+        return writers_.size();
+    }
+
+    // Stores what is queued and joins the writers; push() must not be
+    // called any more.
+    void stop();
+
+private:
+    struct Batch : MpscNode {
+        const PostRequest* request = nullptr;
+        std::size_t metrics = 0;
+        Completion done;
+    };
+
+    struct Writer {
+        MpscQueue queue;
+        // Bumped by every push, waited on by an idle writer.
+        std::atomic<std::uint32_t> pushed{0};
+        std::atomic<bool> sleeping{false};
+        std::thread thread;
+    };
+
+    void run(Writer& writer);
+    void store(std::vector<std::unique_ptr<Batch>>& batches);
+
+    StoreFunction store_;
+    std::size_t max_batch_metrics_;
+    std::vector<std::unique_ptr<Writer>> writers_;
+    std::atomic<std::size_t> next_shard_{0};
+    std::atomic<bool> stopping_{false};
+};
@@ -0,0 +1,315 @@
+#include "query.h"
+
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+    // Parentheses, function calls and unary minus nest by recursion, and
+    // operator chains build trees that planning recurses over, so both are
+    // capped well below what a thread stack holds.
+    constexpr std::size_t kMaxQueryDepth = 64;
+    constexpr std::size_t kMaxQueryOperators = 1024;
+
+    bool IsWordChar(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool IsTagChar(char c) {
+        return IsWordChar(c) || c == '=' || c == '.' || c == ':' || c == '-' || c == '/';
+    }
+
+    QueryNodePtr MakeNode(EQueryNodeKind kind) {
+        auto node = std::make_unique<QueryNode>();
+        node->kind = kind;
+        return node;
+    }
+
+    class QueryParser {
+    public:
+        explicit QueryParser(std::string_view text)
+            : text_(text)
+        {
+        }
+
+        QueryNodePtr Parse() {
+            auto node = ParseExpression();
+            SkipSpaces();
+            if (pos_ != text_.size()) {
+                Fail("unexpected input");
+            }
+            return node;
+        }
+
+    private:
+        QueryNodePtr ParseExpression() {
+            auto node = ParseTerm();
+            while (true) {
+                SkipSpaces();
+                if (Peek() != '+' && Peek() != '-') {
+                    return node;
+                }
+                char op = text_[pos_++];
+                node = MakeBinary(op, std::move(node), ParseTerm());
+            }
+        }
+
+        QueryNodePtr ParseTerm() {
+            auto node = ParseUnary();
+            while (true) {
+                SkipSpaces();
+                if (Peek() != '*' && Peek() != '/') {
+                    return node;
+                }
+                char op = text_[pos_++];
+                node = MakeBinary(op, std::move(node), ParseUnary());
+            }
+        }
+
+        // Every nested expression passes through here, so this is where
+        // the depth is counted.
+        QueryNodePtr ParseUnary() {
+            if (depth_ == kMaxQueryDepth) {
+                Fail("expression nested deeper than " + std::to_string(kMaxQueryDepth) + " levels");
+            }
+            ++depth_;
+            SkipSpaces();
+            QueryNodePtr node;
+            if (Peek() == '-') {
+                ++pos_;
+                auto zero = MakeNode(EQueryNodeKind::NUMBER);
+                node = MakeBinary('-', std::move(zero), ParseUnary());
+            } else {
+                node = ParsePrimary();
+            }
+            --depth_;
+            return node;
+        }
+
+        QueryNodePtr ParsePrimary() {
+            SkipSpaces();
+            char c = Peek();
+            if (c == '(') {
+                ++pos_;
+                auto node = ParseExpression();
+                Expect(')');
+                return node;
+            }
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                auto node = MakeNode(EQueryNodeKind::NUMBER);
+                node->number = ParseNumber();
+                return node;
+            }
+            if (!IsWordChar(c)) {
+                Fail("expected expression");
+            }
+
+            std::string_view word = ParseWord();
+            SkipSpaces();
+            if (Peek() == '{') {
+                return ParseSelector(word);
+            }
+            if (word == "rate") {
+                auto node = MakeNode(EQueryNodeKind::RATE);
+                Expect('(');
+                node->children.push_back(ParseExpression());
+                Expect(')');
+                return node;
+            }
+            if (word == "increase") {
+                auto node = MakeNode(EQueryNodeKind::INCREASE);
+                Expect('(');
+                node->children.push_back(ParseExpression());
+                Expect(')');
+                return node;
+            }
+            if (word == "histogram_quantile") {
+                auto node = MakeNode(EQueryNodeKind::HISTOGRAM_QUANTILE);
+                Expect('(');
+                SkipSpaces();
+                node->number = ParseNumber();
+                if (node->number < 0.0 || node->number > 1.0) {
+                    Fail("quantile must be between 0 and 1");
+                }
+                Expect(',');
+                node->children.push_back(ParseExpression());
+                Expect(')');
+                return node;
+            }
+            if (word.starts_with("moving_")) {
+                auto node = MakeNode(EQueryNodeKind::MOVING);
+                node->aggregation = ParseAggregation(word.substr(std::string_view("moving_").size()));
+                Expect('(');
+                node->children.push_back(ParseExpression());
+                Expect(',');
+                node->window_ms = ParseDuration();
+                Expect(')');
+                return node;
+            }
+
+            auto node = MakeNode(EQueryNodeKind::AGGREGATE);
+            node->aggregation = ParseAggregation(word);
+            SkipSpaces();
+            if (IsWordChar(Peek())) {
+                if (ParseWord() != "by") {
+                    Fail("expected 'by'");
+                }
+                Expect('(');
+                do {
+                    SkipSpaces();
+                    node->by.emplace_back(ParseWord());
+                } while (TryConsume(','));
+                Expect(')');
+            }
+            Expect('(');
+            node->children.push_back(ParseExpression());
+            Expect(')');
+            return node;
+        }
+
+        QueryNodePtr ParseSelector(std::string_view project_id) {
+            auto node = MakeNode(EQueryNodeKind::SELECTOR);
+            node->project_id = project_id;
+            Expect('{');
+            SkipSpaces();
+            if (TryConsume('}')) {
+                return node;
+            }
+            do {
+                SkipSpaces();
+                node->tags.emplace_back(ParseTag());
+            } while (TryConsume(','));
+            Expect('}');
+            return node;
+        }
+
+        std::string ParseTag() {
+            if (Peek() == '"') {
+                ++pos_;
+                auto end = text_.find('"', pos_);
+                if (end == std::string_view::npos) {
+                    Fail("unterminated string");
+                }
+                std::string tag(text_.substr(pos_, end - pos_));
+                pos_ = end + 1;
+                return tag;
+            }
+            auto begin = pos_;
+            while (pos_ < text_.size() && IsTagChar(text_[pos_])) {
+                ++pos_;
+            }
+            if (begin == pos_) {
+                Fail("expected tag");
+            }
+            return std::string(text_.substr(begin, pos_ - begin));
+        }
+
+        EAggregation ParseAggregation(std::string_view name) {
+            try {
+                return AggregationFromString(std::string(name));
+            } catch (const std::invalid_argument&) {
+                Fail("unknown function '" + std::string(name) + "'");
+            }
+        }
+
+        double ParseNumber() {
+            double value = 0.0;
+            auto [ptr, ec] = std::from_chars(text_.data() + pos_, text_.data() + text_.size(), value);
+            if (ec != std::errc()) {
+                Fail("expected number");
+            }
+            pos_ = ptr - text_.data();
+            return value;
+        }
+
+        int64_t ParseDuration() {
+            SkipSpaces();
+            double amount = ParseNumber();
+            double unit_ms = 0.0;
+            switch (Peek()) {
+                case 's':
+                    unit_ms = 1000.0;
+                    break;
+                case 'm':
+                    unit_ms = 60.0 * 1000.0;
+                    break;
+                case 'h':
+                    unit_ms = 3600.0 * 1000.0;
+                    break;
+                default:
+                    Fail("expected duration unit (s, m or h)");
+            }
+            ++pos_;
+            // Checked as a double, since converting an out of range value to
+            // int64_t is undefined.
+            double milliseconds = amount * unit_ms;
+            if (!std::isfinite(milliseconds) || milliseconds < 0.0 || milliseconds > static_cast<double>(kMaxIntervalSeconds) * 1000.0) {
+                Fail("duration out of range");
+            }
+            return static_cast<int64_t>(milliseconds);
+        }
+
+        std::string_view ParseWord() {
+            auto begin = pos_;
+            while (pos_ < text_.size() && IsWordChar(text_[pos_])) {
+                ++pos_;
+            }
+            if (begin == pos_) {
+                Fail("expected identifier");
+            }
+            return text_.substr(begin, pos_ - begin);
+        }
+
+        QueryNodePtr MakeBinary(char op, QueryNodePtr lhs, QueryNodePtr rhs) {
+            if (++operators_ > kMaxQueryOperators) {
+                Fail("more than " + std::to_string(kMaxQueryOperators) + " operators");
+            }
+            auto node = MakeNode(EQueryNodeKind::BINARY);
+            node->op = op;
+            node->children.push_back(std::move(lhs));
+            node->children.push_back(std::move(rhs));
+            return node;
+        }
+
+        void SkipSpaces() {
+            while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+                ++pos_;
+            }
+        }
+
+        char Peek() const {
+            return pos_ < text_.size() ? text_[pos_] : '\0';
+        }
+
+        bool TryConsume(char c) {
+            SkipSpaces();
+            if (Peek() != c) {
+                return false;
+            }
+            ++pos_;
+            return true;
+        }
+
+        void Expect(char c) {
+            if (!TryConsume(c)) {
+                Fail(std::string("expected '") + c + "'");
+            }
+        }
+
+        [[noreturn]] void Fail(const std::string& message) const {
+            throw QueryError("Query error at position " + std::to_string(pos_) + ": " + message);
+        }
+
+        std::string_view text_;
+        std::size_t pos_ = 0;
+        std::size_t depth_ = 0;
+        std::size_t operators_ = 0;
+    };
+
+} // anonymous namespace
+
+QueryNodePtr ParseQuery(std::string_view text) {
+    return QueryParser(text).Parse();
+}
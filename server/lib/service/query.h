@@ -0,0 +1,65 @@
+#pragma once
+
+#include "aggregation.h"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Expression language for /query:
+//
+//   expr      := term (('+' | '-') term)*
+//   term      := unary (('*' | '/') unary)*
+//   unary     := '-' unary | primary
+//   primary   := number | '(' expr ')' | selector | function
+//   selector  := project '{' [tag (',' tag)*] '}'
+//   function  := ('rate' | 'increase') '(' expr ')'
+//              | ('sum' | 'avg' | 'min' | 'max' | 'count') ['by' '(' key (',' key)* ')'] '(' expr ')'
+//              | ('moving_sum' | 'moving_avg' | 'moving_min' | 'moving_max') '(' expr ',' duration ')'
+//              | 'histogram_quantile' '(' number ',' expr ')'
+//   duration  := number ('s' | 'm' | 'h')
+//
+// Example: sum by (region) (rate(web{env=prod})) / 2
+
+class QueryError : public std::invalid_argument {
+public:
+    using std::invalid_argument::invalid_argument;
+};
+
+enum EQueryNodeKind {
+    NUMBER,
+    SELECTOR,
+    RATE,
+    AGGREGATE,
+    BINARY,
+    MOVING,
+    HISTOGRAM_QUANTILE,
+    INCREASE,
+};
+
+struct QueryNode {
+    EQueryNodeKind kind;
+
+    // NUMBER, and the quantile of HISTOGRAM_QUANTILE
+    double number = 0.0;
+    // SELECTOR
+    std::string project_id;
+    Tags tags;
+    // AGGREGATE and MOVING
+    EAggregation aggregation = EAggregation::SUM;
+    // AGGREGATE
+    std::vector<std::string> by;
+    // BINARY: one of + - * /
+    char op = 0;
+    // MOVING
+    int64_t window_ms = 0;
+
+    std::vector<std::unique_ptr<QueryNode>> children;
+};
+
+using QueryNodePtr = std::unique_ptr<QueryNode>;
+
+// Throws QueryError with the offending position on malformed input.
+QueryNodePtr ParseQuery(std::string_view text);
@@ -0,0 +1,528 @@
+#include "query_plan.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+    constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+    template <class F>
+    void ApplyColumns(const double* lhs, const double* rhs, double* out, std::size_t length, F op) {
+        for (std::size_t i = 0; i < length; ++i) {
+            out[i] = op(lhs[i], rhs[i]);
+        }
+    }
+
+    template <class F>
+    void ApplyScalar(const double* lhs, double rhs, double* out, std::size_t length, F op) {
+        for (std::size_t i = 0; i < length; ++i) {
+            out[i] = op(lhs[i], rhs);
+        }
+    }
+
+    template <class F>
+    void ApplyScalar(double lhs, const double* rhs, double* out, std::size_t length, F op) {
+        for (std::size_t i = 0; i < length; ++i) {
+            out[i] = op(lhs, rhs[i]);
+        }
+    }
+
+    // Resolves the operator once, so the column loops are monomorphic.
+    template <class Visitor>
+    void DispatchOp(char op, Visitor&& visitor) {
+        switch (op) {
+            case '+':
+                return visitor([](double a, double b) { return a + b; });
+            case '-':
+                return visitor([](double a, double b) { return a - b; });
+            case '*':
+                return visitor([](double a, double b) { return a * b; });
+            case '/':
+                return visitor([](double a, double b) { return a / b; });
+            default:
+                std::unreachable();
+        }
+    }
+
+    class ConstantOperator : public QueryOperator {
+    public:
+        explicit ConstantOperator(double value)
+            : value_(value)
+        {
+        }
+
+        Frame Execute(const QueryContext&) const override {
+            return Frame{.scalar = value_};
+        }
+
+    private:
+        double value_;
+    };
+
+    class SelectorOperator : public QueryOperator {
+    public:
+        SelectorOperator(std::string project_id, Tags tags)
+            : project_id_(std::move(project_id)),
+              tags_(std::move(tags))
+        {
+        }
+
+        Frame Execute(const QueryContext& context) const override {
+            Frame frame;
+            for (auto& series : context.source(project_id_, tags_)) {
+                FrameSeries& out = frame.series.emplace_back(FrameSeries{
+                    .tags = std::move(series.tags),
+                    .values = std::vector<double>(context.length, kNaN)
+                });
+                for (std::size_t i = 0; i < series.timestamps.size(); ++i) {
+                    int64_t offset = BucketOf(series.timestamps[i]) - context.start;
+                    if (offset < 0) {
+                        continue;
+                    }
+                    auto index = static_cast<std::size_t>(offset / kBucketMilliseconds);
+                    if (index >= context.length) {
+                        continue;
+                    }
+                    double& slot = out.values[index];
+                    slot = std::isnan(slot) ? series.values[i] : slot + series.values[i];
+                }
+            }
+            return frame;
+        }
+
+    private:
+        std::string project_id_;
+        Tags tags_;
+    };
+
+    // Bucket values are sums over kBucketMilliseconds, rate() turns them into per-second values.
+    class RateOperator : public QueryOperator {
+    public:
+        explicit RateOperator(std::unique_ptr<QueryOperator> child)
+            : child_(std::move(child))
+        {
+        }
+
+        Frame Execute(const QueryContext& context) const override {
+            constexpr double kPerSecond = 1000.0 / static_cast<double>(kBucketMilliseconds);
+            Frame frame = child_->Execute(context);
+            if (frame.scalar) {
+                *frame.scalar *= kPerSecond;
+            }
+            for (auto& series : frame.series) {
+                for (double& value : series.values) {
+                    value *= kPerSecond;
+                }
+            }
+            return frame;
+        }
+
+    private:
+        std::unique_ptr<QueryOperator> child_;
+    };
+
+    // Turns the cumulative values of COUNTER buckets into how much the
+    // counter grew in every bucket, in one pass over each column. A drop is
+    // a reset: the counter restarted from zero. Growth over missing buckets
+    // is spread evenly across them; the first bucket with a value grows as
+    // fast as the one after it, but not by more than its value.
+    class IncreaseOperator : public QueryOperator {
+    public:
+        explicit IncreaseOperator(std::unique_ptr<QueryOperator> child)
+            : child_(std::move(child))
+        {
+        }
+
+        Frame Execute(const QueryContext& context) const override {
+            Frame frame = child_->Execute(context);
+            if (frame.scalar) {
+                return Frame{.scalar = kNaN};
+            }
+            std::vector<double> increase;
+            for (auto& series : frame.series) {
+                Increase(series.values, increase);
+                series.values.swap(increase);
+            }
+            return frame;
+        }
+
+    private:
+        static void Increase(const std::vector<double>& values, std::vector<double>& out) {
+            constexpr std::size_t kNone = std::numeric_limits<std::size_t>::max();
+            out.assign(values.size(), kNaN);
+            std::size_t first = kNone;
+            std::size_t previous = kNone;
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                if (std::isnan(values[i])) {
+                    continue;
+                }
+                if (previous == kNone) {
+                    first = i;
+                } else {
+                    double delta = values[i] - values[previous];
+                    if (delta < 0) {
+                        delta = values[i];
+                    }
+                    double per_bucket = delta / static_cast<double>(i - previous);
+                    std::fill(out.begin() + static_cast<std::ptrdiff_t>(previous + 1),
+                              out.begin() + static_cast<std::ptrdiff_t>(i + 1), per_bucket);
+                    if (previous == first) {
+                        out[first] = std::min(per_bucket, std::max(0.0, values[first]));
+                    }
+                }
+                previous = i;
+            }
+        }
+
+        std::unique_ptr<QueryOperator> child_;
+    };
+
+    class AggregateOperator : public QueryOperator {
+    public:
+        AggregateOperator(EAggregation aggregation, std::vector<std::string> by, std::unique_ptr<QueryOperator> child)
+            : aggregation_(aggregation),
+              by_(std::move(by)),
+              child_(std::move(child))
+        {
+        }
+
+        Frame Execute(const QueryContext& context) const override {
+            Frame input = child_->Execute(context);
+            if (input.scalar) {
+                return input;
+            }
+
+            std::map<Tags, std::vector<PartialAggregate>> groups;
+            for (const auto& series : input.series) {
+                auto [it, inserted] = groups.try_emplace(GroupKey(series.tags, by_));
+                if (inserted) {
+                    it->second.resize(context.length);
+                }
+                PartialAggregate* partials = it->second.data();
+                const double* values = series.values.data();
+                for (std::size_t i = 0; i < context.length; ++i) {
+                    if (!std::isnan(values[i])) {
+                        partials[i].Add(values[i]);
+                    }
+                }
+            }
+
+            Frame frame;
+            frame.series.reserve(groups.size());
+            for (auto& [key, partials] : groups) {
+                FrameSeries& out = frame.series.emplace_back(FrameSeries{
+                    .tags = key,
+                    .values = std::vector<double>(context.length)
+                });
+                for (std::size_t i = 0; i < context.length; ++i) {
+                    out.values[i] = partials[i].count == 0 ? kNaN : partials[i].Finalize(aggregation_);
+                }
+            }
+            return frame;
+        }
+
+    private:
+        EAggregation aggregation_;
+        std::vector<std::string> by_;
+        std::unique_ptr<QueryOperator> child_;
+    };
+
+    class BinaryOperator : public QueryOperator {
+    public:
+        BinaryOperator(char op, std::unique_ptr<QueryOperator> lhs, std::unique_ptr<QueryOperator> rhs)
+            : op_(op),
+              lhs_(std::move(lhs)),
+              rhs_(std::move(rhs))
+        {
+        }
+
+        Frame Execute(const QueryContext& context) const override {
+            Frame lhs = lhs_->Execute(context);
+            Frame rhs = rhs_->Execute(context);
+            std::size_t length = context.length;
+
+            Frame frame;
+            DispatchOp(op_, [&](auto op) {
+                if (lhs.scalar && rhs.scalar) {
+                    frame.scalar = op(*lhs.scalar, *rhs.scalar);
+                } else if (rhs.scalar) {
+                    frame.series = std::move(lhs.series);
+                    for (auto& series : frame.series) {
+                        ApplyScalar(series.values.data(), *rhs.scalar, series.values.data(), length, op);
+                    }
+                } else if (lhs.scalar) {
+                    frame.series = std::move(rhs.series);
+                    for (auto& series : frame.series) {
+                        ApplyScalar(*lhs.scalar, series.values.data(), series.values.data(), length, op);
+                    }
+                } else if (rhs.series.size() == 1) {
+                    frame.series = std::move(lhs.series);
+                    for (auto& series : frame.series) {
+                        ApplyColumns(series.values.data(), rhs.series.front().values.data(), series.values.data(), length, op);
+                    }
+                } else if (lhs.series.size() == 1) {
+                    frame.series = std::move(rhs.series);
+                    for (auto& series : frame.series) {
+                        ApplyColumns(lhs.series.front().values.data(), series.values.data(), series.values.data(), length, op);
+                    }
+                } else {
+                    // Many-to-many: pair series with identical tags, drop the rest.
+                    std::map<Tags, const FrameSeries*> right;
+                    for (const auto& series : rhs.series) {
+                        right.emplace(series.tags, &series);
+                    }
+                    for (auto& series : lhs.series) {
+                        auto it = right.find(series.tags);
+                        if (it == right.end()) {
+                            continue;
+                        }
+                        ApplyColumns(series.values.data(), it->second->values.data(), series.values.data(), length, op);
+                        frame.series.push_back(std::move(series));
+                    }
+                }
+            });
+            return frame;
+        }
+
+    private:
+        char op_;
+        std::unique_ptr<QueryOperator> lhs_;
+        std::unique_ptr<QueryOperator> rhs_;
+    };
+
+    // Aggregates every bucket together with the window_buckets - 1 buckets before it.
+    class MovingOperator : public QueryOperator {
+    public:
+        MovingOperator(EAggregation aggregation, std::size_t window_buckets, std::unique_ptr<QueryOperator> child)
+            : aggregation_(aggregation),
+              window_buckets_(window_buckets),
+              child_(std::move(child))
+        {
+        }
+
+        Frame Execute(const QueryContext& context) const override {
+            Frame frame = child_->Execute(context);
+            for (auto& series : frame.series) {
+                series.values = Slide(series.values);
+            }
+            return frame;
+        }
+
+    private:
+        std::vector<double> Slide(const std::vector<double>& values) const {
+            std::vector<double> out(values.size(), kNaN);
+            double sum = 0.0;
+            int64_t count = 0;
+            // Indices of candidate extremes, monotonic in value.
+            std::deque<std::size_t> extremes;
+            bool track_max = aggregation_ == EAggregation::MAXIMUM;
+
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                if (!std::isnan(values[i])) {
+                    sum += values[i];
+                    ++count;
+                    while (!extremes.empty() &&
+                           (track_max ? values[extremes.back()] <= values[i] : values[extremes.back()] >= values[i])) {
+                        extremes.pop_back();
+                    }
+                    extremes.push_back(i);
+                }
+                if (i >= window_buckets_) {
+                    std::size_t leaving = i - window_buckets_;
+                    if (!std::isnan(values[leaving])) {
+                        sum -= values[leaving];
+                        --count;
+                    }
+                    if (!extremes.empty() && extremes.front() == leaving) {
+                        extremes.pop_front();
+                    }
+                }
+                if (count == 0) {
+                    continue;
+                }
+                switch (aggregation_) {
+                    case EAggregation::SUM:
+                        out[i] = sum;
+                        break;
+                    case EAggregation::AVG:
+                        out[i] = sum / static_cast<double>(count);
+                        break;
+                    case EAggregation::COUNT:
+                        out[i] = static_cast<double>(count);
+                        break;
+                    case EAggregation::MINIMUM:
+                    case EAggregation::MAXIMUM:
+                        out[i] = values[extremes.front()];
+                        break;
+                    default:
+                        std::unreachable();
+                }
+            }
+            return out;
+        }
+
+        EAggregation aggregation_;
+        std::size_t window_buckets_;
+        std::unique_ptr<QueryOperator> child_;
+    };
+
+    // Series of one histogram differ only in their le tag: every bucket of
+    // the grid is estimated from the counts of all their bounds.
+    class HistogramQuantileOperator : public QueryOperator {
+    public:
+        HistogramQuantileOperator(double quantile, std::unique_ptr<QueryOperator> child)
+            : quantile_(quantile),
+              child_(std::move(child))
+        {
+        }
+
+        Frame Execute(const QueryContext& context) const override {
+            Frame input = child_->Execute(context);
+            if (input.scalar) {
+                return Frame{.scalar = kNaN};
+            }
+
+            std::map<Tags, std::vector<std::pair<double, const double*>>> histograms;
+            for (const auto& series : input.series) {
+                Tags key;
+                std::optional<double> bound;
+                for (const auto& tag : series.tags) {
+                    if (TagKey(tag) == kHistogramBoundKey) {
+                        bound = ParseHistogramBound(std::string_view(tag).substr(kHistogramBoundKey.size() + 1));
+                    } else {
+                        key.push_back(tag);
+                    }
+                }
+                if (bound) {
+                    histograms[std::move(key)].emplace_back(*bound, series.values.data());
+                }
+            }
+
+            Frame frame;
+            frame.series.reserve(histograms.size());
+            std::vector<HistogramBucket> buckets;
+            for (auto& [key, bounds] : histograms) {
+                std::ranges::sort(bounds, {}, &std::pair<double, const double*>::first);
+                FrameSeries& out = frame.series.emplace_back(FrameSeries{
+                    .tags = key,
+                    .values = std::vector<double>(context.length, kNaN)
+                });
+                for (std::size_t i = 0; i < context.length; ++i) {
+                    buckets.clear();
+                    for (const auto& [bound, values] : bounds) {
+                        if (!std::isnan(values[i])) {
+                            buckets.push_back(HistogramBucket{bound, values[i]});
+                        }
+                    }
+                    out.values[i] = HistogramQuantile(quantile_, buckets);
+                }
+            }
+            return frame;
+        }
+
+    private:
+        double quantile_;
+        std::unique_ptr<QueryOperator> child_;
+    };
+
+    std::unique_ptr<QueryOperator> CompileNode(const QueryNode& node) {
+        switch (node.kind) {
+            case EQueryNodeKind::NUMBER:
+                return std::make_unique<ConstantOperator>(node.number);
+            case EQueryNodeKind::SELECTOR:
+                return std::make_unique<SelectorOperator>(node.project_id, node.tags);
+            case EQueryNodeKind::RATE:
+                return std::make_unique<RateOperator>(CompileNode(*node.children.at(0)));
+            case EQueryNodeKind::AGGREGATE:
+                return std::make_unique<AggregateOperator>(node.aggregation, node.by, CompileNode(*node.children.at(0)));
+            case EQueryNodeKind::BINARY:
+                return std::make_unique<BinaryOperator>(
+                    node.op,
+                    CompileNode(*node.children.at(0)),
+                    CompileNode(*node.children.at(1)));
+            case EQueryNodeKind::MOVING: {
+                if (node.window_ms < kBucketMilliseconds) {
+                    throw QueryError("Moving window must be at least one bucket");
+                }
+                auto window_buckets = static_cast<std::size_t>(node.window_ms / kBucketMilliseconds);
+                return std::make_unique<MovingOperator>(node.aggregation, window_buckets, CompileNode(*node.children.at(0)));
+            }
+            case EQueryNodeKind::INCREASE:
+                return std::make_unique<IncreaseOperator>(CompileNode(*node.children.at(0)));
+            case EQueryNodeKind::HISTOGRAM_QUANTILE:
+                return std::make_unique<HistogramQuantileOperator>(node.number, CompileNode(*node.children.at(0)));
+            default:
+                std::unreachable();
+        }
+    }
+
+} // anonymous namespace
+
+QueryPlan::QueryPlan(std::unique_ptr<QueryOperator> root)
+    : root_(std::move(root))
+{
+}
+
+Frame QueryPlan::Execute(const SeriesSource& source, int64_t start, std::size_t length) const {
+    return root_->Execute(QueryContext{
+        .source = source,
+        .start = start,
+        .length = length
+    });
+}
+
+std::unique_ptr<QueryPlan> CompileQuery(const QueryNode& node) {
+    return std::make_unique<QueryPlan>(CompileNode(node));
+}
+
+QueryPlanCache::QueryPlanCache(std::size_t capacity)
+    : capacity_(std::max<std::size_t>(1, capacity))
+{
+}
+
+QueryPlanCache& QueryPlanCache::Instance() {
+    static QueryPlanCache cache;
+    return cache;
+}
+
+std::shared_ptr<const QueryPlan> QueryPlanCache::Get(std::string_view text) {
+    {
+        std::lock_guard lock(mutex_);
+        if (auto it = index_.find(text); it != index_.end()) {
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Compiled unlocked; a plan another thread cached meanwhile wins.
+    std::shared_ptr<const QueryPlan> plan = CompileQuery(*ParseQuery(text));
+
+    std::lock_guard lock(mutex_);
+    if (auto it = index_.find(text); it != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->second;
+    }
+    if (entries_.size() >= capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+    entries_.emplace_front(std::string(text), plan);
+    index_.emplace(entries_.front().first, entries_.begin());
+    return plan;
+}
+
+std::size_t QueryPlanCache::Size() const {
+    std::lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+std::shared_ptr<const QueryPlan> GetQueryPlan(std::string_view text) {
+    return QueryPlanCache::Instance().Get(text);
+}
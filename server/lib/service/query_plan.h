@@ -0,0 +1,85 @@
+#pragma once
+
+#include "aggregation.h"
+#include "query.h"
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A series laid out on the query's bucket grid, NaN marks a missing bucket.
+struct FrameSeries {
+    Tags tags;
+    std::vector<double> values;
+};
+
+// Output of one plan operator: either a scalar or a set of series that all
+// share the same grid of `length` buckets starting at `start`.
+struct Frame {
+    std::optional<double> scalar;
+    std::vector<FrameSeries> series;
+};
+
+using SeriesSource = std::function<std::vector<Series>(const std::string& project_id, const Tags& filter)>;
+
+struct QueryContext {
+    const SeriesSource& source;
+    int64_t start;
+    std::size_t length;
+};
+
+// Operators are invoked once per query and work on whole columns,
+// so there is no per-point dispatch.
+class QueryOperator {
+public:
+    virtual ~QueryOperator() = default;
+    virtual Frame Execute(const QueryContext& context) const = 0;
+};
+
+class QueryPlan {
+public:
+    explicit QueryPlan(std::unique_ptr<QueryOperator> root);
+
+    Frame Execute(const SeriesSource& source, int64_t start, std::size_t length) const;
+
+private:
+    std::unique_ptr<QueryOperator> root_;
+};
+
+std::unique_ptr<QueryPlan> CompileQuery(const QueryNode& node);
+
+// Compiled plans by query text. Beyond capacity the least recently used
+// plan is evicted, so hot plans stay however many queries pass by.
+class QueryPlanCache {
+public:
+    static constexpr std::size_t kMaxPlans = 1024;
+
+    explicit QueryPlanCache(std::size_t capacity = kMaxPlans);
+
+    static QueryPlanCache& Instance();
+
+    // Parses and compiles the query unless its plan is cached.
+    std::shared_ptr<const QueryPlan> Get(std::string_view text);
+    std::size_t Size() const;
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const QueryPlan>>;
+
+    mutable std::mutex mutex_;
+    std::size_t capacity_;
+    // Most recently used first.
+    std::list<Entry> entries_;
+    // Keys view the text of their entry.
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+};
+
+// Parses and compiles the query, reusing the plan if the same text was compiled before.
+std::shared_ptr<const QueryPlan> GetQueryPlan(std::string_view text);
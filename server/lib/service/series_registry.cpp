@@ -0,0 +1,145 @@
+#include "series_registry.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace {
+
+    constexpr std::size_t kInitialCapacity = 16;
+
+    bool SameSeries(const SeriesHandle& series, std::string_view project_id, const Tags& tags, std::size_t hash) {
+        return series.hash == hash
+            && series.project_id == project_id
+            && std::ranges::equal(series.tags, tags, [](const std::string& lhs, const std::pmr::string& rhs) {
+                return std::string_view(lhs) == std::string_view(rhs);
+            });
+    }
+
+} // anonymous namespace
+
+SeriesRegistry::Table::Table(std::size_t capacity)
+    : mask(capacity - 1)
+    , slots(new std::atomic<const SeriesHandle*>[capacity])
+{
+    for (std::size_t i = 0; i < capacity; ++i) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+SeriesRegistry::SeriesRegistry(std::size_t capacity)
+    : capacity_(capacity)
+{
+}
+
+SeriesRegistry& SeriesRegistry::Instance() {
+    static SeriesRegistry registry;
+    return registry;
+}
+
+std::size_t SeriesRegistry::Hash(std::string_view project_id, const Tags& tags) {
+    std::hash<std::string_view> hasher;
+    std::size_t hash = hasher(project_id);
+    for (const auto& tag : tags) {
+        hash ^= hasher(tag) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+std::string SeriesRegistry::JoinTags(const Tags& tags) {
+    std::string joined;
+    for (const auto& tag : tags) {
+        joined += '|';
+        joined += tag;
+    }
+    return joined;
+}
+
+std::size_t SeriesRegistry::ShardOf(std::size_t hash) {
+    // The low bits pick the slot, the high ones the shard.
+    return (hash >> (8 * sizeof(std::size_t) - 6)) % kShards;
+}
+
+const SeriesHandle* SeriesRegistry::Probe(const Table& table, std::string_view project_id, const Tags& tags, std::size_t hash) {
+    for (std::size_t i = hash & table.mask;; i = (i + 1) & table.mask) {
+        const auto* series = table.slots[i].load(std::memory_order_acquire);
+        if (!series) {
+            return nullptr;
+        }
+        if (SameSeries(*series, project_id, tags, hash)) {
+            return series;
+        }
+    }
+}
+
+void SeriesRegistry::Place(Table& table, const SeriesHandle* series) {
+    std::size_t i = series->hash & table.mask;
+    while (table.slots[i].load(std::memory_order_relaxed)) {
+        i = (i + 1) & table.mask;
+    }
+    table.slots[i].store(series, std::memory_order_release);
+}
+
+const SeriesHandle* SeriesRegistry::Find(std::string_view project_id, const Tags& tags) const {
+    return Find(project_id, tags, Hash(project_id, tags));
+}
+
+const SeriesHandle* SeriesRegistry::Find(std::string_view project_id, const Tags& tags, std::size_t hash) const {
+    const auto& shard = shards_[ShardOf(hash)];
+    const auto* table = shard.table.load(std::memory_order_acquire);
+    return table ? Probe(*table, project_id, tags, hash) : nullptr;
+}
+
+const SeriesHandle* SeriesRegistry::Add(std::string_view project_id, const Tags& tags,
+                                        std::string quoted_table, std::string quoted_tags) {
+    auto hash = Hash(project_id, tags);
+    if (const auto* series = Find(project_id, tags, hash)) {
+        return series;
+    }
+    return Insert(project_id, tags, hash, std::move(quoted_table), std::move(quoted_tags));
+}
+
+const SeriesHandle* SeriesRegistry::Insert(std::string_view project_id, const Tags& tags, std::size_t hash,
+                                           std::string quoted_table, std::string quoted_tags) {
+    auto& shard = shards_[ShardOf(hash)];
+    std::lock_guard lock(shard.mutex);
+    auto* table = shard.table.load(std::memory_order_relaxed);
+    if (table) {
+        if (const auto* series = Probe(*table, project_id, tags, hash)) {
+            return series;
+        }
+    }
+    // Ids are taken only below the capacity, whatever the shard.
+    auto id = next_id_.load(std::memory_order_relaxed);
+    do {
+        if (id >= capacity_) {
+            return nullptr;
+        }
+    } while (!next_id_.compare_exchange_weak(id, id + 1, std::memory_order_relaxed));
+
+    auto series = std::make_unique<SeriesHandle>();
+    series->hash = hash;
+    series->project_id = project_id;
+    series->tags.assign(tags.begin(), tags.end());
+    series->quoted_table = std::move(quoted_table);
+    series->quoted_tags = std::move(quoted_tags);
+    series->id = id;
+
+    // At most half full, so probes stay short.
+    std::size_t capacity = table ? table->mask + 1 : 0;
+    if (2 * (shard.size + 1) > capacity) {
+        auto grown = std::make_unique<Table>(std::max(kInitialCapacity, 2 * capacity));
+        for (const auto& existing : shard.series) {
+            Place(*grown, existing.get());
+        }
+        table = shard.tables.emplace_back(std::move(grown)).get();
+        shard.table.store(table, std::memory_order_release);
+    }
+    Place(*table, series.get());
+    ++shard.size;
+    return shard.series.emplace_back(std::move(series)).get();
+}
+
+std::size_t SeriesRegistry::Size() const {
+    return static_cast<std::size_t>(next_id_.load(std::memory_order_relaxed));
+}
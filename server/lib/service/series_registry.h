@@ -0,0 +1,107 @@
+#pragma once
+
+#include "aggregation.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A series as the database knows it: its project table and its tags,
+// with what every statement about it needs computed once.
+struct SeriesHandle {
+    // Dense, in order of first use.
+    std::uint64_t id = 0;
+    std::size_t hash = 0;
+    std::string project_id;
+    std::vector<std::string> tags;
+    // tx.quote_name(project_id)
+    std::string quoted_table;
+    // tx.quote of the tags joined as |tag1|tag2, the form the tags column holds.
+    std::string quoted_tags;
+};
+
+// Interns series into handles that live as long as the registry, so the
+// statements of a known series need neither string building nor quoting.
+// Lookups take no lock: every shard is an open addressing table of atomic
+// pointers that writers, one at a time per shard, fill in or replace with
+// a table twice the size. Replaced tables are kept, since a reader may
+// still be probing one; they add up to less than the live table. Since
+// handles are never freed, the registry stops at a capacity, and series
+// beyond it are quoted by every statement like unknown ones.
+class SeriesRegistry {
+public:
+    static constexpr std::size_t kShards = 64;
+    static constexpr std::size_t kMaxSeries = 1 << 20;
+
+    explicit SeriesRegistry(std::size_t capacity = kMaxSeries);
+
+    SeriesRegistry(const SeriesRegistry&) = delete;
+    SeriesRegistry& operator=(const SeriesRegistry&) = delete;
+
+    static SeriesRegistry& Instance();
+
+    static std::size_t Hash(std::string_view project_id, const Tags& tags);
+
+    // nullptr for a series never interned.
+    const SeriesHandle* Find(std::string_view project_id, const Tags& tags) const;
+    const SeriesHandle* Find(std::string_view project_id, const Tags& tags, std::size_t hash) const;
+    // Remembers a series the database holds, quoted_table being
+    // tx.quote_name(project_id) and quoted_tags tx.quote(JoinTags(tags)).
+    // Only for committed writes: a series whose insert rolled back, such as
+    // one of an unknown project, must not take memory. nullptr once the
+    // registry is full.
+    const SeriesHandle* Add(std::string_view project_id, const Tags& tags,
+                            std::string quoted_table, std::string quoted_tags);
+    // Add() quoting with tx, a pqxx transaction or anything with its
+    // quote_name() and quote(), the first time a series is seen.
+    template <class Transaction>
+    const SeriesHandle* Intern(std::string_view project_id, const Tags& tags, Transaction& tx) {
+        auto hash = Hash(project_id, tags);
+        if (const auto* series = Find(project_id, tags, hash)) {
+            return series;
+        }
+        return Insert(project_id, tags, hash, tx.quote_name(std::string(project_id)), tx.quote(JoinTags(tags)));
+    }
+
+    std::size_t Size() const;
+    std::size_t Capacity() const {
+        return capacity_;
+    }
+
+    // The tags column value of a series: |tag1|tag2, or empty.
+    static std::string JoinTags(const Tags& tags);
+
+private:
+    struct Table {
+        explicit Table(std::size_t capacity);
+
+        std::size_t mask;
+        std::unique_ptr<std::atomic<const SeriesHandle*>[]> slots;
+    };
+
+    struct Shard {
+        std::atomic<Table*> table{nullptr};
+        // Writers only.
+        std::mutex mutex;
+        std::size_t size = 0;
+        std::vector<std::unique_ptr<Table>> tables;
+        std::vector<std::unique_ptr<SeriesHandle>> series;
+    };
+
+    // Keeps the series another thread inserted meanwhile, if any.
+    const SeriesHandle* Insert(std::string_view project_id, const Tags& tags, std::size_t hash,
+                               std::string quoted_table, std::string quoted_tags);
+    static std::size_t ShardOf(std::size_t hash);
+    static const SeriesHandle* Probe(const Table& table, std::string_view project_id, const Tags& tags, std::size_t hash);
+    static void Place(Table& table, const SeriesHandle* series);
+
+    std::size_t capacity_;
+    std::array<Shard, kShards> shards_;
+    std::atomic<std::uint64_t> next_id_{0};
+};
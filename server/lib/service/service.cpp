@@ -1,4 +1,20 @@
 #include "service.h"
+#include "bucket_keys.h"
+#include "series_registry.h"
+#include "subscriptions.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 std::string ToString(EMetricType type) {
     switch (type) {
@@ -6,30 +22,129 @@ std::string ToString(EMetricType type) {
             return "DOT";
         case EMetricType::SPEED:
             return "SPEED";
+        case EMetricType::HISTOGRAM:
+            return "HISTOGRAM";
+        case EMetricType::COUNTER:
+            return "COUNTER";
         default:
             std::unreachable();
     }
 }
 
-EMetricType FromString(const std::string& str) {
+EMetricType FromString(std::string_view str) {
     if (str == "DOT") {
         return EMetricType::DOT;
     }
     if (str == "SPEED") {
         return EMetricType::SPEED;
     }
-    std::unreachable();
+    if (str == "HISTOGRAM") {
+        return EMetricType::HISTOGRAM;
+    }
+    if (str == "COUNTER") {
+        return EMetricType::COUNTER;
+    }
+    throw std::invalid_argument("Unknown metric type: " + std::string(str));
 }
 
+namespace {
+
+    std::atomic<std::uint64_t> connections_opened{0};
+    std::atomic<std::size_t> connections_open{0};
+    std::atomic<std::size_t> connections_in_use{0};
+    std::atomic<std::uint64_t> connection_uses{0};
+
+    // Counts the connection of a thread as open until the thread exits.
+    struct ThreadConnectionSlot {
+        std::unique_ptr<pqxx::connection> connection;
+
+        ~ThreadConnectionSlot() {
+            if (connection) {
+                connections_open.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    pqxx::connection& ThreadConnection() {
+        thread_local ThreadConnectionSlot slot;
+        auto& connection = slot.connection;
+        if (!connection || !connection->is_open()) {
+            TraceSpan span(TRACE_CONNECT);
+            bool reopened = connection != nullptr;
+            connection = std::make_unique<pqxx::connection>(
+                "host=localhost "
+                "dbname=tsdb "
+                "user=postgres "
+                "password=yourpassword "
+                "port=5432"
+            );
+            connections_opened.fetch_add(1, std::memory_order_relaxed);
+            if (!reopened) {
+                connections_open.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        return *connection;
+    }
+
+    // Several rows of one bucket merged: the counter sample taken last, or
+    // the sum of the rows without a sample time.
+    constexpr std::string_view kMergedBucketValue =
+        "COALESCE((ARRAY_AGG(value ORDER BY sample_ms DESC) FILTER (WHERE sample_ms IS NOT NULL))[1], SUM(value))";
+
+    // Value of a bucket in a read: its row, or its rows merged in a table
+    // without the bucket key, grouped by time by the caller.
+    std::string_view BucketValue(const BucketLayout& layout) {
+        if (layout.keyed) {
+            return "value";
+        }
+        return layout.sampled ? kMergedBucketValue : "SUM(value)";
+    }
+
+    // Rows of one bucket in a table without the bucket key are merged,
+    // one day of data per transaction.
+    constexpr int64_t kKeyMigrationSliceMilliseconds = 24 * 3600 * 1000;
+
+    // Merges the rows sharing a bucket, in time >= from and time < to when
+    // given, into one.
+    void MergeBucketRows(pqxx::work& tx, const std::string& table_name, std::optional<std::pair<int64_t, int64_t>> range) {
+        std::string condition;
+        if (range) {
+            condition = std::format(" WHERE time >= to_timestamp({}::bigint / 1000.0) AND time < to_timestamp({}::bigint / 1000.0)",
+                                    range->first, range->second);
+        }
+        tx.exec(std::format(R"(
+            WITH duplicated AS (
+                SELECT tags, time FROM {0}{1} GROUP BY tags, time HAVING COUNT(*) > 1
+            ), merged AS (
+                DELETE FROM {0} USING duplicated
+                WHERE {0}.tags = duplicated.tags AND {0}.time = duplicated.time
+                RETURNING {0}.time, {0}.tags, {0}.value, {0}.sample_ms
+            )
+            INSERT INTO {0} (time, tags, value, sample_ms)
+            SELECT time, tags, {2}, MAX(sample_ms) FROM merged GROUP BY time, tags;
+        )", table_name, condition, kMergedBucketValue));
+    }
+
+} // anonymous namespace
+
 MonitoringService::MonitoringService()
-    : m_connection(
-        "host=localhost "
-        "dbname=tsdb "
-        "user=postgres "
-        "password=yourpassword "
-        "port=5432"
-    )
+    : m_connection(ThreadConnection())
 {
+    connections_in_use.fetch_add(1, std::memory_order_relaxed);
+    connection_uses.fetch_add(1, std::memory_order_relaxed);
+}
+
+MonitoringService::~MonitoringService() {
+    connections_in_use.fetch_sub(1, std::memory_order_relaxed);
+}
+
+DatabaseStats MonitoringService::Stats() {
+    DatabaseStats stats;
+    stats.connections_opened = connections_opened.load(std::memory_order_relaxed);
+    stats.connections_open = connections_open.load(std::memory_order_relaxed);
+    stats.in_use = connections_in_use.load(std::memory_order_relaxed);
+    stats.uses = connection_uses.load(std::memory_order_relaxed);
+    return stats;
 }
 
 void MonitoringService::RegisterProject(const RegisterProjectRequest& request) {
@@ -40,12 +155,16 @@ void MonitoringService::RegisterProject(const RegisterProjectRequest& request) {
 
     pqxx::work tx(m_connection);
     std::string table_name = tx.quote_name(request.project_id);
+    bool created = tx.exec(std::format(R"(
+        SELECT to_regclass({}) IS NULL;
+    )", tx.quote(table_name)))[0][0].as<bool>();
 
     tx.exec(std::format(R"(
         CREATE TABLE IF NOT EXISTS {} (
             time   TIMESTAMPTZ         NOT NULL,
             tags   TEXT                NOT NULL,
-            value  DOUBLE PRECISION    NULL
+            value  DOUBLE PRECISION    NULL,
+            sample_ms  BIGINT          NULL
         );
     )", table_name));
 
@@ -53,101 +172,637 @@ void MonitoringService::RegisterProject(const RegisterProjectRequest& request) {
         SELECT create_hypertable('{}', 'time', if_not_exists => TRUE);
     )", table_name));
 
+    // One row per series and bucket, which DoPost upserts into. A new table
+    // gets the key right away; one made before the key or the sample_ms
+    // column existed is left to the BucketKeyMigrator, since merging its
+    // rows may take long.
+    auto& keys = BucketKeys::Instance();
+    if (created) {
+        tx.exec(std::format(R"(
+            CREATE UNIQUE INDEX IF NOT EXISTS {} ON {} (tags, time);
+        )", tx.quote_name(BucketKeys::IndexName(request.project_id)), table_name));
+    } else {
+        keys.Layout(request.project_id, tx);
+    }
+
     tx.commit();
+    if (created) {
+        keys.MarkCurrent(request.project_id);
+    }
+}
+
+bool MonitoringService::MigrateBucketKey(const std::string& project_id, std::stop_token stop) {
+    if (!m_connection.is_open()) {
+        std::cerr << "Connection is closed" << std::endl;
+        return false;
+    }
+
+    std::string table_name;
+    std::optional<BucketLayout> layout;
+    {
+        pqxx::work tx(m_connection);
+        table_name = tx.quote_name(project_id);
+        layout = BucketKeys::Inspect(project_id, tx);
+        tx.commit();
+    }
+    if (!layout || layout->current()) {
+        return true;
+    }
+    // Adding the nullable column only changes the catalog, but waits for
+    // the table like any schema change.
+    if (!layout->sampled) {
+        pqxx::work tx(m_connection);
+        tx.exec("ALTER TABLE " + table_name + " ADD COLUMN IF NOT EXISTS sample_ms BIGINT NULL");
+        tx.commit();
+    }
+    if (layout->keyed) {
+        return true;
+    }
+
+    std::optional<int64_t> first;
+    std::optional<int64_t> last;
+    {
+        pqxx::work tx(m_connection);
+        auto row = tx.exec(
+            " SELECT "
+            "    (EXTRACT(EPOCH FROM MIN(time)) * 1000)::bigint, "
+            "    (EXTRACT(EPOCH FROM MAX(time)) * 1000)::bigint "
+            " FROM " + table_name
+        )[0];
+        first = row[0].as<std::optional<int64_t>>();
+        last = row[1].as<std::optional<int64_t>>();
+        tx.commit();
+    }
+
+    // The bulk of the rows is merged a slice at a time while writers go on
+    // appending, so each transaction holds row locks for one slice only.
+    if (first && last) {
+        for (int64_t from = *first; from <= *last; from += kKeyMigrationSliceMilliseconds) {
+            if (stop.stop_requested()) {
+                return false;
+            }
+            pqxx::work tx(m_connection);
+            MergeBucketRows(tx, table_name, std::pair(from, from + kKeyMigrationSliceMilliseconds));
+            tx.commit();
+        }
+    }
+
+    // Then writers wait, readers do not, while what they appended meanwhile
+    // is merged and the key is built. Writers lock the table before they
+    // look for the key, so none appends once it exists.
+    pqxx::work tx(m_connection);
+    tx.exec("LOCK TABLE " + table_name + " IN EXCLUSIVE MODE");
+    if (auto locked = BucketKeys::Inspect(project_id, tx); locked && !locked->keyed) {
+        MergeBucketRows(tx, table_name, std::nullopt);
+        tx.exec(std::format(R"(
+            CREATE UNIQUE INDEX {} ON {} (tags, time);
+        )", tx.quote_name(BucketKeys::IndexName(project_id)), table_name));
+    }
+    tx.commit();
+    return true;
 }
 
 void MonitoringService::DoPost(const PostRequest& request) {
+    const PostRequest* requests[] = {&request};
+    DoPost(requests);
+}
+
+void MonitoringService::DoPost(std::span<const PostRequest* const> requests) {
     if (!m_connection.is_open()) {
         std::cerr << "Connection is closed" << std::endl;
         return;
     }
+    if (requests.empty()) {
+        return;
+    }
+
+    // Scratch state gets an arena of its own: the requests may be borrowed
+    // from a session that keeps parsing into theirs on another thread.
+    std::pmr::monotonic_buffer_resource scratch;
+    std::pmr::memory_resource* memory = &scratch;
+    struct WrittenSeries {
+        const MetricIdentifiers* ids;
+        // nullptr for a series the registry does not hold, which is quoted
+        // here instead and added to it once the write is committed.
+        const SeriesHandle* series;
+        std::string quoted_table;
+        std::string quoted_tags;
+        BucketValues buckets;
+        // Of a counter: the time of the sample each bucket holds.
+        std::pmr::map<int64_t, int64_t> sampled_at;
+        // Value of every bucket the write changed, as stored after it.
+        BucketValues stored;
+
+        std::string_view table() const {
+            return series ? std::string_view(series->quoted_table) : std::string_view(quoted_table);
+        }
+        std::string_view tags() const {
+            return series ? std::string_view(series->quoted_tags) : std::string_view(quoted_tags);
+        }
+    };
+    struct SeriesKeyHash {
+        std::size_t operator()(const MetricIdentifiers* ids) const {
+            return SeriesRegistry::Hash(ids->project_id, ids->tags);
+        }
+    };
+    struct SameSeries {
+        bool operator()(const MetricIdentifiers* lhs, const MetricIdentifiers* rhs) const {
+            return lhs->project_id == rhs->project_id && lhs->tags == rhs->tags;
+        }
+    };
+    std::pmr::vector<WrittenSeries> written(memory);
+    std::pmr::unordered_map<const MetricIdentifiers*, std::size_t, SeriesKeyHash, SameSeries> written_index(memory);
+    std::size_t metrics = 0;
+    for (const auto* request : requests) {
+        metrics += request->metrics.size();
+    }
+    written.reserve(metrics);
 
     pqxx::work tx(m_connection);
-    for (const auto& [ids, value]: request.metrics) {
-        std::string table_name = tx.quote_name(ids.project_id);
-
-        auto tags_str = std::accumulate(
-            ids.tags.begin(), ids.tags.end(), std::string(""),
-            [](std::string&& accumulated, const std::string& next) {
-                accumulated += '|';
-                accumulated += next;
-                return std::move(accumulated);
+    std::optional<TraceSpan> store(std::in_place, TRACE_STORE);
+    // Every metric of a series, across all requests, is merged into one
+    // set of buckets, so each bucket is upserted once per transaction.
+    auto& registry = SeriesRegistry::Instance();
+    for (const auto* request : requests) {
+        for (const auto& [ids, value]: request->metrics) {
+            auto [it, inserted] = written_index.try_emplace(&ids, written.size());
+            if (inserted) {
+                auto& written_series = written.emplace_back(WrittenSeries{
+                    &ids, registry.Find(ids.project_id, ids.tags), {}, {}, BucketValues(memory),
+                    std::pmr::map<int64_t, int64_t>(memory), BucketValues(memory)});
+                if (!written_series.series) {
+                    written_series.quoted_table = tx.quote_name(ids.project_id);
+                    written_series.quoted_tags = tx.quote(SeriesRegistry::JoinTags(ids.tags));
+                }
+            } else if (written[it->second].ids->metric_type != ids.metric_type) {
+                // A bucket holds either a sum or a sample, not both.
+                throw std::invalid_argument(std::format("Series of project '{}' posted as both {} and {}",
+                                                        ids.project_id, ToString(written[it->second].ids->metric_type),
+                                                        ToString(ids.metric_type)));
+            }
+            auto& aggregated_values = written[it->second].buckets;
+            if (ids.metric_type == EMetricType::COUNTER) {
+                // Cumulative samples: a bucket keeps the one taken last, the
+                // later of two taken at the same time.
+                auto& sampled_at = written[it->second].sampled_at;
+                for (const auto& metric_value : value) {
+                    int64_t bucket = BucketOf(metric_value.timestamp);
+                    auto [slot, added] = sampled_at.try_emplace(bucket, metric_value.timestamp);
+                    if (added || metric_value.timestamp >= slot->second) {
+                        slot->second = metric_value.timestamp;
+                        aggregated_values[bucket] = metric_value.value;
+                    }
+                }
+                continue;
+            }
+            for (const auto& metric_value : value) {
+                int64_t bucket = BucketOf(metric_value.timestamp);
+                aggregated_values[bucket] += metric_value.value;
             }
-        );
-
-        std::map<int64_t, double> aggregated_values;
-        for (const auto& metric_value : value) {
-            int64_t bucket = (metric_value.timestamp / 15000) * 15000;
-            aggregated_values[bucket] += metric_value.value;
         }
+    }
 
-        for (const auto& [bucket_ts, sum_value] : aggregated_values) {
-            std::string timestamp_ms = tx.quote(bucket_ts);
-            std::string quoted_tags = tx.quote(tags_str);
-            std::string quoted_value = tx.quote(sum_value);
+    // Concurrent writers take the row locks of the buckets in the same
+    // order, series by table and tags and buckets by time, so they cannot
+    // deadlock, whether the registry holds the series or not.
+    std::ranges::sort(written, {}, [](const WrittenSeries& written_series) {
+        return std::pair(written_series.table(), written_series.tags());
+    });
+    auto& keys = BucketKeys::Instance();
+    std::string_view upsert_table;
+    BucketLayout layout;
+    std::string statement;
+    for (auto& written_series : written) {
+        if (written_series.buckets.empty()) {
+            continue;
+        }
+        auto table = written_series.table();
+        if (table != upsert_table) {
+            // A table without the sample_ms column gets it first, taking the
+            // table before any weaker lock of this transaction would. One
+            // without the bucket key is locked before the check, so the key
+            // cannot appear between the check and the insert.
+            upsert_table = table;
+            const auto& project_id = written_series.ids->project_id;
+            if (keys.KnownCurrent(project_id)) {
+                layout = BucketLayout{.keyed = true, .sampled = true};
+            } else {
+                layout = keys.Layout(project_id, tx);
+                if (!layout.sampled) {
+                    tx.exec(std::format("ALTER TABLE {} ADD COLUMN IF NOT EXISTS sample_ms BIGINT NULL", table));
+                }
+                if (!layout.keyed) {
+                    tx.exec(std::format("LOCK TABLE {} IN ROW EXCLUSIVE MODE", table));
+                    layout = keys.Layout(project_id, tx);
+                }
+                layout.sampled = true;
+            }
+        }
+        bool counter = written_series.ids->metric_type == EMetricType::COUNTER;
+        statement = std::format("INSERT INTO {} (time, tags, value, sample_ms) VALUES ", table);
+        bool first = true;
+        for (const auto& [bucket_ts, sum_value] : written_series.buckets) {
+            std::format_to(std::back_inserter(statement), "{}(to_timestamp({}::bigint / 1000.0), {}, {}, {})",
+                           first ? "" : ", ", tx.quote(bucket_ts), written_series.tags(), tx.quote(sum_value),
+                           counter ? tx.quote(written_series.sampled_at.at(bucket_ts)) : "NULL");
+            first = false;
+        }
+        if (!layout.keyed) {
+            // Reads merge the rows of a bucket until the table is migrated,
+            // so the stored value of a bucket is read back merged too.
+            tx.exec(statement);
+            auto rows = tx.exec(std::format(
+                " SELECT (EXTRACT(EPOCH FROM time) * 1000)::bigint, {}"
+                " FROM {} WHERE tags = {}"
+                " AND time >= to_timestamp({}::bigint / 1000.0) AND time <= to_timestamp({}::bigint / 1000.0)"
+                " GROUP BY time",
+                BucketValue(layout), table, written_series.tags(),
+                written_series.buckets.begin()->first, written_series.buckets.rbegin()->first));
+            for (const auto& row : rows) {
+                auto bucket = row[0].as<int64_t>();
+                if (written_series.buckets.contains(bucket)) {
+                    written_series.stored.emplace(bucket, row[1].as<double>());
+                }
+            }
+            continue;
+        }
+        // Late and repeated data adds to the bucket it belongs to, a
+        // counter bucket keeps the sample taken last. Only counter buckets
+        // have a sample_ms, so a bucket stored as the other kind is left
+        // alone, not returned, and fails the write.
+        if (counter) {
+            std::format_to(std::back_inserter(statement),
+                           " ON CONFLICT (tags, time) DO UPDATE SET"
+                           " value = CASE WHEN {0}.sample_ms <= EXCLUDED.sample_ms THEN EXCLUDED.value ELSE {0}.value END,"
+                           " sample_ms = GREATEST({0}.sample_ms, EXCLUDED.sample_ms)"
+                           " WHERE {0}.sample_ms IS NOT NULL", table);
+        } else {
+            std::format_to(std::back_inserter(statement),
+                           " ON CONFLICT (tags, time) DO UPDATE SET value = {0}.value + EXCLUDED.value"
+                           " WHERE {0}.sample_ms IS NULL", table);
+        }
+        statement += " RETURNING (EXTRACT(EPOCH FROM time) * 1000)::bigint, value, sample_ms";
+        auto rows = tx.exec(statement);
+        if (static_cast<std::size_t>(rows.size()) != written_series.buckets.size()) {
+            throw std::invalid_argument(std::format("Series of project '{}' is stored as another metric type than {}",
+                                                    written_series.ids->project_id, ToString(written_series.ids->metric_type)));
+        }
+        for (const auto& row : rows) {
+            auto bucket = row[0].as<int64_t>();
+            // A counter bucket holding a later sample did not change.
+            if (counter && row[2].as<int64_t>() != written_series.sampled_at.at(bucket)) {
+                continue;
+            }
+            written_series.stored.emplace(bucket, row[1].as<double>());
+        }
+    }
+    store.reset();
+    {
+        TraceSpan commit(TRACE_COMMIT);
+        tx.commit();
+    }
 
-            tx.exec(std::format(R"(
-                INSERT INTO {} (time, tags, value)
-                VALUES (
-                    to_timestamp({}::bigint / 1000.0),
-                    {},
-                    {}
-                )
-            )", table_name, timestamp_ms, quoted_tags, quoted_value));
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    auto& alerts = AlertEngine::Instance();
+    auto& subscriptions = SubscriptionHub::Instance();
+    for (auto& written_series : written) {
+        const auto& ids = *written_series.ids;
+        if (!written_series.series) {
+            registry.Add(ids.project_id, ids.tags, std::move(written_series.quoted_table), std::move(written_series.quoted_tags));
         }
+        alerts.OnBuckets(ids.project_id, ids.tags, written_series.stored, now);
+        subscriptions.OnBuckets(ids, written_series.stored);
     }
-    tx.commit();
 }
 
 std::optional<GetResponse> MonitoringService::DoGet(const GetRequest& request) {
+    GetResponse response(request.identifiers.tags.get_allocator().resource());
+    bool found = StreamGet(request, kGetChunkSize, [&](std::span<const MetricValue> values) {
+        response.values.insert(response.values.end(), values.begin(), values.end());
+    });
+    if (!found) {
+        return std::nullopt;
+    }
+    return response;
+}
+
+bool MonitoringService::StreamGet(
+    const GetRequest& request,
+    std::size_t chunk_size,
+    const std::function<void(std::span<const MetricValue>)>& consume
+) {
     if (!m_connection.is_open()) {
         std::cerr << "Connection is closed" << std::endl;
-        return std::nullopt;
+        return false;
     }
 
     pqxx::work tx(m_connection);
-    std::string table_name = tx.quote_name(request.identifiers.project_id);
+    // A bucket is one row, read in key order and copied out row by row,
+    // the result set is never held in memory.
+    auto rows = tx.stream<int64_t, double>(SeriesBucketsQuery(
+        tx, request.identifiers, "time > NOW() - INTERVAL '" + std::to_string(request.interval_seconds) + " seconds'"));
 
-    auto tags_str = std::accumulate(
-        request.identifiers.tags.begin(), 
-        request.identifiers.tags.end(), 
-        std::string(""),
-        [](std::string&& accumulated, const std::string& next) {
-            accumulated += '|';
-            accumulated += next;
-            return std::move(accumulated);
+    std::pmr::vector<MetricValue> chunk(request.identifiers.tags.get_allocator().resource());
+    chunk.reserve(chunk_size);
+    bool found = false;
+    for (auto [bucket, value] : rows) {
+        chunk.push_back(MetricValue{value, bucket});
+        if (chunk.size() == chunk_size) {
+            consume(chunk);
+            chunk.clear();
+            found = true;
         }
-    );
+    }
+    if (!chunk.empty()) {
+        consume(chunk);
+        found = true;
+    }
+
+    tx.commit();
+    return found;
+}
+
+std::vector<MetricValue> MonitoringService::GetPage(
+    const GetRequest& request,
+    std::optional<int64_t> after_ms,
+    std::size_t limit
+) {
+    std::vector<MetricValue> values;
+    if (!m_connection.is_open()) {
+        std::cerr << "Connection is closed" << std::endl;
+        return values;
+    }
+
+    // Buckets are stored at to_timestamp(bucket_ms / 1000.0), so the one
+    // after_ms names is excluded exactly.
+    pqxx::work tx(m_connection);
+    std::string condition = after_ms
+        ? std::format("time > to_timestamp({}::bigint / 1000.0)", *after_ms)
+        : "time > NOW() - INTERVAL '" + std::to_string(request.interval_seconds) + " seconds'";
+    auto result = tx.exec(SeriesBucketsQuery(tx, request.identifiers, condition) + " LIMIT " + std::to_string(limit));
+    values.reserve(result.size());
+    for (const auto& row : result) {
+        values.push_back(MetricValue{row[1].as<double>(), row[0].as<int64_t>()});
+    }
+    tx.commit();
+    return values;
+}
+
+std::string MonitoringService::SeriesBucketsQuery(pqxx::work& tx, const MetricIdentifiers& ids, std::string_view condition) {
+    // Reads do not intern, a series nobody wrote must not take memory.
+    std::string table_name;
+    std::string quoted_tags;
+    if (const auto* series = SeriesRegistry::Instance().Find(ids.project_id, ids.tags)) {
+        table_name = series->quoted_table;
+        quoted_tags = series->quoted_tags;
+    } else {
+        table_name = tx.quote_name(ids.project_id);
+        quoted_tags = tx.quote(SeriesRegistry::JoinTags(ids.tags));
+    }
+
+    auto layout = BucketKeys::Instance().Layout(ids.project_id, tx);
+    return " SELECT "
+           "    (EXTRACT(EPOCH FROM time) * 1000)::bigint as bucket_ms, " +
+           std::string(BucketValue(layout)) +
+           " FROM " + table_name +
+           " WHERE tags = " + quoted_tags +
+           " AND " + std::string(condition) +
+           (layout.keyed ? "" : " GROUP BY time") +
+           " ORDER BY time";
+}
+
+std::vector<Series> MonitoringService::FetchSeries(
+    pqxx::work& tx,
+    const std::string& project_id,
+    const Tags& filter,
+    int64_t interval_seconds
+) {
+    std::string table_name = tx.quote_name(project_id);
+
+    // Coarse prefilter in SQL, exact tag matching is done by MatchesFilter.
+    std::string tag_conditions;
+    for (const auto& tag : filter) {
+        std::string needle = "|";
+        needle += tag;
+        needle += '|';
+        tag_conditions += " AND strpos(tags || '|', " + tx.quote(needle) + ") > 0";
+    }
 
+    auto layout = BucketKeys::Instance().Layout(project_id, tx);
     auto result = tx.exec(
         " SELECT "
-        "    (EXTRACT(EPOCH FROM time) * 1000)::bigint as time_ms, "
-        "    value "
-        " FROM " + table_name + 
-        " WHERE tags = " + tx.quote(tags_str) +
-        " AND time > NOW() - INTERVAL '" + std::to_string(request.interval_seconds) + " seconds'" +
-        " ORDER BY time ASC"
+        "    tags, "
+        "    (EXTRACT(EPOCH FROM time) * 1000)::bigint as bucket_ms, " +
+        std::string(BucketValue(layout)) +
+        " FROM " + table_name +
+        " WHERE time > NOW() - INTERVAL '" + std::to_string(interval_seconds) + " seconds'" +
+        tag_conditions +
+        (layout.keyed ? "" : " GROUP BY tags, time") +
+        " ORDER BY tags, time"
     );
 
-    if (result.empty()) {
+    std::vector<Series> series;
+    std::optional<std::string_view> current_tags;
+    bool skip_current = false;
+    for (const auto& row : result) {
+        auto tags = row[0].as<std::string_view>();
+        if (tags != current_tags) {
+            current_tags = tags;
+            Tags parsed = ParseTags(tags);
+            skip_current = !MatchesFilter(parsed, filter);
+            if (!skip_current) {
+                series.push_back(Series{.tags = std::move(parsed)});
+            }
+        }
+        if (skip_current) {
+            continue;
+        }
+        series.back().timestamps.push_back(row[1].as<int64_t>());
+        series.back().values.push_back(row[2].as<double>());
+    }
+    return series;
+}
+
+std::optional<GroupedGetResponse> MonitoringService::DoGroupedGet(const GroupedGetRequest& request) {
+    if (!m_connection.is_open()) {
+        std::cerr << "Connection is closed" << std::endl;
         return std::nullopt;
     }
 
-    std::unordered_map<int64_t, double> aggregated_values;
-    GetResponse response;
-    response.values.reserve(result.size());
+    pqxx::work tx(m_connection);
+    auto series = FetchSeries(tx, request.project_id, request.tags, request.interval_seconds);
+    tx.commit();
 
-    for (const auto& row : result) {
-        MetricValue value;
-        value.timestamp = row[0].as<int64_t>();
-        value.value = row[1].as<double>();
-        aggregated_values[(value.timestamp / 15000) * 15000] += value.value;
+    if (series.empty()) {
+        return std::nullopt;
+    }
+
+    auto groups = AggregateGroups(series, request.group_by, DefaultAggregationWorkers(series.size()));
+
+    GroupedGetResponse response;
+    response.groups.reserve(groups.size());
+    for (auto& [key, buckets] : groups) {
+        auto& group = response.groups.emplace_back();
+        group.group = key;
+        group.values.reserve(buckets.size());
+        for (const auto& [timestamp, partial] : buckets) {
+            group.values.push_back(MetricValue{partial.Finalize(request.aggregation), timestamp});
+        }
+    }
+    return response;
+}
+
+namespace {
+
+    // SQL expression over the per-series summary that is an upper bound of
+    // the ranked value, so rows can be ordered by it and scanning can stop
+    // as soon as a bound falls below the current top-k floor.
+    std::string TopKBoundExpression(EAggregation aggregation) {
+        switch (aggregation) {
+            case EAggregation::SUM:
+                return "bucket_sum";
+            case EAggregation::COUNT:
+                return "bucket_count";
+            case EAggregation::AVG:
+            case EAggregation::MINIMUM:
+            case EAggregation::MAXIMUM:
+                return "bucket_max";
+            default:
+                std::unreachable();
+        }
+    }
+
+    // Summary rows fetched from the top-k cursor per round trip.
+    constexpr std::size_t kTopKFetchRows = 1024;
+
+    double TopKBound(const PartialAggregate& summary, EAggregation aggregation) {
+        if (aggregation == EAggregation::SUM || aggregation == EAggregation::COUNT) {
+            return summary.Finalize(aggregation);
+        }
+        return summary.max;
+    }
+
+} // anonymous namespace
+
+TopKResponse MonitoringService::DoTopK(const TopKRequest& request) {
+    if (!m_connection.is_open()) {
+        std::cerr << "Connection is closed" << std::endl;
+        return {};
+    }
+    if (request.k == 0) {
+        return {};
+    }
+
+    pqxx::work tx(m_connection);
+    std::string table_name = tx.quote_name(request.project_id);
+
+    std::string tag_conditions;
+    for (const auto& tag : request.tags) {
+        std::string needle = "|";
+        needle += tag;
+        needle += '|';
+        tag_conditions += " AND strpos(tags || '|', " + tx.quote(needle) + ") > 0";
+    }
+
+    // One summary row per series, computed over its bucket rows and read
+    // through a cursor a block at a time, so only the heap and one block are
+    // held however many series match. Rows come in descending bound order,
+    // which lets the scan stop without fetching the rest.
+    auto layout = BucketKeys::Instance().Layout(request.project_id, tx);
+    tx.exec(
+        " DECLARE topk_summaries NO SCROLL CURSOR FOR"
+        " SELECT "
+        "    tags, "
+        "    SUM(value) as bucket_sum, "
+        "    COUNT(*) as bucket_count, "
+        "    MIN(value) as bucket_min, "
+        "    MAX(value) as bucket_max "
+        " FROM ("
+        "    SELECT tags, " + std::string(BucketValue(layout)) + " as value"
+        "    FROM " + table_name +
+        "    WHERE time > NOW() - INTERVAL '" + std::to_string(request.interval_seconds) + " seconds'" +
+        "    AND value IS NOT NULL" +
+        tag_conditions +
+        (layout.keyed ? "" : " GROUP BY tags, time") +
+        " ) buckets"
+        " GROUP BY tags"
+        " ORDER BY " + TopKBoundExpression(request.aggregation) + " DESC"
+    );
+
+    TopKHeap heap(request.k);
+    bool exhausted = false;
+    while (!exhausted) {
+        auto block = tx.exec("FETCH " + std::to_string(kTopKFetchRows) + " FROM topk_summaries");
+        exhausted = static_cast<std::size_t>(block.size()) < kTopKFetchRows;
+        for (const auto& row : block) {
+            PartialAggregate summary{
+                .sum = row[1].as<double>(),
+                .min = row[3].as<double>(),
+                .max = row[4].as<double>(),
+                .count = row[2].as<int64_t>()
+            };
+            if (heap.Full() && TopKBound(summary, request.aggregation) <= heap.Floor()) {
+                exhausted = true;
+                break;
+            }
+
+            double value = summary.Finalize(request.aggregation);
+            if (!heap.Accepts(value)) {
+                continue;
+            }
+            Tags tags = ParseTags(row[0].as<std::string_view>());
+            if (MatchesFilter(tags, request.tags)) {
+                heap.Push(RankedSeries{std::move(tags), value});
+            }
+        }
     }
+    tx.commit();
+
+    return TopKResponse{std::move(heap).TakeSorted()};
+}
+
+QueryResponse MonitoringService::DoQuery(const QueryRequest& request) {
+    ValidateIntervalSeconds(request.interval_seconds);
+    auto plan = GetQueryPlan(request.query);
 
-    for (const auto& [timestamp, value] : aggregated_values) {
-        response.values.push_back(MetricValue{value, timestamp});
+    if (!m_connection.is_open()) {
+        std::cerr << "Connection is closed" << std::endl;
+        return {};
     }
 
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    int64_t start = BucketOf(now - request.interval_seconds * 1000) + kBucketMilliseconds;
+    auto length = static_cast<std::size_t>((BucketOf(now) - start) / kBucketMilliseconds + 1);
+
+    pqxx::work tx(m_connection);
+    SeriesSource source = [&](const std::string& project_id, const Tags& filter) {
+        return FetchSeries(tx, project_id, filter, request.interval_seconds);
+    };
+    Frame frame = plan->Execute(source, start, length);
     tx.commit();
+
+    if (frame.scalar) {
+        frame.series.push_back(FrameSeries{
+            .tags = {},
+            .values = std::vector<double>(length, *frame.scalar)
+        });
+    }
+
+    QueryResponse response;
+    response.series.reserve(frame.series.size());
+    for (auto& series : frame.series) {
+        auto& out = response.series.emplace_back();
+        out.tags = std::move(series.tags);
+        for (std::size_t i = 0; i < length; ++i) {
+            if (!std::isnan(series.values[i])) {
+                out.values.push_back(MetricValue{
+                    series.values[i],
+                    start + static_cast<int64_t>(i) * kBucketMilliseconds
+                });
+            }
+        }
+    }
     return response;
 }
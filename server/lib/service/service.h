@@ -1,5 +1,10 @@
 #pragma once
 
+#include "aggregation.h"
+#include "alerts.h"
+#include "query_plan.h"
+#include "topk.h"
+
 #include <pqxx/pqxx>
 #include <boost/functional/hash.hpp>
 
@@ -8,24 +13,48 @@
 #include <utility>
 #include <format>
 #include <optional>
+#include <span>
+#include <stop_token>
+#include <string_view>
 #include <vector>
 #include <string>
+#include <functional>
 #include <map>
-
-using Tags = std::vector<std::string>;
+#include <memory_resource>
 
 enum EMetricType {
     DOT,
     SPEED,
+    // Stored as one series per bucket, see HistogramBoundTag.
+    HISTOGRAM,
+    // Cumulative; a bucket keeps the sample with the latest timestamp.
+    COUNTER,
 };
 
 std::string ToString(EMetricType type);
-EMetricType FromString(const std::string& str);
+EMetricType FromString(std::string_view str);
 
+// The request and response types below are allocator-aware: the server
+// builds them inside a per-request arena, and containers of them hand the
+// arena down to every nested string and vector.
 struct MetricIdentifiers {
-    std::string project_id;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::string project_id;
     Tags tags;
-    EMetricType metric_type;
+    EMetricType metric_type = EMetricType::DOT;
+
+    MetricIdentifiers() = default;
+    explicit MetricIdentifiers(const allocator_type& alloc)
+        : project_id(alloc), tags(alloc) {}
+    MetricIdentifiers(const MetricIdentifiers& other, const allocator_type& alloc)
+        : project_id(other.project_id, alloc), tags(other.tags, alloc), metric_type(other.metric_type) {}
+    MetricIdentifiers(MetricIdentifiers&& other, const allocator_type& alloc)
+        : project_id(std::move(other.project_id), alloc), tags(std::move(other.tags), alloc), metric_type(other.metric_type) {}
+    MetricIdentifiers(const MetricIdentifiers&) = default;
+    MetricIdentifiers(MetricIdentifiers&&) = default;
+    MetricIdentifiers& operator=(const MetricIdentifiers&) = default;
+    MetricIdentifiers& operator=(MetricIdentifiers&&) = default;
 
     bool operator==(const MetricIdentifiers &other) const = default;
 };
@@ -46,35 +75,156 @@ struct MetricValue {
 };
 
 struct Metric {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
     MetricIdentifiers identifiers;
-    std::vector<MetricValue> values;
+    std::pmr::vector<MetricValue> values;
+
+    Metric() = default;
+    explicit Metric(const allocator_type& alloc)
+        : identifiers(alloc), values(alloc) {}
+    Metric(MetricIdentifiers identifiers, std::pmr::vector<MetricValue> values, const allocator_type& alloc = {})
+        : identifiers(std::move(identifiers), alloc), values(std::move(values), alloc) {}
+    Metric(const Metric& other, const allocator_type& alloc)
+        : identifiers(other.identifiers, alloc), values(other.values, alloc) {}
+    Metric(Metric&& other, const allocator_type& alloc)
+        : identifiers(std::move(other.identifiers), alloc), values(std::move(other.values), alloc) {}
+    Metric(const Metric&) = default;
+    Metric(Metric&&) = default;
+    Metric& operator=(const Metric&) = default;
+    Metric& operator=(Metric&&) = default;
 };
 
 struct PostRequest {
-    std::vector<Metric> metrics;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::vector<Metric> metrics;
+
+    PostRequest() = default;
+    explicit PostRequest(const allocator_type& alloc)
+        : metrics(alloc) {}
 };
 
 struct GetRequest {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
     MetricIdentifiers identifiers;
-    int64_t interval_seconds;
+    int64_t interval_seconds = 0;
+
+    GetRequest() = default;
+    explicit GetRequest(const allocator_type& alloc)
+        : identifiers(alloc) {}
 };
 
 struct GetResponse {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::vector<MetricValue> values;
+
+    GetResponse() = default;
+    explicit GetResponse(const allocator_type& alloc)
+        : values(alloc) {}
+};
+
+struct GroupedGetRequest {
+    std::string project_id;
+    EMetricType metric_type;
+    Tags tags;
+    std::vector<std::string> group_by;
+    EAggregation aggregation;
+    int64_t interval_seconds;
+};
+
+struct MetricGroup {
+    Tags group;
+    std::vector<MetricValue> values;
+};
+
+struct GroupedGetResponse {
+    std::vector<MetricGroup> groups;
+};
+
+struct TopKRequest {
+    std::string project_id;
+    EMetricType metric_type;
+    Tags tags;
+    EAggregation aggregation;
+    int64_t interval_seconds;
+    std::size_t k;
+};
+
+struct TopKResponse {
+    std::vector<RankedSeries> series;
+};
+
+struct QueryRequest {
+    std::string query;
+    int64_t interval_seconds;
+};
+
+struct QuerySeries {
+    Tags tags;
     std::vector<MetricValue> values;
 };
 
+struct QueryResponse {
+    std::vector<QuerySeries> series;
+};
+
 struct RegisterProjectRequest {
     std::string project_id;
 };
 
+// Use of the per-thread database connections, for /metrics.
+struct DatabaseStats {
+    std::uint64_t connections_opened = 0;
+    std::size_t connections_open = 0;
+    // Services holding their thread's connection right now.
+    std::size_t in_use = 0;
+    std::uint64_t uses = 0;
+};
+
 class MonitoringService {
 public:
+    // Values DoGet reads from the database at a time.
+    static constexpr std::size_t kGetChunkSize = 4096;
+
+    // Uses the database connection of the calling thread, opened on first
+    // use and reopened after it drops, so requests do not pay for a new
+    // connection each. A service must not outlive or leave its thread.
     MonitoringService();
+    ~MonitoringService();
+    MonitoringService(const MonitoringService&) = delete;
+    MonitoringService& operator=(const MonitoringService&) = delete;
+
+    static DatabaseStats Stats();
 
     void DoPost(const PostRequest& request);
+    // Stores the requests in one transaction.
+    void DoPost(std::span<const PostRequest* const> requests);
     std::optional<GetResponse> DoGet(const GetRequest& request);
+    // Reads the buckets of a series in time order straight from the database
+    // and hands them to consume in slices of up to chunk_size values, so
+    // memory stays at one slice whatever the window. Returns false if the
+    // window is empty.
+    bool StreamGet(const GetRequest& request, std::size_t chunk_size, const std::function<void(std::span<const MetricValue>)>& consume);
+    // Up to limit buckets of the window in time order, those after after_ms
+    // when given. Every page is a transaction of its own, so a caller paging
+    // through a window for a slow client holds no transaction in between.
+    std::vector<MetricValue> GetPage(const GetRequest& request, std::optional<int64_t> after_ms, std::size_t limit);
+    std::optional<GroupedGetResponse> DoGroupedGet(const GroupedGetRequest& request);
+    TopKResponse DoTopK(const TopKRequest& request);
+    QueryResponse DoQuery(const QueryRequest& request);
     void RegisterProject(const RegisterProjectRequest& request);
+    // Merges the rows sharing a bucket in a table made before the bucket
+    // key and adds the key, see BucketKeys. False when stop came first.
+    bool MigrateBucketKey(const std::string& project_id, std::stop_token stop = {});
 
 private:
-    pqxx::connection m_connection;
+    std::vector<Series> FetchSeries(pqxx::work& tx, const std::string& project_id, const Tags& filter, int64_t interval_seconds);
+    // Selects bucket_ms and value of the series, one row per bucket, from
+    // the rows matching condition, in time order.
+    std::string SeriesBucketsQuery(pqxx::work& tx, const MetricIdentifiers& ids, std::string_view condition);
+
+    pqxx::connection& m_connection;
 };
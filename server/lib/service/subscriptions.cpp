@@ -0,0 +1,192 @@
+#include "subscriptions.h"
+
+#include <boost/json.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+std::string ToString(EDropPolicy policy) {
+    switch (policy) {
+        case EDropPolicy::DROP_OLDEST:
+            return "drop_oldest";
+        case EDropPolicy::DROP_NEWEST:
+            return "drop_newest";
+        case EDropPolicy::DISCONNECT:
+            return "disconnect";
+        default:
+            std::unreachable();
+    }
+}
+
+EDropPolicy DropPolicyFromString(const std::string& str) {
+    if (str == "drop_oldest") {
+        return EDropPolicy::DROP_OLDEST;
+    }
+    if (str == "drop_newest") {
+        return EDropPolicy::DROP_NEWEST;
+    }
+    if (str == "disconnect") {
+        return EDropPolicy::DISCONNECT;
+    }
+    throw std::invalid_argument("Unknown drop policy: " + str);
+}
+
+Subscriber::Subscriber(std::size_t max_queued, EDropPolicy policy, std::function<void()> notify)
+    : max_queued_(std::max<std::size_t>(1, max_queued))
+    , policy_(policy)
+    , notify_(std::move(notify))
+{
+}
+
+void Subscriber::push(Message message) {
+    bool wake;
+    {
+        std::lock_guard lock(mutex_);
+        if (disconnected_) {
+            return;
+        }
+        if (queue_.size() >= max_queued_) {
+            ++dropped_;
+            switch (policy_) {
+                case EDropPolicy::DROP_OLDEST:
+                    queue_.pop_front();
+                    break;
+                case EDropPolicy::DROP_NEWEST:
+                    return;
+                case EDropPolicy::DISCONNECT:
+                    disconnected_ = true;
+                    queue_.clear();
+                    break;
+            }
+        }
+        if (!disconnected_) {
+            queue_.push_back(std::move(message));
+        }
+        wake = disconnected_ || queue_.size() == 1;
+    }
+    if (wake) {
+        notify_();
+    }
+}
+
+Subscriber::Message Subscriber::pop() {
+    std::lock_guard lock(mutex_);
+    if (queue_.empty()) {
+        return nullptr;
+    }
+    auto message = std::move(queue_.front());
+    queue_.pop_front();
+    return message;
+}
+
+void Subscriber::set_policy(EDropPolicy policy) {
+    std::lock_guard lock(mutex_);
+    policy_ = policy;
+}
+
+bool Subscriber::disconnected() const {
+    std::lock_guard lock(mutex_);
+    return disconnected_;
+}
+
+std::uint64_t Subscriber::dropped() const {
+    std::lock_guard lock(mutex_);
+    return dropped_;
+}
+
+SubscriptionHub& SubscriptionHub::Instance() {
+    static SubscriptionHub hub;
+    return hub;
+}
+
+void SubscriptionHub::Subscribe(const std::shared_ptr<Subscriber>& subscriber, const std::string& project_id, Tags tags) {
+    std::unique_lock lock(mutex_);
+    std::size_t filters = 0;
+    for (const auto& [id, subscriptions] : projects_) {
+        auto it = std::ranges::find(subscriptions, subscriber, &Subscription::subscriber);
+        if (it == subscriptions.end()) {
+            continue;
+        }
+        if (id == project_id && std::ranges::find(it->filters, tags) != it->filters.end()) {
+            return;
+        }
+        filters += it->filters.size();
+    }
+    if (filters >= kMaxFiltersPerSubscriber) {
+        throw std::length_error("A connection holds at most " + std::to_string(kMaxFiltersPerSubscriber) + " subscriptions");
+    }
+
+    auto& subscriptions = projects_[project_id];
+    auto it = std::ranges::find(subscriptions, subscriber, &Subscription::subscriber);
+    if (it == subscriptions.end()) {
+        it = subscriptions.insert(subscriptions.end(), Subscription{subscriber, {}});
+    }
+    it->filters.push_back(std::move(tags));
+}
+
+void SubscriptionHub::Unsubscribe(const Subscriber& subscriber) {
+    std::unique_lock lock(mutex_);
+    for (auto it = projects_.begin(); it != projects_.end();) {
+        std::erase_if(it->second, [&](const Subscription& subscription) {
+            return subscription.subscriber.get() == &subscriber;
+        });
+        it = it->second.empty() ? projects_.erase(it) : std::next(it);
+    }
+}
+
+std::size_t SubscriptionHub::Subscribers() const {
+    std::shared_lock lock(mutex_);
+    std::size_t count = 0;
+    for (const auto& [project_id, subscriptions] : projects_) {
+        count += subscriptions.size();
+    }
+    return count;
+}
+
+void SubscriptionHub::OnBuckets(const MetricIdentifiers& ids, const BucketValues& buckets) {
+    if (buckets.empty()) {
+        return;
+    }
+    // Pushing under the shared lock keeps a subscriber from being notified
+    // after Unsubscribe returned.
+    std::shared_lock lock(mutex_);
+    auto project = projects_.find(std::string(ids.project_id));
+    if (project == projects_.end()) {
+        return;
+    }
+    Subscriber::Message message;
+    for (const auto& subscription : project->second) {
+        bool matches = std::ranges::any_of(subscription.filters, [&](const Tags& filter) {
+            return MatchesFilter(ids.tags, filter);
+        });
+        if (!matches) {
+            continue;
+        }
+        if (!message) {
+            message = std::make_shared<const std::string>(BucketUpdateToJson(ids, buckets));
+        }
+        subscription.subscriber->push(message);
+    }
+}
+
+std::string BucketUpdateToJson(const MetricIdentifiers& ids, const BucketValues& buckets) {
+    boost::json::array tags;
+    for (const auto& tag : ids.tags) {
+        tags.emplace_back(boost::json::string_view(tag.data(), tag.size()));
+    }
+    boost::json::array values;
+    for (const auto& [timestamp, value] : buckets) {
+        values.push_back(boost::json::object{
+            {"timestamp", timestamp},
+            {"value", value}
+        });
+    }
+    return boost::json::serialize(boost::json::object{
+        {"project_id", boost::json::string_view(ids.project_id.data(), ids.project_id.size())},
+        {"metric_type", ToString(ids.metric_type)},
+        {"tags", std::move(tags)},
+        {"buckets", std::move(values)}
+    });
+}
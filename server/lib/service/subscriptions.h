@@ -0,0 +1,93 @@
+#pragma once
+
+#include "service.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// What a subscriber's full queue does with the next update.
+enum EDropPolicy {
+    DROP_OLDEST,
+    DROP_NEWEST,
+    DISCONNECT,
+};
+
+std::string ToString(EDropPolicy policy);
+EDropPolicy DropPolicyFromString(const std::string& str);
+
+// Updates of one client, queued until its connection takes them. Pushed
+// to from the threads that store metrics, popped by the connection.
+class Subscriber {
+public:
+    // An update encoded once and shared by every subscriber it goes to.
+    using Message = std::shared_ptr<const std::string>;
+
+    // notify is called, with the queue unlocked, whenever the queue stops
+    // being empty, and once more when the subscriber is disconnected.
+    Subscriber(std::size_t max_queued, EDropPolicy policy, std::function<void()> notify);
+
+    void push(Message message);
+    // nullptr once the queue is empty.
+    Message pop();
+
+    void set_policy(EDropPolicy policy);
+    // Set once a DISCONNECT queue overflowed; the queue takes no more.
+    bool disconnected() const;
+    std::uint64_t dropped() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::deque<Message> queue_;
+    std::size_t max_queued_;
+    EDropPolicy policy_;
+    bool disconnected_ = false;
+    std::uint64_t dropped_ = 0;
+    std::function<void()> notify_;
+};
+
+// Pushes the buckets written by /post to the subscribers whose filter
+// matches the series. Every update is encoded once, when the first
+// subscriber matches, and then shared.
+class SubscriptionHub {
+public:
+    // Filters one subscriber may hold across projects; every write to a
+    // project tests all filters of its subscribers.
+    static constexpr std::size_t kMaxFiltersPerSubscriber = 64;
+
+    static SubscriptionHub& Instance();
+
+    // Series of project_id carrying all of tags. Subscribing twice to the
+    // same filter changes nothing. Throws std::length_error once the
+    // subscriber holds kMaxFiltersPerSubscriber filters.
+    void Subscribe(const std::shared_ptr<Subscriber>& subscriber, const std::string& project_id, Tags tags);
+    void Unsubscribe(const Subscriber& subscriber);
+    std::size_t Subscribers() const;
+
+    // Called once the buckets of a series have been committed, with the
+    // values they were stored with.
+    void OnBuckets(const MetricIdentifiers& ids, const BucketValues& buckets);
+
+private:
+    struct Subscription {
+        std::shared_ptr<Subscriber> subscriber;
+        // The series matches if any of them does.
+        std::vector<Tags> filters;
+    };
+
+    mutable std::shared_mutex mutex_;
+    // Subscriptions by project.
+    std::unordered_map<std::string, std::vector<Subscription>> projects_;
+};
+
+// {"project_id": ..., "metric_type": ..., "tags": [...], "buckets": [{"timestamp": ..., "value": ...}]}
+// where value is the value of the bucket as stored after the write.
+std::string BucketUpdateToJson(const MetricIdentifiers& ids, const BucketValues& buckets);
@@ -0,0 +1,58 @@
+#include "topk.h"
+
+#include <algorithm>
+
+namespace {
+
+    bool GreaterValue(const RankedSeries& lhs, const RankedSeries& rhs) {
+        return lhs.value > rhs.value;
+    }
+
+} // anonymous namespace
+
+TopKHeap::TopKHeap(std::size_t k)
+    : k_(k)
+{
+    // No reserve: k comes from the client, so the heap grows only with the
+    // series actually pushed.
+}
+
+bool TopKHeap::Full() const {
+    return heap_.size() >= k_;
+}
+
+double TopKHeap::Floor() const {
+    return heap_.front().value;
+}
+
+bool TopKHeap::Accepts(double value) const {
+    if (k_ == 0) {
+        return false;
+    }
+    return !Full() || value > Floor();
+}
+
+void TopKHeap::Push(RankedSeries&& series) {
+    if (!Accepts(series.value)) {
+        return;
+    }
+    if (Full()) {
+        std::pop_heap(heap_.begin(), heap_.end(), GreaterValue);
+        heap_.back() = std::move(series);
+    } else {
+        heap_.push_back(std::move(series));
+    }
+    std::push_heap(heap_.begin(), heap_.end(), GreaterValue);
+}
+
+void TopKHeap::Merge(TopKHeap&& other) {
+    for (auto& series : other.heap_) {
+        Push(std::move(series));
+    }
+    other.heap_.clear();
+}
+
+std::vector<RankedSeries> TopKHeap::TakeSorted() && {
+    std::sort_heap(heap_.begin(), heap_.end(), GreaterValue);
+    return std::move(heap_);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "aggregation.h"
+
+#include <cstddef>
+#include <vector>
+
+struct RankedSeries {
+    Tags tags;
+    double value;
+};
+
+// Keeps the k highest-valued series seen so far in a min-heap,
+// so memory stays O(k) however many series are pushed.
+class TopKHeap {
+public:
+    explicit TopKHeap(std::size_t k);
+
+    bool Full() const;
+    // Lowest value still in the heap; only meaningful when Full().
+    double Floor() const;
+    // Cheap check before building a RankedSeries for the candidate.
+    bool Accepts(double value) const;
+    void Push(RankedSeries&& series);
+    void Merge(TopKHeap&& other);
+
+    // Highest value first.
+    std::vector<RankedSeries> TakeSorted() &&;
+
+private:
+    std::size_t k_;
+    std::vector<RankedSeries> heap_;
+};
@@ -0,0 +1,225 @@
+#include "tracing.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+    thread_local RequestTrace* current_trace = nullptr;
+
+    std::int64_t Microseconds(TraceClock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+} // anonymous namespace
+
+std::string ToString(ETraceStage stage) {
+    switch (stage) {
+        case TRACE_READ:
+            return "read";
+        case TRACE_QUEUE:
+            return "queue";
+        case TRACE_CONNECT:
+            return "connect";
+        case TRACE_PARSE:
+            return "parse";
+        case TRACE_STORE:
+            return "store";
+        case TRACE_COMMIT:
+            return "commit";
+        case TRACE_HANDLER:
+            return "handler";
+        case TRACE_WRITE:
+            return "write";
+        default:
+            std::unreachable();
+    }
+}
+
+ETraceStage TraceStageFromString(const std::string& str) {
+    for (int stage = 0; stage < TRACE_STAGES; ++stage) {
+        if (str == ToString(static_cast<ETraceStage>(stage))) {
+            return static_cast<ETraceStage>(stage);
+        }
+    }
+    throw std::invalid_argument("Unknown trace stage: " + str);
+}
+
+void RequestTrace::start(std::string_view route) {
+    active_ = Tracer::Instance().enabled();
+    if (!active_) {
+        return;
+    }
+    route_ = route;
+    started_ = TraceClock::now();
+    totals_.fill(std::chrono::microseconds::zero());
+    span_count_ = 0;
+}
+
+void RequestTrace::add(ETraceStage stage, TraceClock::time_point begin, TraceClock::time_point end) {
+    if (!active_) {
+        return;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin);
+    totals_[stage] += duration;
+    if (span_count_ < kMaxSpans) {
+        spans_[span_count_++] = Span{
+            .stage = stage,
+            .begin = std::chrono::duration_cast<std::chrono::microseconds>(begin - started_),
+            .duration = duration,
+        };
+    }
+}
+
+void RequestTrace::submit(unsigned status) {
+    if (!active_) {
+        return;
+    }
+    auto& tracer = Tracer::Instance();
+    tracer.write(tracer.local(), *this, status, TraceClock::now());
+    active_ = false;
+}
+
+RequestTrace* RequestTrace::Current() {
+    return current_trace;
+}
+
+TraceScope::TraceScope(RequestTrace* trace)
+    : previous_(std::exchange(current_trace, trace))
+{
+}
+
+TraceScope::~TraceScope() {
+    current_trace = previous_;
+}
+
+Tracer& Tracer::Instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::enable(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+Tracer::Ring& Tracer::local() {
+    thread_local Ring* ring = nullptr;
+    if (!ring) {
+        std::lock_guard lock(mutex_);
+        ring = rings_.emplace_back(std::make_unique<Ring>()).get();
+    }
+    return *ring;
+}
+
+void Tracer::write(Ring& ring, const RequestTrace& trace, unsigned status, TraceClock::time_point end) {
+    static constexpr std::int64_t kMaxSpanTime = (std::int64_t(1) << kSpanTimeBits) - 1;
+    auto pack = [](std::chrono::microseconds time) {
+        return static_cast<std::uint64_t>(std::clamp<std::int64_t>(time.count(), 0, kMaxSpanTime));
+    };
+
+    auto& slot = ring.slots[ring.next++ % kRingSize];
+    auto sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.route.store(trace.route_.data(), std::memory_order_relaxed);
+    slot.route_size.store(trace.route_.size(), std::memory_order_relaxed);
+    slot.status.store(status, std::memory_order_relaxed);
+    slot.started_us.store(Microseconds(trace.started_.time_since_epoch()), std::memory_order_relaxed);
+    slot.duration_us.store(Microseconds(end - trace.started_), std::memory_order_relaxed);
+    for (std::size_t stage = 0; stage < TRACE_STAGES; ++stage) {
+        slot.totals_us[stage].store(trace.totals_[stage].count(), std::memory_order_relaxed);
+    }
+    slot.span_count.store(trace.span_count_, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < trace.span_count_; ++i) {
+        const auto& span = trace.spans_[i];
+        auto packed = static_cast<std::uint64_t>(span.stage) << (2 * kSpanTimeBits)
+            | pack(span.begin) << kSpanTimeBits
+            | pack(span.duration);
+        slot.spans[i].store(packed, std::memory_order_relaxed);
+    }
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool Tracer::read(const Slot& slot, std::chrono::microseconds clock_offset, TraceRecord& record) {
+    constexpr std::uint64_t kSpanTimeMask = (std::uint64_t(1) << kSpanTimeBits) - 1;
+
+    auto sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence == 0 || sequence % 2 == 1) {
+        return false;
+    }
+    const char* route = slot.route.load(std::memory_order_relaxed);
+    auto route_size = slot.route_size.load(std::memory_order_relaxed);
+    record.status = slot.status.load(std::memory_order_relaxed);
+    record.started_at = std::chrono::system_clock::time_point(
+        std::chrono::microseconds(slot.started_us.load(std::memory_order_relaxed)) + clock_offset);
+    record.duration = std::chrono::microseconds(slot.duration_us.load(std::memory_order_relaxed));
+    for (std::size_t stage = 0; stage < TRACE_STAGES; ++stage) {
+        record.totals[stage] = std::chrono::microseconds(slot.totals_us[stage].load(std::memory_order_relaxed));
+    }
+    auto span_count = std::min(slot.span_count.load(std::memory_order_relaxed), RequestTrace::kMaxSpans);
+    std::array<std::uint64_t, RequestTrace::kMaxSpans> spans;
+    for (std::size_t i = 0; i < span_count; ++i) {
+        spans[i] = slot.spans[i].load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+        return false;
+    }
+
+    // The route outlives the slot, so it is safe to copy once the values
+    // are known to belong together.
+    record.route.assign(route ? std::string_view(route, route_size) : std::string_view());
+    record.spans.clear();
+    for (std::size_t i = 0; i < span_count; ++i) {
+        record.spans.push_back(RequestTrace::Span{
+            .stage = static_cast<ETraceStage>(spans[i] >> (2 * kSpanTimeBits)),
+            .begin = std::chrono::microseconds((spans[i] >> kSpanTimeBits) & kSpanTimeMask),
+            .duration = std::chrono::microseconds(spans[i] & kSpanTimeMask),
+        });
+    }
+    return true;
+}
+
+std::vector<TraceRecord> Tracer::slowest(std::size_t n) const {
+    struct Candidate {
+        std::int64_t duration_us;
+        const Slot* slot;
+    };
+    std::vector<Candidate> candidates;
+    {
+        std::lock_guard lock(mutex_);
+        candidates.reserve(rings_.size() * kRingSize);
+        for (const auto& ring : rings_) {
+            for (const auto& slot : ring->slots) {
+                if (slot.sequence.load(std::memory_order_acquire) != 0) {
+                    candidates.push_back({slot.duration_us.load(std::memory_order_relaxed), &slot});
+                }
+            }
+        }
+    }
+    // Rings are never freed, so the slots stay valid without the lock.
+    auto slower = [](const Candidate& lhs, const Candidate& rhs) {
+        return lhs.duration_us > rhs.duration_us;
+    };
+    auto count = std::min(n, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(count), candidates.end(), slower);
+
+    auto clock_offset = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch() - TraceClock::now().time_since_epoch());
+    std::vector<TraceRecord> records;
+    records.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        // A slot rewritten since it was picked is left out.
+        if (TraceRecord record; read(*candidates[i].slot, clock_offset, record)) {
+            records.push_back(std::move(record));
+        }
+    }
+    std::ranges::stable_sort(records, [](const TraceRecord& lhs, const TraceRecord& rhs) {
+        return lhs.duration > rhs.duration;
+    });
+    return records;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Stages a request spends its time in. Spans of one stage may repeat, a
+// streamed /post alternates TRACE_READ and TRACE_PARSE for every piece.
+enum ETraceStage {
+    // Reading the body from the socket.
+    TRACE_READ,
+    // Waiting in the admission queue for a worker.
+    TRACE_QUEUE,
+    // Opening the database connection of a worker.
+    TRACE_CONNECT,
+    // Decoding the body into the request structures.
+    TRACE_PARSE,
+    // Statements of the transaction.
+    TRACE_STORE,
+    TRACE_COMMIT,
+    // Everything the worker did, the stages above included.
+    TRACE_HANDLER,
+    // Sending the response, chunks written by the handler included.
+    TRACE_WRITE,
+    TRACE_STAGES,
+};
+
+std::string ToString(ETraceStage stage);
+ETraceStage TraceStageFromString(const std::string& str);
+
+using TraceClock = std::chrono::steady_clock;
+
+// Stage timings of one request, filled by the threads that serve it one
+// after another and submitted to the Tracer once it is answered. Inactive,
+// and then free to fill, unless tracing was enabled when it started.
+class RequestTrace {
+public:
+    // Spans after that only count towards the stage totals.
+    static constexpr std::size_t kMaxSpans = 32;
+
+    struct Span {
+        ETraceStage stage;
+        std::chrono::microseconds begin;
+        std::chrono::microseconds duration;
+    };
+
+    // route must outlive the trace; the patterns of the router do.
+    void start(std::string_view route);
+
+    bool active() const {
+        return active_;
+    }
+
+    // Reads the clock only for an active trace, so marks cost next to
+    // nothing while tracing is off.
+    TraceClock::time_point now() const {
+        return active_ ? TraceClock::now() : TraceClock::time_point();
+    }
+
+    void add(ETraceStage stage, TraceClock::time_point begin, TraceClock::time_point end);
+
+    // Hands the trace to the ring of the calling thread and deactivates it.
+    void submit(unsigned status);
+
+    // The trace the calling thread works for, see TraceScope.
+    static RequestTrace* Current();
+
+private:
+    friend class Tracer;
+    friend class TraceScope;
+
+    bool active_ = false;
+    std::string_view route_;
+    TraceClock::time_point started_;
+    std::array<std::chrono::microseconds, TRACE_STAGES> totals_{};
+    std::array<Span, kMaxSpans> spans_;
+    std::size_t span_count_ = 0;
+};
+
+// Makes trace the current one of the calling thread while it lives.
+class TraceScope {
+public:
+    explicit TraceScope(RequestTrace* trace);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    RequestTrace* previous_;
+};
+
+// Adds the time until its end to the current trace of the thread, if any.
+class TraceSpan {
+public:
+    explicit TraceSpan(ETraceStage stage)
+        : trace_(RequestTrace::Current())
+        , stage_(stage)
+    {
+        if (trace_ && trace_->active()) {
+            begin_ = TraceClock::now();
+        } else {
+            trace_ = nullptr;
+        }
+    }
+
+    ~TraceSpan() {
+        if (trace_) {
+            trace_->add(stage_, begin_, TraceClock::now());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    RequestTrace* trace_;
+    ETraceStage stage_;
+    TraceClock::time_point begin_;
+};
+
+// A submitted trace as read back from the rings.
+struct TraceRecord {
+    std::string route;
+    unsigned status = 0;
+    std::chrono::system_clock::time_point started_at;
+    std::chrono::microseconds duration{0};
+    std::array<std::chrono::microseconds, TRACE_STAGES> totals{};
+    std::vector<RequestTrace::Span> spans;
+};
+
+// Keeps the last kRingSize traces submitted by every thread in a ring of
+// that thread. Submitting takes no lock and never waits: every slot is a
+// seqlock that readers retry or skip while its owner rewrites it. Rings
+// outlive their threads, like the blocks of ServerMetrics.
+class Tracer {
+public:
+    static constexpr std::size_t kRingSize = 1024;
+
+    static Tracer& Instance();
+
+    // Off by default; requests started meanwhile are not traced.
+    void enable(bool enabled);
+    bool enabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // The n slowest traces the rings hold, slowest first.
+    std::vector<TraceRecord> slowest(std::size_t n) const;
+
+private:
+    friend class RequestTrace;
+
+    Tracer() = default;
+
+    // Spans packed as stage, begin and duration in microseconds.
+    static constexpr int kSpanTimeBits = 30;
+
+    struct Slot {
+        // Odd while the owner writes the slot.
+        std::atomic<std::uint64_t> sequence{0};
+        std::atomic<const char*> route{nullptr};
+        std::atomic<std::size_t> route_size{0};
+        std::atomic<unsigned> status{0};
+        // TraceClock, turned into wall clock time when read.
+        std::atomic<std::int64_t> started_us{0};
+        std::atomic<std::int64_t> duration_us{0};
+        std::array<std::atomic<std::int64_t>, TRACE_STAGES> totals_us{};
+        std::atomic<std::size_t> span_count{0};
+        std::array<std::atomic<std::uint64_t>, RequestTrace::kMaxSpans> spans{};
+    };
+
+    struct Ring {
+        std::array<Slot, kRingSize> slots;
+        // Only the owner touches it.
+        std::size_t next = 0;
+    };
+
+    Ring& local();
+    void write(Ring& ring, const RequestTrace& trace, unsigned status, TraceClock::time_point end);
+    // clock_offset takes TraceClock to system_clock time.
+    static bool read(const Slot& slot, std::chrono::microseconds clock_offset, TraceRecord& record);
+
+    std::atomic<bool> enabled_{false};
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+};
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <lib/server/admission.h>
+
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    AdmissionLimits MakeLimits(std::size_t max_queue, std::size_t route_limit) {
+        AdmissionLimits limits;
+        limits.max_queue = max_queue;
+        limits.routes = {{"/post", route_limit}};
+        return limits;
+    }
+
+} // anonymous namespace
+
+TEST(AdmissionTest, BoundsTheQueue) {
+    AdmissionController controller(MakeLimits(2, 10));
+    auto first = controller.admit("/get");
+    auto second = controller.admit("/get");
+    EXPECT_TRUE(first);
+    EXPECT_TRUE(second);
+    EXPECT_FALSE(controller.admit("/get"));
+    EXPECT_EQ(controller.stats().queue_depth, 2u);
+
+    // A started request leaves the queue.
+    EXPECT_TRUE(first.start());
+    EXPECT_EQ(controller.stats().queue_depth, 1u);
+    EXPECT_EQ(controller.stats().running, 1u);
+    auto third = controller.admit("/get");
+    EXPECT_TRUE(third);
+
+    second = {};
+    third = {};
+    first = {};
+    auto stats = controller.stats();
+    EXPECT_EQ(stats.queue_depth, 0u);
+    EXPECT_EQ(stats.running, 0u);
+    EXPECT_EQ(stats.admitted, 3u);
+    EXPECT_EQ(stats.rejected, 1u);
+}
+
+TEST(AdmissionTest, LimitsRoutes) {
+    AdmissionController controller(MakeLimits(100, 1));
+    auto post = controller.admit("/post");
+    EXPECT_TRUE(post);
+    EXPECT_TRUE(post.start());
+    // Running requests still count against their route.
+    EXPECT_FALSE(controller.admit("/post"));
+    EXPECT_TRUE(controller.admit("/get"));
+    EXPECT_EQ(controller.stats().in_flight.at("/post"), 1u);
+
+    auto moved = std::move(post);
+    EXPECT_FALSE(post);
+    moved = {};
+    EXPECT_EQ(controller.stats().in_flight.at("/post"), 0u);
+    EXPECT_TRUE(controller.admit("/post"));
+}
+
+TEST(AdmissionTest, ShedsStaleRequests) {
+    AdmissionLimits limits = MakeLimits(10, 10);
+    limits.max_queue_time = std::chrono::milliseconds(5);
+    AdmissionController controller(limits);
+
+    auto fresh = controller.admit("/get");
+    EXPECT_TRUE(fresh.start());
+    auto stale = controller.admit("/get");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(stale.start());
+
+    auto stats = controller.stats();
+    EXPECT_EQ(stats.shed, 1u);
+    EXPECT_GE(stats.wait_time_max_us, 20000u);
+    EXPECT_GE(stats.wait_time_sum_us, stats.wait_time_max_us);
+}
+
+TEST(AdmissionTest, ConcurrentAdmissionsKeepLimits) {
+    AdmissionController controller(MakeLimits(1000, 8));
+    std::atomic<std::size_t> running{0};
+    std::atomic<std::size_t> peak{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 2000; ++j) {
+                auto ticket = controller.admit("/post");
+                if (!ticket || !ticket.start()) {
+                    continue;
+                }
+                auto now = running.fetch_add(1) + 1;
+                auto seen = peak.load();
+                while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+                }
+                running.fetch_sub(1);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_LE(peak.load(), 8u);
+    auto stats = controller.stats();
+    EXPECT_EQ(stats.queue_depth, 0u);
+    EXPECT_EQ(stats.running, 0u);
+    EXPECT_EQ(stats.in_flight.at("/post"), 0u);
+    EXPECT_EQ(stats.admitted + stats.rejected, 16000u);
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <lib/service/aggregation.h>
+#include <lib/service/topk.h>
+
+TEST(AggregationTest, ParseTags) {
+    EXPECT_TRUE(ParseTags("").empty());
+    EXPECT_EQ(ParseTags("|a"), Tags({"a"}));
+    EXPECT_EQ(ParseTags("|region=eu|host=1"), Tags({"region=eu", "host=1"}));
+}
+
+TEST(AggregationTest, FilterAndGroupKey) {
+    Tags tags = {"region=eu", "host=1", "canary"};
+
+    EXPECT_TRUE(MatchesFilter(tags, {}));
+    EXPECT_TRUE(MatchesFilter(tags, {"canary", "region=eu"}));
+    EXPECT_FALSE(MatchesFilter(tags, {"region=us"}));
+
+    EXPECT_EQ(GroupKey(tags, {"region"}), Tags({"region=eu"}));
+    EXPECT_EQ(GroupKey(tags, {"host", "dc"}), Tags({"host=1", "dc="}));
+}
+
+TEST(AggregationTest, AggregateGroupsIsIndependentOfWorkerCount) {
+    std::vector<Series> series;
+    for (int i = 0; i < 1000; ++i) {
+        Series s;
+        s.tags = {i % 2 == 0 ? "region=eu" : "region=us", std::pmr::string("host=" + std::to_string(i))};
+        s.timestamps = {0, kBucketMilliseconds};
+        s.values = {1.0, static_cast<double>(i)};
+        series.push_back(std::move(s));
+    }
+
+    auto single = AggregateGroups(series, {"region"}, 1);
+    auto parallel = AggregateGroups(series, {"region"}, 8);
+
+    ASSERT_EQ(single.size(), 2);
+    ASSERT_EQ(parallel.size(), 2);
+    for (const auto& [key, buckets] : single) {
+        const auto& other = parallel.at(key);
+        ASSERT_EQ(buckets.size(), other.size());
+        for (const auto& [bucket, partial] : buckets) {
+            EXPECT_DOUBLE_EQ(partial.sum, other.at(bucket).sum);
+            EXPECT_EQ(partial.count, other.at(bucket).count);
+            EXPECT_DOUBLE_EQ(partial.max, other.at(bucket).max);
+        }
+    }
+
+    const auto& eu = single.at({"region=eu"});
+    EXPECT_DOUBLE_EQ(eu.at(0).Finalize(EAggregation::SUM), 500.0);
+    EXPECT_DOUBLE_EQ(eu.at(kBucketMilliseconds).Finalize(EAggregation::MAXIMUM), 998.0);
+    EXPECT_DOUBLE_EQ(eu.at(kBucketMilliseconds).Finalize(EAggregation::COUNT), 500.0);
+    EXPECT_DOUBLE_EQ(eu.at(kBucketMilliseconds).Finalize(EAggregation::AVG), 499.0);
+}
+
+TEST(AggregationTest, TopKHeapKeepsHighestValues) {
+    TopKHeap heap(3);
+    for (int i = 0; i < 100; ++i) {
+        double value = static_cast<double>((i * 37) % 100);
+        if (heap.Accepts(value)) {
+            heap.Push(RankedSeries{{std::pmr::string("host=" + std::to_string(i))}, value});
+        }
+    }
+    EXPECT_TRUE(heap.Full());
+    EXPECT_DOUBLE_EQ(heap.Floor(), 97.0);
+    EXPECT_FALSE(heap.Accepts(97.0));
+
+    TopKHeap other(3);
+    other.Push(RankedSeries{{"host=x"}, 150.0});
+    heap.Merge(std::move(other));
+
+    auto top = std::move(heap).TakeSorted();
+    ASSERT_EQ(top.size(), 3);
+    EXPECT_DOUBLE_EQ(top[0].value, 150.0);
+    EXPECT_EQ(top[0].tags, Tags({"host=x"}));
+    EXPECT_DOUBLE_EQ(top[1].value, 99.0);
+    EXPECT_DOUBLE_EQ(top[2].value, 98.0);
+}
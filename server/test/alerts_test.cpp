@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <lib/service/alerts.h>
+
+namespace {
+
+    AlertRule MakeRule(std::string id, EAlertCondition condition, double threshold) {
+        AlertRule rule;
+        rule.id = std::move(id);
+        rule.project_id = "web";
+        rule.tags = {"kind=errors"};
+        rule.condition = condition;
+        rule.threshold = threshold;
+        return rule;
+    }
+
+} // anonymous namespace
+
+TEST(AlertsTest, ThresholdFiresAndResolves) {
+    AlertEngine engine;
+    engine.AddRule(MakeRule("high", EAlertCondition::ABOVE, 10.0));
+    Tags tags = {"kind=errors", "host=1"};
+
+    engine.OnBuckets("web", tags, {{0, 6.0}}, 0);
+    EXPECT_TRUE(engine.DrainEvents(10).empty());
+
+    // Same bucket again, stored with what both writes added: the new value
+    // replaces the old one and crosses the threshold.
+    engine.OnBuckets("web", tags, {{0, 12.0}}, 1000);
+    auto events = engine.DrainEvents(10);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_EQ(events[0].rule_id, "high");
+    EXPECT_TRUE(events[0].firing);
+    EXPECT_DOUBLE_EQ(events[0].value, 12.0);
+
+    engine.OnBuckets("web", tags, {{kBucketMilliseconds, 1.0}}, 16000);
+    events = engine.DrainEvents(10);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_FALSE(events[0].firing);
+
+    // Other projects and tags are not matched.
+    engine.OnBuckets("web", {"kind=requests"}, {{0, 100.0}}, 17000);
+    engine.OnBuckets("api", tags, {{0, 100.0}}, 17000);
+    EXPECT_TRUE(engine.DrainEvents(10).empty());
+}
+
+TEST(AlertsTest, BucketSeenAgainIsNotAdded) {
+    AlertEngine engine;
+    engine.AddRule(MakeRule("high", EAlertCondition::ABOVE, 10.0));
+    Tags tags = {"kind=errors"};
+
+    // A counter posted twice within a bucket is stored, and seen, twice
+    // with its own value.
+    engine.OnBuckets("web", tags, {{0, 8.0}}, 0);
+    engine.OnBuckets("web", tags, {{0, 8.0}}, 1000);
+    EXPECT_TRUE(engine.DrainEvents(10).empty());
+}
+
+TEST(AlertsTest, RateOfChange) {
+    AlertEngine engine;
+    engine.AddRule(MakeRule("jump", EAlertCondition::RATE_OF_CHANGE, 1.0));
+    Tags tags = {"kind=errors"};
+
+    engine.OnBuckets("web", tags, {{0, 10.0}, {kBucketMilliseconds, 20.0}}, 0);
+    EXPECT_TRUE(engine.DrainEvents(10).empty());
+
+    engine.OnBuckets("web", tags, {{2 * kBucketMilliseconds, 50.0}}, 0);
+    auto events = engine.DrainEvents(10);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_DOUBLE_EQ(events[0].value, 2.0);
+
+    // Two buckets missing: the change is spread over 45 seconds.
+    engine.OnBuckets("web", tags, {{5 * kBucketMilliseconds, 59.0}}, 0);
+    events = engine.DrainEvents(10);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_FALSE(events[0].firing);
+    EXPECT_DOUBLE_EQ(events[0].value, 0.2);
+}
+
+TEST(AlertsTest, Absence) {
+    AlertEngine engine;
+    AlertRule rule = MakeRule("silent", EAlertCondition::ABSENT, 0.0);
+    rule.absent_seconds = 60;
+    engine.AddRule(rule);
+    Tags tags = {"kind=errors"};
+
+    engine.OnBuckets("web", tags, {{0, 1.0}}, 0);
+    engine.Sweep(30000);
+    EXPECT_TRUE(engine.DrainEvents(10).empty());
+
+    engine.Sweep(61000);
+    auto events = engine.DrainEvents(10);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_TRUE(events[0].firing);
+
+    engine.OnBuckets("web", tags, {{60000, 1.0}}, 62000);
+    events = engine.DrainEvents(10);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_FALSE(events[0].firing);
+}
+
+TEST(AlertsTest, SweepForgetsSilentSeries) {
+    AlertEngine engine;
+    engine.AddRule(MakeRule("high", EAlertCondition::ABOVE, 10.0));
+    Tags tags = {"kind=errors"};
+
+    engine.OnBuckets("web", tags, {{kBucketMilliseconds, 6.0}}, 0);
+    engine.Sweep(AlertEngine::kSeriesTtlMilliseconds + 1);
+
+    // The series was forgotten, so an earlier bucket is not late data and
+    // gets evaluated.
+    engine.OnBuckets("web", tags, {{0, 12.0}}, AlertEngine::kSeriesTtlMilliseconds + 2);
+    EXPECT_EQ(engine.DrainEvents(10).size(), 1);
+}
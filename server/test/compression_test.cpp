@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include <lib/server/compression.h>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    std::string MakeBody(std::size_t points) {
+        std::string body;
+        for (std::size_t i = 0; i < points; ++i) {
+            body += R"({"value":)" + std::to_string(i % 97) + R"(,"timestamp":)" + std::to_string(1700000000000 + i * 15000) + "},";
+        }
+        return body;
+    }
+
+    // Feeds the body in pieces, as the request reader does.
+    std::string Decompress(EContentEncoding encoding, std::string_view body, std::size_t piece, std::uint64_t max_output) {
+        Decompressor decompressor(encoding, max_output);
+        std::string out;
+        while (!body.empty()) {
+            std::string_view input = body.substr(0, piece);
+            body.remove_prefix(input.size());
+            for (auto chunk = decompressor.read(input); !chunk.empty(); chunk = decompressor.read(input)) {
+                out += chunk;
+            }
+        }
+        decompressor.finish();
+        return out;
+    }
+
+} // anonymous namespace
+
+TEST(CompressionTest, GzipRoundTrip) {
+    std::string body = MakeBody(20000);
+    std::string compressed;
+    Compress(EContentEncoding::GZIP, body, compressed);
+    EXPECT_LT(compressed.size(), body.size() / 4);
+    EXPECT_EQ(static_cast<unsigned char>(compressed[0]), 0x1f);
+    EXPECT_EQ(static_cast<unsigned char>(compressed[1]), 0x8b);
+
+    EXPECT_EQ(Decompress(EContentEncoding::GZIP, compressed, 1000, body.size()), body);
+    EXPECT_EQ(Decompress(EContentEncoding::GZIP, compressed, compressed.size(), body.size()), body);
+}
+
+TEST(CompressionTest, StreamingWrites) {
+    std::string body = MakeBody(5000);
+    std::string whole;
+    Compress(EContentEncoding::GZIP, body, whole);
+
+    // Compresses again, reusing the pooled context.
+    Compressor compressor(EContentEncoding::GZIP);
+    std::string streamed;
+    for (std::size_t offset = 0; offset < body.size(); offset += 777) {
+        compressor.write(std::string_view(body).substr(offset, 777), streamed);
+    }
+    compressor.finish(streamed);
+    EXPECT_EQ(Decompress(EContentEncoding::GZIP, streamed, 4096, body.size()), body);
+    EXPECT_EQ(Decompress(EContentEncoding::GZIP, whole, 4096, body.size()), body);
+}
+
+TEST(CompressionTest, InterleavesStreamsAcrossThreads) {
+    std::vector<EContentEncoding> encodings = {EContentEncoding::GZIP};
+#ifdef MONITORING_WITH_ZSTD
+    encodings.push_back(EContentEncoding::ZSTD);
+#endif
+    for (auto encoding : encodings) {
+        std::string bodies[] = {MakeBody(20000), MakeBody(3000)};
+        std::string compressed[2];
+        std::string_view rest[2];
+        std::string out[2];
+        for (int i = 0; i < 2; ++i) {
+            Compress(encoding, bodies[i], compressed[i]);
+            rest[i] = compressed[i];
+        }
+
+        // Every piece goes to a thread of its own, alternating between the
+        // two streams, as /post bodies move between workers.
+        Decompressor first(encoding, bodies[0].size());
+        Decompressor second(encoding, bodies[1].size());
+        Decompressor* decompressors[] = {&first, &second};
+        while (!rest[0].empty() || !rest[1].empty()) {
+            for (int i = 0; i < 2; ++i) {
+                std::thread([&, i] {
+                    std::string_view input = rest[i].substr(0, 1000);
+                    rest[i].remove_prefix(input.size());
+                    for (auto chunk = decompressors[i]->read(input); !chunk.empty(); chunk = decompressors[i]->read(input)) {
+                        out[i] += chunk;
+                    }
+                }).join();
+            }
+        }
+        std::thread([&] {
+            first.finish();
+            second.finish();
+        }).join();
+        EXPECT_EQ(out[0], bodies[0]) << ToString(encoding);
+        EXPECT_EQ(out[1], bodies[1]) << ToString(encoding);
+    }
+}
+
+TEST(CompressionTest, Negotiation) {
+    EXPECT_EQ(NegotiateEncoding(""), EContentEncoding::IDENTITY);
+    EXPECT_EQ(NegotiateEncoding("gzip"), EContentEncoding::GZIP);
+    EXPECT_EQ(NegotiateEncoding("deflate, GZIP;q=0.5"), EContentEncoding::GZIP);
+    EXPECT_EQ(NegotiateEncoding("gzip;q=0, br"), EContentEncoding::IDENTITY);
+    EXPECT_EQ(NegotiateEncoding("identity"), EContentEncoding::IDENTITY);
+#ifdef MONITORING_WITH_ZSTD
+    EXPECT_EQ(NegotiateEncoding("*;q=0.1, gzip;q=0"), EContentEncoding::ZSTD);
+    EXPECT_EQ(NegotiateEncoding("*;q=0.1, gzip;q=0, zstd;q=0"), EContentEncoding::IDENTITY);
+    EXPECT_EQ(NegotiateEncoding("gzip, zstd"), EContentEncoding::ZSTD);
+    EXPECT_EQ(NegotiateEncoding("gzip, zstd;q=0.8"), EContentEncoding::GZIP);
+    EXPECT_EQ(NegotiateEncoding("*"), EContentEncoding::ZSTD);
+#else
+    EXPECT_EQ(NegotiateEncoding("gzip;q=0.2, zstd"), EContentEncoding::GZIP);
+    EXPECT_EQ(NegotiateEncoding("*"), EContentEncoding::GZIP);
+    EXPECT_EQ(NegotiateEncoding("*;q=0.1, gzip;q=0"), EContentEncoding::IDENTITY);
+    EXPECT_THROW(ContentEncodingFromString("zstd"), std::invalid_argument);
+#endif
+
+    EXPECT_EQ(ContentEncodingFromString(""), EContentEncoding::IDENTITY);
+    EXPECT_EQ(ContentEncodingFromString("x-gzip"), EContentEncoding::GZIP);
+    EXPECT_THROW(ContentEncodingFromString("br"), std::invalid_argument);
+}
+
+TEST(CompressionTest, RejectsBadInput) {
+    std::string body = MakeBody(20000);
+    std::string compressed;
+    Compress(EContentEncoding::GZIP, body, compressed);
+
+    EXPECT_THROW(Decompress(EContentEncoding::GZIP, compressed, 1000, body.size() - 1), std::length_error);
+    EXPECT_THROW(Decompress(EContentEncoding::GZIP, compressed.substr(0, compressed.size() / 2), 1000, body.size()), std::invalid_argument);
+    EXPECT_THROW(Decompress(EContentEncoding::GZIP, compressed + "x", 1000, body.size()), std::invalid_argument);
+    EXPECT_THROW(Decompress(EContentEncoding::GZIP, "not gzip at all", 1000, body.size()), std::invalid_argument);
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <lib/codec/frame_encoder.h>
+#include <lib/server/frame_decoder.h>
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    std::string EncodeSample() {
+        FrameEncoder encoder;
+        auto cpu = encoder.series("web", WIRE_SPEED, std::vector<std::string>{"region=eu", "host=1"});
+        auto errors = encoder.series("api", WIRE_DOT, std::vector<std::string>{});
+        std::vector<int64_t> timestamps = {1700000000000, 1700000015000, 1699999990000};
+        std::vector<double> values = {1.5, -0.0, std::numeric_limits<double>::max()};
+        encoder.points(cpu, timestamps, values);
+        encoder.points(errors, std::vector<int64_t>{5}, std::vector<double>{7.0});
+        encoder.points(cpu, std::vector<int64_t>{1700000030000}, std::vector<double>{2.5});
+        return encoder.take();
+    }
+
+    void ExpectSample(const PostRequest& request) {
+        ASSERT_EQ(request.metrics.size(), 2);
+        const auto& cpu = request.metrics[0];
+        EXPECT_EQ(cpu.identifiers.project_id, "web");
+        EXPECT_EQ(cpu.identifiers.metric_type, EMetricType::SPEED);
+        EXPECT_EQ(cpu.identifiers.tags, Tags({"region=eu", "host=1"}));
+        ASSERT_EQ(cpu.values.size(), 4);
+        EXPECT_EQ(cpu.values[0].timestamp, 1700000000000);
+        EXPECT_EQ(cpu.values[2].timestamp, 1699999990000);
+        EXPECT_EQ(cpu.values[2].value, std::numeric_limits<double>::max());
+        EXPECT_EQ(cpu.values[3].value, 2.5);
+
+        const auto& errors = request.metrics[1];
+        EXPECT_EQ(errors.identifiers.project_id, "api");
+        EXPECT_TRUE(errors.identifiers.tags.empty());
+        ASSERT_EQ(errors.values.size(), 1);
+        EXPECT_EQ(errors.values[0].value, 7.0);
+        EXPECT_EQ(errors.values[0].timestamp, 5);
+    }
+
+} // anonymous namespace
+
+TEST(FrameCodecTest, RoundTrip) {
+    ExpectSample(DecodeFrames(EncodeSample()));
+}
+
+TEST(FrameCodecTest, ExtremeTimestampsRoundTrip) {
+    FrameEncoder encoder;
+    auto series = encoder.series("web", WIRE_DOT, std::vector<std::string>{});
+    std::vector<int64_t> timestamps = {
+        std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(), -1, std::numeric_limits<int64_t>::min()};
+    encoder.points(series, timestamps, std::vector<double>(timestamps.size(), 1.0));
+    auto request = DecodeFrames(encoder.take());
+    ASSERT_EQ(request.metrics.size(), 1);
+    ASSERT_EQ(request.metrics[0].values.size(), timestamps.size());
+    for (std::size_t i = 0; i < timestamps.size(); ++i) {
+        EXPECT_EQ(request.metrics[0].values[i].timestamp, timestamps[i]);
+    }
+}
+
+TEST(FrameCodecTest, CarriesCounters) {
+    FrameEncoder encoder;
+    auto requests = encoder.series("web", WIRE_COUNTER, std::vector<std::string>{"host=1"});
+    encoder.points(requests, std::vector<int64_t>{1700000000000}, std::vector<double>{42.0});
+    auto request = DecodeFrames(encoder.take());
+    ASSERT_EQ(request.metrics.size(), 1);
+    EXPECT_EQ(request.metrics[0].identifiers.metric_type, EMetricType::COUNTER);
+    EXPECT_EQ(request.metrics[0].values[0].value, 42.0);
+}
+
+TEST(FrameCodecTest, DecodesByteByByte) {
+    auto body = EncodeSample();
+    FrameDecoder decoder;
+    for (std::size_t i = 0; i < body.size(); ++i) {
+        decoder.write(std::string_view(body).substr(i, 1), true);
+    }
+    decoder.write({}, false);
+    ExpectSample(decoder.release());
+}
+
+TEST(FrameCodecTest, ReleasesCompletedMetrics) {
+    auto body = EncodeSample();
+    FrameDecoder decoder;
+    std::size_t points = 0;
+    for (std::size_t i = 0; i < body.size(); i += 7) {
+        decoder.write(std::string_view(body).substr(i, 7), true);
+        for (const auto& metric : decoder.release_completed().metrics) {
+            points += metric.values.size();
+        }
+        EXPECT_EQ(decoder.completed(), 0);
+    }
+    decoder.write({}, false);
+    EXPECT_TRUE(decoder.release().metrics.empty());
+    EXPECT_EQ(points, 5);
+}
+
+TEST(FrameCodecTest, RejectsInvalidStreams) {
+    auto body = EncodeSample();
+    FrameEncoder bounded;
+    bounded.series("web", WIRE_DOT, std::vector<std::string>{"le=0.5"});
+    FrameEncoder histogram;
+    histogram.series("web", static_cast<EWireMetricType>(EMetricType::HISTOGRAM), std::vector<std::string>{});
+    std::string unknown_series = std::string(kFrameMagic) + std::string("\x03\x00\x00\x00\x02\x05\x00", 7);
+    const std::vector<std::string> invalid = {
+        "",
+        "JSON{}",
+        body.substr(0, body.size() - 1),
+        std::string(kFrameMagic) + std::string("\x01\x00\x00\x00\x09", 5),
+        std::string(kFrameMagic) + std::string("\xff\xff\xff\xff", 4),
+        unknown_series,
+        // Frames carry no histograms, so nothing may pass for a bucket.
+        bounded.take(),
+        histogram.take(),
+    };
+    for (const auto& data : invalid) {
+        EXPECT_THROW(DecodeFrames(data), std::invalid_argument) << data.size();
+    }
+}
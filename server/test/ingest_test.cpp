@@ -0,0 +1,221 @@
+#include <gtest/gtest.h>
+#include <lib/service/ingest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <latch>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    struct Item : MpscNode {
+        int producer = 0;
+        int sequence = 0;
+    };
+
+    PostRequest MakeRequest(const std::string& project_id, int value) {
+        PostRequest request;
+        MetricIdentifiers ids;
+        ids.project_id = project_id;
+        ids.tags.emplace_back("host=" + std::to_string(value));
+        std::pmr::vector<MetricValue> values;
+        values.push_back(MetricValue{.value = static_cast<double>(value), .timestamp = 1700000000000});
+        request.metrics.emplace_back(std::move(ids), std::move(values));
+        return request;
+    }
+
+    // Queues request, which must outlive the future, and returns a future of
+    // its completion.
+    std::future<void> Push(IngestPipeline& pipeline, std::size_t shard, const PostRequest& request) {
+        auto promise = std::make_shared<std::promise<void>>();
+        auto future = promise->get_future();
+        pipeline.push(shard, request, [promise](std::exception_ptr error) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value();
+            }
+        });
+        return future;
+    }
+
+    // What a store function was handed, one entry per transaction.
+    struct Recorder {
+        std::mutex mutex;
+        std::vector<std::vector<int>> transactions;
+
+        IngestPipeline::StoreFunction store() {
+            return [this](std::span<const PostRequest* const> requests) {
+                std::vector<int> values;
+                for (const auto* request : requests) {
+                    for (const auto& metric : request->metrics) {
+                        if (metric.identifiers.project_id == "bad") {
+                            throw std::runtime_error("Unknown project");
+                        }
+                        values.push_back(static_cast<int>(metric.values.front().value));
+                    }
+                }
+                std::lock_guard lock(mutex);
+                transactions.push_back(std::move(values));
+            };
+        }
+    };
+
+} // anonymous namespace
+
+TEST(IngestTest, QueueKeepsTheOrderOfEveryProducer) {
+    constexpr int kProducers = 4;
+    constexpr int kItems = 20000;
+    MpscQueue queue;
+    std::vector<std::vector<Item>> items(kProducers);
+    for (auto& producer : items) {
+        producer = std::vector<Item>(kItems);
+    }
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < kProducers; ++producer) {
+        producers.emplace_back([&, producer] {
+            for (int i = 0; i < kItems; ++i) {
+                items[producer][i].producer = producer;
+                items[producer][i].sequence = i;
+                queue.push(&items[producer][i]);
+            }
+        });
+    }
+
+    std::vector<int> next(kProducers, 0);
+    int taken = 0;
+    while (taken < kProducers * kItems) {
+        auto* node = queue.pop();
+        if (!node) {
+            std::this_thread::yield();
+            continue;
+        }
+        auto* item = static_cast<Item*>(node);
+        EXPECT_EQ(item->sequence, next[item->producer]++);
+        ++taken;
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    EXPECT_EQ(queue.pop(), nullptr);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(IngestTest, WritersBatchQueuedRequests) {
+    Recorder recorder;
+    std::latch first_started(1);
+    std::latch release_first(1);
+    auto record = recorder.store();
+    bool blocked = false;
+    std::deque<PostRequest> requests;
+    std::vector<const PostRequest*> stored;
+    IngestPipeline pipeline(1, [&](std::span<const PostRequest* const> batch) {
+        // Holds the writer until the rest is queued behind the first batch.
+        if (!blocked) {
+            blocked = true;
+            first_started.count_down();
+            release_first.wait();
+        }
+        stored.insert(stored.end(), batch.begin(), batch.end());
+        record(batch);
+    });
+
+    auto shard = pipeline.shard();
+    std::vector<std::future<void>> futures;
+    futures.push_back(Push(pipeline, shard, requests.emplace_back(MakeRequest("web", 0))));
+    first_started.wait();
+    for (int i = 1; i < 10; ++i) {
+        futures.push_back(Push(pipeline, shard, requests.emplace_back(MakeRequest("web", i))));
+    }
+    release_first.count_down();
+    for (auto& future : futures) {
+        future.get();
+    }
+
+    std::lock_guard lock(recorder.mutex);
+    ASSERT_EQ(recorder.transactions.size(), 2);
+    EXPECT_EQ(recorder.transactions[0], std::vector<int>{0});
+    EXPECT_EQ(recorder.transactions[1], (std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9}));
+    // The writer stored the requests it was given, not copies.
+    ASSERT_EQ(stored.size(), requests.size());
+    for (std::size_t i = 0; i < stored.size(); ++i) {
+        EXPECT_EQ(stored[i], &requests[i]);
+    }
+}
+
+TEST(IngestTest, FailedBatchFailsAlone) {
+    Recorder recorder;
+    std::latch started(1);
+    std::latch release(1);
+    auto record = recorder.store();
+    bool blocked = false;
+    IngestPipeline pipeline(1, [&](std::span<const PostRequest* const> requests) {
+        if (!blocked) {
+            blocked = true;
+            started.count_down();
+            release.wait();
+        }
+        record(requests);
+    });
+
+    std::deque<PostRequest> requests;
+    auto first = Push(pipeline, 0, requests.emplace_back(MakeRequest("web", 0)));
+    started.wait();
+    auto good = Push(pipeline, 0, requests.emplace_back(MakeRequest("web", 1)));
+    auto bad = Push(pipeline, 0, requests.emplace_back(MakeRequest("bad", 2)));
+    auto last = Push(pipeline, 0, requests.emplace_back(MakeRequest("web", 3)));
+    release.count_down();
+
+    first.get();
+    good.get();
+    EXPECT_THROW(bad.get(), std::runtime_error);
+    last.get();
+    std::lock_guard lock(recorder.mutex);
+    // The merged transaction failed, then every batch went on its own.
+    EXPECT_EQ(recorder.transactions, (std::vector<std::vector<int>>{{0}, {1}, {3}}));
+}
+
+TEST(IngestTest, StopStoresWhatIsQueued) {
+    Recorder recorder;
+    std::vector<std::future<void>> futures;
+    std::vector<std::deque<PostRequest>> requests(4);
+    {
+        IngestPipeline pipeline(3, recorder.store(), 4);
+        std::vector<std::thread> producers;
+        for (int producer = 0; producer < 4; ++producer) {
+            producers.emplace_back([&pipeline, producer, &futures, &recorder, &requests = requests[producer]] {
+                auto shard = pipeline.shard();
+                for (int i = 0; i < 100; ++i) {
+                    auto future = Push(pipeline, shard, requests.emplace_back(MakeRequest("web", producer * 100 + i)));
+                    std::lock_guard lock(recorder.mutex);
+                    futures.push_back(std::move(future));
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        pipeline.stop();
+    }
+    for (auto& future : futures) {
+        EXPECT_EQ(future.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+        future.get();
+    }
+
+    std::vector<bool> stored(400, false);
+    for (const auto& transaction : recorder.transactions) {
+        // Batches of one metric each, so never more than max_batch_metrics.
+        EXPECT_LE(transaction.size(), 4);
+        for (int value : transaction) {
+            EXPECT_FALSE(stored[value]);
+            stored[value] = true;
+        }
+    }
+    EXPECT_EQ(std::count(stored.begin(), stored.end(), true), 400);
+}
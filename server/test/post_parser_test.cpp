@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+#include <lib/server/post_parser.h>
+
+namespace {
+
+    const std::string kBody = R"({
+        "metrics": [
+            {
+                "project_id": "web",
+                "metric_type": "SPEED",
+                "tags": ["region=eu", "host=1"],
+                "values": [
+                    {"value": 1.5, "timestamp": 1000},
+                    {"timestamp": 2000, "value": 3}
+                ]
+            },
+            {
+                "values": [],
+                "tags": [],
+                "metric_type": "DOT",
+                "project_id": "api"
+            }
+        ]
+    })";
+
+} // anonymous namespace
+
+TEST(PostParserTest, ParsesRequest) {
+    auto request = ParsePostRequest(kBody);
+    ASSERT_EQ(request.metrics.size(), 2);
+
+    const auto& first = request.metrics[0];
+    EXPECT_EQ(first.identifiers.project_id, "web");
+    EXPECT_EQ(first.identifiers.metric_type, EMetricType::SPEED);
+    EXPECT_EQ(first.identifiers.tags, Tags({"region=eu", "host=1"}));
+    ASSERT_EQ(first.values.size(), 2);
+    EXPECT_DOUBLE_EQ(first.values[0].value, 1.5);
+    EXPECT_EQ(first.values[0].timestamp, 1000);
+    EXPECT_DOUBLE_EQ(first.values[1].value, 3.0);
+    EXPECT_EQ(first.values[1].timestamp, 2000);
+
+    const auto& second = request.metrics[1];
+    EXPECT_EQ(second.identifiers.project_id, "api");
+    EXPECT_EQ(second.identifiers.metric_type, EMetricType::DOT);
+    EXPECT_TRUE(second.identifiers.tags.empty());
+    EXPECT_TRUE(second.values.empty());
+}
+
+TEST(PostParserTest, ParsesByteByByte) {
+    PostRequestParser parser;
+    for (std::size_t i = 0; i < kBody.size(); ++i) {
+        parser.write(std::string_view(kBody).substr(i, 1), true);
+    }
+    parser.write({}, false);
+    ASSERT_TRUE(parser.done());
+
+    auto request = parser.release();
+    ASSERT_EQ(request.metrics.size(), 2);
+    EXPECT_EQ(request.metrics[0].identifiers.tags, Tags({"region=eu", "host=1"}));
+    EXPECT_EQ(request.metrics[1].identifiers.project_id, "api");
+}
+
+TEST(PostParserTest, ReleasesCompletedMetricsWhileParsing) {
+    PostRequestParser parser;
+    std::vector<Metric> metrics;
+    for (std::size_t i = 0; i < kBody.size(); ++i) {
+        parser.write(std::string_view(kBody).substr(i, 1), true);
+        if (parser.completed() > 0) {
+            auto batch = parser.release_completed();
+            ASSERT_EQ(batch.metrics.size(), 1);
+            metrics.push_back(std::move(batch.metrics[0]));
+        }
+        EXPECT_EQ(parser.completed(), 0);
+    }
+    parser.write({}, false);
+    EXPECT_TRUE(parser.release().metrics.empty());
+
+    ASSERT_EQ(metrics.size(), 2);
+    EXPECT_EQ(metrics[0].identifiers.project_id, "web");
+    EXPECT_EQ(metrics[0].identifiers.tags, Tags({"region=eu", "host=1"}));
+    EXPECT_EQ(metrics[0].values.size(), 2);
+    EXPECT_EQ(metrics[1].identifiers.project_id, "api");
+}
+
+TEST(PostParserTest, ExpandsHistogramsIntoBucketSeries) {
+    // metric_type after the values, so the parser only knows at the end.
+    auto request = ParsePostRequest(R"({
+        "metrics": [{
+            "project_id": "web",
+            "tags": ["route=/get"],
+            "values": [
+                {"timestamp": 1000, "buckets": {"0.5": 3, "0.1": 7, "+Inf": 0}},
+                {"buckets": {"0.10": 2, "2.5": 1, "+Inf": 4}, "timestamp": 2000}
+            ],
+            "metric_type": "HISTOGRAM"
+        }]
+    })");
+    ASSERT_EQ(request.metrics.size(), 4);
+
+    std::vector<std::string> bounds;
+    for (const auto& metric : request.metrics) {
+        EXPECT_EQ(metric.identifiers.project_id, "web");
+        EXPECT_EQ(metric.identifiers.metric_type, EMetricType::HISTOGRAM);
+        ASSERT_EQ(metric.identifiers.tags.size(), 2);
+        EXPECT_EQ(metric.identifiers.tags[0], "route=/get");
+        bounds.emplace_back(metric.identifiers.tags[1]);
+    }
+    EXPECT_EQ(bounds, (std::vector<std::string>{"le=0.1", "le=0.5", "le=2.5", "le=+Inf"}));
+
+    // Both samples of 0.1, in order; the empty +Inf bucket of the first is not stored.
+    const auto& fastest = request.metrics[0].values;
+    ASSERT_EQ(fastest.size(), 2);
+    EXPECT_DOUBLE_EQ(fastest[0].value, 7.0);
+    EXPECT_EQ(fastest[0].timestamp, 1000);
+    EXPECT_DOUBLE_EQ(fastest[1].value, 2.0);
+    EXPECT_EQ(fastest[1].timestamp, 2000);
+    ASSERT_EQ(request.metrics[3].values.size(), 1);
+    EXPECT_DOUBLE_EQ(request.metrics[3].values[0].value, 4.0);
+    EXPECT_EQ(request.metrics[3].values[0].timestamp, 2000);
+}
+
+TEST(PostParserTest, SpellingsOfOneBoundAreOneSeries) {
+    auto request = ParsePostRequest(R"({"metrics": [{
+        "project_id": "web", "metric_type": "HISTOGRAM", "tags": [],
+        "values": [
+            {"timestamp": 1000, "buckets": {"0.1": 3, "+Inf": 2}},
+            {"timestamp": 2000, "buckets": {"0.100": 5, "Inf": 1}}
+        ]
+    }]})");
+    ASSERT_EQ(request.metrics.size(), 2);
+    EXPECT_EQ(request.metrics[0].identifiers.tags, Tags({"le=0.1"}));
+    const auto& values = request.metrics[0].values;
+    ASSERT_EQ(values.size(), 2);
+    EXPECT_DOUBLE_EQ(values[0].value, 3.0);
+    EXPECT_EQ(values[0].timestamp, 1000);
+    EXPECT_DOUBLE_EQ(values[1].value, 5.0);
+    EXPECT_EQ(request.metrics[1].identifiers.tags, Tags({"le=+Inf"}));
+    ASSERT_EQ(request.metrics[1].values.size(), 2);
+
+    // Within one value they are a duplicate key.
+    for (const char* buckets : {R"({"0.1": 3, "0.10": 4})", R"({"1e-1": 1, "0.1": 1})", R"({"+Inf": 2, "Inf": 1})"}) {
+        EXPECT_THROW(ParsePostRequest(std::string(R"({"metrics": [{"project_id": "web", "metric_type": "HISTOGRAM", "tags": [],)"
+                                                  R"( "values": [{"timestamp": 1000, "buckets": )") + buckets + "}]}]}"),
+                     std::invalid_argument) << buckets;
+    }
+}
+
+TEST(PostParserTest, RejectsInvalidDocuments) {
+    const std::vector<std::string> invalid = {
+        R"([])",
+        R"({})",
+        R"({"metrics": {}})",
+        R"({"metrics": [], "extra": 1})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "DOT", "tags": []}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "GAUGE", "tags": [], "values": []}]})",
+        R"({"metrics": [{"project_id": 1, "metric_type": "DOT", "tags": [], "values": []}]})",
+        R"({"metrics": [{"project_id": "web", "project_id": "web", "metric_type": "DOT", "tags": [], "values": []}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "DOT", "tags": [1], "values": []}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "DOT", "tags": [], "values": [{"value": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "DOT", "tags": [], "values": [{"value": 1, "timestamp": 1.5}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "DOT", "tags": [], "values": [{"value": null, "timestamp": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "DOT", "tags": [], "values": [{"buckets": {"1": 1}, "timestamp": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "HISTOGRAM", "tags": [], "values": [{"value": 1, "timestamp": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "HISTOGRAM", "tags": [], "values": [{"buckets": {"1": 1}, "value": 1, "timestamp": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "HISTOGRAM", "tags": [], "values": [{"buckets": {"fast": 1}, "timestamp": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "HISTOGRAM", "tags": [], "values": [{"buckets": {"1": -1}, "timestamp": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "HISTOGRAM", "tags": ["le=1"], "values": [{"buckets": {"1": 1}, "timestamp": 1}]}]})",
+        R"({"metrics": [{"project_id": "web", "metric_type": "DOT", "tags": ["le=1"], "values": [{"value": 1, "timestamp": 1}]}]})",
+        R"({"metrics": []} trailing)",
+        R"({"metrics": [)",
+    };
+    for (const auto& body : invalid) {
+        EXPECT_THROW(ParsePostRequest(body), std::invalid_argument) << body;
+    }
+}
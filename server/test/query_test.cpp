@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <lib/service/query_plan.h>
+
+#include <cmath>
+#include <limits>
+
+namespace {
+
+    Series MakeSeries(Tags tags, std::vector<double> values) {
+        Series series;
+        series.tags = std::move(tags);
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            series.timestamps.push_back(static_cast<int64_t>(i) * kBucketMilliseconds);
+            series.values.push_back(values[i]);
+        }
+        return series;
+    }
+
+    SeriesSource MakeSource() {
+        return [](const std::string& project_id, const Tags& filter) {
+            std::vector<Series> all = {
+                MakeSeries({"region=eu", "host=1"}, {1, 2, 3, 4}),
+                MakeSeries({"region=eu", "host=2"}, {10, 20, 30, 40}),
+                MakeSeries({"region=us", "host=3"}, {100, 200, 300, 400}),
+            };
+            std::vector<Series> selected;
+            if (project_id != "web") {
+                return selected;
+            }
+            for (auto& series : all) {
+                if (MatchesFilter(series.tags, filter)) {
+                    selected.push_back(std::move(series));
+                }
+            }
+            return selected;
+        };
+    }
+
+    Frame Evaluate(std::string_view query) {
+        auto source = MakeSource();
+        return CompileQuery(*ParseQuery(query))->Execute(source, 0, 4);
+    }
+
+} // anonymous namespace
+
+TEST(QueryTest, Selector) {
+    auto frame = Evaluate("web{region=eu}");
+    ASSERT_EQ(frame.series.size(), 2);
+    EXPECT_EQ(frame.series[1].tags, Tags({"region=eu", "host=2"}));
+    EXPECT_DOUBLE_EQ(frame.series[1].values[3], 40.0);
+}
+
+TEST(QueryTest, SumByAndArithmetic) {
+    auto frame = Evaluate("sum by (region) (web{}) * 2 - 1");
+    ASSERT_EQ(frame.series.size(), 2);
+    EXPECT_EQ(frame.series[0].tags, Tags({"region=eu"}));
+    EXPECT_DOUBLE_EQ(frame.series[0].values[0], 21.0);
+    EXPECT_EQ(frame.series[1].tags, Tags({"region=us"}));
+    EXPECT_DOUBLE_EQ(frame.series[1].values[3], 799.0);
+}
+
+TEST(QueryTest, RateAndSeriesDivision) {
+    auto frame = Evaluate("rate(web{host=2}) / web{host=1}");
+    ASSERT_EQ(frame.series.size(), 1);
+    EXPECT_DOUBLE_EQ(frame.series[0].values[1], 10.0 / 15.0);
+}
+
+TEST(QueryTest, MovingWindow) {
+    auto frame = Evaluate("moving_avg(web{host=1}, 30s)");
+    ASSERT_EQ(frame.series.size(), 1);
+    EXPECT_DOUBLE_EQ(frame.series[0].values[0], 1.0);
+    EXPECT_DOUBLE_EQ(frame.series[0].values[3], 3.5);
+
+    frame = Evaluate("moving_max(-web{host=3}, 45s)");
+    EXPECT_DOUBLE_EQ(frame.series[0].values[3], -200.0);
+}
+
+TEST(QueryTest, MissingBucketsStayMissing) {
+    auto frame = Evaluate("avg(web{region=us})");
+    ASSERT_EQ(frame.series.size(), 1);
+    EXPECT_TRUE(frame.series[0].tags.empty());
+    EXPECT_DOUBLE_EQ(frame.series[0].values[2], 300.0);
+
+    frame = Evaluate("avg(web{region=asia})");
+    EXPECT_TRUE(frame.series.empty());
+}
+
+TEST(QueryTest, CounterIncrease) {
+    // Highest cumulative value per bucket: a gap at 2, a reset at 5.
+    constexpr double kMissing = std::numeric_limits<double>::quiet_NaN();
+    SeriesSource source = [&](const std::string&, const Tags&) {
+        return std::vector<Series>{
+            MakeSeries({"host=1"}, {kMissing, 100, kMissing, 130, 140, 5, 25}),
+        };
+    };
+    auto increase = CompileQuery(*ParseQuery("increase(web{})"))->Execute(source, 0, 7);
+    ASSERT_EQ(increase.series.size(), 1);
+    const auto& values = increase.series[0].values;
+    EXPECT_TRUE(std::isnan(values[0]));
+    EXPECT_DOUBLE_EQ(values[1], 15.0);
+    EXPECT_DOUBLE_EQ(values[2], 15.0);
+    EXPECT_DOUBLE_EQ(values[3], 15.0);
+    EXPECT_DOUBLE_EQ(values[4], 10.0);
+    EXPECT_DOUBLE_EQ(values[5], 5.0);
+    EXPECT_DOUBLE_EQ(values[6], 20.0);
+
+    auto rate = CompileQuery(*ParseQuery("rate(increase(web{}))"))->Execute(source, 0, 7);
+    EXPECT_DOUBLE_EQ(rate.series[0].values[6], 20.0 / 15.0);
+
+    // A counter seen once has grown by an unknown amount.
+    SeriesSource single = [](const std::string&, const Tags&) {
+        return std::vector<Series>{MakeSeries({"host=1"}, {7})};
+    };
+    increase = CompileQuery(*ParseQuery("increase(web{})"))->Execute(single, 0, 1);
+    EXPECT_TRUE(std::isnan(increase.series[0].values[0]));
+}
+
+TEST(QueryTest, HistogramQuantile) {
+    // Two hosts of one histogram, counts per bucket; host=2 has no samples
+    // above 0.2 in the first bucket of the grid.
+    SeriesSource source = [](const std::string&, const Tags& filter) {
+        std::vector<Series> all = {
+            MakeSeries({"host=1", "le=0.1"}, {10, 0}),
+            MakeSeries({"host=1", "le=0.2"}, {10, 0}),
+            MakeSeries({"host=1", "le=+Inf"}, {0, 5}),
+            MakeSeries({"host=2", "le=0.2"}, {20, 4}),
+        };
+        std::erase_if(all, [&filter](const Series& series) {
+            return !MatchesFilter(series.tags, filter);
+        });
+        return all;
+    };
+    auto evaluate = [&](std::string_view query) {
+        return CompileQuery(*ParseQuery(query))->Execute(source, 0, 2);
+    };
+
+    auto frame = evaluate("histogram_quantile(0.5, web{})");
+    ASSERT_EQ(frame.series.size(), 2);
+    EXPECT_EQ(frame.series[0].tags, Tags({"host=1"}));
+    EXPECT_DOUBLE_EQ(frame.series[0].values[0], 0.1);
+    // Every sample above the highest finite bound.
+    EXPECT_DOUBLE_EQ(frame.series[0].values[1], 0.2);
+    EXPECT_DOUBLE_EQ(frame.series[1].values[0], 0.1);
+
+    // Buckets summed across hosts: 10, 30, 0 at the first bucket of the grid.
+    frame = evaluate("histogram_quantile(0.9, sum by (le) (web{}))");
+    ASSERT_EQ(frame.series.size(), 1);
+    EXPECT_TRUE(frame.series[0].tags.empty());
+    EXPECT_DOUBLE_EQ(frame.series[0].values[0], 0.1 + 0.1 * (36.0 - 10.0) / 30.0);
+
+    // And across time.
+    frame = evaluate("histogram_quantile(1, moving_sum(sum by (le) (web{}), 30s))");
+    EXPECT_DOUBLE_EQ(frame.series[0].values[1], 0.2);
+
+    frame = evaluate("histogram_quantile(0.5, web{host=3})");
+    EXPECT_TRUE(frame.series.empty());
+    EXPECT_THROW(ParseQuery("histogram_quantile(1.5, web{})"), QueryError);
+}
+
+TEST(QueryTest, ParseErrors) {
+    EXPECT_THROW(ParseQuery("sum(web{}"), QueryError);
+    EXPECT_THROW(ParseQuery("median(web{})"), QueryError);
+    EXPECT_THROW(ParseQuery("moving_avg(web{}, 10)"), QueryError);
+    EXPECT_THROW(ParseQuery("web{} +"), QueryError);
+}
+
+TEST(QueryTest, ParseLimits) {
+    auto nested = [](std::size_t depth) {
+        return std::string(depth, '(') + "web{}" + std::string(depth, ')');
+    };
+    EXPECT_NO_THROW(ParseQuery(nested(32)));
+    EXPECT_THROW(ParseQuery(nested(100000)), QueryError);
+    EXPECT_THROW(ParseQuery(std::string(100000, '-') + "1"), QueryError);
+
+    std::string chain = "web{}";
+    for (int i = 0; i < 2000; ++i) {
+        chain += " + web{}";
+    }
+    EXPECT_THROW(ParseQuery(chain), QueryError);
+
+    EXPECT_NO_THROW(ParseQuery("moving_avg(web{}, 1h)"));
+    EXPECT_THROW(ParseQuery("moving_avg(web{}, 1e300h)"), QueryError);
+    EXPECT_THROW(ParseQuery("moving_avg(web{}, -5m)"), QueryError);
+}
+
+TEST(QueryTest, PlansAreCached) {
+    EXPECT_EQ(GetQueryPlan("sum(web{})"), GetQueryPlan("sum(web{})"));
+}
+
+TEST(QueryTest, PlanCacheEvictsLeastRecentlyUsed) {
+    QueryPlanCache cache(2);
+    auto hot = cache.Get("sum(web{})");
+    auto cold = cache.Get("max(web{})");
+    // Using the hot plan makes the cold one the next to go.
+    EXPECT_EQ(cache.Get("sum(web{})"), hot);
+    cache.Get("min(web{})");
+    EXPECT_EQ(cache.Size(), 2);
+    EXPECT_EQ(cache.Get("sum(web{})"), hot);
+    EXPECT_NE(cache.Get("max(web{})"), cold);
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <lib/codec/remote_write_encoder.h>
+#include <lib/server/compression.h>
+#include <lib/server/remote_write.h>
+
+#include <bit>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    std::string Repetitive(std::size_t size) {
+        std::string data;
+        for (std::size_t i = 0; data.size() < size; ++i) {
+            data += "series_" + std::to_string(i % 97) + "{host=\"web-" + std::to_string(i % 13) + "\"} ";
+        }
+        data.resize(size);
+        return data;
+    }
+
+} // anonymous namespace
+
+TEST(RemoteWriteTest, SnappyRoundTrip) {
+    for (std::size_t size : {0, 1, 59, 60, 300, 70000, 300000}) {
+        auto data = Repetitive(size);
+        auto compressed = SnappyCompress(data);
+        if (size >= 300) {
+            EXPECT_LT(compressed.size(), data.size() / 2) << size;
+        }
+        EXPECT_EQ(SnappyUncompress(compressed, size), data) << size;
+    }
+}
+
+TEST(RemoteWriteTest, SnappyOverlappingCopy) {
+    // "ab", then a copy of 10 bytes from 2 back: "abababababab".
+    std::string block = {12, 1 << 2, 'a', 'b', static_cast<char>(1 | ((10 - 4) << 2)), 2};
+    EXPECT_EQ(SnappyUncompress(block, 100), "abababababab");
+}
+
+TEST(RemoteWriteTest, SnappyRejectsMalformedBlocks) {
+    EXPECT_THROW(SnappyUncompress("", 100), std::invalid_argument);
+    // Copy before the start.
+    EXPECT_THROW(SnappyUncompress(std::string{4, 1, 1}, 100), std::invalid_argument);
+    // Literal cut short, and output shorter than declared.
+    EXPECT_THROW(SnappyUncompress(std::string{4, 3 << 2, 'a'}, 100), std::invalid_argument);
+    EXPECT_THROW(SnappyUncompress(std::string{4, 0, 'a'}, 100), std::invalid_argument);
+    EXPECT_THROW(SnappyUncompress(SnappyCompress(Repetitive(1000)), 999), std::length_error);
+    // Three bytes cannot hold 1 MiB, however it is declared.
+    EXPECT_THROW(SnappyUncompress(std::string{'\x80', '\x80', '\x40'}, 64 << 20), std::invalid_argument);
+    // The best ratio snappy achieves is still accepted.
+    std::string zeros(1 << 20, '\0');
+    EXPECT_EQ(SnappyUncompress(SnappyCompress(zeros), 1 << 20), zeros);
+}
+
+TEST(RemoteWriteTest, DecodesWriteRequest) {
+    RemoteWriteEncoder encoder;
+    std::vector<int64_t> timestamps = {1700000000000, 1700000015000, 1700000030000};
+    std::vector<double> values = {1.5, std::bit_cast<double>(kStaleMarkerBits), -2.0};
+    encoder.series({{"dc", "eu"}, {"__name__", "http_requests"}, {"code", "200"}}, timestamps, values);
+    encoder.series({{"__name__", "up"}}, std::vector<int64_t>{5}, std::vector<double>{1.0});
+    // Only a stale marker: the series is dropped.
+    encoder.series({{"__name__", "gone"}}, std::vector<int64_t>{5}, std::vector<double>{std::bit_cast<double>(kStaleMarkerBits)});
+    auto body = encoder.take();
+    EXPECT_TRUE(encoder.message().empty());
+
+    auto request = DecodeWriteRequest(SnappyUncompress(body, 1 << 20), "web");
+    ASSERT_EQ(request.metrics.size(), 2);
+    const auto& requests = request.metrics[0];
+    EXPECT_EQ(requests.identifiers.project_id, "web");
+    EXPECT_EQ(requests.identifiers.metric_type, EMetricType::DOT);
+    EXPECT_EQ(requests.identifiers.tags, Tags({"metric=http_requests", "dc=eu", "code=200"}));
+    ASSERT_EQ(requests.values.size(), 2);
+    EXPECT_EQ(requests.values[0].value, 1.5);
+    EXPECT_EQ(requests.values[0].timestamp, 1700000000000);
+    EXPECT_EQ(requests.values[1].value, -2.0);
+    EXPECT_EQ(requests.values[1].timestamp, 1700000030000);
+    EXPECT_EQ(request.metrics[1].identifiers.tags, Tags({"metric=up"}));
+}
+
+TEST(RemoteWriteTest, SkipsUnknownFieldsAndRejectsMalformedMessages) {
+    RemoteWriteEncoder encoder;
+    encoder.series({{"__name__", "up"}}, std::vector<int64_t>{5}, std::vector<double>{1.0});
+    // Metadata (field 3) and a fixed32 field are skipped.
+    std::string message = encoder.message() + std::string{0x1a, 2, 0x08, 0x01, 0x25, 0, 0, 0, 0};
+    EXPECT_EQ(DecodeWriteRequest(message, "web").metrics.size(), 1);
+
+    EXPECT_THROW(DecodeWriteRequest(message, ""), std::invalid_argument);
+    EXPECT_THROW(DecodeWriteRequest(message.substr(0, message.size() - 7), "web"), std::invalid_argument);
+    // A group, which remote write never sends.
+    EXPECT_THROW(DecodeWriteRequest(std::string{0x0b}, "web"), std::invalid_argument);
+    // A label without a name.
+    EXPECT_THROW(DecodeWriteRequest(std::string{0x0a, 4, 0x0a, 2, 0x12, 0}, "web"), std::invalid_argument);
+
+    // '|' would split the tag in the tags column.
+    RemoteWriteEncoder piped;
+    piped.series({{"__name__", "up"}, {"path", "/a|b"}}, std::vector<int64_t>{5}, std::vector<double>{1.0});
+    EXPECT_THROW(DecodeWriteRequest(piped.message(), "web"), std::invalid_argument);
+}
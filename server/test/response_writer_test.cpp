@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <lib/server/response_writer.h>
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+    GetResponse MakeResponse(std::initializer_list<MetricValue> values) {
+        GetResponse response;
+        response.values.assign(values);
+        return response;
+    }
+
+} // anonymous namespace
+
+TEST(ResponseWriterTest, ShortestRoundTrip) {
+    std::string out;
+    WriteGetResponse(MakeResponse({{0.1, 1700000000000}, {-2.5, 0}, {1e300, -15000}}), out);
+    EXPECT_EQ(out, R"({"metrics":[{"value":0.1,"timestamp":1700000000000},)"
+                   R"({"value":-2.5,"timestamp":0},)"
+                   R"({"value":1e+300,"timestamp":-15000}]})");
+
+    double tricky = 0.1 + 0.2;
+    out.clear();
+    WriteGetResponse(MakeResponse({{tricky, 1}}), out);
+    auto start = out.find(':', out.find("value")) + 1;
+    EXPECT_EQ(std::stod(out.substr(start)), tricky);
+}
+
+TEST(ResponseWriterTest, FixedPrecision) {
+    std::string out;
+    WriteGetResponse(MakeResponse({{3.14159, 1}, {1234567.0, 2}, {-0.004, 3}}), out, NumberFormat{.precision = 2});
+    EXPECT_EQ(out, R"({"metrics":[{"value":3.14,"timestamp":1},)"
+                   R"({"value":1234567.00,"timestamp":2},)"
+                   R"({"value":-0.00,"timestamp":3}]})");
+
+    out.clear();
+    WriteGetResponse(MakeResponse({{std::numeric_limits<double>::max(), 1}}), out, NumberFormat{.precision = 17});
+    EXPECT_EQ(out.size(), std::string(R"({"metrics":[{"value":,"timestamp":1}]})").size() + 309 + 1 + 17);
+}
+
+TEST(ResponseWriterTest, EdgeCases) {
+    std::string out = "prefix";
+    WriteGetResponse(GetResponse{}, out);
+    EXPECT_EQ(out, R"(prefix{"metrics":[]})");
+
+    out.clear();
+    WriteGetResponse(MakeResponse({{std::nan(""), 1}, {std::numeric_limits<double>::infinity(), 2}}), out, NumberFormat{.precision = 0});
+    EXPECT_EQ(out, R"({"metrics":[{"value":null,"timestamp":1},{"value":null,"timestamp":2}]})");
+
+    EXPECT_THROW(WriteGetResponse(GetResponse{}, out, NumberFormat{.precision = -1}), std::invalid_argument);
+    EXPECT_THROW(WriteGetResponse(GetResponse{}, out, NumberFormat{.precision = 18}), std::invalid_argument);
+}
+
+TEST(ResponseWriterTest, ChunksMakeTheSameDocument) {
+    GetResponse response = MakeResponse({{1.5, 1}, {2.5, 2}, {3.5, 3}});
+    std::string whole;
+    WriteGetResponse(response, whole);
+
+    std::span<const MetricValue> values = response.values;
+    std::string chunked(kGetResponseHead);
+    WriteMetricValues(values.first(2), chunked);
+    chunked += ',';
+    WriteMetricValues(values.subspan(2), chunked);
+    chunked += kGetResponseTail;
+    EXPECT_EQ(chunked, whole);
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <lib/server/router.h>
+
+namespace http = boost::beast::http;
+
+TEST(RouterTest, StaticRoutes) {
+    Router<int> router;
+    router.add("/register", http::verb::post, 1);
+    router.add("/post", http::verb::post, 2);
+    router.add("/get", http::verb::get, 3);
+    router.add("/alerts/rules", http::verb::get, 4);
+    router.add("/alerts/rules", http::verb::post, 5);
+    router.build();
+
+    auto match = router.match("/get", http::verb::get);
+    ASSERT_NE(match.handler, nullptr);
+    EXPECT_EQ(*match.handler, 3);
+
+    match = router.match("/alerts/rules?verbose=1", http::verb::post);
+    ASSERT_NE(match.handler, nullptr);
+    EXPECT_EQ(*match.handler, 5);
+
+    match = router.match("/get", http::verb::post);
+    EXPECT_EQ(match.handler, nullptr);
+    EXPECT_EQ(match.status, http::status::method_not_allowed);
+
+    match = router.match("/missing", http::verb::get);
+    EXPECT_EQ(match.handler, nullptr);
+    EXPECT_EQ(match.status, http::status::not_found);
+}
+
+TEST(RouterTest, PathParameters) {
+    Router<int> router;
+    router.add("/alerts/rules", http::verb::delete_, 1);
+    router.add("/alerts/rules/{id}", http::verb::delete_, 2);
+    router.add("/projects/{project}/series/{series}", http::verb::get, 3);
+    router.build();
+
+    auto match = router.match("/alerts/rules/high-errors", http::verb::delete_);
+    ASSERT_NE(match.handler, nullptr);
+    EXPECT_EQ(*match.handler, 2);
+    EXPECT_EQ(match.params.get("id"), "high-errors");
+    EXPECT_EQ(match.pattern, "/alerts/rules/{id}");
+
+    match = router.match("/projects/web/series/42", http::verb::get);
+    ASSERT_NE(match.handler, nullptr);
+    EXPECT_EQ(*match.handler, 3);
+    EXPECT_EQ(match.params.get("project"), "web");
+    EXPECT_EQ(match.params.get("series"), "42");
+
+    EXPECT_EQ(router.match("/alerts/rules?all=1", http::verb::delete_).pattern, "/alerts/rules");
+    EXPECT_EQ(router.match("/projects/web/series", http::verb::get).handler, nullptr);
+    EXPECT_TRUE(router.match("/projects/web/series", http::verb::get).pattern.empty());
+    EXPECT_EQ(router.match("/projects/web/series/42/extra", http::verb::get).handler, nullptr);
+    EXPECT_EQ(router.match("/alerts/rules/", http::verb::delete_).handler, nullptr);
+}
+
+TEST(RouterTest, ManyStaticRoutesGetDistinctSlots) {
+    Router<int> router;
+    for (int i = 0; i < 200; ++i) {
+        router.add("/route/" + std::to_string(i), http::verb::get, i);
+    }
+    router.build();
+    for (int i = 0; i < 200; ++i) {
+        auto match = router.match("/route/" + std::to_string(i), http::verb::get);
+        ASSERT_NE(match.handler, nullptr);
+        EXPECT_EQ(*match.handler, i);
+    }
+}
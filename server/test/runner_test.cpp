@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+#include <lib/server/runner.h>
+
+#include <boost/asio/connect.hpp>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace {
+
+    // Sends requests over one keep-alive connection.
+    class Client {
+    public:
+        explicit Client(unsigned short port)
+            : socket_(ioc_)
+        {
+            socket_.connect(tcp::endpoint{net::ip::make_address("127.0.0.1"), port});
+        }
+
+        http::response<http::string_body> get(const std::string& target) {
+            http::request<http::string_body> request{http::verb::get, target, 11};
+            request.set(http::field::host, "127.0.0.1");
+            http::write(socket_, request);
+            http::response<http::string_body> response;
+            http::read(socket_, buffer_, response);
+            return response;
+        }
+
+    private:
+        net::io_context ioc_;
+        tcp::socket socket_;
+        beast::flat_buffer buffer_;
+    };
+
+    ServerOptions MakeOptions(bool sharded) {
+        ServerOptions options;
+        options.endpoint = tcp::endpoint{net::ip::make_address("127.0.0.1"), 0};
+        options.threads = 2;
+        options.sharded = sharded;
+        options.workers_per_shard = 1;
+        return options;
+    }
+
+    void ExpectServes(HttpServer& server) {
+        ASSERT_NE(server.port(), 0);
+        server.start();
+        // Several connections, so that more than one shard gets some.
+        for (int i = 0; i < 8; ++i) {
+            Client client(server.port());
+            auto stats = client.get("/stats/admission");
+            EXPECT_EQ(stats.result(), http::status::ok);
+            EXPECT_NE(stats.body().find("\"queue_depth\""), std::string::npos);
+            EXPECT_TRUE(stats.keep_alive());
+            EXPECT_EQ(client.get("/missing").result(), http::status::not_found);
+        }
+        auto metrics = Client(server.port()).get("/metrics");
+        EXPECT_EQ(metrics.result(), http::status::ok);
+        EXPECT_NE(metrics.body().find("monitoring_http_requests_total{route=\"/stats/admission\",code=\"200\"}"), std::string::npos);
+        server.stop();
+        server.join();
+    }
+
+} // anonymous namespace
+
+TEST(RunnerTest, SharedModeServes) {
+    HttpServer server(MakeOptions(false));
+    ExpectServes(server);
+}
+
+TEST(RunnerTest, ShardsShareThePort) {
+    auto options = MakeOptions(true);
+    options.statsd = udp::endpoint{net::ip::make_address("127.0.0.1"), 0};
+    options.writer_threads = 2;
+    HttpServer server(std::move(options));
+    EXPECT_NE(server.statsd_port(), 0);
+    ExpectServes(server);
+}
+
+TEST(RunnerTest, TracesRequestStages) {
+    auto options = MakeOptions(false);
+    options.tracing = true;
+    HttpServer server(std::move(options));
+    server.start();
+
+    Client client(server.port());
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(client.get("/stats/admission").result(), http::status::ok);
+    }
+    auto traces = client.get("/traces/slowest?n=2");
+    EXPECT_EQ(traces.result(), http::status::ok);
+    EXPECT_NE(traces.body().find("\"route\":\"/stats/admission\""), std::string::npos);
+    EXPECT_NE(traces.body().find("\"queue\":"), std::string::npos);
+    auto chrome = client.get("/traces/slowest?format=chrome");
+    EXPECT_EQ(chrome.result(), http::status::ok);
+    EXPECT_NE(chrome.body().find("\"traceEvents\""), std::string::npos);
+    EXPECT_EQ(client.get("/traces/slowest?n=many").result(), http::status::bad_request);
+    EXPECT_EQ(client.get("/traces/slowest?format=xml").result(), http::status::bad_request);
+
+    server.stop();
+    server.join();
+}
+
+TEST(RunnerTest, PushesBucketsToSubscribers) {
+    HttpServer server(MakeOptions(false));
+    server.start();
+
+    // A plain request to the subscription route is refused.
+    EXPECT_EQ(Client(server.port()).get("/subscribe").result(), http::status::upgrade_required);
+
+    net::io_context ioc;
+    websocket::stream<tcp::socket> ws(ioc);
+    ws.next_layer().connect(tcp::endpoint{net::ip::make_address("127.0.0.1"), server.port()});
+    ws.handshake("127.0.0.1", "/subscribe");
+    ws.write(net::buffer(std::string(R"({"project_id": "web", "tags": ["env=prod"]})")));
+    beast::flat_buffer buffer;
+    ws.read(buffer);
+    EXPECT_EQ(beast::buffers_to_string(buffer.data()), R"({"message": "Subscribed"})");
+    buffer.consume(buffer.size());
+
+    // What /post hands the hub after its commit.
+    MetricIdentifiers ids;
+    ids.project_id = "web";
+    ids.tags = {"env=prod", "host=1"};
+    for (int i = 0; i < 100 && SubscriptionHub::Instance().Subscribers() == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    SubscriptionHub::Instance().OnBuckets(ids, BucketValues{{15000, 2.5}});
+    ws.read(buffer);
+    EXPECT_EQ(beast::buffers_to_string(buffer.data()), BucketUpdateToJson(ids, BucketValues{{15000, 2.5}}));
+
+    ws.close(websocket::close_code::normal);
+    for (int i = 0; i < 100 && SubscriptionHub::Instance().Subscribers() != 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(SubscriptionHub::Instance().Subscribers(), 0);
+    server.stop();
+    server.join();
+}
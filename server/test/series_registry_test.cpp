@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <lib/service/series_registry.h>
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // Quotes like PostgreSQL would, and counts how often it was asked to.
+    struct FakeTransaction {
+        std::atomic<int> quoted{0};
+
+        std::string quote_name(const std::string& name) {
+            ++quoted;
+            return "\"" + name + "\"";
+        }
+
+        std::string quote(const std::string& value) {
+            ++quoted;
+            return "'" + value + "'";
+        }
+    };
+
+    Tags MakeTags(std::initializer_list<std::string_view> tags) {
+        Tags result;
+        for (auto tag : tags) {
+            result.emplace_back(tag);
+        }
+        return result;
+    }
+
+} // anonymous namespace
+
+TEST(SeriesRegistryTest, InternsOnce) {
+    auto& registry = SeriesRegistry::Instance();
+    FakeTransaction tx;
+    auto tags = MakeTags({"env=prod", "host=a"});
+    EXPECT_EQ(registry.Find("registry_once", tags), nullptr);
+
+    const auto* series = registry.Intern("registry_once", tags, tx);
+    ASSERT_NE(series, nullptr);
+    EXPECT_EQ(series->quoted_table, "\"registry_once\"");
+    EXPECT_EQ(series->quoted_tags, "'|env=prod|host=a'");
+    EXPECT_EQ(series->hash, SeriesRegistry::Hash("registry_once", tags));
+    EXPECT_EQ(tx.quoted, 2);
+
+    EXPECT_EQ(registry.Intern("registry_once", tags, tx), series);
+    EXPECT_EQ(registry.Find("registry_once", tags), series);
+    EXPECT_EQ(registry.Add("registry_once", tags, "ignored", "ignored"), series);
+    EXPECT_EQ(tx.quoted, 2);
+
+    // The order of the tags is part of the series, as in the tags column.
+    const auto* swapped = registry.Intern("registry_once", MakeTags({"host=a", "env=prod"}), tx);
+    ASSERT_NE(swapped, nullptr);
+    EXPECT_NE(swapped, series);
+    EXPECT_NE(swapped->id, series->id);
+    EXPECT_EQ(registry.Find("registry_other", tags), nullptr);
+    EXPECT_EQ(SeriesRegistry::JoinTags(Tags{}), "");
+}
+
+TEST(SeriesRegistryTest, InternsConcurrently) {
+    constexpr int kThreads = 8;
+    constexpr int kSeries = 5000;
+    auto& registry = SeriesRegistry::Instance();
+    auto size_before = registry.Size();
+    FakeTransaction tx;
+
+    // Every thread interns the same series, in its own order, and looks
+    // them up while others grow the tables.
+    std::vector<std::vector<const SeriesHandle*>> handles(kThreads, std::vector<const SeriesHandle*>(kSeries));
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < kThreads; ++thread) {
+        threads.emplace_back([&, thread] {
+            for (int i = 0; i < kSeries; ++i) {
+                int series = (i * 7919 + thread * 613) % kSeries;
+                auto tags = MakeTags({"host=" + std::to_string(series)});
+                handles[thread][series] = registry.Intern("registry_concurrent", tags, tx);
+                EXPECT_EQ(registry.Find("registry_concurrent", tags), handles[thread][series]);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(registry.Size(), size_before + kSeries);
+    std::set<std::uint64_t> ids;
+    for (int series = 0; series < kSeries; ++series) {
+        for (int thread = 1; thread < kThreads; ++thread) {
+            EXPECT_EQ(handles[thread][series], handles[0][series]);
+        }
+        EXPECT_EQ(handles[0][series]->tags, std::vector<std::string>{"host=" + std::to_string(series)});
+        ids.insert(handles[0][series]->id);
+    }
+    EXPECT_EQ(ids.size(), kSeries);
+}
+
+TEST(SeriesRegistryTest, StopsAtCapacity) {
+    constexpr std::size_t kCapacity = 100;
+    SeriesRegistry registry(kCapacity);
+    FakeTransaction tx;
+    for (std::size_t i = 0; i < kCapacity; ++i) {
+        EXPECT_NE(registry.Intern("registry_full", MakeTags({"host=" + std::to_string(i)}), tx), nullptr);
+    }
+    EXPECT_EQ(registry.Size(), kCapacity);
+
+    // Known series are still found, new ones are left to the caller.
+    auto known = MakeTags({"host=7"});
+    EXPECT_NE(registry.Find("registry_full", known), nullptr);
+    EXPECT_EQ(registry.Intern("registry_full", known, tx), registry.Find("registry_full", known));
+    auto unknown = MakeTags({"host=" + std::to_string(kCapacity)});
+    EXPECT_EQ(registry.Add("registry_full", unknown, "\"registry_full\"", "'|host=100'"), nullptr);
+    EXPECT_EQ(registry.Find("registry_full", unknown), nullptr);
+    EXPECT_EQ(registry.Size(), kCapacity);
+}
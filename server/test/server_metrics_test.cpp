@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <lib/server/server_metrics.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    std::string Line(std::string_view name, std::string_view labels, std::string_view value) {
+        return std::string(name) + "{" + std::string(labels) + "} " + std::string(value) + "\n";
+    }
+
+} // anonymous namespace
+
+TEST(ServerMetricsTest, HistogramBucketsCoverEveryValue) {
+    EXPECT_EQ(LatencyHistogram::BucketIndex(0), 0);
+    EXPECT_EQ(LatencyHistogram::BucketIndex(15), 15);
+    std::size_t previous = 0;
+    for (std::uint64_t value = 1; value < (1u << 20); value += 1 + value / 64) {
+        auto index = LatencyHistogram::BucketIndex(value);
+        EXPECT_GE(index, previous);
+        EXPECT_LE(value, LatencyHistogram::BucketUpperBound(index));
+        EXPECT_GT(value, LatencyHistogram::BucketUpperBound(index - 1));
+        // Within 1/8 of the value.
+        EXPECT_LE(LatencyHistogram::BucketUpperBound(index) - value, value / 8);
+        previous = index;
+    }
+    EXPECT_EQ(LatencyHistogram::BucketIndex(std::uint64_t(1) << 40), LatencyHistogram::kBuckets - 1);
+
+    LatencyHistogram histogram;
+    histogram.record(3);
+    histogram.record(1000);
+    histogram.record(1010);
+    std::vector<std::uint64_t> counts(LatencyHistogram::kBuckets);
+    EXPECT_EQ(histogram.merge_into(counts), 2013);
+    EXPECT_EQ(counts[3], 1);
+    EXPECT_EQ(counts[LatencyHistogram::BucketIndex(1000)], 2);
+}
+
+TEST(ServerMetricsTest, MergesThreadsOnScrape) {
+    auto& metrics = ServerMetrics::Instance();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&metrics] {
+            for (int j = 0; j < 100; ++j) {
+                metrics.record("/test/merge", j < 90 ? 200 : 503, 10, 100, std::chrono::microseconds(800));
+            }
+            metrics.record("", 404, 0, 20, std::chrono::seconds(20));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto text = ServerMetrics::Instance().scrape();
+    EXPECT_NE(text.find("# TYPE monitoring_http_requests_total counter\n"), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_requests_total", "route=\"/test/merge\",code=\"200\"", "360")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_requests_total", "route=\"/test/merge\",code=\"503\"", "40")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_requests_total", "route=\"none\",code=\"404\"", "4")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_request_bytes_total", "route=\"/test/merge\"", "4000")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_response_bytes_total", "route=\"/test/merge\"", "40000")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_request_duration_seconds_bucket", "route=\"/test/merge\",le=\"0.0005\"", "0")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_request_duration_seconds_bucket", "route=\"/test/merge\",le=\"0.001\"", "400")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_request_duration_seconds_count", "route=\"/test/merge\"", "400")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_request_duration_seconds_bucket", "route=\"none\",le=\"10\"", "0")), std::string::npos);
+    EXPECT_NE(text.find(Line("monitoring_http_request_duration_seconds_bucket", "route=\"none\",le=\"+Inf\"", "4")), std::string::npos);
+    EXPECT_NE(text.find("monitoring_db_connections_open "), std::string::npos);
+    EXPECT_NE(text.find("monitoring_queue_depth "), std::string::npos);
+}
@@ -6,6 +6,7 @@
 #include <string>
 #include <memory>
 #include <lib/service/service.h>
+#include <lib/server/compression.h>
 #include <lib/server/server.h>
 
 #include <boost/beast/core.hpp>
@@ -38,37 +39,40 @@ public:
         });
     }
 
-    std::future<void> DoPost(const PostRequest& request) {
-        return std::async(std::launch::async, [this, request]() {
-            boost::json::object json_body;
-            boost::json::array metrics_array;
+    static std::string PostBody(const PostRequest& request) {
+        boost::json::object json_body;
+        boost::json::array metrics_array;
 
-            for (const auto& metric : request.metrics) {
-                boost::json::object metric_json;
-                metric_json["project_id"] = metric.identifiers.project_id;
-                metric_json["metric_type"] = ToString(metric.identifiers.metric_type);
-                
-                boost::json::array tags_array;
-                for (const auto& tag : metric.identifiers.tags) {
-                    tags_array.emplace_back(tag);
-                }
-                metric_json["tags"] = tags_array;
-                
-                boost::json::array values_array;
-                for (const auto& value : metric.values) {
-                    boost::json::object value_json;
-                    value_json["value"] = value.value;
-                    value_json["timestamp"] = value.timestamp;
-                    values_array.emplace_back(std::move(value_json));
-                }
-                metric_json["values"] = values_array;
-                
-                metrics_array.emplace_back(std::move(metric_json));
+        for (const auto& metric : request.metrics) {
+            boost::json::object metric_json;
+            metric_json["project_id"] = metric.identifiers.project_id.c_str();
+            metric_json["metric_type"] = ToString(metric.identifiers.metric_type);
+            
+            boost::json::array tags_array;
+            for (const auto& tag : metric.identifiers.tags) {
+                tags_array.emplace_back(tag.c_str());
             }
+            metric_json["tags"] = tags_array;
             
-            json_body["metrics"] = metrics_array;
+            boost::json::array values_array;
+            for (const auto& value : metric.values) {
+                boost::json::object value_json;
+                value_json["value"] = value.value;
+                value_json["timestamp"] = value.timestamp;
+                values_array.emplace_back(std::move(value_json));
+            }
+            metric_json["values"] = values_array;
             
-            auto response = sendRequest("/post", http::verb::post, boost::json::serialize(json_body));
+            metrics_array.emplace_back(std::move(metric_json));
+        }
+        
+        json_body["metrics"] = metrics_array;
+        return boost::json::serialize(json_body);
+    }
+
+    std::future<void> DoPost(const PostRequest& request) {
+        return std::async(std::launch::async, [this, request]() {
+            auto response = sendRequest("/post", http::verb::post, PostBody(request));
             
             if (response.result() != http::status::ok) {
                 throw std::runtime_error("Failed to post metrics: " + response.body());
@@ -79,12 +83,12 @@ public:
     std::future<std::optional<GetResponse>> DoGet(const GetRequest& request) {
         return std::async(std::launch::async, [this, request]() -> std::optional<GetResponse> {
             boost::json::object json_body;
-            json_body["project_id"] = request.identifiers.project_id;
+            json_body["project_id"] = request.identifiers.project_id.c_str();
             json_body["metric_type"] = ToString(request.identifiers.metric_type);
             
             boost::json::array tags_array;
             for (const auto& tag : request.identifiers.tags) {
-                tags_array.emplace_back(tag);
+                tags_array.emplace_back(tag.c_str());
             }
             json_body["tags"] = tags_array;
             
@@ -118,6 +122,35 @@ public:
         });
     }
 
+    // Posts an already encoded body a piece at a time, pausing between
+    // pieces so the server reads it in several parts.
+    std::future<void> PostPieces(std::string body, EContentEncoding encoding, std::size_t piece) {
+        return std::async(std::launch::async, [this, body = std::move(body), encoding, piece]() {
+            tcp::resolver resolver(ioc_);
+            beast::tcp_stream stream(ioc_);
+            stream.connect(resolver.resolve(host_, std::to_string(port_)));
+
+            http::request<http::empty_body> req{http::verb::post, "/post", 11};
+            req.set(http::field::host, host_);
+            req.set(http::field::content_type, "application/json");
+            req.set(http::field::content_encoding, ToString(encoding));
+            req.content_length(body.size());
+            http::request_serializer<http::empty_body> serializer(req);
+            http::write_header(stream, serializer);
+            for (std::size_t offset = 0; offset < body.size(); offset += piece) {
+                net::write(stream.socket(), net::buffer(body.data() + offset, std::min(piece, body.size() - offset)));
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+
+            beast::flat_buffer buffer;
+            http::response<http::string_body> res;
+            http::read(stream, buffer, res);
+            if (res.result() != http::status::ok) {
+                throw std::runtime_error("Failed to post metrics: " + res.body());
+            }
+        });
+    }
+
 private:
     http::response<http::string_body> sendRequest(
         const std::string& target,
@@ -176,7 +209,7 @@ protected:
             listener_ = std::make_shared<HttpListener>(
                 ioc_for_server_,
                 tcp::endpoint{net::ip::make_address("127.0.0.1"), 8080},
-                std::ref(pool));
+                pool.get_executor());
                 
             listener_->run();
 
@@ -216,12 +249,12 @@ TEST_F(DockerPostgresFixture, PostAndGetMetrics) {
     ids.tags = {"tag1", "tag2"};
     ids.metric_type = EMetricType::DOT;  // Set a default metric type
 
-    client_->RegisterProject(ids.project_id).get();
+    client_->RegisterProject(std::string(ids.project_id)).get();
     
     int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now().time_since_epoch()).count() / 15000 * 15000;
 
-    std::vector<MetricValue> values;
+    std::pmr::vector<MetricValue> values;
     values.push_back({10.5, now - 30000});
     values.push_back({20.5, now - 15000});
 
@@ -256,4 +289,157 @@ TEST_F(DockerPostgresFixture, PostAndGetMetrics) {
     EXPECT_NEAR(response->values[0].value, 10.5, 0.001);
     EXPECT_NEAR(response->values[1].value, 20.5, 0.001);
     EXPECT_NEAR(response->values[2].value, 51.0, 0.001);
-} 
\ No newline at end of file
+
+    // A window this long is streamed with chunked transfer encoding.
+    getRequest.interval_seconds = 7 * 24 * 3600;
+    auto streamed = client_->DoGet(getRequest).get();
+
+    ASSERT_TRUE(streamed.has_value());
+    ASSERT_EQ(streamed->values.size(), 3);
+    EXPECT_NEAR(streamed->values[0].value, 10.5, 0.001);
+    EXPECT_NEAR(streamed->values[2].value, 51.0, 0.001);
+
+    // It is read a page at a time, each page after the last bucket sent.
+    MonitoringService service;
+    auto first = service.GetPage(getRequest, std::nullopt, 2);
+    ASSERT_EQ(first.size(), 2);
+    auto rest = service.GetPage(getRequest, first.back().timestamp, 2);
+    ASSERT_EQ(rest.size(), 1);
+    EXPECT_NEAR(rest[0].value, 51.0, 0.001);
+    EXPECT_TRUE(service.GetPage(getRequest, rest.back().timestamp, 2).empty());
+} 
+TEST_F(DockerPostgresFixture, MigratesTableWithoutBucketKey) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() / 15000 * 15000;
+
+    // A table as projects got it before the bucket key: a row per post.
+    {
+        pqxx::connection connection("host=localhost user=postgres password=yourpassword dbname=tsdb port=5432");
+        pqxx::work tx(connection);
+        tx.exec("CREATE TABLE legacy_project (time TIMESTAMPTZ NOT NULL, tags TEXT NOT NULL, value DOUBLE PRECISION NULL);");
+        tx.exec("SELECT create_hypertable('legacy_project', 'time');");
+        for (double value : {1.0, 2.0, 4.0}) {
+            tx.exec(std::format("INSERT INTO legacy_project VALUES (to_timestamp({} / 1000.0), '|host=a', {});", now - 15000, value));
+        }
+        tx.exec(std::format("INSERT INTO legacy_project VALUES (to_timestamp({} / 1000.0), '|host=a', 8.0);", now));
+        tx.commit();
+    }
+
+    MetricIdentifiers ids;
+    ids.project_id = "legacy_project";
+    ids.tags = {"host=a"};
+    GetRequest getRequest;
+    getRequest.identifiers = ids;
+    getRequest.interval_seconds = 60;
+    auto check = [&] {
+        auto response = client_->DoGet(getRequest).get();
+        ASSERT_TRUE(response.has_value());
+        ASSERT_EQ(response->values.size(), 2);
+        EXPECT_NEAR(response->values[0].value, 7.0, 0.001);
+        EXPECT_NEAR(response->values[1].value, 24.0, 0.001);
+    };
+
+    // Until it is migrated, writes append and reads sum the rows.
+    PostRequest postRequest;
+    postRequest.metrics.push_back({ids, {MetricValue{16.0, now}}});
+    client_->DoPost(postRequest).get();
+    check();
+
+    MonitoringService service;
+    EXPECT_TRUE(service.MigrateBucketKey("legacy_project"));
+    pqxx::connection connection("host=localhost user=postgres password=yourpassword dbname=tsdb port=5432");
+    pqxx::work tx(connection);
+    EXPECT_EQ(tx.exec("SELECT COUNT(*) FROM legacy_project;")[0][0].as<int64_t>(), 2);
+    EXPECT_TRUE(tx.exec("SELECT to_regclass('legacy_project_bucket_key') IS NOT NULL;")[0][0].as<bool>());
+    tx.commit();
+    check();
+}
+
+TEST_F(DockerPostgresFixture, KeepsLatestCounterSample) {
+    MetricIdentifiers ids;
+    ids.project_id = "counter_project";
+    ids.tags = {"host=a"};
+    ids.metric_type = EMetricType::COUNTER;
+    client_->RegisterProject(std::string(ids.project_id)).get();
+
+    int64_t bucket = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() / 15000 * 15000 - 15000;
+    GetRequest getRequest;
+    getRequest.identifiers = ids;
+    getRequest.interval_seconds = 60;
+    auto check = [&](double expected) {
+        auto response = client_->DoGet(getRequest).get();
+        ASSERT_TRUE(response.has_value());
+        ASSERT_EQ(response->values.size(), 1);
+        EXPECT_NEAR(response->values[0].value, expected, 0.001);
+    };
+
+    // The counter was reset between the two samples: the bucket holds the
+    // later one, not the higher.
+    PostRequest postRequest;
+    postRequest.metrics.push_back({ids, {MetricValue{10.0, bucket + 1000}, MetricValue{3.0, bucket + 2000}}});
+    client_->DoPost(postRequest).get();
+    check(3.0);
+
+    // A sample arriving late does not replace a later one.
+    postRequest.metrics[0].values = {MetricValue{100.0, bucket + 500}};
+    client_->DoPost(postRequest).get();
+    check(3.0);
+
+    postRequest.metrics[0].values = {MetricValue{5.0, bucket + 3000}};
+    client_->DoPost(postRequest).get();
+    check(5.0);
+
+    // One series cannot be posted with two metric types.
+    auto dot = ids;
+    dot.metric_type = EMetricType::DOT;
+    postRequest.metrics.push_back({dot, {MetricValue{1.0, bucket + 4000}}});
+    EXPECT_THROW(client_->DoPost(postRequest).get(), std::runtime_error);
+    check(5.0);
+
+    // Nor with another type in a later request, while a bucket is shared.
+    PostRequest dotRequest;
+    dotRequest.metrics.push_back({dot, {MetricValue{1.0, bucket + 5000}}});
+    EXPECT_THROW(client_->DoPost(dotRequest).get(), std::runtime_error);
+    check(5.0);
+}
+
+TEST_F(DockerPostgresFixture, PostsCompressedBodiesInPieces) {
+    std::vector<EContentEncoding> encodings = {EContentEncoding::GZIP};
+#ifdef MONITORING_WITH_ZSTD
+    encodings.push_back(EContentEncoding::ZSTD);
+#endif
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() / 15000 * 15000;
+
+    for (auto encoding : encodings) {
+        MetricIdentifiers ids;
+        ids.project_id = "compressed_" + ToString(encoding);
+        ids.tags = {"host=a"};
+        ids.metric_type = EMetricType::DOT;
+        client_->RegisterProject(std::string(ids.project_id)).get();
+
+        // Decompresses to several times the size of a body piece, and is
+        // sent in pieces small enough that every one is a read of its own.
+        constexpr int kValues = 30000;
+        PostRequest postRequest;
+        postRequest.metrics.push_back({ids, {}});
+        for (int i = 0; i < kValues; ++i) {
+            postRequest.metrics[0].values.push_back({1.0, now - 30000 + (i % 3) * 15000 + i % 1000});
+        }
+        std::string compressed;
+        Compress(encoding, HttpClient::PostBody(postRequest), compressed);
+        ASSERT_GT(compressed.size(), 4 * 1024);
+        client_->PostPieces(compressed, encoding, 1024).get();
+
+        GetRequest getRequest;
+        getRequest.identifiers = ids;
+        getRequest.interval_seconds = 60;
+        auto response = client_->DoGet(getRequest).get();
+        ASSERT_TRUE(response.has_value());
+        ASSERT_EQ(response->values.size(), 3) << ToString(encoding);
+        for (const auto& value : response->values) {
+            EXPECT_NEAR(value.value, kValues / 3, 0.001) << ToString(encoding);
+        }
+    }
+}
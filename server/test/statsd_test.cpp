@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include <lib/server/statsd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    constexpr int64_t kStart = 1700000010000 / kBucketMilliseconds * kBucketMilliseconds;
+
+    StatsdSample Parse(std::string_view line) {
+        StatsdSample sample;
+        EXPECT_TRUE(ParseStatsdLine(line, sample)) << line;
+        return sample;
+    }
+
+    const Metric& FindMetric(const std::vector<PostRequest>& requests, std::string_view project_id, std::vector<std::string_view> tags) {
+        for (auto& request : requests) {
+            for (auto& metric : request.metrics) {
+                if (metric.identifiers.project_id == project_id && std::ranges::equal(metric.identifiers.tags, tags)) {
+                    return metric;
+                }
+            }
+        }
+        throw std::runtime_error("metric not found");
+    }
+
+} // anonymous namespace
+
+TEST(StatsdTest, ParsesLines) {
+    auto counter = Parse("shop.requests.ok:3|c|@0.5|#host:a,dc:eu");
+    EXPECT_EQ(counter.project_id, "shop");
+    EXPECT_EQ(counter.metric, "requests.ok");
+    EXPECT_EQ(counter.value, 3.0);
+    EXPECT_EQ(counter.type, STATSD_COUNTER);
+    EXPECT_EQ(counter.sample_rate, 0.5);
+    EXPECT_EQ(counter.tags, "host:a,dc:eu");
+
+    auto gauge = Parse("shop.queue:-4|g\r");
+    EXPECT_EQ(gauge.type, STATSD_GAUGE);
+    EXPECT_TRUE(gauge.delta);
+    EXPECT_EQ(gauge.value, -4.0);
+    EXPECT_FALSE(Parse("shop.queue:4|g").delta);
+    EXPECT_EQ(Parse("shop.latency:12.5|ms").type, STATSD_TIMER);
+
+    StatsdSample sample;
+    for (std::string_view bad : {"", "shop.x", "shop.x:1", "shop.x:abc|c", "shop.x:1|s", "shop.x:1|c|@2", "noproject:1|c", ".x:1|c", "shop.:1|c"}) {
+        EXPECT_FALSE(ParseStatsdLine(bad, sample)) << bad;
+    }
+}
+
+TEST(StatsdTest, AggregatesIntoBuckets) {
+    StatsdAggregator aggregator;
+    aggregator.add(Parse("shop.requests:1|c|#host:a"), kStart + 100);
+    aggregator.add(Parse("shop.requests:2|c|@0.5|#host:a"), kStart + 200);
+    aggregator.add(Parse("shop.requests:5|c|#host:b"), kStart + 300);
+    aggregator.add(Parse("shop.queue:10|g"), kStart + 400);
+    aggregator.add(Parse("shop.queue:-3|g"), kStart + 500);
+    aggregator.add(Parse("shop.latency:10|ms"), kStart + 600);
+    aggregator.add(Parse("shop.latency:30|ms"), kStart + 700);
+    aggregator.add(Parse("shop.requests:7|c|#host:a"), kStart + kBucketMilliseconds);
+    aggregator.add(Parse("other.requests:1|c"), kStart);
+    EXPECT_EQ(aggregator.series(), 5u);
+
+    // The first bucket is not over yet.
+    EXPECT_TRUE(aggregator.flush(kStart + kBucketMilliseconds, 1000).empty());
+
+    auto requests = aggregator.flush(kStart + kBucketMilliseconds + 1000, 1000);
+    ASSERT_EQ(requests.size(), 2u);
+    auto& host_a = FindMetric(requests, "shop", {"metric=requests", "host=a"});
+    EXPECT_EQ(host_a.identifiers.metric_type, EMetricType::SPEED);
+    ASSERT_EQ(host_a.values.size(), 1u);
+    EXPECT_EQ(host_a.values[0].value, 5.0);
+    EXPECT_EQ(host_a.values[0].timestamp, kStart);
+
+    EXPECT_EQ(FindMetric(requests, "shop", {"metric=requests", "host=b"}).values[0].value, 5.0);
+    auto& queue = FindMetric(requests, "shop", {"metric=queue"});
+    EXPECT_EQ(queue.identifiers.metric_type, EMetricType::DOT);
+    EXPECT_EQ(queue.values[0].value, 7.0);
+    EXPECT_EQ(FindMetric(requests, "shop", {"metric=latency"}).values[0].value, 20.0);
+    EXPECT_EQ(FindMetric(requests, "other", {"metric=requests"}).values[0].value, 1.0);
+
+    // Only the second bucket of host:a is left.
+    auto rest = aggregator.flush(0, 0, true);
+    ASSERT_EQ(rest.size(), 1u);
+    ASSERT_EQ(rest[0].metrics.size(), 1u);
+    EXPECT_EQ(rest[0].metrics[0].values[0].value, 7.0);
+    EXPECT_EQ(rest[0].metrics[0].values[0].timestamp, kStart + kBucketMilliseconds);
+}
+
+TEST(StatsdTest, ForgetsIdleSeries) {
+    StatsdAggregator aggregator;
+    aggregator.add(Parse("shop.queue:10|g"), kStart);
+    aggregator.flush(kStart + kBucketMilliseconds, 0);
+    EXPECT_EQ(aggregator.series(), 1u);
+
+    // A gauge delta continues from the last value while the series is known.
+    aggregator.add(Parse("shop.queue:+1|g"), kStart + kBucketMilliseconds);
+    EXPECT_EQ(aggregator.flush(0, 0, true)[0].metrics[0].values[0].value, 11.0);
+
+    aggregator.flush(kStart + kBucketMilliseconds + StatsdAggregator::kIdleMilliseconds, 0);
+    EXPECT_EQ(aggregator.series(), 0u);
+}
+
+TEST(StatsdTest, BoundsSeriesAndDropsLateSamples) {
+    StatsdAggregator aggregator(2);
+    EXPECT_TRUE(aggregator.add(Parse("shop.queue:10|g"), kStart));
+    EXPECT_TRUE(aggregator.add(Parse("shop.requests:1|c"), kStart));
+    EXPECT_FALSE(aggregator.add(Parse("shop.latency:5|ms"), kStart));
+    EXPECT_EQ(aggregator.series(), 2u);
+    EXPECT_EQ(aggregator.dropped(), 1u);
+
+    aggregator.flush(kStart + kBucketMilliseconds, 0);
+
+    // A second gauge value for the stored bucket would be added to the
+    // first one by the database.
+    EXPECT_FALSE(aggregator.add(Parse("shop.queue:12|g"), kStart + 100));
+    // A counter adds up either way.
+    EXPECT_TRUE(aggregator.add(Parse("shop.requests:2|c"), kStart + 100));
+    EXPECT_TRUE(aggregator.add(Parse("shop.queue:12|g"), kStart + kBucketMilliseconds));
+    EXPECT_EQ(aggregator.dropped(), 2u);
+
+    auto rest = aggregator.flush(0, 0, true);
+    EXPECT_EQ(FindMetric(rest, "shop", {"metric=requests"}).values[0].value, 2.0);
+    EXPECT_EQ(FindMetric(rest, "shop", {"metric=queue"}).values[0].value, 12.0);
+}
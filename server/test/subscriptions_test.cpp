@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include <lib/service/subscriptions.h>
+
+#include <boost/json.hpp>
+
+#include <memory>
+#include <string>
+
+namespace {
+
+    Subscriber::Message MakeMessage(int i) {
+        return std::make_shared<const std::string>(std::to_string(i));
+    }
+
+    MetricIdentifiers MakeIds(std::string project_id, Tags tags) {
+        MetricIdentifiers ids;
+        ids.project_id = std::move(project_id);
+        ids.tags = std::move(tags);
+        return ids;
+    }
+
+} // anonymous namespace
+
+TEST(SubscriptionsTest, FullQueuesFollowTheirPolicy) {
+    int notified = 0;
+    auto notify = [&] { ++notified; };
+
+    Subscriber oldest(2, EDropPolicy::DROP_OLDEST, notify);
+    for (int i = 0; i < 4; ++i) {
+        oldest.push(MakeMessage(i));
+    }
+    // Only the push into the empty queue wakes the connection.
+    EXPECT_EQ(notified, 1);
+    EXPECT_EQ(oldest.dropped(), 2);
+    EXPECT_EQ(*oldest.pop(), "2");
+    EXPECT_EQ(*oldest.pop(), "3");
+    EXPECT_EQ(oldest.pop(), nullptr);
+
+    Subscriber newest(2, EDropPolicy::DROP_NEWEST, notify);
+    for (int i = 0; i < 4; ++i) {
+        newest.push(MakeMessage(i));
+    }
+    EXPECT_EQ(*newest.pop(), "0");
+    EXPECT_EQ(*newest.pop(), "1");
+    EXPECT_EQ(newest.pop(), nullptr);
+
+    notified = 0;
+    Subscriber disconnect(2, EDropPolicy::DISCONNECT, notify);
+    for (int i = 0; i < 4; ++i) {
+        disconnect.push(MakeMessage(i));
+    }
+    EXPECT_TRUE(disconnect.disconnected());
+    EXPECT_EQ(notified, 2);
+    EXPECT_EQ(disconnect.pop(), nullptr);
+}
+
+TEST(SubscriptionsTest, UpdatesAreEncodedOnceAndShared) {
+    SubscriptionHub hub;
+    auto make_subscriber = [] {
+        return std::make_shared<Subscriber>(16, EDropPolicy::DROP_OLDEST, [] {});
+    };
+    auto prod = make_subscriber();
+    auto everything = make_subscriber();
+    auto dev = make_subscriber();
+    hub.Subscribe(prod, "web", {"env=prod"});
+    // Two matching filters still deliver the update once.
+    hub.Subscribe(everything, "web", {});
+    hub.Subscribe(everything, "web", {"region=eu"});
+    hub.Subscribe(dev, "web", {"env=dev"});
+    hub.Subscribe(dev, "api", {});
+    EXPECT_EQ(hub.Subscribers(), 4);
+
+    BucketValues buckets = {{15000, 2.5}};
+    hub.OnBuckets(MakeIds("web", {"env=prod", "region=eu"}), buckets);
+    auto message = prod->pop();
+    ASSERT_NE(message, nullptr);
+    EXPECT_EQ(everything->pop(), message);
+    EXPECT_EQ(everything->pop(), nullptr);
+    EXPECT_EQ(dev->pop(), nullptr);
+
+    hub.Unsubscribe(*dev);
+    EXPECT_EQ(hub.Subscribers(), 2);
+    hub.OnBuckets(MakeIds("api", {}), buckets);
+    EXPECT_EQ(dev->pop(), nullptr);
+}
+
+TEST(SubscriptionsTest, CapsFiltersPerSubscriber) {
+    SubscriptionHub hub;
+    auto subscriber = std::make_shared<Subscriber>(16, EDropPolicy::DROP_OLDEST, [] {});
+    for (std::size_t i = 0; i < SubscriptionHub::kMaxFiltersPerSubscriber; ++i) {
+        hub.Subscribe(subscriber, i % 2 ? "web" : "api", {std::pmr::string("host=" + std::to_string(i))});
+    }
+    // A filter held already is not counted twice, the limit spans projects.
+    hub.Subscribe(subscriber, "web", {"host=1"});
+    EXPECT_THROW(hub.Subscribe(subscriber, "web", {"host=new"}), std::length_error);
+    EXPECT_THROW(hub.Subscribe(subscriber, "other", {}), std::length_error);
+
+    auto other = std::make_shared<Subscriber>(16, EDropPolicy::DROP_OLDEST, [] {});
+    hub.Subscribe(other, "web", {"host=new"});
+    hub.OnBuckets(MakeIds("web", {"host=new"}), BucketValues{{15000, 1.0}});
+    EXPECT_NE(other->pop(), nullptr);
+    EXPECT_EQ(subscriber->pop(), nullptr);
+}
+
+TEST(SubscriptionsTest, EncodesBucketUpdates) {
+    auto ids = MakeIds("web", {"env=prod"});
+    ids.metric_type = EMetricType::SPEED;
+    BucketValues buckets = {{15000, 2.5}, {30000, 1.0}};
+    auto json = boost::json::parse(BucketUpdateToJson(ids, buckets));
+    EXPECT_EQ(json.at("project_id").as_string(), "web");
+    EXPECT_EQ(json.at("metric_type").as_string(), "SPEED");
+    EXPECT_EQ(json.at("tags").as_array().size(), 1);
+    auto& values = json.at("buckets").as_array();
+    ASSERT_EQ(values.size(), 2);
+    EXPECT_EQ(values[1].at("timestamp").as_int64(), 30000);
+    EXPECT_EQ(values[1].at("value").as_double(), 1.0);
+}
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <lib/service/tracing.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(TracingTest, StageNamesRoundTrip) {
+    for (int stage = 0; stage < TRACE_STAGES; ++stage) {
+        EXPECT_EQ(TraceStageFromString(ToString(static_cast<ETraceStage>(stage))), stage);
+    }
+    EXPECT_THROW(TraceStageFromString("sleep"), std::invalid_argument);
+}
+
+TEST(TracingTest, DisabledTracesAreNotKept) {
+    Tracer::Instance().enable(false);
+    RequestTrace trace;
+    trace.start("/test/disabled");
+    EXPECT_FALSE(trace.active());
+    {
+        TraceScope scope(&trace);
+        TraceSpan span(TRACE_PARSE);
+    }
+    trace.submit(200);
+
+    Tracer::Instance().enable(true);
+    for (const auto& record : Tracer::Instance().slowest(Tracer::kRingSize)) {
+        EXPECT_NE(record.route, "/test/disabled");
+    }
+}
+
+TEST(TracingTest, RecordsStagesAndSpans) {
+    Tracer::Instance().enable(true);
+    RequestTrace trace;
+    trace.start("/test/stages");
+    auto begin = TraceClock::now();
+    trace.add(TRACE_READ, begin, begin + std::chrono::milliseconds(2));
+    for (std::size_t i = 0; i < RequestTrace::kMaxSpans + 8; ++i) {
+        trace.add(TRACE_PARSE, begin, begin + std::chrono::microseconds(100));
+    }
+    {
+        TraceScope scope(&trace);
+        EXPECT_EQ(RequestTrace::Current(), &trace);
+        TraceSpan span(TRACE_COMMIT);
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    }
+    EXPECT_EQ(RequestTrace::Current(), nullptr);
+    trace.submit(201);
+    EXPECT_FALSE(trace.active());
+
+    auto records = Tracer::Instance().slowest(1);
+    ASSERT_EQ(records.size(), 1);
+    const auto& record = records.front();
+    EXPECT_EQ(record.route, "/test/stages");
+    EXPECT_EQ(record.status, 201);
+    EXPECT_GE(record.duration, std::chrono::milliseconds(30));
+    EXPECT_EQ(record.totals[TRACE_READ], std::chrono::milliseconds(2));
+    EXPECT_EQ(record.totals[TRACE_PARSE], std::chrono::microseconds(100) * (RequestTrace::kMaxSpans + 8));
+    EXPECT_GE(record.totals[TRACE_COMMIT], std::chrono::milliseconds(30));
+    // Spans beyond the limit only count towards the totals.
+    ASSERT_EQ(record.spans.size(), RequestTrace::kMaxSpans);
+    EXPECT_EQ(record.spans[0].stage, TRACE_READ);
+    EXPECT_EQ(record.spans[0].duration, std::chrono::milliseconds(2));
+    EXPECT_EQ(record.spans[1].stage, TRACE_PARSE);
+}
+
+TEST(TracingTest, ReadsRingsWhileThreadsSubmit) {
+    Tracer::Instance().enable(true);
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&stop] {
+            RequestTrace trace;
+            // Wraps the ring several times over.
+            for (std::size_t j = 0; j < 4 * Tracer::kRingSize && !stop; ++j) {
+                trace.start("/test/concurrent");
+                auto now = TraceClock::now();
+                trace.add(TRACE_STORE, now, now + std::chrono::microseconds(j % 7));
+                trace.submit(200);
+            }
+        });
+    }
+    for (int i = 0; i < 50; ++i) {
+        for (const auto& record : Tracer::Instance().slowest(64)) {
+            // Every record is read whole or not at all.
+            if (record.route == "/test/concurrent") {
+                EXPECT_EQ(record.status, 200);
+                ASSERT_EQ(record.spans.size(), 1);
+                EXPECT_EQ(record.spans[0].stage, TRACE_STORE);
+                EXPECT_EQ(record.spans[0].duration, record.totals[TRACE_STORE]);
+            }
+        }
+    }
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto records = Tracer::Instance().slowest(Tracer::kRingSize);
+    EXPECT_TRUE(std::ranges::is_sorted(records, std::greater<>(), &TraceRecord::duration));
+}